@@ -0,0 +1,951 @@
+#ifndef _ASSEMBLER_H_
+#define _ASSEMBLER_H_ 1
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <string_view>
+
+#include "ISA.h"
+
+/**
+    Compile-time RV32IMA + Zicsr assembler.
+
+    Assembler<N> builds a program of exactly N instructions: one method per
+    instruction (named like the Make* builders), and branches and jumps take a
+    label name, resolved by Finish(). Assemble<N>(source) parses textual assembly
+    into the same builder; ASSEMBLE(source) counts the instructions first.
+
+    Everything is constexpr, so a constexpr program is encoded by the compiler and
+    a bad one (unknown mnemonic or label, immediate out of range, wrong N) does not
+    compile: the error points at the throw below that names the problem. Outside
+    a constant expression the same errors throw the string.
+
+        constexpr auto PROGRAM = ASSEMBLE(R"(
+                li   a0, 0
+                li   t0, 10
+            loop:
+                add  a0, a0, t0
+                addi t0, t0, -1
+                bnez t0, loop
+                ebreak
+        )");
+
+    Text syntax: one instruction per line, "name:" labels, '#' or "//" comments,
+    x0..x31 or ABI register names, loads and stores as "rd, imm(rs1)", decimal or
+    0x immediates. Branch and jump targets are labels or byte offsets. Pseudo
+    instructions: nop, li, mv, not, neg, seqz, snez, j, jr, ret, call, beqz, bnez,
+    blez, bgez, bltz, bgtz, bgt, ble, bgtu, bleu, csrr, csrw, csrs, csrc (and the
+    i forms), rdcycle, rdtime, rdinstret (and the h forms). CSRs are numbers or
+    names (cycle, mhpmcounter3, mhpmevent3, satp, ...).
+*/
+template <size_t N, size_t MAX_LABELS = 256>
+class Assembler
+{
+public:
+    typedef std::array<INSTRUCTION, N> Program;
+
+    typedef INSTRUCTION (*MakeR)(size_t rd, size_t rs1, size_t rs2);
+    typedef INSTRUCTION (*MakeI)(size_t rd, size_t rs1, int32_t imm);
+    typedef INSTRUCTION (*MakeU)(size_t rd, uint32_t imm20);
+    typedef INSTRUCTION (*MakeB)(size_t rs1, size_t rs2, int32_t delta);
+
+public:
+    constexpr Assembler()
+    {}
+
+    // Binds `name` to the next instruction
+    constexpr void Label(std::string_view name)
+    {
+        for (size_t i = 0; i < labels; ++i)
+            if (label[i].name == name)
+                throw "assembler: duplicate label";
+        if (labels == MAX_LABELS)
+            throw "assembler: too many labels";
+
+        label[labels++] = {name, size};
+    }
+
+    // Instructions emitted so far (may exceed N: Finish() reports it)
+    constexpr size_t Size() const
+    { return size; }
+
+    constexpr Program Finish() const
+    {
+        if (size != N)
+            throw "assembler: instruction count does not match the program size";
+
+        Program result = program;
+        for (size_t i = 0; i < fixups; ++i)
+        {
+            const Fixup& fixup = fixup_list[i];
+            int32_t      delta = (int32_t(Find(fixup.target)) - int32_t(fixup.index)) * 4;
+
+            if (fixup.jal)
+                result[fixup.index] = MakeJAL(fixup.rs1, CheckJump(delta));
+            else
+                result[fixup.index] = fixup.make(fixup.rs1, fixup.rs2, CheckBranch(delta));
+        }
+        return result;
+    }
+
+public:
+    // Formats: every instruction below is one of these with its Make* builder
+    constexpr void Emit(INSTRUCTION instruction)
+    {
+        if (size < N)
+            program[size] = instruction;
+        ++size;
+    }
+
+    constexpr void R(MakeR make, size_t rd, size_t rs1, size_t rs2)
+    { Emit(make(CheckRegister(rd), CheckRegister(rs1), CheckRegister(rs2))); }
+
+    constexpr void I(MakeI make, size_t rd, size_t rs1, int32_t imm)
+    { Emit(make(CheckRegister(rd), CheckRegister(rs1), CheckImmediate(imm))); }
+
+    constexpr void Shift(MakeR make, size_t rd, size_t rs1, size_t shamt)
+    {
+        if (shamt >= 32)
+            throw "assembler: shift amount out of range";
+        Emit(make(CheckRegister(rd), CheckRegister(rs1), shamt));
+    }
+
+    constexpr void U(MakeU make, size_t rd, uint32_t imm20)
+    {
+        if (imm20 >= (1u << 20))
+            throw "assembler: upper immediate out of range";
+        Emit(make(CheckRegister(rd), imm20));
+    }
+
+    constexpr void Branch(MakeB make, size_t rs1, size_t rs2, int32_t delta)
+    { Emit(make(CheckRegister(rs1), CheckRegister(rs2), CheckBranch(delta))); }
+
+    constexpr void Branch(MakeB make, size_t rs1, size_t rs2, std::string_view target)
+    {
+        AddFixup({size, target, make, CheckRegister(rs1), CheckRegister(rs2), false});
+        Emit(MakeADDI(0, 0, 0));
+    }
+
+    constexpr void AMO(size_t funct5, size_t rd, size_t rs1, size_t rs2)
+    { Emit(MakeAMO(funct5, CheckRegister(rd), CheckRegister(rs1), CheckRegister(rs2))); }
+
+    // funct3 5..7 take a 5-bit immediate in place of rs1
+    constexpr void CSR(size_t funct3, size_t rd, uint32_t csr, size_t rs1)
+    {
+        if (csr >= 4096)
+            throw "assembler: CSR number out of range";
+        if (funct3 >= 5 && rs1 >= 32)
+            throw "assembler: CSR immediate out of range";
+        Emit(MakeCSR(funct3, CheckRegister(rd), funct3 >= 5 ? rs1 : CheckRegister(rs1), csr));
+    }
+
+public:
+    // RV32I
+    constexpr void LUI(size_t rd, uint32_t imm20)
+    { U(MakeLUI, rd, imm20); }
+    constexpr void AUIPC(size_t rd, uint32_t imm20)
+    { U(MakeAUIPC, rd, imm20); }
+
+    constexpr void JAL(size_t rd, int32_t delta)
+    { Emit(MakeJAL(CheckRegister(rd), CheckJump(delta))); }
+    constexpr void JAL(size_t rd, std::string_view target)
+    {
+        AddFixup({size, target, nullptr, CheckRegister(rd), 0, true});
+        Emit(MakeADDI(0, 0, 0));
+    }
+    constexpr void JALR(size_t rd, size_t rs1, int32_t imm)
+    { I(MakeJALR, rd, rs1, imm); }
+
+    template <typename Target>
+    constexpr void BEQ(size_t rs1, size_t rs2, Target target)
+    { Branch(MakeBEQ, rs1, rs2, target); }
+    template <typename Target>
+    constexpr void BNE(size_t rs1, size_t rs2, Target target)
+    { Branch(MakeBNE, rs1, rs2, target); }
+    template <typename Target>
+    constexpr void BLT(size_t rs1, size_t rs2, Target target)
+    { Branch(MakeBLT, rs1, rs2, target); }
+    template <typename Target>
+    constexpr void BGE(size_t rs1, size_t rs2, Target target)
+    { Branch(MakeBGE, rs1, rs2, target); }
+    template <typename Target>
+    constexpr void BLTU(size_t rs1, size_t rs2, Target target)
+    { Branch(MakeBLTU, rs1, rs2, target); }
+    template <typename Target>
+    constexpr void BGEU(size_t rs1, size_t rs2, Target target)
+    { Branch(MakeBGEU, rs1, rs2, target); }
+
+    constexpr void LB(size_t rd, size_t rs1, int32_t imm)
+    { I(MakeLB, rd, rs1, imm); }
+    constexpr void LH(size_t rd, size_t rs1, int32_t imm)
+    { I(MakeLH, rd, rs1, imm); }
+    constexpr void LW(size_t rd, size_t rs1, int32_t imm)
+    { I(MakeLW, rd, rs1, imm); }
+    constexpr void LBU(size_t rd, size_t rs1, int32_t imm)
+    { I(MakeLBU, rd, rs1, imm); }
+    constexpr void LHU(size_t rd, size_t rs1, int32_t imm)
+    { I(MakeLHU, rd, rs1, imm); }
+    constexpr void SB(size_t rs2, size_t rs1, int32_t imm)
+    { I(MakeSB, rs2, rs1, imm); }
+    constexpr void SH(size_t rs2, size_t rs1, int32_t imm)
+    { I(MakeSH, rs2, rs1, imm); }
+    constexpr void SW(size_t rs2, size_t rs1, int32_t imm)
+    { I(MakeSW, rs2, rs1, imm); }
+
+    constexpr void ADDI(size_t rd, size_t rs1, int32_t imm)
+    { I(MakeADDI, rd, rs1, imm); }
+    constexpr void SLTI(size_t rd, size_t rs1, int32_t imm)
+    { I(MakeSLTI, rd, rs1, imm); }
+    constexpr void SLTIU(size_t rd, size_t rs1, int32_t imm)
+    { I(MakeSLTIU, rd, rs1, imm); }
+    constexpr void XORI(size_t rd, size_t rs1, int32_t imm)
+    { I(MakeXORI, rd, rs1, imm); }
+    constexpr void ORI(size_t rd, size_t rs1, int32_t imm)
+    { I(MakeORI, rd, rs1, imm); }
+    constexpr void ANDI(size_t rd, size_t rs1, int32_t imm)
+    { I(MakeANDI, rd, rs1, imm); }
+    constexpr void SLLI(size_t rd, size_t rs1, size_t shamt)
+    { Shift(MakeSLLI, rd, rs1, shamt); }
+    constexpr void SRLI(size_t rd, size_t rs1, size_t shamt)
+    { Shift(MakeSRLI, rd, rs1, shamt); }
+    constexpr void SRAI(size_t rd, size_t rs1, size_t shamt)
+    { Shift(MakeSRAI, rd, rs1, shamt); }
+
+    constexpr void ADD(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeADD, rd, rs1, rs2); }
+    constexpr void SUB(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeSUB, rd, rs1, rs2); }
+    constexpr void SLL(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeSLL, rd, rs1, rs2); }
+    constexpr void SLT(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeSLT, rd, rs1, rs2); }
+    constexpr void SLTU(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeSLTU, rd, rs1, rs2); }
+    constexpr void XOR(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeXOR, rd, rs1, rs2); }
+    constexpr void SRL(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeSRL, rd, rs1, rs2); }
+    constexpr void SRA(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeSRA, rd, rs1, rs2); }
+    constexpr void OR(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeOR, rd, rs1, rs2); }
+    constexpr void AND(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeAND, rd, rs1, rs2); }
+
+    constexpr void FENCE()
+    { Emit(MakeFENCE()); }
+    constexpr void ECALL()
+    { Emit(MakeECALL()); }
+    constexpr void EBREAK()
+    { Emit(MakeEBREAK()); }
+    constexpr void MRET()
+    { Emit(MakeMRET()); }
+    constexpr void WFI()
+    { Emit(MakeWFI()); }
+    constexpr void SFENCE_VMA(size_t rs1 = 0, size_t rs2 = 0)
+    { Emit(MakeSFENCE_VMA(rs1, rs2)); }
+
+    // M extension
+    constexpr void MUL(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeMUL, rd, rs1, rs2); }
+    constexpr void MULH(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeMULH, rd, rs1, rs2); }
+    constexpr void MULHSU(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeMULHSU, rd, rs1, rs2); }
+    constexpr void MULHU(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeMULHU, rd, rs1, rs2); }
+    constexpr void DIV(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeDIV, rd, rs1, rs2); }
+    constexpr void DIVU(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeDIVU, rd, rs1, rs2); }
+    constexpr void REM(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeREM, rd, rs1, rs2); }
+    constexpr void REMU(size_t rd, size_t rs1, size_t rs2)
+    { R(MakeREMU, rd, rs1, rs2); }
+
+    // A extension
+    constexpr void LR(size_t rd, size_t rs1)
+    { AMO(0x02, rd, rs1, 0); }
+    constexpr void SC(size_t rd, size_t rs1, size_t rs2)
+    { AMO(0x03, rd, rs1, rs2); }
+
+    // Zicsr
+    constexpr void CSRRW(size_t rd, uint32_t csr, size_t rs1)
+    { CSR(1, rd, csr, rs1); }
+    constexpr void CSRRS(size_t rd, uint32_t csr, size_t rs1)
+    { CSR(2, rd, csr, rs1); }
+    constexpr void CSRRC(size_t rd, uint32_t csr, size_t rs1)
+    { CSR(3, rd, csr, rs1); }
+    constexpr void CSRRWI(size_t rd, uint32_t csr, size_t uimm)
+    { CSR(5, rd, csr, uimm); }
+    constexpr void CSRRSI(size_t rd, uint32_t csr, size_t uimm)
+    { CSR(6, rd, csr, uimm); }
+    constexpr void CSRRCI(size_t rd, uint32_t csr, size_t uimm)
+    { CSR(7, rd, csr, uimm); }
+
+    // Pseudo instructions
+    constexpr void NOP()
+    { ADDI(0, 0, 0); }
+    constexpr void MV(size_t rd, size_t rs1)
+    { ADDI(rd, rs1, 0); }
+    constexpr void CSRR(size_t rd, uint32_t csr)
+    { CSRRS(rd, csr, 0); }
+    constexpr void CSRW(uint32_t csr, size_t rs1)
+    { CSRRW(0, csr, rs1); }
+    constexpr void RDCYCLE(size_t rd)
+    { CSRR(rd, 0xc00); }
+    constexpr void RDTIME(size_t rd)
+    { CSRR(rd, 0xc01); }
+    constexpr void RDINSTRET(size_t rd)
+    { CSRR(rd, 0xc02); }
+
+    // One ADDI for 12-bit values, otherwise LUI (+ ADDI)
+    constexpr void LI(size_t rd, int32_t value)
+    {
+        if (-2048 <= value && value < 2048)
+            return ADDI(rd, 0, value);
+
+        uint32_t upper = (uint32_t(value) + 0x800) >> 12;
+        int32_t  lower = int32_t(uint32_t(value) - (upper << 12));
+        LUI(rd, upper & 0xfffff);
+        if (lower != 0)
+            ADDI(rd, rd, lower);
+    }
+
+private:
+    struct Symbol
+    {
+        std::string_view name;
+        size_t           index = 0;
+    };
+
+    // Branch or JAL to a label, encoded by Finish()
+    struct Fixup
+    {
+        size_t           index  = 0;
+        std::string_view target;
+        MakeB            make   = nullptr;
+        size_t           rs1    = 0; // JAL: rd
+        size_t           rs2    = 0;
+        bool             jal    = false;
+    };
+
+    constexpr void AddFixup(const Fixup& fixup)
+    {
+        if (size < N)
+            fixup_list[fixups++] = fixup;
+    }
+
+    constexpr size_t Find(std::string_view name) const
+    {
+        for (size_t i = 0; i < labels; ++i)
+            if (label[i].name == name)
+                return label[i].index;
+        throw "assembler: undefined label";
+    }
+
+    static constexpr size_t CheckRegister(size_t r)
+    {
+        if (r >= 32)
+            throw "assembler: no such register";
+        return r;
+    }
+
+    static constexpr int32_t CheckImmediate(int32_t imm)
+    {
+        if (imm < -2048 || imm >= 2048)
+            throw "assembler: immediate out of range";
+        return imm;
+    }
+
+    static constexpr int32_t CheckBranch(int32_t delta)
+    {
+        if (delta < -4096 || delta >= 4096 || (delta & 1) != 0)
+            throw "assembler: branch target out of range";
+        return delta;
+    }
+
+    static constexpr int32_t CheckJump(int32_t delta)
+    {
+        if (delta < -(1 << 20) || delta >= (1 << 20) || (delta & 1) != 0)
+            throw "assembler: jump target out of range";
+        return delta;
+    }
+
+private:
+    Program                        program    = {};
+    size_t                         size       = 0;
+    std::array<Symbol, MAX_LABELS> label      = {};
+    size_t                         labels     = 0;
+    std::array<Fixup, N>           fixup_list = {};
+    size_t                         fixups     = 0;
+};
+
+/**
+    Text front end: feeds one source line at a time to an Assembler.
+*/
+class AssemblyParser
+{
+public:
+    constexpr AssemblyParser(std::string_view source):
+        source(source),
+        pos   (0)
+    {}
+
+    template <typename Builder>
+    constexpr void Parse(Builder& builder)
+    {
+        for (;;)
+        {
+            SkipBlankLines();
+            if (pos == source.size())
+                break;
+
+            std::string_view name = Identifier();
+            SkipSpace();
+            if (Peek() == ':')
+            {
+                ++pos;
+                builder.Label(name);
+                continue;
+            }
+
+            Instruction(builder, name);
+            SkipSpace();
+            if (!AtLineEnd())
+                throw "assembler: unexpected text after the operands";
+        }
+    }
+
+private:
+    template <typename Builder>
+    constexpr void Instruction(Builder& a, std::string_view op)
+    {
+        typedef typename Builder::MakeR MakeR;
+        typedef typename Builder::MakeI MakeI;
+        typedef typename Builder::MakeU MakeU;
+        typedef typename Builder::MakeB MakeB;
+
+        struct RegisterOp  { std::string_view name; MakeR make; };
+        struct ImmediateOp { std::string_view name; MakeI make; };
+        struct UpperOp     { std::string_view name; MakeU make; };
+        struct BranchOp    { std::string_view name; MakeB make; };
+
+        constexpr RegisterOp REGISTER_OPS[] = {
+            {"add", MakeADD}, {"sub", MakeSUB}, {"sll", MakeSLL}, {"slt", MakeSLT}, {"sltu", MakeSLTU},
+            {"xor", MakeXOR}, {"srl", MakeSRL}, {"sra", MakeSRA}, {"or", MakeOR}, {"and", MakeAND},
+            {"mul", MakeMUL}, {"mulh", MakeMULH}, {"mulhsu", MakeMULHSU}, {"mulhu", MakeMULHU},
+            {"div", MakeDIV}, {"divu", MakeDIVU}, {"rem", MakeREM}, {"remu", MakeREMU},
+        };
+        constexpr ImmediateOp IMMEDIATE_OPS[] = {
+            {"addi", MakeADDI}, {"slti", MakeSLTI}, {"sltiu", MakeSLTIU},
+            {"xori", MakeXORI}, {"ori", MakeORI}, {"andi", MakeANDI},
+        };
+        constexpr RegisterOp SHIFT_OPS[] = {{"slli", MakeSLLI}, {"srli", MakeSRLI}, {"srai", MakeSRAI}};
+        constexpr ImmediateOp LOAD_OPS[] = {{"lb", MakeLB}, {"lh", MakeLH}, {"lw", MakeLW}, {"lbu", MakeLBU}, {"lhu", MakeLHU}};
+        constexpr ImmediateOp STORE_OPS[] = {{"sb", MakeSB}, {"sh", MakeSH}, {"sw", MakeSW}};
+        constexpr UpperOp UPPER_OPS[] = {{"lui", MakeLUI}, {"auipc", MakeAUIPC}};
+        constexpr BranchOp BRANCH_OPS[] = {
+            {"beq", MakeBEQ}, {"bne", MakeBNE}, {"blt", MakeBLT},
+            {"bge", MakeBGE}, {"bltu", MakeBLTU}, {"bgeu", MakeBGEU},
+        };
+        // branches against zero and with swapped operands
+        constexpr BranchOp BRANCH_ZERO_OPS[] = {
+            {"beqz", MakeBEQ}, {"bnez", MakeBNE}, {"bltz", MakeBLT}, {"bgez", MakeBGE},
+        };
+        constexpr BranchOp BRANCH_ZERO_SWAPPED_OPS[] = {{"bgtz", MakeBLT}, {"blez", MakeBGE}};
+        constexpr BranchOp BRANCH_SWAPPED_OPS[] = {{"bgt", MakeBLT}, {"ble", MakeBGE}, {"bgtu", MakeBLTU}, {"bleu", MakeBGEU}};
+        struct CsrOp { std::string_view name; size_t funct3; };
+        constexpr CsrOp CSR_OPS[] = {
+            {"csrrw", 1}, {"csrrs", 2}, {"csrrc", 3}, {"csrrwi", 5}, {"csrrsi", 6}, {"csrrci", 7},
+        };
+        // csrw, csrs, csrc and their immediate forms: rd = x0
+        constexpr CsrOp CSR_WRITE_OPS[] = {
+            {"csrw", 1}, {"csrs", 2}, {"csrc", 3}, {"csrwi", 5}, {"csrsi", 6}, {"csrci", 7},
+        };
+        struct CounterOp { std::string_view name; uint32_t csr; };
+        constexpr CounterOp COUNTER_OPS[] = {
+            {"rdcycle", 0xc00}, {"rdtime", 0xc01}, {"rdinstret", 0xc02},
+            {"rdcycleh", 0xc80}, {"rdtimeh", 0xc81}, {"rdinstreth", 0xc82},
+        };
+        struct AmoOp { std::string_view name; size_t funct5; };
+        constexpr AmoOp AMO_OPS[] = {
+            {"amoadd.w", 0x00}, {"amoswap.w", 0x01}, {"amoxor.w", 0x04}, {"amoor.w", 0x08}, {"amoand.w", 0x0c},
+            {"amomin.w", 0x10}, {"amomax.w", 0x14}, {"amominu.w", 0x18}, {"amomaxu.w", 0x1c},
+        };
+
+        if (const RegisterOp* r = Lookup(REGISTER_OPS, op))
+        {
+            size_t rd  = Register();
+            size_t rs1 = (Comma(), Register());
+            size_t rs2 = (Comma(), Register());
+            a.R(r->make, rd, rs1, rs2);
+        }
+        else if (const ImmediateOp* i = Lookup(IMMEDIATE_OPS, op))
+        {
+            size_t  rd  = Register();
+            size_t  rs1 = (Comma(), Register());
+            int32_t imm = (Comma(), Immediate());
+            a.I(i->make, rd, rs1, imm);
+        }
+        else if (const RegisterOp* shift = Lookup(SHIFT_OPS, op))
+        {
+            size_t  rd    = Register();
+            size_t  rs1   = (Comma(), Register());
+            int32_t shamt = (Comma(), Immediate());
+            if (shamt < 0)
+                throw "assembler: shift amount out of range";
+            a.Shift(shift->make, rd, rs1, size_t(shamt));
+        }
+        else if (const ImmediateOp* load = Lookup(LOAD_OPS, op))
+        {
+            size_t  rd  = Register();
+            int32_t imm = (Comma(), Immediate());
+            size_t  rs1 = Base();
+            a.I(load->make, rd, rs1, imm);
+        }
+        else if (const ImmediateOp* store = Lookup(STORE_OPS, op))
+        {
+            size_t  rs2 = Register();
+            int32_t imm = (Comma(), Immediate());
+            size_t  rs1 = Base();
+            a.I(store->make, rs2, rs1, imm);
+        }
+        else if (const UpperOp* u = Lookup(UPPER_OPS, op))
+        {
+            size_t  rd    = Register();
+            int32_t imm20 = (Comma(), Immediate());
+            if (imm20 < 0)
+                throw "assembler: upper immediate out of range";
+            a.U(u->make, rd, uint32_t(imm20));
+        }
+        else if (const BranchOp* b = Lookup(BRANCH_OPS, op))
+        {
+            size_t rs1 = Register();
+            size_t rs2 = (Comma(), Register());
+            Comma();
+            Target(a, b->make, rs1, rs2);
+        }
+        else if (const BranchOp* b = Lookup(BRANCH_SWAPPED_OPS, op))
+        {
+            size_t rs1 = Register();
+            size_t rs2 = (Comma(), Register());
+            Comma();
+            Target(a, b->make, rs2, rs1);
+        }
+        else if (const BranchOp* b = Lookup(BRANCH_ZERO_OPS, op))
+        {
+            size_t rs1 = Register();
+            Comma();
+            Target(a, b->make, rs1, 0);
+        }
+        else if (const BranchOp* b = Lookup(BRANCH_ZERO_SWAPPED_OPS, op))
+        {
+            size_t rs1 = Register();
+            Comma();
+            Target(a, b->make, 0, rs1);
+        }
+        else if (const AmoOp* amo = Lookup(AMO_OPS, op))
+        {
+            size_t rd  = Register();
+            size_t rs2 = (Comma(), Register());
+            Comma();
+            size_t rs1 = Base();
+            a.AMO(amo->funct5, rd, rs1, rs2);
+        }
+        else if (op == "lr.w")
+        {
+            size_t rd = Register();
+            Comma();
+            a.LR(rd, Base());
+        }
+        else if (op == "sc.w")
+        {
+            size_t rd  = Register();
+            size_t rs2 = (Comma(), Register());
+            Comma();
+            a.SC(rd, Base(), rs2);
+        }
+        else if (op == "jal")
+        {
+            // "jal target" links ra
+            size_t rd = 1;
+            if (IsRegisterOperand())
+            {
+                rd = Register();
+                Comma();
+            }
+            Target(a, nullptr, rd, 0);
+        }
+        else if (op == "jalr")
+        {
+            // "jalr rs1", "jalr rd, imm(rs1)" or "jalr rd, rs1, imm"
+            size_t rd = Register();
+            SkipSpace();
+            if (Peek() != ',')
+                return a.JALR(1, rd, 0);
+
+            Comma();
+            if (IsRegisterOperand())
+            {
+                size_t  rs1 = Register();
+                int32_t imm = 0;
+                SkipSpace();
+                if (Peek() == ',')
+                    imm = (Comma(), Immediate());
+                a.JALR(rd, rs1, imm);
+            }
+            else
+            {
+                int32_t imm = Immediate();
+                a.JALR(rd, Base(), imm);
+            }
+        }
+        else if (op == "j")
+            Target(a, nullptr, 0, 0);
+        else if (op == "call")
+            Target(a, nullptr, 1, 0);
+        else if (op == "jr")
+            a.JALR(0, Register(), 0);
+        else if (op == "ret")
+            a.JALR(0, 1, 0);
+        else if (op == "li")
+        {
+            size_t  rd    = Register();
+            int32_t value = (Comma(), Immediate());
+            a.LI(rd, value);
+        }
+        else if (op == "mv" || op == "not" || op == "neg" || op == "seqz" || op == "snez")
+        {
+            size_t rd = Register();
+            size_t rs = (Comma(), Register());
+            if (op == "mv")
+                a.ADDI(rd, rs, 0);
+            else if (op == "not")
+                a.XORI(rd, rs, -1);
+            else if (op == "neg")
+                a.SUB(rd, 0, rs);
+            else if (op == "seqz")
+                a.SLTIU(rd, rs, 1);
+            else
+                a.SLTU(rd, 0, rs);
+        }
+        else if (op == "nop")
+            a.NOP();
+        else if (op == "fence")
+            a.FENCE();
+        else if (op == "ecall")
+            a.ECALL();
+        else if (op == "ebreak")
+            a.EBREAK();
+        else if (op == "mret")
+            a.MRET();
+        else if (op == "wfi")
+            a.WFI();
+        else if (const CsrOp* csr = Lookup(CSR_OPS, op))
+        {
+            size_t   rd     = Register();
+            uint32_t number = (Comma(), Csr());
+            Comma();
+            a.CSR(csr->funct3, rd, number, csr->funct3 >= 5 ? size_t(Uimm()) : Register());
+        }
+        else if (const CsrOp* csr = Lookup(CSR_WRITE_OPS, op))
+        {
+            uint32_t number = Csr();
+            Comma();
+            a.CSR(csr->funct3, 0, number, csr->funct3 >= 5 ? size_t(Uimm()) : Register());
+        }
+        else if (op == "csrr")
+        {
+            size_t rd = Register();
+            a.CSRR(rd, (Comma(), Csr()));
+        }
+        else if (const CounterOp* counter = Lookup(COUNTER_OPS, op))
+            a.CSRR(Register(), counter->csr);
+        else if (op == "sfence.vma")
+        {
+            size_t rs1 = 0, rs2 = 0;
+            if ((SkipSpace(), !AtLineEnd()))
+            {
+                rs1 = Register();
+                if ((SkipSpace(), !AtLineEnd()))
+                    rs2 = (Comma(), Register());
+            }
+            a.SFENCE_VMA(rs1, rs2);
+        }
+        else
+            throw "assembler: unknown mnemonic";
+    }
+
+    // Label or byte offset; a null `make` is a JAL with rd = rs1
+    template <typename Builder>
+    constexpr void Target(Builder& a, typename Builder::MakeB make, size_t rs1, size_t rs2)
+    {
+        SkipSpace();
+        if (IsDigit(Peek()) || Peek() == '-' || Peek() == '+')
+        {
+            int32_t delta = Immediate();
+            return make == nullptr ? a.JAL(rs1, delta) : a.Branch(make, rs1, rs2, delta);
+        }
+
+        std::string_view label = Identifier();
+        make == nullptr ? a.JAL(rs1, label) : a.Branch(make, rs1, rs2, label);
+    }
+
+    template <typename Entry, size_t SIZE>
+    static constexpr const Entry* Lookup(const Entry (&table)[SIZE], std::string_view name)
+    {
+        for (const Entry& entry : table)
+            if (entry.name == name)
+                return &entry;
+        return nullptr;
+    }
+
+    constexpr size_t Register()
+    {
+        constexpr std::string_view ABI[32] = {
+            "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+            "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+        };
+
+        std::string_view name = Identifier();
+        size_t           r    = 32;
+        if (name == "fp")
+            r = 8;
+        for (size_t i = 0; i < 32; ++i)
+            if (name == ABI[i])
+                r = i;
+        if (name.size() >= 2 && name.size() <= 3 && name[0] == 'x' && IsDigit(name[1]))
+        {
+            r = 0;
+            for (size_t i = 1; i < name.size(); ++i)
+                r = IsDigit(name[i]) ? r * 10 + size_t(name[i] - '0') : 32;
+        }
+        if (r >= 32)
+            throw "assembler: no such register";
+        return r;
+    }
+
+    // CSR number or name: the counters, satp, mhpmevent3..31, the machine trap CSRs and the CLINT
+    constexpr uint32_t Csr()
+    {
+        struct Named { std::string_view name; uint32_t csr; };
+        constexpr Named NAMES[] = {
+            {"cycle", 0xc00}, {"time", 0xc01}, {"instret", 0xc02}, {"cycleh", 0xc80}, {"timeh", 0xc81}, {"instreth", 0xc82},
+            {"mcycle", 0xb00}, {"minstret", 0xb02}, {"mcycleh", 0xb80}, {"minstreth", 0xb82}, {"satp", 0x180},
+            {"mstatus", 0x300}, {"mie", 0x304}, {"mtvec", 0x305}, {"mscratch", 0x340}, {"mepc", 0x341}, {"mcause", 0x342},
+            {"mip", 0x344}, {"mtimecmp", 0x7c0}, {"mtimecmph", 0x7c1}, {"msip", 0x7c2},
+        };
+        // name + n (3..31) -> base + n
+        constexpr Named NUMBERED[] = {
+            {"hpmcounter", 0xc00}, {"mhpmcounter", 0xb00}, {"mhpmevent", 0x320},
+        };
+
+        SkipSpace();
+        if (!IsIdentifierStart(Peek()))
+        {
+            int32_t number = Immediate();
+            if (number < 0 || number >= 4096)
+                throw "assembler: CSR number out of range";
+            return uint32_t(number);
+        }
+
+        std::string_view name = Identifier();
+        if (const Named* named = Lookup(NAMES, name))
+            return named->csr;
+        for (const Named& numbered : NUMBERED)
+        {
+            std::string_view rest = name.substr(0, numbered.name.size()) == numbered.name ? name.substr(numbered.name.size()) : "";
+            bool             high = numbered.csr != 0x320 && !rest.empty() && rest.back() == 'h';
+            if (high)
+                rest.remove_suffix(1);
+
+            uint32_t n = rest.empty() ? 0 : 32;
+            if (rest.size() >= 1 && rest.size() <= 2 && IsDigit(rest[0]) && (rest.size() == 1 || IsDigit(rest[1])))
+                n = rest.size() == 1 ? rest[0] - '0' : (rest[0] - '0') * 10 + (rest[1] - '0');
+            if (n >= 3 && n < 32)
+                return numbered.csr + n + (high ? 0x80 : 0);
+        }
+        throw "assembler: unknown CSR";
+    }
+
+    // 5-bit immediate of csrrwi, csrrsi, csrrci
+    constexpr uint32_t Uimm()
+    {
+        int32_t value = Immediate();
+        if (value < 0 || value >= 32)
+            throw "assembler: CSR immediate out of range";
+        return uint32_t(value);
+    }
+
+    // Next operand is a register name (not a label or a number)
+    constexpr bool IsRegisterOperand()
+    {
+        SkipSpace();
+        if (!IsIdentifierStart(Peek()))
+            return false;
+
+        size_t           start = pos;
+        std::string_view name  = Identifier();
+        pos = start;
+        return IsRegisterName(name);
+    }
+
+    static constexpr bool IsRegisterName(std::string_view name)
+    {
+        constexpr std::string_view ABI[] = {
+            "zero", "ra", "sp", "gp", "tp", "fp", "t0", "t1", "t2", "t3", "t4", "t5", "t6",
+            "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11",
+            "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7",
+        };
+        for (std::string_view abi : ABI)
+            if (name == abi)
+                return true;
+        return name.size() >= 2 && name[0] == 'x' && IsDigit(name[1]);
+    }
+
+    // "(rs1)" of a memory operand
+    constexpr size_t Base()
+    {
+        SkipSpace();
+        if (Peek() != '(')
+            throw "assembler: expected (register)";
+        ++pos;
+        size_t rs1 = Register();
+        SkipSpace();
+        if (Peek() != ')')
+            throw "assembler: expected (register)";
+        ++pos;
+        return rs1;
+    }
+
+    constexpr int32_t Immediate()
+    {
+        SkipSpace();
+        bool negative = false;
+        if (Peek() == '-' || Peek() == '+')
+            negative = source[pos++] == '-';
+
+        // memory operands may omit a zero offset: "(rs1)"
+        if (Peek() == '(')
+            return 0;
+
+        uint32_t base = 10;
+        if (Peek() == '0' && pos + 1 < source.size() && (source[pos + 1] == 'x' || source[pos + 1] == 'X'))
+        {
+            base = 16;
+            pos += 2;
+        }
+
+        uint64_t value  = 0;
+        size_t   digits = 0;
+        for (;; ++digits, ++pos)
+        {
+            char     c     = Peek();
+            uint32_t digit = 16;
+            if (IsDigit(c))
+                digit = uint32_t(c - '0');
+            else if (base == 16 && c >= 'a' && c <= 'f')
+                digit = uint32_t(c - 'a' + 10);
+            else if (base == 16 && c >= 'A' && c <= 'F')
+                digit = uint32_t(c - 'A' + 10);
+            if (digit >= base)
+                break;
+            value = value * base + digit;
+            if (value > 0xffffffffu)
+                throw "assembler: immediate out of range";
+        }
+        if (digits == 0)
+            throw "assembler: expected a number";
+
+        // 32-bit patterns such as 0xffffffff are allowed and wrap to negative
+        return int32_t(uint32_t(negative ? 0 - value : value));
+    }
+
+    constexpr void Comma()
+    {
+        SkipSpace();
+        if (Peek() != ',')
+            throw "assembler: expected ','";
+        ++pos;
+    }
+
+    constexpr std::string_view Identifier()
+    {
+        SkipSpace();
+        size_t start = pos;
+        if (!IsIdentifierStart(Peek()))
+            throw "assembler: expected a name";
+        while (IsIdentifierStart(Peek()) || IsDigit(Peek()))
+            ++pos;
+        return source.substr(start, pos - start);
+    }
+
+    constexpr char Peek() const
+    { return pos < source.size() ? source[pos] : '\0'; }
+
+    constexpr void SkipSpace()
+    {
+        while (Peek() == ' ' || Peek() == '\t' || Peek() == '\r')
+            ++pos;
+    }
+
+    constexpr bool AtLineEnd() const
+    {
+        char c = Peek();
+        return c == '\0' || c == '\n' || c == '#' || (c == '/' && pos + 1 < source.size() && source[pos + 1] == '/');
+    }
+
+    // Blank lines, comments and line ends
+    constexpr void SkipBlankLines()
+    {
+        for (;;)
+        {
+            SkipSpace();
+            if (Peek() == '\n')
+                ++pos;
+            else if (AtLineEnd() && pos < source.size())
+                while (pos < source.size() && source[pos] != '\n')
+                    ++pos;
+            else
+                break;
+        }
+    }
+
+    static constexpr bool IsDigit(char c)
+    { return c >= '0' && c <= '9'; }
+
+    static constexpr bool IsIdentifierStart(char c)
+    { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '.'; }
+
+private:
+    std::string_view source;
+    size_t           pos;
+};
+
+// Instructions `source` assembles to (pseudo instructions expanded)
+constexpr size_t AssembledSize(std::string_view source)
+{
+    Assembler<0> counter;
+    AssemblyParser(source).Parse(counter);
+    return counter.Size();
+}
+
+template <size_t N>
+constexpr std::array<INSTRUCTION, N> Assemble(std::string_view source)
+{
+    Assembler<N> assembler;
+    AssemblyParser(source).Parse(assembler);
+    return assembler.Finish();
+}
+
+// constexpr std::array<INSTRUCTION, size> of a string literal
+#define ASSEMBLE(source)                                                   \
+    ([]                                                                    \
+    {                                                                      \
+        constexpr std::string_view text = source;                          \
+        return Assemble<AssembledSize(text)>(text);                        \
+    }())
+
+#endif // _ASSEMBLER_H_
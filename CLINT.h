@@ -0,0 +1,118 @@
+#ifndef _CLINT_H_
+#define _CLINT_H_ 1
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <queue>
+#include <functional>
+
+// mip / mie bits
+constexpr uint32_t MIP_MSIP = 1 << 3;
+constexpr uint32_t MIP_MTIP = 1 << 7;
+
+// Something that happens at a known cycle
+struct TimedEvent
+{
+    uint64_t cycle;
+    uint32_t kind;
+
+    bool operator>(const TimedEvent& other) const
+    { return cycle > other.cycle; }
+};
+
+// Min-heap of TimedEvents keyed by cycle
+class EventQueue
+{
+public:
+    void Push(uint64_t cycle, uint32_t kind)
+    { heap.push({cycle, kind}); }
+
+    // Cycle of the earliest event, UINT64_MAX if there is none
+    uint64_t Next() const
+    { return heap.empty() ? UINT64_MAX : heap.top().cycle; }
+
+    // Removes an event due at `now`; false if there is none
+    bool Pop(uint64_t now, TimedEvent& event)
+    {
+        if (heap.empty() || heap.top().cycle > now)
+            return false;
+        event = heap.top();
+        heap.pop();
+        return true;
+    }
+
+    size_t Size() const
+    { return heap.size(); }
+
+private:
+    std::priority_queue<TimedEvent, std::vector<TimedEvent>, std::greater<TimedEvent>> heap;
+};
+
+/**
+    Core-local interruptor of one hart: mtime, mtimecmp and msip.
+
+    mtime is the engine's cycle count. Whatever changes the pending interrupts at
+    a known cycle is an event on the queue: the mtimecmp deadline, and software
+    interrupts a device model or the host raises with Schedule(). Between events
+    nothing can become pending, so the engines only compare the cycle with Next()
+    and WFI skips straight to it. A stale deadline (mtimecmp was written again)
+    just costs one more look at the pending bits.
+*/
+class Clint
+{
+public:
+    enum Event : uint32_t
+    {
+        TIMER,    // mtimecmp may have been reached
+        SOFTWARE, // sets msip
+    };
+
+public:
+    Clint():
+        mtimecmp(UINT64_MAX),
+        msip    (false)
+    {}
+
+    uint64_t TimeCompare() const
+    { return mtimecmp; }
+
+    void SetTimeCompare(uint64_t value)
+    {
+        mtimecmp = value;
+        events.Push(value, TIMER);
+    }
+
+    bool Software() const
+    { return msip; }
+
+    void SetSoftware(bool value)
+    { msip = value; }
+
+    // Raises a software interrupt at `cycle`
+    void Schedule(uint64_t cycle, Event event = SOFTWARE)
+    { events.Push(cycle, event); }
+
+    // Cycle of the next event
+    uint64_t Next() const
+    { return events.Next(); }
+
+    // MIP_MSIP | MIP_MTIP at `now`, after the events due by then
+    uint32_t Pending(uint64_t now)
+    {
+        TimedEvent event;
+        while (events.Pop(now, event))
+        {
+            if (event.kind == SOFTWARE)
+                msip = true;
+        }
+        return (msip ? MIP_MSIP : 0) | (now >= mtimecmp ? MIP_MTIP : 0);
+    }
+
+private:
+    uint64_t   mtimecmp;
+    bool       msip;
+    EventQueue events;
+};
+
+#endif // _CLINT_H_
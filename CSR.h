@@ -0,0 +1,341 @@
+#ifndef _CSR_H_
+#define _CSR_H_ 1
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+
+#include "ISA.h"
+#include "Engine.h"
+#include "MMU.h"
+#include "CLINT.h"
+
+/**
+    Zicsr, Zicntr, machine-mode interrupts and the CLINT.
+
+    A CSR instruction, MRET or WFI stops the engine like a trap (CAUSE_CSR, the
+    instruction in tval) once everything older has retired, and
+    Engine::HandleTrap() runs it here. So CSR accesses are serializing and exact:
+    cycle is Engine::Cycles() at that point and instret counts the instructions
+    retired before it. Instructions that do not touch a CSR never reach this file.
+
+    Implemented CSRs:
+        cycle, time, instret, hpmcounter3..31 (read-only, and their h halves)
+        mcycle, minstret, mhpmcounter3..31 (writable, and their h halves)
+        mhpmevent3..31: the PerformanceEvent counted by mhpmcounterN
+        mstatus (MIE, MPIE), mie, mip, mtvec (direct), mscratch, mepc, mcause
+        mtimecmp, mtimecmph, msip (0x7c0..0x7c2): the CLINT, see CLINT.h
+        satp: MMU::Satp()
+
+    The counters are 64 bits. Writing one stores an offset against the engine's
+    count, so the engines never see the write. The engine retires the CSR
+    instruction after it ran, and a minstret write does not count it. time and
+    mtime read the cycle count. mhpmcounterN starts out counting event N - 2
+    (loads, stores, squashed, forwarded, mispredicts, ITLB and DTLB misses) and
+    reads 0 after the last event. There are no privilege levels, so every CSR is
+    accessible; anything else is an illegal instruction.
+
+    Interrupts: the engines ask Interrupt() before an instruction retires. With
+    mstatus.MIE set and an enabled interrupt pending it returns the cause, the
+    engine stops in front of the instruction and HandleTrap() enters the handler
+    at mtvec with mepc = that instruction. Software beats timer. DataMemory has
+    no MMIO path, so the CLINT registers are custom CSRs instead of memory.
+*/
+
+enum CsrKind : uint8_t
+{
+    CSR_NONE,
+    CSR_COUNTER,           // mcycle, minstret, mhpmcounterN
+    CSR_COUNTER_HIGH,      // their h halves
+    CSR_USER_COUNTER,      // cycle, time, instret, hpmcounterN
+    CSR_USER_COUNTER_HIGH,
+    CSR_EVENT_SELECT,      // mhpmeventN
+    CSR_SATP,
+    CSR_MSTATUS,
+    CSR_MIE,
+    CSR_MIP,
+    CSR_MTVEC,
+    CSR_MSCRATCH,
+    CSR_MEPC,
+    CSR_MCAUSE,
+    CSR_MTIMECMP,
+    CSR_MTIMECMPH,
+    CSR_MSIP,
+};
+
+// One entry per CSR number, so an access costs a table lookup
+constexpr std::array<CsrKind, 4096> MakeCsrTable()
+{
+    std::array<CsrKind, 4096> table = {};
+    for (uint32_t n = 0; n < 32; ++n)
+    {
+        if (n != 1) // no mtime CSR
+        {
+            table[0xb00 + n] = CSR_COUNTER;
+            table[0xb80 + n] = CSR_COUNTER_HIGH;
+        }
+        table[0xc00 + n] = CSR_USER_COUNTER;
+        table[0xc80 + n] = CSR_USER_COUNTER_HIGH;
+        if (n >= 3)
+            table[0x320 + n] = CSR_EVENT_SELECT;
+    }
+    table[0x180] = CSR_SATP;
+    table[0x300] = CSR_MSTATUS;
+    table[0x304] = CSR_MIE;
+    table[0x305] = CSR_MTVEC;
+    table[0x340] = CSR_MSCRATCH;
+    table[0x341] = CSR_MEPC;
+    table[0x342] = CSR_MCAUSE;
+    table[0x344] = CSR_MIP;
+    table[0x7c0] = CSR_MTIMECMP;
+    table[0x7c1] = CSR_MTIMECMPH;
+    table[0x7c2] = CSR_MSIP;
+    return table;
+}
+
+constexpr std::array<CsrKind, 4096> CSR_TABLE = MakeCsrTable();
+
+class CsrFile
+{
+public:
+    // mstatus bits
+    static constexpr uint32_t MSTATUS_MIE  = 1 << 3;
+    static constexpr uint32_t MSTATUS_MPIE = 1 << 7;
+    static constexpr uint32_t MSTATUS_MPP  = 3 << 11; // always M
+
+public:
+    CsrFile():
+        offsets {},
+        events  {},
+        mstatus (0),
+        mie     (0),
+        mtvec   (0),
+        mscratch(0),
+        mepc    (0),
+        mcause  (0),
+        armed   (false),
+        idle    (0)
+    {
+        for (uint32_t n = 3; n < EVENT_COUNT + 2; ++n)
+            events[n] = n - 2;
+    }
+
+    // Interrupt to take before the next instruction retires at cycle `now`, 0 if none
+    uint32_t Interrupt(uint64_t now)
+    {
+        if (!armed && now < clint.Next())
+            return 0;
+        return Deliverable(now);
+    }
+
+    // Interrupt() returns 0 before this cycle unless the guest writes a CSR
+    uint64_t NextInterrupt() const
+    { return armed ? 0 : clint.Next(); }
+
+    // Runs the instruction (or enters the interrupt) that stopped `engine`; false if it is illegal
+    bool Execute(Engine& engine, MachineState& trap)
+    {
+        if (IsInterrupt(trap.cause))
+        {
+            mepc    = trap.pc;
+            mcause  = trap.cause;
+            mstatus = (mstatus & MSTATUS_MIE) ? MSTATUS_MPIE : 0;
+            trap.pc = mtvec;
+            armed   = false;
+            return true;
+        }
+
+        uint32_t instruction = trap.tval;
+        if (instruction == MakeMRET().raw)
+        {
+            mstatus = MSTATUS_MPIE | ((mstatus & MSTATUS_MPIE) ? MSTATUS_MIE : 0);
+            trap.pc = mepc;
+            armed   = true;
+            return true;
+        }
+        if (instruction == MakeWFI().raw)
+        {
+            // sleeps until the next event, a NOP if there is none
+            uint64_t now = engine.Cycles();
+            if ((clint.Pending(now) & mie) == 0 && clint.Next() != UINT64_MAX)
+            {
+                idle += clint.Next() - now;
+                engine.Idle(clint.Next() - now);
+            }
+            trap.pc += 4;
+            return true;
+        }
+
+        uint32_t funct3 = (instruction >> 12) & 0x7;
+        uint32_t rd     = (instruction >> 7) & 0x1f;
+        uint32_t rs1    = (instruction >> 15) & 0x1f;
+        uint32_t csr    = instruction >> 20;
+        CsrKind  kind   = CSR_TABLE[csr];
+        if (kind == CSR_NONE || (funct3 & 0x3) == 0)
+            return false;
+
+        // CSRRS / CSRRC with x0 or uimm 0 only read
+        uint32_t operand = (funct3 & 0x4) ? rs1 : engine.Register(rs1);
+        bool     write   = (funct3 & 0x3) == 1 || rs1 != 0;
+        if (write && (csr >> 10) == 3)
+            return false; // read-only
+
+        uint32_t old = Read(engine, kind, csr);
+        if (write)
+        {
+            switch (funct3 & 0x3)
+            {
+            case 1:  Write(engine, kind, csr, operand);        break;
+            case 2:  Write(engine, kind, csr, old | operand);  break;
+            default: Write(engine, kind, csr, old & ~operand); break;
+            }
+            armed = true;
+        }
+        engine.SetRegister(rd, old);
+        trap.pc += 4;
+        return true;
+    }
+
+    // Cycles WFI skipped
+    uint64_t IdleCycles() const
+    { return idle; }
+
+public:
+    Clint clint;
+
+private:
+    // The pending, enabled interrupt with the highest priority
+    uint32_t Deliverable(uint64_t now)
+    {
+        uint32_t pending = (mstatus & MSTATUS_MIE) ? clint.Pending(now) & mie : 0;
+        armed = pending != 0;
+        if (pending & MIP_MSIP)
+            return CAUSE_MACHINE_SOFTWARE_INTERRUPT;
+        if (pending & MIP_MTIP)
+            return CAUSE_MACHINE_TIMER_INTERRUPT;
+        return 0;
+    }
+
+    // The engine's count behind counter `n` (cycle, time, instret, hpmcounterN)
+    static uint64_t Count(const Engine& engine, uint32_t event, uint32_t n)
+    {
+        switch (n)
+        {
+        case 0:
+        case 1:  return engine.Cycles();
+        case 2:  return engine.Instructions();
+        default: return event < EVENT_COUNT ? engine.Events(PerformanceEvent(event)) : 0;
+        }
+    }
+
+    uint64_t Counter(const Engine& engine, uint32_t n) const
+    { return Count(engine, events[n], n) + offsets[n]; }
+
+    uint32_t Read(const Engine& engine, CsrKind kind, uint32_t csr)
+    {
+        switch (kind)
+        {
+        case CSR_COUNTER:
+        case CSR_USER_COUNTER:
+            return uint32_t(Counter(engine, csr & 0x1f));
+        case CSR_COUNTER_HIGH:
+        case CSR_USER_COUNTER_HIGH:
+            return uint32_t(Counter(engine, csr & 0x1f) >> 32);
+        case CSR_EVENT_SELECT:
+            return events[csr & 0x1f];
+        case CSR_SATP:
+            return engine.MMU().Satp();
+        case CSR_MSTATUS:
+            return mstatus | MSTATUS_MPP;
+        case CSR_MIE:
+            return mie;
+        case CSR_MIP:
+            return clint.Pending(engine.Cycles());
+        case CSR_MTVEC:
+            return mtvec;
+        case CSR_MSCRATCH:
+            return mscratch;
+        case CSR_MEPC:
+            return mepc;
+        case CSR_MCAUSE:
+            return mcause;
+        case CSR_MTIMECMP:
+            return uint32_t(clint.TimeCompare());
+        case CSR_MTIMECMPH:
+            return uint32_t(clint.TimeCompare() >> 32);
+        case CSR_MSIP:
+            return clint.Software();
+        default:
+            return 0;
+        }
+    }
+
+    void Write(Engine& engine, CsrKind kind, uint32_t csr, uint32_t value)
+    {
+        uint32_t n       = csr & 0x1f;
+        uint64_t counter = Counter(engine, n);
+        uint64_t compare = clint.TimeCompare();
+        switch (kind)
+        {
+        case CSR_COUNTER:
+            offsets[n] += ((counter & ~uint64_t(0xffffffff)) | value) - counter - (n == 2);
+            break;
+        case CSR_COUNTER_HIGH:
+            offsets[n] += ((uint64_t(value) << 32) | (counter & 0xffffffff)) - counter - (n == 2);
+            break;
+        case CSR_EVENT_SELECT:
+            // keep the value the counter had under its old event
+            offsets[n] = counter - Count(engine, value, n);
+            events[n]  = value;
+            break;
+        case CSR_SATP:
+            engine.MMU().SetSatp(value);
+            break;
+        case CSR_MSTATUS:
+            mstatus = value & (MSTATUS_MIE | MSTATUS_MPIE);
+            break;
+        case CSR_MIE:
+            mie = value & (MIP_MSIP | MIP_MTIP);
+            break;
+        case CSR_MTVEC:
+            mtvec = value & ~3u;
+            break;
+        case CSR_MSCRATCH:
+            mscratch = value;
+            break;
+        case CSR_MEPC:
+            mepc = value & ~1u;
+            break;
+        case CSR_MCAUSE:
+            mcause = value;
+            break;
+        case CSR_MTIMECMP:
+            clint.SetTimeCompare((compare & ~uint64_t(0xffffffff)) | value);
+            break;
+        case CSR_MTIMECMPH:
+            clint.SetTimeCompare((uint64_t(value) << 32) | (compare & 0xffffffff));
+            break;
+        case CSR_MSIP:
+            clint.SetSoftware(value & 1);
+            break;
+        default:
+            break; // mip: MSIP and MTIP come from the CLINT
+        }
+    }
+
+private:
+    uint64_t offsets[32]; // written value - engine count
+    uint32_t events[32];  // mhpmevent
+
+    uint32_t mstatus;
+    uint32_t mie;
+    uint32_t mtvec;
+    uint32_t mscratch;
+    uint32_t mepc;
+    uint32_t mcause;
+
+    bool     armed; // Interrupt() has to look even before the next event
+    uint64_t idle;
+};
+
+#endif // _CSR_H_
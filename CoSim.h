@@ -0,0 +1,995 @@
+#ifndef _CO_SIM_H_
+#define _CO_SIM_H_ 1
+
+#include <iostream>
+#include <sstream>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Engine.h"
+#include "MMU.h"
+
+/**
+    Lockstep co-simulation: a timing engine reports every instruction it retires
+    (pc, rd value, memory word written) into a lock-free queue, and a checker
+    thread replays the same program on ReferenceISS and compares each record.
+
+    The reference decodes the instruction words by itself (RV32IMAC, following the
+    specification, not the engines' ControlUnit, Immediate or RVC expansion), so a
+    decode, forwarding or immediate bug shows up as the first record that differs.
+
+    Trap handlers run on the engine: after a handled trap the engine sends its
+    registers, DataMemory and resume pc and the reference takes them over, so
+    what a handler (the syscall proxy, say) wrote is mirrored.
+*/
+
+// One event of the engine under test, in retirement order
+struct RetireRecord
+{
+    enum Kind : uint32_t
+    {
+        RETIRE,   // instruction completed
+        TRAP,     // instruction trapped: rd = cause
+        REGISTER, // after a handled trap: x[rd] = value
+        MEMORY,   // after a handled trap: memory[address] = word, rd = 1 if read-only
+        RESUME,   // after a handled trap: continue at pc, value = satp
+        STOP,     // engine stopped: rd = status, value = exit code
+    };
+
+    uint32_t kind;
+    uint32_t pc;
+    uint32_t rd;      // 0 = no register written
+    uint32_t value;
+    uint32_t memory;  // 1 = wrote the word at address (stores and AMOs)
+    uint32_t address;
+    uint32_t word;    // memory[address] after the instruction
+};
+
+// Single-producer, single-consumer ring; the producer waits while it is full
+template<class T, size_t CAPACITY>
+class SpscQueue
+{
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+public:
+    SpscQueue():
+        head      (0),
+        tail_cache(0),
+        tail      (0),
+        head_cache(0),
+        items     (CAPACITY)
+    {}
+
+    void Push(const T& item)
+    {
+        size_t position = tail.load(std::memory_order_relaxed);
+        for (size_t spins = 0; position - head_cache == CAPACITY; ++spins)
+        {
+            head_cache = head.load(std::memory_order_acquire);
+            if (position - head_cache == CAPACITY)
+                Backoff(spins);
+        }
+
+        items[position & (CAPACITY - 1)] = item;
+        tail.store(position + 1, std::memory_order_release);
+    }
+
+    bool Pop(T& item)
+    {
+        size_t position = head.load(std::memory_order_relaxed);
+        if (position == tail_cache)
+        {
+            tail_cache = tail.load(std::memory_order_acquire);
+            if (position == tail_cache)
+                return false;
+        }
+
+        item = items[position & (CAPACITY - 1)];
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Waiting side: spin briefly, then sleep so a shared core goes to the other side
+    static void Backoff(size_t spins)
+    {
+        if (spins < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+private:
+    // consumer side
+    alignas(64) std::atomic<size_t> head;
+    size_t                          tail_cache;
+
+    // producer side
+    alignas(64) std::atomic<size_t> tail;
+    size_t                          head_cache;
+
+    std::vector<T> items;
+};
+
+// Instruction-level reference simulator, one instruction per Step()
+class ReferenceISS
+{
+public:
+    // What one instruction did
+    struct Effect
+    {
+        bool     trap;
+        uint32_t cause;
+        uint32_t rd; // 0 = none
+        uint32_t value;
+        bool     memory;
+        uint32_t address;
+        uint32_t word;
+    };
+
+public:
+    ReferenceISS(const uint32_t* program, size_t size, const uint32_t* memory, size_t memory_size):
+        pc         (0),
+        regs       {},
+        program    (program, program + size),
+        memory     (memory, memory + memory_size),
+        satp       (0),
+        reserved   (false),
+        reservation(0),
+        reserved_value(0)
+    {}
+
+    Effect Step()
+    {
+        Effect   effect = {};
+        uint32_t instruction, length, cause;
+
+        if (!Fetch(pc, instruction, length, cause))
+            return Trap(effect, cause);
+
+        uint32_t opcode      = instruction & 0x7f;
+        uint32_t rd          = (instruction >> 7) & 0x1f;
+        uint32_t funct3      = (instruction >> 12) & 0x7;
+        uint32_t funct7      = instruction >> 25;
+        uint32_t a           = regs[(instruction >> 15) & 0x1f];
+        uint32_t b           = regs[(instruction >> 20) & 0x1f];
+        uint32_t next        = pc + length;
+        uint32_t result      = 0;
+        bool     writes      = true;
+
+        switch (opcode)
+        {
+        case 0x37: // LUI
+            result = ImmU(instruction);
+            break;
+        case 0x17: // AUIPC
+            result = pc + ImmU(instruction);
+            break;
+        case 0x6f: // JAL
+            result = pc + length;
+            next   = pc + ImmJ(instruction);
+            break;
+        case 0x67: // JALR
+            if (funct3 != 0)
+                return Trap(effect, CAUSE_ILLEGAL_INSTRUCTION);
+            result = pc + length;
+            next   = (a + ImmI(instruction)) & ~1u;
+            break;
+        case 0x63: // BEQ BNE - - BLT BGE BLTU BGEU
+        {
+            bool taken;
+            switch (funct3)
+            {
+            case 0: taken = a == b; break;
+            case 1: taken = a != b; break;
+            case 4: taken = int32_t(a) <  int32_t(b); break;
+            case 5: taken = int32_t(a) >= int32_t(b); break;
+            case 6: taken = a <  b; break;
+            case 7: taken = a >= b; break;
+            default:
+                return Trap(effect, CAUSE_ILLEGAL_INSTRUCTION);
+            }
+            if (taken)
+                next = pc + ImmB(instruction);
+            writes = false;
+            break;
+        }
+        case 0x03: // LB LH LW - LBU LHU
+        {
+            uint32_t address = a + ImmI(instruction);
+            if (funct3 == 3 || funct3 > 5)
+                return Trap(effect, CAUSE_ILLEGAL_INSTRUCTION);
+            if (!Physical(address, LOAD, cause))
+                return Trap(effect, cause);
+            if (address >= memory.size())
+                return Trap(effect, CAUSE_LOAD_ACCESS);
+
+            uint32_t word = memory[address]; // one word per address, narrow accesses use its low bits
+            switch (funct3)
+            {
+            case 0: result = uint32_t(int32_t(int8_t(word)));  break;
+            case 1: result = uint32_t(int32_t(int16_t(word))); break;
+            case 2: result = word;                             break;
+            case 4: result = word & 0xff;                      break;
+            case 5: result = word & 0xffff;                    break;
+            }
+            break;
+        }
+        case 0x23: // SB SH SW
+        {
+            uint32_t address = a + ImmS(instruction);
+            if (funct3 > 2)
+                return Trap(effect, CAUSE_ILLEGAL_INSTRUCTION);
+            if (!Physical(address, STORE, cause))
+                return Trap(effect, cause);
+            if (address >= memory.size() || !Writable(address))
+                return Trap(effect, CAUSE_STORE_ACCESS);
+
+            uint32_t mask = funct3 == 0 ? 0xff : funct3 == 1 ? 0xffff : 0xffffffff;
+            memory[address] = (memory[address] & ~mask) | (b & mask);
+            Wrote(effect, address);
+            writes = false;
+            break;
+        }
+        case 0x13: // OP-IMM
+        {
+            uint32_t shamt = ImmI(instruction) & 0x1f;
+            if ((funct3 == 1 && funct7 != 0) || (funct3 == 5 && funct7 != 0 && funct7 != 0x20))
+                return Trap(effect, CAUSE_ILLEGAL_INSTRUCTION);
+            switch (funct3)
+            {
+            case 0: result = a + ImmI(instruction);                               break;
+            case 1: result = a << shamt;                                          break;
+            case 2: result = int32_t(a) < int32_t(ImmI(instruction));             break;
+            case 3: result = a < ImmI(instruction);                               break;
+            case 4: result = a ^ ImmI(instruction);                               break;
+            case 5: result = funct7 ? uint32_t(int32_t(a) >> shamt) : a >> shamt; break;
+            case 6: result = a | ImmI(instruction);                               break;
+            case 7: result = a & ImmI(instruction);                               break;
+            }
+            break;
+        }
+        case 0x33: // OP, M extension
+            if (funct7 == 1)
+            {
+                result = MulDiv(funct3, a, b);
+                break;
+            }
+            if (funct7 != 0 && !(funct7 == 0x20 && (funct3 == 0 || funct3 == 5)))
+                return Trap(effect, CAUSE_ILLEGAL_INSTRUCTION);
+            switch (funct3)
+            {
+            case 0: result = funct7 ? a - b : a + b;                                       break;
+            case 1: result = a << (b & 0x1f);                                              break;
+            case 2: result = int32_t(a) < int32_t(b);                                      break;
+            case 3: result = a < b;                                                        break;
+            case 4: result = a ^ b;                                                        break;
+            case 5: result = funct7 ? uint32_t(int32_t(a) >> (b & 0x1f)) : a >> (b & 0x1f); break;
+            case 6: result = a | b;                                                        break;
+            case 7: result = a & b;                                                        break;
+            }
+            break;
+        case 0x0f: // FENCE, FENCE.I
+            writes = false;
+            break;
+        case 0x73: // ECALL, EBREAK, SFENCE.VMA, MRET, WFI, CSR*
+            if ((funct3 != 0 && funct3 != 4) || instruction == 0x30200073 || instruction == 0x10500073)
+                return Trap(effect, CAUSE_CSR); // the engine executes it and sends its registers
+            if (instruction == 0x00000073)
+                return Trap(effect, CAUSE_ECALL);
+            if (instruction == 0x00100073)
+                return Trap(effect, CAUSE_BREAKPOINT);
+            if ((instruction & 0xfe007fff) == 0x12000073)
+                return Trap(effect, CAUSE_SFENCE_VMA);
+            return Trap(effect, CAUSE_ILLEGAL_INSTRUCTION);
+        case 0x2f: // A extension
+        {
+            uint32_t funct5 = funct7 >> 2;
+            if (funct3 != 2 || !Atomic(funct5, 0, 0, result, true) || (funct5 == 0x02 && ((instruction >> 20) & 0x1f) != 0))
+                return Trap(effect, CAUSE_ILLEGAL_INSTRUCTION);
+            if (!Physical(a, STORE, cause))
+                return Trap(effect, cause);
+            if (a >= memory.size() || !Writable(a))
+                return Trap(effect, CAUSE_STORE_ACCESS);
+
+            Atomic(funct5, a, b, result, false);
+            Wrote(effect, a);
+            break;
+        }
+        default:
+            return Trap(effect, CAUSE_ILLEGAL_INSTRUCTION);
+        }
+
+        if (writes && rd != 0)
+        {
+            regs[rd]     = result;
+            effect.rd    = rd;
+            effect.value = result;
+        }
+        pc = next;
+        return effect;
+    }
+
+    // The instruction at `pc` (16-bit aligned, a compressed one expanded) and its length
+    bool Fetch(uint32_t pc, uint32_t& instruction, uint32_t& length, uint32_t& cause) const
+    {
+        uint64_t low, high;
+        if ((pc & 0x1) != 0)
+        {
+            cause = CAUSE_FETCH_MISALIGNED;
+            return false;
+        }
+        if (!FetchAddress(pc, low, cause))
+            return false;
+
+        if ((Halfword(low) & 0x3) != 0x3)
+        {
+            instruction = Expand(Halfword(low));
+            length      = 2;
+            return true;
+        }
+        if (!FetchAddress(pc + 2, high, cause))
+            return false;
+
+        instruction = Halfword(low) | (Halfword(high) << 16);
+        length      = 4;
+        return true;
+    }
+
+    static std::string Disassemble(uint32_t instruction)
+    {
+        static const char* ABI[32] = {
+            "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+            "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+        };
+        static const char* BRANCH[8] = {"beq", "bne", "?", "?", "blt", "bge", "bltu", "bgeu"};
+        static const char* LOAD  [8] = {"lb", "lh", "lw", "?", "lbu", "lhu", "?", "?"};
+        static const char* STORE [8] = {"sb", "sh", "sw", "?", "?", "?", "?", "?"};
+        static const char* OPIMM [8] = {"addi", "slli", "slti", "sltiu", "xori", "srli", "ori", "andi"};
+        static const char* OP    [8] = {"add", "sll", "slt", "sltu", "xor", "srl", "or", "and"};
+        static const char* MULDIV[8] = {"mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu"};
+
+        uint32_t opcode = instruction & 0x7f;
+        uint32_t funct3 = (instruction >> 12) & 0x7;
+        uint32_t funct7 = instruction >> 25;
+        const char* rd  = ABI[(instruction >> 7) & 0x1f];
+        const char* rs1 = ABI[(instruction >> 15) & 0x1f];
+        const char* rs2 = ABI[(instruction >> 20) & 0x1f];
+
+        std::ostringstream out;
+        switch (opcode)
+        {
+        case 0x37:
+            out << "lui " << rd << ", 0x" << std::hex << (instruction >> 12);
+            break;
+        case 0x17:
+            out << "auipc " << rd << ", 0x" << std::hex << (instruction >> 12);
+            break;
+        case 0x6f:
+            out << "jal " << rd << ", " << int32_t(ImmJ(instruction));
+            break;
+        case 0x67:
+            out << "jalr " << rd << ", " << int32_t(ImmI(instruction)) << '(' << rs1 << ')';
+            break;
+        case 0x63:
+            out << BRANCH[funct3] << ' ' << rs1 << ", " << rs2 << ", " << int32_t(ImmB(instruction));
+            break;
+        case 0x03:
+            out << LOAD[funct3] << ' ' << rd << ", " << int32_t(ImmI(instruction)) << '(' << rs1 << ')';
+            break;
+        case 0x23:
+            out << STORE[funct3] << ' ' << rs2 << ", " << int32_t(ImmS(instruction)) << '(' << rs1 << ')';
+            break;
+        case 0x13:
+            if (funct3 == 1 || funct3 == 5)
+                out << (funct3 == 5 && funct7 == 0x20 ? "srai" : OPIMM[funct3]) << ' ' << rd << ", " << rs1 << ", " << (ImmI(instruction) & 0x1f);
+            else
+                out << OPIMM[funct3] << ' ' << rd << ", " << rs1 << ", " << int32_t(ImmI(instruction));
+            break;
+        case 0x33:
+            if (funct7 == 1)
+                out << MULDIV[funct3];
+            else if (funct7 == 0x20)
+                out << (funct3 == 0 ? "sub" : "sra");
+            else
+                out << OP[funct3];
+            out << ' ' << rd << ", " << rs1 << ", " << rs2;
+            break;
+        case 0x0f:
+            out << "fence";
+            break;
+        case 0x73:
+            if (funct3 != 0 && funct3 != 4)
+            {
+                static const char* CSR[8] = {"?", "csrrw", "csrrs", "csrrc", "?", "csrrwi", "csrrsi", "csrrci"};
+                out << CSR[funct3] << ' ' << rd << ", 0x" << std::hex << (instruction >> 20) << std::dec << ", ";
+                if (funct3 & 0x4)
+                    out << ((instruction >> 15) & 0x1f);
+                else
+                    out << rs1;
+            }
+            else if (instruction == 0x30200073 || instruction == 0x10500073)
+                out << (instruction == 0x30200073 ? "mret" : "wfi");
+            else
+                out << (instruction == 0x00100073 ? "ebreak" : instruction == 0x00000073 ? "ecall" : "system?");
+            break;
+        case 0x2f:
+        {
+            static const char* AMO[32] = {
+                "amoadd.w", "amoswap.w", "lr.w", "sc.w", "amoxor.w", "?", "?", "?",
+                "amoor.w", "?", "?", "?", "amoand.w", "?", "?", "?",
+                "amomin.w", "?", "?", "?", "amomax.w", "?", "?", "?",
+                "amominu.w", "?", "?", "?", "amomaxu.w", "?", "?", "?",
+            };
+            out << AMO[funct7 >> 2] << ' ' << rd << ", ";
+            if ((funct7 >> 2) != 0x02)
+                out << rs2 << ", ";
+            out << '(' << rs1 << ')';
+            break;
+        }
+        default:
+            out << "unknown";
+            break;
+        }
+        out << "  [0x" << std::hex << instruction << ']';
+        return out.str();
+    }
+
+public:
+    uint32_t pc;
+    uint32_t regs[32];
+
+    std::vector<uint32_t> program;
+    std::vector<uint32_t> memory;
+    std::vector<uint8_t>  readonly; // per GuestMemory page, stores fault
+    uint32_t              satp;     // Sv32 when bit 31 is set (see MMU.h)
+
+private:
+    enum Access
+    {
+        FETCH,
+        LOAD,
+        STORE,
+    };
+
+    // Code byte address of `pc`, checked against the program
+    bool FetchAddress(uint32_t pc, uint64_t& address, uint32_t& cause) const
+    {
+        uint32_t ppn = pc >> 12;
+        if ((satp >> 31) != 0 && !Walk(pc >> 12, FETCH, ppn, cause))
+            return false;
+
+        address = (uint64_t(ppn) << 12) | (pc & 0xfff);
+        if ((address >> 2) >= program.size())
+        {
+            cause = CAUSE_FETCH_ACCESS;
+            return false;
+        }
+        return true;
+    }
+
+    // Replaces the data word `address` by its physical word
+    bool Physical(uint32_t& address, Access access, uint32_t& cause) const
+    {
+        if ((satp >> 31) == 0)
+            return true;
+
+        uint32_t ppn;
+        if (address >= (1u << 30))
+        {
+            cause = access == LOAD ? CAUSE_LOAD_PAGE_FAULT : CAUSE_STORE_PAGE_FAULT;
+            return false;
+        }
+        if (!Walk(address >> 10, access, ppn, cause))
+            return false;
+        address = (ppn << 10) | (address & 0x3ff);
+        return true;
+    }
+
+    // Sv32 table walk, no TLB: A must be set, stores need W and D
+    bool Walk(uint32_t vpn, Access access, uint32_t& ppn, uint32_t& cause) const
+    {
+        static const uint32_t page_fault[]   = {CAUSE_FETCH_PAGE_FAULT, CAUSE_LOAD_PAGE_FAULT, CAUSE_STORE_PAGE_FAULT};
+        static const uint32_t access_fault[] = {CAUSE_FETCH_ACCESS, CAUSE_LOAD_ACCESS, CAUSE_STORE_ACCESS};
+        static const uint32_t needs[]        = {0x08, 0x02, 0x84}; // X, R, W + D
+
+        uint64_t table = uint64_t(satp & 0x3fffff) * 1024;
+        uint32_t pte   = 0;
+        for (int level = 1; ; --level)
+        {
+            uint64_t address = table + (level == 1 ? vpn >> 10 : vpn & 0x3ff);
+            if (address >= memory.size())
+            {
+                cause = access_fault[access];
+                return false;
+            }
+
+            pte = memory[address];
+            if ((pte & 0x1) == 0 || (pte & 0x6) == 0x4)
+                break;
+            if ((pte & 0xa) != 0)
+            {
+                bool misaligned = level == 1 && ((pte >> 10) & 0x3ff) != 0;
+                if ((pte & 0x40) == 0 || (pte & needs[access]) != needs[access] || misaligned)
+                    break;
+                ppn = level == 1 ? (pte >> 10) | (vpn & 0x3ff) : pte >> 10;
+                return true;
+            }
+            if (level == 0)
+                break;
+            table = uint64_t(pte >> 10) * 1024;
+        }
+
+        cause = page_fault[access];
+        return false;
+    }
+
+    bool Writable(uint32_t address) const
+    { return address / GuestMemory::PAGE_WORDS >= readonly.size() || !readonly[address / GuestMemory::PAGE_WORDS]; }
+
+    uint32_t Halfword(uint64_t pc) const
+    { return (program[pc >> 2] >> (8 * (pc & 0x2))) & 0xffff; }
+
+    // RV32C: the 32-bit instruction a compressed parcel stands for, 0 (illegal) if reserved
+    static uint32_t Expand(uint32_t c)
+    {
+        uint32_t r   = (c >> 7) & 0x1f;      // rd / rs1
+        uint32_t r2  = (c >> 2) & 0x1f;      // rs2
+        uint32_t rp  = 8 + ((c >> 7) & 0x7); // rd' / rs1' in bits 9:7
+        uint32_t r2p = 8 + ((c >> 2) & 0x7); // rd' / rs2' in bits 4:2
+        uint32_t b12 = (c >> 12) & 0x1;
+        uint32_t imm = Sext((b12 << 5) | r2, 6);
+        uint32_t lw  = (((c >> 10) & 0x7) << 3) | (((c >> 6) & 0x1) << 2) | (((c >> 5) & 0x1) << 6);
+        uint32_t j   = Sext((b12 << 11) | (((c >> 11) & 0x1) << 4) | (((c >> 9) & 0x3) << 8) | (((c >> 8) & 0x1) << 10) |
+                            (((c >> 7) & 0x1) << 6) | (((c >> 6) & 0x1) << 7) | (((c >> 3) & 0x7) << 1) | (((c >> 2) & 0x1) << 5), 12);
+        uint32_t b   = Sext((b12 << 8) | (((c >> 10) & 0x3) << 3) | (((c >> 5) & 0x3) << 6) | (((c >> 3) & 0x3) << 1) |
+                            (((c >> 2) & 0x1) << 5), 9);
+
+        // quadrant and funct3 as two octal digits
+        switch (((c & 0x3) << 3) | (c >> 13))
+        {
+        case 000: // C.ADDI4SPN
+        {
+            uint32_t u = (((c >> 7) & 0xf) << 6) | (((c >> 11) & 0x3) << 4) | (((c >> 5) & 0x1) << 3) | (((c >> 6) & 0x1) << 2);
+            return u ? EncodeI(u, 2, 0, r2p, 0x13) : 0;
+        }
+        case 002: // C.LW
+            return EncodeI(lw, rp, 2, r2p, 0x03);
+        case 006: // C.SW
+            return EncodeS(lw, r2p, rp, 2);
+        case 010: // C.ADDI
+            return EncodeI(imm, r, 0, r, 0x13);
+        case 011: // C.JAL
+            return EncodeJ(j, 1);
+        case 012: // C.LI
+            return EncodeI(imm, 0, 0, r, 0x13);
+        case 013:
+            if (r == 2)
+            {
+                // C.ADDI16SP
+                uint32_t u = Sext((b12 << 9) | (((c >> 6) & 0x1) << 4) | (((c >> 5) & 0x1) << 6) | (((c >> 3) & 0x3) << 7) |
+                                  (((c >> 2) & 0x1) << 5), 10);
+                return u ? EncodeI(u, 2, 0, 2, 0x13) : 0;
+            }
+            return imm ? (imm << 12) | (r << 7) | 0x37 : 0; // C.LUI
+        case 014:
+            switch ((c >> 10) & 0x3)
+            {
+            case 0: // C.SRLI
+                return b12 ? 0 : EncodeI(r2, rp, 5, rp, 0x13);
+            case 1: // C.SRAI
+                return b12 ? 0 : EncodeI(0x400 | r2, rp, 5, rp, 0x13);
+            case 2: // C.ANDI
+                return EncodeI(imm, rp, 7, rp, 0x13);
+            default:
+            {
+                // C.SUB C.XOR C.OR C.AND
+                static const uint32_t FUNCT3[4] = {0, 4, 6, 7};
+                uint32_t op = (c >> 5) & 0x3;
+                return b12 ? 0 : EncodeR(op == 0 ? 0x20 : 0, r2p, rp, FUNCT3[op], rp);
+            }
+            }
+        case 015: // C.J
+            return EncodeJ(j, 0);
+        case 016: // C.BEQZ
+            return EncodeB(b, 0, rp, 0);
+        case 017: // C.BNEZ
+            return EncodeB(b, 0, rp, 1);
+        case 020: // C.SLLI
+            return b12 ? 0 : EncodeI(r2, r, 1, r, 0x13);
+        case 022: // C.LWSP
+            return r ? EncodeI((b12 << 5) | (((c >> 4) & 0x7) << 2) | (((c >> 2) & 0x3) << 6), 2, 2, r, 0x03) : 0;
+        case 024:
+            if (!b12)
+                return r2 ? EncodeR(0, r2, 0, 0, r) : r ? EncodeI(0, r, 0, 0, 0x67) : 0; // C.MV, C.JR
+            if (r2)
+                return EncodeR(0, r2, r, 0, r); // C.ADD
+            return r ? EncodeI(0, r, 0, 1, 0x67) : 0x00100073; // C.JALR, C.EBREAK
+        case 026: // C.SWSP
+            return EncodeS((((c >> 9) & 0xf) << 2) | (((c >> 7) & 0x3) << 6), r2, 2, 2);
+        default: // F and D loads and stores, reserved
+            return 0;
+        }
+    }
+
+    static uint32_t Sext(uint32_t value, uint32_t bits)
+    { return uint32_t(int32_t(value << (32 - bits)) >> (32 - bits)); }
+
+    static uint32_t EncodeR(uint32_t funct7, uint32_t rs2, uint32_t rs1, uint32_t funct3, uint32_t rd)
+    { return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | 0x33; }
+
+    static uint32_t EncodeI(uint32_t imm, uint32_t rs1, uint32_t funct3, uint32_t rd, uint32_t opcode)
+    { return ((imm & 0xfff) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode; }
+
+    static uint32_t EncodeS(uint32_t imm, uint32_t rs2, uint32_t rs1, uint32_t funct3)
+    { return (((imm >> 5) & 0x7f) << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | ((imm & 0x1f) << 7) | 0x23; }
+
+    static uint32_t EncodeB(uint32_t imm, uint32_t rs2, uint32_t rs1, uint32_t funct3)
+    {
+        return (((imm >> 12) & 0x1) << 31) | (((imm >> 5) & 0x3f) << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) |
+               (((imm >> 1) & 0xf) << 8) | (((imm >> 11) & 0x1) << 7) | 0x63;
+    }
+
+    static uint32_t EncodeJ(uint32_t imm, uint32_t rd)
+    {
+        return (((imm >> 20) & 0x1) << 31) | (((imm >> 1) & 0x3ff) << 21) | (((imm >> 11) & 0x1) << 20) |
+               (((imm >> 12) & 0xff) << 12) | (rd << 7) | 0x6f;
+    }
+
+    static uint32_t ImmI(uint32_t instruction)
+    { return uint32_t(int32_t(instruction) >> 20); }
+
+    static uint32_t ImmS(uint32_t instruction)
+    { return uint32_t((int32_t(instruction) >> 25) << 5) | ((instruction >> 7) & 0x1f); }
+
+    static uint32_t ImmB(uint32_t instruction)
+    {
+        return uint32_t((int32_t(instruction) >> 31) << 12) | (((instruction >> 7) & 0x1) << 11) |
+               (((instruction >> 25) & 0x3f) << 5) | (((instruction >> 8) & 0xf) << 1);
+    }
+
+    static uint32_t ImmU(uint32_t instruction)
+    { return instruction & 0xfffff000; }
+
+    static uint32_t ImmJ(uint32_t instruction)
+    {
+        return uint32_t((int32_t(instruction) >> 31) << 20) | (instruction & 0x000ff000) |
+               (((instruction >> 20) & 0x1) << 11) | (((instruction >> 21) & 0x3ff) << 1);
+    }
+
+    static uint32_t MulDiv(uint32_t funct3, uint32_t a, uint32_t b)
+    {
+        int64_t sa = int32_t(a);
+        int64_t sb = int32_t(b);
+
+        switch (funct3)
+        {
+        case 0: return a * b;
+        case 1: return uint32_t(uint64_t(sa * sb) >> 32);
+        case 2: return uint32_t(uint64_t(sa * int64_t(b)) >> 32);
+        case 3: return uint32_t((uint64_t(a) * b) >> 32);
+        case 4: return b == 0 ? 0xffffffff : uint32_t(sa / sb); // INT_MIN / -1 wraps back to INT_MIN
+        case 5: return b == 0 ? 0xffffffff : a / b;
+        case 6: return b == 0 ? a : uint32_t(sa % sb);
+        default: return b == 0 ? a : a % b;
+        }
+    }
+
+    // Returns false for an unknown funct5; with `check` only validates it
+    bool Atomic(uint32_t funct5, uint32_t address, uint32_t b, uint32_t& result, bool check)
+    {
+        uint32_t  old  = check ? 0 : memory[address];
+        uint32_t  word = old;
+
+        switch (funct5)
+        {
+        case 0x02: // LR
+            if (!check)
+            {
+                reserved       = true;
+                reservation    = address;
+                reserved_value = old;
+            }
+            break;
+        case 0x03: // SC
+        {
+            bool success = reserved && reservation == address && reserved_value == old;
+            if (!check)
+                reserved = false;
+            if (success)
+                word = b;
+            old = success ? 0 : 1;
+            break;
+        }
+        case 0x01: word = b;                                              break;
+        case 0x00: word = old + b;                                        break;
+        case 0x04: word = old ^ b;                                        break;
+        case 0x08: word = old | b;                                        break;
+        case 0x0c: word = old & b;                                        break;
+        case 0x10: word = int32_t(old) < int32_t(b) ? old : b;            break;
+        case 0x14: word = int32_t(old) > int32_t(b) ? old : b;            break;
+        case 0x18: word = old < b ? old : b;                              break;
+        case 0x1c: word = old > b ? old : b;                              break;
+        default:
+            return false;
+        }
+
+        if (!check)
+        {
+            memory[address] = word;
+            result          = old;
+        }
+        return true;
+    }
+
+    Effect& Trap(Effect& effect, uint32_t cause)
+    {
+        effect.trap  = true;
+        effect.cause = cause;
+        return effect;
+    }
+
+    void Wrote(Effect& effect, uint32_t address)
+    {
+        effect.memory  = true;
+        effect.address = address;
+        effect.word    = memory[address];
+    }
+
+private:
+    bool     reserved;
+    uint32_t reservation;
+    uint32_t reserved_value;
+};
+
+// Checker thread fed by an engine; the engine calls Retire()/Trap() as it retires
+class CoSimulator
+{
+public:
+    static constexpr size_t QUEUE_SIZE = 1 << 14;
+    static constexpr size_t HISTORY    = 8; // records shown before a divergence
+
+public:
+    // Snapshot of `engine` before it ran; program = the instruction words at address 0
+    CoSimulator(const uint32_t* program, size_t size, const Engine& engine):
+        reference(program, size, engine.Memory(), engine.MemorySize()),
+        checked  (0),
+        diverged (false)
+    {
+        for (size_t i = 1; i < 32; ++i)
+            reference.regs[i] = engine.Register(i);
+        reference.readonly = engine.Guest().ReadOnlyPages();
+        reference.satp     = engine.MMU().Satp();
+
+        checker = std::thread(&CoSimulator::Check, this);
+    }
+
+    ~CoSimulator()
+    {
+        if (checker.joinable())
+        {
+            queue.Push({RetireRecord::STOP, 0, ERROR, 0, 0, 0, 0});
+            checker.join();
+        }
+    }
+
+    CoSimulator(const CoSimulator&) = delete;
+    CoSimulator& operator=(const CoSimulator&) = delete;
+
+    // Producer side (the engine's thread)
+
+    void Retire(uint32_t pc, uint32_t rd, uint32_t value, bool memory, uint32_t address, uint32_t word)
+    { queue.Push({RetireRecord::RETIRE, pc, rd, value, memory, address, word}); }
+
+    // After HandleTrap(): `trap` is the state it was called with
+    void Trap(const MachineState& trap, const Engine& engine)
+    {
+        queue.Push({RetireRecord::TRAP, trap.pc, trap.cause, 0, 0, 0, 0});
+        if (engine.Status().status != RUNNING)
+            return;
+
+        for (uint32_t i = 1; i < 32; ++i)
+            queue.Push({RetireRecord::REGISTER, 0, i, engine.Register(i), 0, 0, 0});
+        // CSR instructions, SFENCE.VMA and interrupts leave memory alone
+        const GuestMemory& memory = engine.Guest();
+        bool               same   = trap.cause == CAUSE_CSR || trap.cause == CAUSE_SFENCE_VMA || IsInterrupt(trap.cause);
+        for (uint32_t address = 0; !same && address < memory.size(); ++address)
+            queue.Push({RetireRecord::MEMORY, 0, !memory.Writable(address), 0, 1, address, memory[address]});
+        queue.Push({RetireRecord::RESUME, engine.Status().pc, 0, engine.MMU().Satp(), 0, 0, 0});
+    }
+
+    // The engine polls this and stops once the checker found a difference
+    bool Diverged() const
+    { return diverged.load(std::memory_order_relaxed); }
+
+    // Sends the final state and waits for the checker; true if nothing differed
+    bool Finish(const Engine& engine)
+    {
+        if (checker.joinable())
+        {
+            const MachineState& state = engine.Status();
+            queue.Push({RetireRecord::STOP, state.pc, uint32_t(state.status), state.exit_code, 0, 0, 0});
+            checker.join();
+        }
+        return !diverged;
+    }
+
+    void PrintReport(std::ostream& out) const
+    {
+        if (diverged)
+            out << diagnosis;
+        else
+            out << "co-simulation: " << checked << " instructions match the reference" << std::endl;
+    }
+
+private:
+    void Check()
+    {
+        RetireRecord record;
+        for (size_t spins = 0;; )
+        {
+            if (!queue.Pop(record))
+            {
+                queue.Backoff(spins++);
+                continue;
+            }
+            spins = 0;
+
+            if (record.kind == RetireRecord::STOP)
+            {
+                if (!diverged && record.rd != ERROR)
+                    CheckStop(record);
+                break;
+            }
+
+            // keeps draining so the engine never blocks on a full queue
+            if (!diverged)
+                CheckRecord(record);
+        }
+    }
+
+    void CheckRecord(const RetireRecord& record)
+    {
+        switch (record.kind)
+        {
+        case RetireRecord::REGISTER:
+            reference.regs[record.rd] = record.value;
+            return;
+        case RetireRecord::MEMORY:
+        {
+            // a handler may have mapped more memory
+            size_t page = record.address / GuestMemory::PAGE_WORDS;
+            if (record.address >= reference.memory.size())
+                reference.memory.resize(record.address + 1);
+            if (page >= reference.readonly.size())
+                reference.readonly.resize(page + 1);
+            reference.memory[record.address] = record.word;
+            reference.readonly[page]         = record.rd;
+            return;
+        }
+        case RetireRecord::RESUME:
+            reference.pc   = record.pc;
+            reference.satp = record.value;
+            return;
+        case RetireRecord::TRAP:
+            // an interrupt comes from outside the instruction stream, the RESUME moves the reference
+            if (IsInterrupt(record.rd))
+                return;
+            break;
+        default:
+            break;
+        }
+
+        uint32_t                    pc     = reference.pc;
+        uint32_t                    a0     = reference.regs[10];
+        uint32_t                    a7     = reference.regs[17];
+        const ReferenceISS::Effect  effect = reference.Step();
+
+        last_trap = effect.trap ? effect.cause : UINT32_MAX;
+        last_a0   = a0;
+        last_a7   = a7;
+
+        bool trapped  = record.kind == RetireRecord::TRAP;
+        bool same_reg = record.rd == effect.rd && record.value == effect.value;
+        bool same_mem = bool(record.memory) == effect.memory &&
+                        (!effect.memory || (record.address == effect.address && record.word == effect.word));
+
+        if (record.pc == pc && trapped == effect.trap && (trapped ? record.rd == effect.cause : same_reg && same_mem))
+        {
+            history[checked % HISTORY] = pc;
+            ++checked;
+            return;
+        }
+
+        // the slow path only runs once
+        std::ostringstream out;
+        if (record.pc != pc)
+            out << "  engine retired pc = " << record.pc << ", reference pc = " << pc << '\n';
+        else if (record.kind == RetireRecord::TRAP && !effect.trap)
+            out << "  engine trapped: " << MachineState::CauseName(record.rd) << ", reference did not\n";
+        else if (record.kind == RetireRecord::RETIRE && effect.trap)
+            out << "  reference trapped: " << MachineState::CauseName(effect.cause) << ", engine did not\n";
+        else if (record.kind == RetireRecord::TRAP && record.rd != effect.cause)
+            out << "  engine trapped: " << MachineState::CauseName(record.rd) << ", reference: " << MachineState::CauseName(effect.cause) << '\n';
+        else
+        {
+            if (!same_reg)
+                out << "  engine wrote " << Register(record.rd, record.value) << ", reference " << Register(effect.rd, effect.value) << '\n';
+            if (!same_mem)
+                out << "  engine wrote " << Word(record.memory, record.address, record.word) << ", reference " << Word(effect.memory, effect.address, effect.word) << '\n';
+        }
+
+        Diverge(pc, out.str());
+    }
+
+    // A halt has to follow EBREAK or the exit ECALL, with the reference's a0
+    void CheckStop(const RetireRecord& record)
+    {
+        if (record.rd != HALTED)
+            return;
+
+        bool halts = last_trap == CAUSE_BREAKPOINT || (last_trap == CAUSE_ECALL && IsExitCall(last_a7));
+        if (!halts || (last_a0 & 0xff) != (record.value & 0xff))
+        {
+            std::ostringstream out;
+            out << "  engine halted with exit code " << record.value << ", reference "
+                << (halts ? "exit code " + std::to_string(last_a0) : std::string("did not halt")) << '\n';
+            Diverge(reference.pc, out.str());
+        }
+    }
+
+    void Diverge(uint32_t pc, const std::string& difference)
+    {
+        std::ostringstream out;
+        out << "co-simulation: divergence at instruction " << checked << ", pc = " << pc;
+        uint32_t instruction = 0, length, cause;
+        if (reference.Fetch(pc, instruction, length, cause))
+            out << ": " << ReferenceISS::Disassemble(instruction);
+        out << '\n' << difference;
+
+        size_t first = checked > HISTORY ? checked - HISTORY : 0;
+        if (first < checked)
+            out << "  last retired:\n";
+        for (size_t n = first; n < checked; ++n)
+        {
+            uint32_t at = history[n % HISTORY];
+            reference.Fetch(at, instruction, length, cause);
+            out << "    #" << n << " pc = " << at << ": " << ReferenceISS::Disassemble(instruction) << '\n';
+        }
+
+        out << "  reference registers:";
+        for (size_t i = 1; i < 32; ++i)
+            out << (i % 8 == 1 ? "\n   " : "") << " x" << i << '=' << reference.regs[i];
+        out << '\n';
+
+        diagnosis = out.str();
+        diverged.store(true, std::memory_order_relaxed);
+    }
+
+    static std::string Register(uint32_t rd, uint32_t value)
+    { return rd == 0 ? std::string("no register") : "x" + std::to_string(rd) + " = " + std::to_string(value); }
+
+    static std::string Word(bool memory, uint32_t address, uint32_t word)
+    { return !memory ? std::string("no memory") : "mem[" + std::to_string(address) + "] = " + std::to_string(word); }
+
+private:
+    SpscQueue<RetireRecord, QUEUE_SIZE> queue;
+    ReferenceISS                        reference;
+    std::thread                         checker;
+
+    // checker thread only
+    size_t      checked;
+    uint32_t    history[HISTORY] = {};
+    uint32_t    last_trap = UINT32_MAX;
+    uint32_t    last_a0   = 0;
+    uint32_t    last_a7   = 0;
+    std::string diagnosis;
+
+    std::atomic<bool> diverged;
+};
+
+#endif // _CO_SIM_H_
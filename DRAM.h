@@ -0,0 +1,331 @@
+#ifndef _DRAM_H_
+#define _DRAM_H_ 1
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+struct DRAMConfig
+{
+    size_t channels  = 1;
+    size_t banks     = 8;    // banks per channel
+    size_t row_size  = 2048; // bytes per row
+    bool   open_page = true; // row-buffer policy (false = closed page, auto-precharge)
+
+    // all timings are in core cycles
+    size_t tRCD   = 14;   // ACT -> RD/WR
+    size_t tCL    = 14;   // RD/WR -> first data
+    size_t tRP    = 14;   // PRE -> ACT
+    size_t tBURST = 4;    // data transfer on the channel bus
+    size_t tREFI  = 7800; // refresh interval
+    size_t tRFC   = 350;  // refresh cycle time
+
+    size_t queue_depth = 16; // requests per channel
+};
+
+/**
+    Event-driven DRAM controller.
+
+    Nothing is simulated per cycle: the controller only makes a scheduling
+    decision when a request arrives or when the requester waits for one, and
+    jumps straight to the next time a bank can accept a command.
+    Missed refreshes are accounted for analytically.
+
+    Scheduling is FR-FCFS: among the requests whose bank is ready, row hits
+    go first, then the oldest request.
+*/
+class DRAMController
+{
+public:
+    struct Statistics
+    {
+        size_t reads         = 0;
+        size_t writes        = 0;
+        size_t row_hits      = 0;
+        size_t row_misses    = 0; // bank was precharged
+        size_t row_conflicts = 0; // bank conflict: another row was open
+        size_t refreshes     = 0;
+        size_t read_latency  = 0; // sum over reads (arrival -> data)
+        size_t write_latency = 0; // sum over writes (arrival -> data)
+        size_t max_latency   = 0;
+    };
+
+private:
+    static constexpr int64_t NO_ROW = -1;
+
+    struct Request
+    {
+        size_t   id;
+        uint32_t address;
+        size_t   bank;
+        int64_t  row;
+        bool     write;
+        size_t   arrival;
+    };
+
+    struct Bank
+    {
+        int64_t open_row = NO_ROW;
+        size_t  ready    = 0; // cycle when the bank accepts the next command
+    };
+
+    struct Channel
+    {
+        std::vector<Bank>    banks;
+        std::vector<Request> queue;
+        size_t bus_free     = 0; // cycle when the data bus is free
+        size_t cursor       = 0; // time of the last scheduling decision
+        size_t next_refresh = 0;
+    };
+
+public:
+    DRAMController(const DRAMConfig& config = DRAMConfig()):
+        config  (config),
+        channels(config.channels),
+        stats   (),
+        next_id (0),
+        last_id (0),
+        last_done(0)
+    {
+        if (config.channels == 0 || config.banks == 0 || config.row_size == 0 || config.queue_depth == 0 ||
+            config.tREFI == 0 || config.tRFC >= config.tREFI)
+            throw "bad DRAM config";
+
+        for (Channel& channel : channels)
+        {
+            channel.banks.resize(config.banks);
+            channel.next_refresh = config.tREFI;
+        }
+    }
+
+public:
+    // Blocking read: returns the cycle when the data is available
+    size_t Read(uint32_t address, size_t now)
+    {
+        Channel& channel = channels[ChannelOf(address)];
+        size_t   id      = Enqueue(channel, address, false, now);
+
+        while (last_id != id)
+            Schedule(channel, SIZE_MAX, true);
+        return last_done;
+    }
+
+    // Posted write: returns the cycle when the requester may continue,
+    // which is `now` unless the channel queue is full
+    size_t Write(uint32_t address, size_t now)
+    {
+        Channel& channel = channels[ChannelOf(address)];
+        Enqueue(channel, address, true, now);
+
+        size_t ready = now;
+        while (channel.queue.size() > config.queue_depth)
+        {
+            Schedule(channel, SIZE_MAX, true);
+            if (channel.cursor > ready)
+                ready = channel.cursor;
+        }
+        return ready;
+    }
+
+    // Issues everything still queued (posted writes)
+    void Drain()
+    {
+        for (Channel& channel : channels)
+            while (!channel.queue.empty())
+                Schedule(channel, SIZE_MAX, true);
+    }
+
+    const Statistics& GetStatistics() const
+    { return stats; }
+
+    void PrintStatistics(std::ostream& out) const
+    {
+        size_t accesses = stats.row_hits + stats.row_misses + stats.row_conflicts;
+        size_t requests = stats.reads + stats.writes;
+
+        out << "DRAM: " << config.channels << " channel(s), " << config.banks << " banks, "
+            << (config.open_page ? "open" : "closed") << " page\n";
+        out << "DRAM reads          = " << stats.reads  << '\n';
+        out << "DRAM writes         = " << stats.writes << '\n';
+        out << "DRAM row hits       = " << stats.row_hits      << " (" << Percent(stats.row_hits, accesses) << "%)\n";
+        out << "DRAM row misses     = " << stats.row_misses    << '\n';
+        out << "DRAM bank conflicts = " << stats.row_conflicts << '\n';
+        out << "DRAM refreshes      = " << stats.refreshes     << '\n';
+        out << "DRAM avg read lat.  = " << Average(stats.read_latency, stats.reads) << '\n';
+        out << "DRAM avg latency    = " << Average(stats.read_latency + stats.write_latency, requests) << '\n';
+        out << "DRAM max latency    = " << stats.max_latency << std::endl;
+    }
+
+private:
+    static double Percent(size_t part, size_t total)
+    { return total ? 100.0 * part / total : 0.0; }
+    static double Average(size_t sum, size_t count)
+    { return count ? double(sum) / count : 0.0; }
+
+    // address = row : bank : channel : column
+    size_t ChannelOf(uint32_t address) const
+    { return (address / config.row_size) % config.channels; }
+    size_t BankOf(uint32_t address) const
+    { return (address / config.row_size / config.channels) % config.banks; }
+    int64_t RowOf(uint32_t address) const
+    { return address / config.row_size / config.channels / config.banks; }
+
+    size_t Enqueue(Channel& channel, uint32_t address, bool write, size_t now)
+    {
+        // everything that could have been issued before `now` is issued first
+        Schedule(channel, now, false);
+
+        Request request;
+        request.id      = ++next_id;
+        request.address = address;
+        request.bank    = BankOf(address);
+        request.row     = RowOf(address);
+        request.write   = write;
+        request.arrival = now;
+        channel.queue.push_back(request);
+
+        if (write)
+            ++stats.writes;
+        else
+            ++stats.reads;
+        return request.id;
+    }
+
+    void Refresh(Channel& channel, size_t time)
+    {
+        // refreshes whose window passed completely while the channel was idle
+        if (channel.next_refresh + config.tREFI <= time)
+        {
+            size_t skipped = (time - channel.next_refresh) / config.tREFI;
+            stats.refreshes      += skipped;
+            channel.next_refresh += skipped * config.tREFI;
+        }
+
+        size_t start = channel.next_refresh;
+        for (Bank& bank : channel.banks)
+            if (bank.ready > start)
+                start = bank.ready;
+
+        for (Bank& bank : channel.banks)
+        {
+            bank.open_row = NO_ROW;
+            bank.ready    = start + config.tRFC;
+        }
+
+        channel.next_refresh += config.tREFI;
+        ++stats.refreshes;
+    }
+
+    // Makes scheduling decisions up to `until`. With `once` set, returns
+    // after the first issued request.
+    void Schedule(Channel& channel, size_t until, bool once)
+    {
+        while (!channel.queue.empty())
+        {
+            // next decision point: earliest time any queued request may issue
+            size_t time = SIZE_MAX;
+            for (const Request& request : channel.queue)
+            {
+                size_t start = std::max(request.arrival, channel.banks[request.bank].ready);
+                if (start < time)
+                    time = start;
+            }
+            time = std::max(time, channel.cursor);
+
+            if (time > until)
+                return;
+
+            if (channel.next_refresh <= time)
+            {
+                Refresh(channel, time);
+                continue;
+            }
+
+            // FR-FCFS: oldest row hit, otherwise oldest ready request
+            size_t pick = SIZE_MAX;
+            for (size_t i = 0; i < channel.queue.size(); ++i)
+            {
+                const Request& request = channel.queue[i];
+                const Bank&    bank    = channel.banks[request.bank];
+                if (std::max(request.arrival, bank.ready) > time)
+                    continue;
+
+                if (bank.open_row == request.row)
+                {
+                    pick = i;
+                    break;
+                }
+                if (pick == SIZE_MAX)
+                    pick = i;
+            }
+
+            Issue(channel, channel.queue[pick], time);
+            channel.queue.erase(channel.queue.begin() + pick);
+            channel.cursor = time;
+
+            if (once)
+                return;
+        }
+    }
+
+    void Issue(Channel& channel, const Request& request, size_t time)
+    {
+        Bank&  bank = channel.banks[request.bank];
+        size_t latency;
+
+        if (bank.open_row == request.row)
+        {
+            latency = config.tCL;
+            ++stats.row_hits;
+        }
+        else if (bank.open_row == NO_ROW)
+        {
+            latency = config.tRCD + config.tCL;
+            ++stats.row_misses;
+        }
+        else
+        {
+            latency = config.tRP + config.tRCD + config.tCL;
+            ++stats.row_conflicts;
+        }
+
+        size_t data = std::max(time + latency, channel.bus_free);
+        size_t done = data + config.tBURST;
+        channel.bus_free = done;
+
+        if (config.open_page)
+        {
+            bank.open_row = request.row;
+            bank.ready    = time + latency - config.tCL + config.tBURST;
+        }
+        else
+        {
+            bank.open_row = NO_ROW;
+            bank.ready    = done + config.tRP;
+        }
+
+        size_t total = done - request.arrival;
+        if (request.write)
+            stats.write_latency += total;
+        else
+            stats.read_latency  += total;
+        if (total > stats.max_latency)
+            stats.max_latency = total;
+
+        last_id   = request.id;
+        last_done = done;
+    }
+
+private:
+    DRAMConfig           config;
+    std::vector<Channel> channels;
+    Statistics           stats;
+
+    size_t next_id;
+    size_t last_id;   // last issued request
+    size_t last_done; // its completion cycle
+};
+
+#endif // _DRAM_H_
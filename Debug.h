@@ -0,0 +1,291 @@
+#ifndef _DEBUG_H_
+#define _DEBUG_H_ 1
+
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+#include "Engine.h"
+
+/**
+    Breakpoints, single-step and watchpoints of a debugger (see GdbStub.h).
+
+    The engines ask Stop() once for every instruction about to retire, in
+    program order, where they also take interrupts. If it says so the engine
+    stops in front of the instruction (CAUSE_DEBUG, see Engine::HandleTrap()),
+    with everything older retired and nothing younger: exact whatever was
+    fetched or executed speculatively. Nothing happens in the fetch path.
+
+    Breakpoints live in a bitmap per 4 KiB page of code, one bit per halfword,
+    allocated when the page gets its first breakpoint. Stop() only looks at the
+    bitmap of a marked page, so code in other pages costs a page lookup, and an
+    engine without a DebugUnit does not ask at all.
+
+    Watchpoints cover DataMemory words and fire on reads, writes or writes that
+    change the word. The engines report the accesses of retiring instructions to
+    Access(), which only looks at the watch list for a page that holds a watched
+    word (a count per GuestMemory page, like its read-only flags); accesses to
+    other pages return after one lookup. A hit is logged with its pc, cycle and
+    the word, and a stopping watchpoint stops in front of the next instruction,
+    after the access completed.
+*/
+class DebugUnit
+{
+public:
+    enum Reason
+    {
+        NONE,
+        BREAKPOINT,
+        STEP,       // the instruction after the one Resume() ran
+        WATCHPOINT, // the instruction after an access to a watched word
+        INTERRUPT,  // Interrupt()
+    };
+
+    enum WatchKind : uint32_t
+    {
+        WATCH_WRITE  = 1,
+        WATCH_READ   = 2,
+        WATCH_ACCESS = 3,
+        WATCH_CHANGE = 4, // a write that changes the word
+    };
+
+    struct Watchpoint
+    {
+        uint32_t              address; // first word
+        uint32_t              words;
+        uint32_t              kind;    // WatchKind
+        bool                  stop;    // or only log hits
+        std::vector<uint32_t> values;  // WATCH_CHANGE: the words as last seen
+    };
+
+    struct Hit
+    {
+        uint32_t pc;
+        uint64_t cycle;
+        uint32_t address;
+        uint32_t value; // the word after the access
+        uint32_t kind;  // WatchKind of the access
+    };
+
+    // Hits kept for PrintHits(); later ones are only counted
+    static constexpr size_t MAX_HITS = 4096;
+
+    static constexpr uint32_t PAGE_BITS = 12;
+
+public:
+    DebugUnit():
+        resume      (false),
+        pending     (NONE),
+        reason      (NONE),
+        watched     (0),
+        watched_kind(0),
+        hits        (0)
+    {}
+
+    // Breakpoint at `pc`; false if there already was one
+    bool Insert(uint32_t pc)
+    {
+        size_t page = pc >> PAGE_BITS;
+        if (page >= pages.size())
+            pages.resize(page + 1);
+        if (pages[page].empty())
+            pages[page].resize(PAGE_SLOTS / 64, 0);
+
+        uint64_t& bits = pages[page][Slot(pc) / 64];
+        uint64_t  bit  = uint64_t(1) << (Slot(pc) % 64);
+        if (bits & bit)
+            return false;
+        bits |= bit;
+        breakpoints.push_back(pc);
+        return true;
+    }
+
+    // Removes the breakpoint at `pc`; false if there was none
+    bool Remove(uint32_t pc)
+    {
+        if (!Test(pc))
+            return false;
+        std::vector<uint64_t>& bitmap = pages[pc >> PAGE_BITS];
+        bitmap[Slot(pc) / 64] &= ~(uint64_t(1) << (Slot(pc) % 64));
+        if (std::all_of(bitmap.begin(), bitmap.end(), [](uint64_t bits) { return bits == 0; }))
+            bitmap.clear(); // unmarks the page
+        breakpoints.erase(std::find(breakpoints.begin(), breakpoints.end(), pc));
+        return true;
+    }
+
+    const std::vector<uint32_t>& Breakpoints() const
+    { return breakpoints; }
+
+    /** Watchpoint on `words` words from `address` on that logs its hits and with
+        `stop` also stops. WATCH_CHANGE compares with `memory` (DataMemory) as it
+        is now, then with what the guest last read or wrote.
+    */
+    void Watch(uint32_t address, uint32_t words, uint32_t kind, bool stop = true, const uint32_t* memory = nullptr)
+    {
+        if (words == 0)
+            return;
+        Watchpoint watch = {address, words, kind, stop, {}};
+        if (kind & WATCH_CHANGE)
+            watch.values.assign(memory + address, memory + address + words);
+        watchpoints.push_back(watch);
+        Flag(watch, 1);
+    }
+
+    // Removes a watchpoint Watch() set with the same range and kind; false if there is none
+    bool Unwatch(uint32_t address, uint32_t words, uint32_t kind)
+    {
+        for (size_t i = 0; i < watchpoints.size(); ++i)
+        {
+            const Watchpoint& watch = watchpoints[i];
+            if (watch.address == address && watch.words == words && watch.kind == kind)
+            {
+                Flag(watch, -1);
+                watchpoints.erase(watchpoints.begin() + i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Before the engine runs again: the next instruction retires even at a
+    // breakpoint, and with `step` the one after it stops
+    void Resume(bool step)
+    {
+        resume  = true;
+        pending = step ? STEP : NONE;
+        reason  = NONE;
+    }
+
+    // Drops every breakpoint and watchpoint and anything pending
+    void Clear()
+    {
+        pages.clear();
+        breakpoints.clear();
+        watchpoints.clear();
+        flagged.clear();
+        resume  = false;
+        pending = NONE;
+    }
+
+    // Stops in front of the next instruction
+    void Interrupt()
+    { pending = INTERRUPT; }
+
+    // Why the engine stopped last, with the word and WatchKind of a WATCHPOINT
+    Reason LastReason() const
+    { return reason; }
+    uint32_t WatchedAddress() const
+    { return watched; }
+    uint32_t WatchedKind() const
+    { return watched_kind; }
+
+    void PrintHits(std::ostream& out) const
+    {
+        static const char* names[] = {"", "write", "read", "access", "change", "change", "change", "change"};
+        for (const Hit& hit : log)
+            out << "watchpoint: pc = " << hit.pc << ", cycle = " << hit.cycle << ", mem[" << hit.address << "] = " << hit.value
+                << " (" << names[hit.kind & 7] << ")\n";
+        if (hits > log.size())
+            out << "watchpoint: " << hits - log.size() << " more hits\n";
+    }
+
+public:
+    // The instruction at `pc` is about to retire: true to stop in front of it
+    bool Stop(uint32_t pc)
+    {
+        if (resume)
+        {
+            resume = false;
+            return false;
+        }
+        if (pending != NONE)
+        {
+            reason  = pending;
+            pending = NONE;
+            return true;
+        }
+        if (!Test(pc))
+            return false;
+        reason = BREAKPOINT;
+        return true;
+    }
+
+    // The instruction at `pc` retiring at `cycle` read and/or wrote DataMemory
+    // word `address`, which holds `value` after it
+    void Access(uint32_t pc, uint32_t address, bool read, bool write, uint32_t value, uint64_t cycle)
+    {
+        size_t page = address / GuestMemory::PAGE_WORDS;
+        if (page >= flagged.size() || flagged[page] == 0)
+            return;
+
+        bool logged = false;
+        for (Watchpoint& watch : watchpoints)
+        {
+            if (address - watch.address >= watch.words)
+                continue;
+            uint32_t access = (read ? uint32_t(WATCH_READ) : 0u) | (write ? uint32_t(WATCH_WRITE) : 0u);
+            if (watch.kind & WATCH_CHANGE)
+            {
+                uint32_t& last = watch.values[address - watch.address];
+                if (write && last != value)
+                    access |= WATCH_CHANGE;
+                last = value;
+            }
+            if ((watch.kind & access) == 0)
+                continue;
+
+            if (!logged && hits++ < MAX_HITS)
+                log.push_back({pc, cycle, address, value, watch.kind & access});
+            logged = true;
+            if (watch.stop)
+            {
+                pending = WATCHPOINT;
+                watched      = address;
+                watched_kind = watch.kind;
+            }
+        }
+    }
+
+private:
+    static constexpr size_t PAGE_SLOTS = (size_t(1) << PAGE_BITS) / 2; // halfwords
+
+    static size_t Slot(uint32_t pc)
+    { return (pc & ((1u << PAGE_BITS) - 1)) >> 1; }
+
+    // Counts the watchpoint in every page it covers
+    void Flag(const Watchpoint& watch, int count)
+    {
+        size_t first = watch.address / GuestMemory::PAGE_WORDS;
+        size_t last  = (size_t(watch.address) + watch.words - 1) / GuestMemory::PAGE_WORDS;
+        if (last >= flagged.size())
+            flagged.resize(last + 1, 0);
+        for (size_t page = first; page <= last; ++page)
+            flagged[page] += count;
+    }
+
+    bool Test(uint32_t pc) const
+    {
+        size_t page = pc >> PAGE_BITS;
+        if (page >= pages.size() || pages[page].empty())
+            return false; // unmarked page
+        return (pages[page][Slot(pc) / 64] >> (Slot(pc) % 64)) & 1;
+    }
+
+private:
+    std::vector<std::vector<uint64_t>> pages; // breakpoint bitmap per page, empty if none
+    std::vector<uint32_t>              breakpoints;
+    std::vector<Watchpoint>            watchpoints;
+    std::vector<uint32_t>              flagged; // watchpoints per DataMemory page
+    std::vector<Hit>                   log;
+
+    bool     resume;  // the next instruction retires unchecked
+    Reason   pending; // stops in front of the next one
+    Reason   reason;
+    uint32_t watched;
+    uint32_t watched_kind;
+    size_t   hits;
+};
+
+#endif // _DEBUG_H_
@@ -0,0 +1,540 @@
+#ifndef _ENGINE_H_
+#define _ENGINE_H_ 1
+
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+enum MachineStatus
+{
+    RUNNING,
+    HALTED, // EBREAK or the exit ECALL (a7 = 93 or 94)
+    TRAP,   // guest exception nobody handled
+    ERROR,  // simulator error
+};
+
+// Exception codes (mcause)
+constexpr uint32_t CAUSE_FETCH_MISALIGNED    = 0;
+constexpr uint32_t CAUSE_FETCH_ACCESS        = 1;
+constexpr uint32_t CAUSE_ILLEGAL_INSTRUCTION = 2;
+constexpr uint32_t CAUSE_BREAKPOINT          = 3;
+constexpr uint32_t CAUSE_LOAD_ACCESS         = 5;
+constexpr uint32_t CAUSE_STORE_ACCESS        = 7;
+constexpr uint32_t CAUSE_ECALL               = 11;
+constexpr uint32_t CAUSE_FETCH_PAGE_FAULT    = 12;
+constexpr uint32_t CAUSE_LOAD_PAGE_FAULT     = 13;
+constexpr uint32_t CAUSE_STORE_PAGE_FAULT    = 15;
+
+// Interrupts (mcause bit 31): taken before an instruction instead of raised by it
+constexpr uint32_t CAUSE_INTERRUPT                  = 0x80000000;
+constexpr uint32_t CAUSE_MACHINE_SOFTWARE_INTERRUPT = CAUSE_INTERRUPT | 3;
+constexpr uint32_t CAUSE_MACHINE_TIMER_INTERRUPT    = CAUSE_INTERRUPT | 7;
+
+constexpr bool IsInterrupt(uint32_t cause)
+{ return (cause & CAUSE_INTERRUPT) != 0; }
+
+// Not an exception: SFENCE.VMA stops the engine like a trap so that it can flush
+// its TLBs and refetch everything younger (Engine::HandleTrap() resumes it)
+constexpr uint32_t CAUSE_SFENCE_VMA = 64;
+
+// Not an exception either: a CSR instruction, MRET or WFI, executed by
+// Engine::HandleTrap() once everything older has retired (see CSR.h)
+constexpr uint32_t CAUSE_CSR = 65;
+
+// Nor this: a DebugUnit stopped the engine in front of the instruction at pc
+// (see Debug.h); the engine stays stopped until the debugger rewinds it
+constexpr uint32_t CAUSE_DEBUG = 66;
+
+// What an hpmcounter counts (the value of its mhpmevent); an engine that does
+// not model an event reads 0
+enum PerformanceEvent : uint32_t
+{
+    EVENT_NONE,
+    EVENT_LOADS,       // loads and AMOs performed
+    EVENT_STORES,      // stores performed
+    EVENT_SQUASHED,    // wrong-path instructions dropped
+    EVENT_FORWARDED,   // bypassed operands (pipeline) or store-to-load forwards (out-of-order)
+    EVENT_MISPREDICTS, // branches and jumps that redirected fetch
+    EVENT_ITLB_MISSES,
+    EVENT_DTLB_MISSES,
+    EVENT_COUNT,
+};
+
+// a7 of the ECALLs that halt the machine
+constexpr uint32_t SYSCALL_EXIT       = 93;
+constexpr uint32_t SYSCALL_EXIT_GROUP = 94;
+
+constexpr bool IsExitCall(uint32_t a7)
+{ return a7 == SYSCALL_EXIT || a7 == SYSCALL_EXIT_GROUP; }
+
+struct MachineState
+{
+    MachineStatus status    = RUNNING;
+    uint32_t      cause     = 0; // TRAP
+    uint32_t      pc        = 0; // TRAP: faulting instruction
+    uint32_t      tval      = 0; // TRAP: its instruction word (CSR and illegal instructions)
+    uint32_t      exit_code = 0; // HALTED: a0
+    const char*   message   = nullptr; // ERROR
+
+    void Halt(uint32_t exit_code)
+    {
+        status          = HALTED;
+        this->exit_code = exit_code;
+    }
+
+    void Trap(uint32_t cause, uint32_t pc, uint32_t tval = 0)
+    {
+        status      = TRAP;
+        this->cause = cause;
+        this->pc    = pc;
+        this->tval  = tval;
+    }
+
+    void Fail(const char* message)
+    {
+        status        = ERROR;
+        this->message = message;
+    }
+
+    // Process exit code: the guest's for HALTED, 128 + cause for TRAP, 255 for ERROR
+    int ExitCode() const
+    {
+        switch (status)
+        {
+        case HALTED:
+            return exit_code & 0xff;
+        case TRAP:
+            return 128 + (cause & 0x7f);
+        case ERROR:
+            return 255;
+        default:
+            return 0;
+        }
+    }
+
+    static const char* CauseName(uint32_t cause)
+    {
+        switch (cause)
+        {
+        case CAUSE_FETCH_MISALIGNED:           return "instruction address misaligned";
+        case CAUSE_FETCH_ACCESS:               return "instruction access fault";
+        case CAUSE_ILLEGAL_INSTRUCTION:        return "illegal instruction";
+        case CAUSE_BREAKPOINT:                 return "breakpoint";
+        case CAUSE_LOAD_ACCESS:                return "load access fault";
+        case CAUSE_STORE_ACCESS:               return "store access fault";
+        case CAUSE_ECALL:                      return "environment call";
+        case CAUSE_FETCH_PAGE_FAULT:           return "instruction page fault";
+        case CAUSE_LOAD_PAGE_FAULT:            return "load page fault";
+        case CAUSE_STORE_PAGE_FAULT:           return "store page fault";
+        case CAUSE_MACHINE_SOFTWARE_INTERRUPT: return "machine software interrupt";
+        case CAUSE_MACHINE_TIMER_INTERRUPT:    return "machine timer interrupt";
+        case CAUSE_DEBUG:                      return "debugger stop";
+        default:                               return "unknown";
+        }
+    }
+
+    void Print(std::ostream& out) const
+    {
+        switch (status)
+        {
+        case RUNNING:
+            out << "running";
+            break;
+        case HALTED:
+            out << "halted, exit code " << exit_code;
+            break;
+        case TRAP:
+            out << "trap: " << CauseName(cause) << " (" << cause << ") at pc = " << pc;
+            break;
+        case ERROR:
+            out << "error: " << message;
+            break;
+        }
+        out << std::endl;
+    }
+
+    bool operator==(const MachineState& other) const
+    {
+        return status == other.status && cause == other.cause && pc == other.pc && exit_code == other.exit_code;
+    }
+};
+
+// DataMemory storage: owned words, or a host buffer attached without copying.
+// Host files can be mapped into owned memory (Map): the pages come straight from
+// the page cache, so a large input costs nothing until the guest touches it and
+// simulators mapping the same file share it.
+class GuestMemory
+{
+public:
+    static constexpr size_t PAGE_WORDS = 1024; // one 4 KiB host page
+
+    enum MapMode
+    {
+        READ_ONLY,     // guest stores fault (store access)
+        COPY_ON_WRITE, // guest stores go to private copies of the pages
+        SHARED,        // guest stores reach the file
+    };
+
+public:
+    explicit GuestMemory(size_t size):
+        storage    (size),
+        words      (storage.data()),
+        count      (size),
+        region     (nullptr),
+        accessible (0),
+        generation (0)
+    {}
+
+    ~GuestMemory()
+    { Release(); }
+
+    GuestMemory(const GuestMemory&) = delete;
+    GuestMemory& operator=(const GuestMemory&) = delete;
+
+    // `words` stays owned by the caller and has to outlive this memory
+    void Attach(uint32_t* words, size_t size)
+    {
+        storage.clear();
+        storage.shrink_to_fit();
+        Release();
+        this->words = words;
+        this->count = size;
+        ++generation;
+    }
+
+    /** Maps `size` words of host file `fd` from byte `offset` (page aligned) at
+        word `address` (a multiple of PAGE_WORDS), or zero pages for fd = -1.
+        DataMemory grows to cover them; words past the end of the file read 0.
+        Returns 0 or an errno (attached memory cannot be mapped into).
+    */
+    int Map(int fd, uint64_t offset, size_t address, size_t size, MapMode mode)
+    {
+        if (size == 0 || address % PAGE_WORDS != 0 || offset % (PAGE_WORDS * sizeof(uint32_t)) != 0)
+            return EINVAL;
+        if (address > RESERVED_WORDS || size > RESERVED_WORDS - address)
+            return ENOMEM;
+        if (storage.empty() && region == nullptr)
+            return EPERM;
+
+        size_t file_words = 0;
+        if (fd >= 0)
+        {
+            struct stat info;
+            if (fstat(fd, &info) < 0)
+                return errno;
+            if (uint64_t(info.st_size) > offset)
+                file_words = std::min<uint64_t>(size, (info.st_size - offset + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+        }
+
+        int error = Reserve(address + size);
+        if (error != 0)
+            return error;
+
+        size_t pages = (size + PAGE_WORDS - 1) / PAGE_WORDS;
+        size_t file  = (file_words + PAGE_WORDS - 1) / PAGE_WORDS;
+        int    prot  = mode == READ_ONLY ? PROT_READ : PROT_READ | PROT_WRITE;
+        if (file != 0)
+        {
+            void* target = region + address;
+            void* mapped = mmap(target, file * PAGE_BYTES, prot, MAP_FIXED | (mode == COPY_ON_WRITE ? MAP_PRIVATE : MAP_SHARED), fd, offset);
+            if (mapped == MAP_FAILED)
+                return errno;
+        }
+        if (pages > file)
+        {
+            void* target = region + address + file * PAGE_WORDS;
+            if (mmap(target, (pages - file) * PAGE_BYTES, prot, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED)
+                return errno;
+        }
+
+        // the flags cover every page of the memory
+        size_t first = address / PAGE_WORDS;
+        count = std::max(count, address + size);
+        readonly.resize(std::max(readonly.size(), (count + PAGE_WORDS - 1) / PAGE_WORDS), 0);
+        std::fill(readonly.begin() + first, readonly.begin() + first + pages, mode == READ_ONLY);
+        ++generation;
+        return 0;
+    }
+
+    // Stores to `address` (inside the memory) are allowed
+    bool Writable(size_t address) const
+    { return address / PAGE_WORDS >= readonly.size() || !readonly[address / PAGE_WORDS]; }
+
+    // And to all `count` words from `address` on (host writes into a read-only page fault)
+    bool Writable(size_t address, size_t count) const
+    {
+        for (size_t page = address / PAGE_WORDS; count != 0 && page <= (address + count - 1) / PAGE_WORDS; ++page)
+        {
+            if (page < readonly.size() && readonly[page])
+                return false;
+        }
+        return true;
+    }
+
+    // One flag per page, empty until something is mapped
+    const std::vector<uint8_t>& ReadOnlyPages() const
+    { return readonly; }
+
+    // Changes whenever data(), size() or the read-only pages change
+    size_t Generation() const
+    { return generation; }
+
+    uint32_t* data()
+    { return words; }
+    const uint32_t* data() const
+    { return words; }
+    size_t size() const
+    { return count; }
+
+    uint32_t& operator[](size_t address)
+    { return words[address]; }
+    const uint32_t& operator[](size_t address) const
+    { return words[address]; }
+
+private:
+    static constexpr size_t PAGE_BYTES     = PAGE_WORDS * sizeof(uint32_t);
+    static constexpr size_t RESERVED_WORDS = size_t(1) << 32; // every word address
+
+    // Moves the owned words into a reservation of the whole guest address space
+    // (so mappings never move it) with the first `size` words accessible
+    int Reserve(size_t size)
+    {
+        if (region == nullptr)
+        {
+            void* reserved = mmap(nullptr, RESERVED_WORDS * sizeof(uint32_t), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (reserved == MAP_FAILED)
+                return errno;
+            region = static_cast<uint32_t*>(reserved);
+
+            int error = Reserve(count);
+            if (error != 0)
+            {
+                Release();
+                return error;
+            }
+            std::copy(storage.begin(), storage.end(), region);
+            storage.clear();
+            storage.shrink_to_fit();
+            words = region;
+        }
+
+        size_t pages = (size + PAGE_WORDS - 1) / PAGE_WORDS;
+        if (pages > accessible)
+        {
+            if (mprotect(region + accessible * PAGE_WORDS, (pages - accessible) * PAGE_BYTES, PROT_READ | PROT_WRITE) < 0)
+                return errno;
+            accessible = pages;
+        }
+        return 0;
+    }
+
+    void Release()
+    {
+        if (region != nullptr)
+            munmap(region, RESERVED_WORDS * sizeof(uint32_t));
+        region     = nullptr;
+        accessible = 0;
+        readonly.clear();
+    }
+
+private:
+    std::vector<uint32_t> storage;
+    uint32_t*             words;
+    size_t                count;
+
+    uint32_t*            region;     // owned words once something is mapped
+    size_t               accessible; // pages of the region backed by memory or files
+    std::vector<uint8_t> readonly;   // per page
+    size_t               generation;
+};
+
+class Engine;
+class Mmu;
+class CsrFile;
+
+// Called for a guest trap; returns true to resume at state.pc (the handler may move it)
+typedef bool (*TrapHandler)(Engine& engine, MachineState& state, void* context);
+
+// Common interface of the simulation engines selectable at startup
+class Engine
+{
+public:
+    virtual ~Engine()
+    {}
+
+    virtual const char* Name() const = 0;
+
+    // Runs until the machine leaves RUNNING
+    virtual const MachineState& Run() = 0;
+
+    // Runs for at least `cycles` cycles (whole stages, cycles or blocks) unless the machine stops first
+    virtual const MachineState& RunFor(size_t cycles) = 0;
+
+    const MachineState& Status() const
+    { return state; }
+
+    void SetTrapHandler(TrapHandler handler, void* context = nullptr)
+    {
+        trap_handler = handler;
+        trap_context = context;
+    }
+
+    // Spin loops are fast-forwarded to the next event (see Spin.h) unless disabled
+    void SetFastForward(bool enable)
+    { fast_forward = enable; }
+
+public:
+    virtual size_t Cycles() const = 0;
+    virtual size_t Instructions() const = 0; // retired
+
+    virtual uint32_t Register(size_t index) const = 0;
+
+    // Architectural write (x0 stays 0). Timing engines may have younger
+    // instructions in flight that already read the old value.
+    virtual void SetRegister(size_t index, uint32_t value) = 0;
+
+    // DataMemory contents (one word per address)
+    virtual const uint32_t* Memory() const = 0;
+    virtual uint32_t*       Memory() = 0;
+    virtual size_t          MemorySize() const = 0;
+
+    // Replaces DataMemory with `size` words of host memory (zero copy, see GuestMemory)
+    virtual void AttachMemory(uint32_t* words, size_t size) = 0;
+
+    // DataMemory itself: host file mappings and read-only pages (see GuestMemory::Map)
+    virtual GuestMemory&       Guest() = 0;
+    virtual const GuestMemory& Guest() const = 0;
+
+    // Sv32 translation of fetch and DataMemory accesses (see MMU.h)
+    virtual Mmu&       MMU() = 0;
+    virtual const Mmu& MMU() const = 0;
+
+    // Zicsr state, the interrupt enables and the CLINT (see CSR.h)
+    virtual CsrFile&       Csrs() = 0;
+    virtual const CsrFile& Csrs() const = 0;
+
+    // Occurrences of `event` so far (the hpmcounters, see CSR.h)
+    virtual uint64_t Events(PerformanceEvent event) const = 0;
+
+    // Advances the clock by `cycles` with nothing in flight (WFI)
+    virtual void Idle(size_t cycles) = 0;
+
+    // Drops everything in flight and resumes RUNNING at `pc`, with the clock at
+    // `cycle` and `instructions` retired (reverse execution, see History.h)
+    virtual void Rewind(uint32_t pc, size_t cycle, size_t instructions) = 0;
+
+    virtual void PrintStatistics(std::ostream& out) const = 0;
+
+protected:
+    // After state.Trap(): enters interrupts, halts for EBREAK and the exit ECALL,
+    // otherwise asks the trap handler. Returns true if the engine has to resume at state.pc.
+    bool HandleTrap()
+    {
+        if (state.cause == CAUSE_DEBUG)
+            return false;
+
+        bool system = state.cause == CAUSE_CSR || IsInterrupt(state.cause);
+        if (state.cause == CAUSE_SFENCE_VMA || (system && AccessCsr(state)))
+        {
+            if (state.cause == CAUSE_SFENCE_VMA)
+            {
+                Fence();
+                state.pc += 4;
+            }
+            state.status = RUNNING;
+            return true;
+        }
+        if (state.cause == CAUSE_CSR)
+            state.cause = CAUSE_ILLEGAL_INSTRUCTION; // no such CSR, or a write to a read-only one
+        if (state.cause == CAUSE_BREAKPOINT || (state.cause == CAUSE_ECALL && IsExitCall(Register(17))))
+        {
+            state.Halt(Register(10));
+            return false;
+        }
+
+        if (trap_handler != nullptr && trap_handler(*this, state, trap_context))
+        {
+            state.status = RUNNING;
+            return true;
+        }
+        return false;
+    }
+
+    // SFENCE.VMA: drops every cached translation
+    virtual void Fence() = 0;
+
+    // Executes the CSR instruction in trap.tval or enters the interrupt, and moves
+    // trap.pc to where the engine resumes; false if the instruction is illegal
+    virtual bool AccessCsr(MachineState& trap) = 0;
+
+protected:
+    MachineState state;
+    TrapHandler  trap_handler = nullptr;
+    void*        trap_context = nullptr;
+    bool         fast_forward = true;
+};
+
+// Architectural state copied out of an engine
+struct EngineState
+{
+    const char*           name;
+    MachineState          state;
+    uint32_t              regs[32];
+    std::vector<uint32_t> memory;
+
+    EngineState(const Engine& engine):
+        name  (engine.Name()),
+        state (engine.Status()),
+        regs  {},
+        memory(engine.Memory(), engine.Memory() + engine.MemorySize())
+    {
+        for (size_t i = 1; i < 32; ++i)
+            regs[i] = engine.Register(i);
+    }
+};
+
+// Compares two architectural states, prints every difference
+inline bool CompareState(const EngineState& left, const EngineState& right, std::ostream& out)
+{
+    bool equal = true;
+
+    if (!(left.state == right.state))
+    {
+        out << left.name << ": ";
+        left.state.Print(out);
+        out << right.name << ": ";
+        right.state.Print(out);
+        equal = false;
+    }
+
+    for (size_t i = 1; i < 32; ++i)
+    {
+        if (left.regs[i] != right.regs[i])
+        {
+            out << "x" << i << ": " << left.name << " = " << left.regs[i]
+                << ", " << right.name << " = " << right.regs[i] << '\n';
+            equal = false;
+        }
+    }
+
+    size_t size = left.memory.size() < right.memory.size() ? left.memory.size() : right.memory.size();
+    for (size_t address = 0; address < size; ++address)
+    {
+        if (left.memory[address] != right.memory[address])
+        {
+            out << "mem[" << address << "]: " << left.name << " = " << left.memory[address]
+                << ", " << right.name << " = " << right.memory[address] << '\n';
+            equal = false;
+        }
+    }
+
+    out.flush();
+    return equal;
+}
+
+#endif // _ENGINE_H_
@@ -0,0 +1,543 @@
+#ifndef _GDB_STUB_H_
+#define _GDB_STUB_H_ 1
+
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <string>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "Engine.h"
+#include "Debug.h"
+#include "History.h"
+
+/**
+    GDB remote serial protocol stub: lets one gdb (target remote) control an
+    engine through a DebugUnit, over TCP on localhost or a Unix socket.
+
+    gdb sees x0 .. x31 and pc (riscv:rv32, from target.xml), DataMemory, and
+    software breakpoints, hardware breakpoints and write, read and access
+    watchpoints, all of them kept by the DebugUnit and none written into the
+    program. Continue runs the engine in chunks of cycles and polls the socket
+    in between for ^C. With a History attached, reverse-step and
+    reverse-continue go back through it.
+
+    Memory addresses are DataMemory words, as in guest pointers and syscall
+    buffers: `m A,L` reads L bytes of the words from word A on, four per word,
+    little-endian. A watchpoint covers the words its bytes span from A on. The
+    program itself is not in DataMemory and cannot be read.
+*/
+class GdbStub
+{
+public:
+    static constexpr size_t   CHUNK     = 100000; // cycles between polls for ^C
+    static constexpr uint32_t PC_NUMBER = 32;
+
+public:
+    GdbStub(Engine& engine, DebugUnit& debug, History* history = nullptr):
+        engine  (engine),
+        debug   (debug),
+        history (history),
+        listener(-1),
+        client  (-1),
+        ack     (true),
+        pc      (0),
+        moved   (false)
+    {}
+
+    ~GdbStub()
+    {
+        if (client >= 0)
+            close(client);
+        if (listener >= 0)
+            close(listener);
+        if (!path.empty())
+            unlink(path.c_str());
+    }
+
+    // Listens on `where`: a TCP port on 127.0.0.1, or unix:PATH; returns 0 or an errno
+    int Listen(const char* where)
+    {
+        int error;
+        if (strncmp(where, "unix:", 5) == 0)
+        {
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            if (strlen(where + 5) == 0 || strlen(where + 5) >= sizeof(address.sun_path))
+                return EINVAL;
+            strcpy(address.sun_path, where + 5);
+
+            listener = socket(AF_UNIX, SOCK_STREAM, 0);
+            unlink(address.sun_path);
+            error = Bind(reinterpret_cast<sockaddr*>(&address), sizeof(address));
+            if (error == 0)
+                path = address.sun_path;
+        }
+        else
+        {
+            char*         end;
+            unsigned long port = strtoul(where, &end, 10);
+            if (*where == '\0' || *end != '\0' || port == 0 || port > 65535)
+                return EINVAL;
+
+            sockaddr_in address = {};
+            address.sin_family      = AF_INET;
+            address.sin_port        = htons(uint16_t(port));
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+            int reuse = 1;
+            listener = socket(AF_INET, SOCK_STREAM, 0);
+            if (listener >= 0)
+                setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            error = Bind(reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        }
+        return error;
+    }
+
+    // Waits for gdb, then serves it until it detaches (the run goes on to the
+    // end), kills the program or hangs up (the engine stays where it stopped)
+    const MachineState& Serve()
+    {
+        client = accept(listener, nullptr, nullptr);
+        if (client < 0)
+            return engine.Status();
+        int nodelay = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        std::string packet;
+        while (Receive(packet) && packet != "k")
+        {
+            if (!Send(Handle(packet)) || packet.compare(0, 5, "vKill") == 0)
+                break;
+            if (packet == "QStartNoAckMode")
+                ack = false; // after gdb acknowledged the OK
+            if (packet == "D")
+            {
+                Detach();
+                break;
+            }
+        }
+
+        close(client);
+        client = -1;
+        return engine.Status();
+    }
+
+private:
+    int Bind(sockaddr* address, socklen_t size)
+    {
+        if (listener < 0 || bind(listener, address, size) < 0 || listen(listener, 1) < 0)
+            return errno;
+        return 0;
+    }
+
+    std::string Handle(const std::string& packet)
+    {
+        const char* args = packet.c_str() + 1;
+        switch (packet[0])
+        {
+        case '?':
+            return StopReply();
+        case 'g':
+        {
+            std::string reply;
+            for (uint32_t i = 0; i <= PC_NUMBER; ++i)
+                reply += Hex32(ReadRegister(i));
+            return reply;
+        }
+        case 'G':
+            for (uint32_t i = 0; i <= PC_NUMBER && 8 * (i + 1) <= packet.size() - 1; ++i)
+                WriteRegister(i, ParseHex32(args + 8 * i));
+            return "OK";
+        case 'p':
+        {
+            uint32_t number = strtoul(args, nullptr, 16);
+            return number <= PC_NUMBER ? Hex32(ReadRegister(number)) : "E01";
+        }
+        case 'P':
+        {
+            char*    value;
+            uint32_t number = strtoul(args, &value, 16);
+            if (number > PC_NUMBER || *value != '=')
+                return "E01";
+            WriteRegister(number, ParseHex32(value + 1));
+            return "OK";
+        }
+        case 'm':
+            return ReadMemory(args);
+        case 'M':
+            return WriteMemory(args);
+        case 'c':
+        case 's':
+            if (*args != '\0')
+                WriteRegister(PC_NUMBER, strtoul(args, nullptr, 16));
+            return Resume(packet[0] == 's');
+        case 'Z':
+        case 'z':
+            return Point(packet[0] == 'Z', args);
+        case 'b':
+            if (packet == "bs" || packet == "bc")
+                return Reverse(packet == "bc");
+            return "";
+        case 'H':
+        case 'T':
+            return "OK";
+        case 'q':
+            return Query(packet);
+        case 'Q':
+            return packet == "QStartNoAckMode" ? "OK" : "";
+        case 'D':
+            return "OK";
+        case 'v':
+            return packet.compare(0, 5, "vKill") == 0 ? "OK" : "";
+        default:
+            return ""; // unsupported (vCont? included: gdb falls back to c and s)
+        }
+    }
+
+    std::string Query(const std::string& packet)
+    {
+        if (packet.compare(0, 10, "qSupported") == 0)
+            return std::string("PacketSize=4000;QStartNoAckMode+;qXfer:features:read+;swbreak+") +
+                   (history != nullptr ? ";ReverseStep+;ReverseContinue+" : "");
+        if (packet.compare(0, 31, "qXfer:features:read:target.xml:") == 0)
+        {
+            std::string xml = TargetXml();
+            size_t      offset, length;
+            if (sscanf(packet.c_str() + 31, "%zx,%zx", &offset, &length) != 2)
+                return "E01";
+            if (offset >= xml.size())
+                return "l";
+            std::string part = xml.substr(offset, length);
+            return (offset + part.size() < xml.size() ? "m" : "l") + part;
+        }
+        if (packet == "qAttached")
+            return "1";
+        if (packet == "qfThreadInfo")
+            return "m1";
+        if (packet == "qsThreadInfo")
+            return "l";
+        if (packet == "qC")
+            return "QC1";
+        if (packet == "qSymbol::")
+            return "OK";
+        return "";
+    }
+
+    // Z/z type,addr,kind: breakpoints go to the DebugUnit's bitmap, watchpoints to its watch list
+    std::string Point(bool insert, const char* args)
+    {
+        unsigned type;
+        uint32_t address, length;
+        if (sscanf(args, "%u,%x,%x", &type, &address, &length) != 3 || type > 4)
+            return "E01";
+        if (type <= 1)
+        {
+            if (insert)
+                debug.Insert(address);
+            else
+                debug.Remove(address);
+            return "OK";
+        }
+
+        static const uint32_t kinds[] = {0, 0, DebugUnit::WATCH_WRITE, DebugUnit::WATCH_READ, DebugUnit::WATCH_ACCESS};
+        uint32_t words = (length + 3) / 4;
+        if (words == 0)
+            return "E01";
+        if (insert)
+            debug.Watch(address, words, kinds[type]);
+        else
+            debug.Unwatch(address, words, kinds[type]);
+        return "OK";
+    }
+
+    // Runs from `pc` until the DebugUnit, the program or ^C stops it
+    std::string Resume(bool step)
+    {
+        MachineStatus status = engine.Status().status;
+        if (status == HALTED || status == ERROR)
+            return StopReply();
+        if (status == TRAP || moved)
+            engine.Rewind(pc, engine.Cycles(), engine.Instructions());
+        moved = false;
+
+        debug.Resume(step);
+        while (engine.RunFor(CHUNK).status == RUNNING)
+        {
+            if (!Poll())
+                return "";
+        }
+        pc = engine.Status().pc;
+        return StopReply();
+    }
+
+    std::string Reverse(bool to_breakpoint)
+    {
+        if (history == nullptr)
+            return "E01";
+        size_t depth = history->Depth();
+        bool   found = to_breakpoint ? history->ReverseContinue(engine, debug.Breakpoints())
+                                     : history->StepBack(engine, 1) != 0;
+        if (history->Depth() != depth)
+        {
+            pc    = history->Resume(); // the engine is there, RUNNING
+            moved = false;
+        }
+        if (!found)
+            return "T05replaylog:begin;";
+        return to_breakpoint ? "T05swbreak:;" : "S05";
+    }
+
+    // Runs the program to the end without breakpoints, unless it already stopped for good
+    void Detach()
+    {
+        const MachineState& state = engine.Status();
+        if (state.status == HALTED || state.status == ERROR || (state.status == TRAP && state.cause != CAUSE_DEBUG))
+            return;
+        if (state.status == TRAP || moved)
+            engine.Rewind(pc, engine.Cycles(), engine.Instructions());
+        debug.Clear();
+        engine.Run();
+    }
+
+    std::string StopReply() const
+    {
+        const MachineState& state = engine.Status();
+        switch (state.status)
+        {
+        case HALTED:
+            return "W" + Hex8(state.exit_code & 0xff);
+        case ERROR:
+            return "X06";
+        case TRAP:
+            break;
+        default:
+            return "S05"; // not run yet, or gone back
+        }
+
+        if (state.cause != CAUSE_DEBUG)
+            return state.cause == CAUSE_ILLEGAL_INSTRUCTION ? "S04" : "S0b";
+        switch (debug.LastReason())
+        {
+        case DebugUnit::BREAKPOINT:
+            return "T05swbreak:;";
+        case DebugUnit::WATCHPOINT:
+        {
+            const char* name = debug.WatchedKind() == DebugUnit::WATCH_READ   ? "rwatch" :
+                               debug.WatchedKind() == DebugUnit::WATCH_ACCESS ? "awatch" : "watch";
+            char        reply[32];
+            snprintf(reply, sizeof(reply), "T05%s:%x;", name, debug.WatchedAddress());
+            return reply;
+        }
+        case DebugUnit::INTERRUPT:
+            return "S02";
+        default:
+            return "S05";
+        }
+    }
+
+    uint32_t ReadRegister(uint32_t number) const
+    { return number == PC_NUMBER ? pc : engine.Register(number); }
+
+    void WriteRegister(uint32_t number, uint32_t value)
+    {
+        if (number != PC_NUMBER)
+        {
+            engine.SetRegister(number, value);
+        }
+        else if (value != pc)
+        {
+            pc    = value;
+            moved = true;
+        }
+    }
+
+    // The `size` bytes from word `address` on, or nullptr if they are not all in DataMemory
+    uint8_t* Bytes(uint32_t address, size_t size)
+    {
+        size_t bytes = engine.MemorySize() * sizeof(uint32_t);
+        size_t start = size_t(address) * sizeof(uint32_t);
+        if (start > bytes || size > bytes - start)
+            return nullptr;
+        return reinterpret_cast<uint8_t*>(engine.Memory() + address);
+    }
+
+    std::string ReadMemory(const char* args)
+    {
+        uint32_t address, length;
+        if (sscanf(args, "%x,%x", &address, &length) != 2)
+            return "E01";
+        const uint8_t* bytes = Bytes(address, length);
+        if (bytes == nullptr)
+            return "E01";
+        std::string reply;
+        for (size_t i = 0; i < length; ++i)
+            reply += Hex8(bytes[i]);
+        return reply;
+    }
+
+    std::string WriteMemory(const char* args)
+    {
+        uint32_t address, length;
+        int      data;
+        if (sscanf(args, "%x,%x:%n", &address, &length, &data) != 2 || strlen(args + data) != 2 * size_t(length))
+            return "E01";
+        uint8_t* bytes = Bytes(address, length);
+        if (bytes == nullptr || !engine.Guest().Writable(address, (length + 3) / 4))
+            return "E01"; // outside DataMemory, or a read-only mapped page
+        for (size_t i = 0; i < length; ++i)
+            bytes[i] = uint8_t(ParseHex(args + data + 2 * i, 2));
+        return "OK";
+    }
+
+    static std::string TargetXml()
+    {
+        static const char* names[] = {
+            "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "fp", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+            "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+        };
+        std::string xml = "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+                          "<target version=\"1.0\"><architecture>riscv:rv32</architecture>"
+                          "<feature name=\"org.gnu.gdb.riscv.cpu\">";
+        for (size_t i = 0; i < 32; ++i)
+        {
+            const char* type = i == 1 ? "code_ptr" : (i == 2 || i == 8) ? "data_ptr" : "int";
+            xml += std::string("<reg name=\"") + names[i] + "\" bitsize=\"32\" type=\"" + type + "\"/>";
+        }
+        xml += "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/></feature></target>";
+        return xml;
+    }
+
+    static std::string Hex8(uint32_t value)
+    {
+        char text[3];
+        snprintf(text, sizeof(text), "%02x", value & 0xff);
+        return text;
+    }
+
+    // Target byte order: little-endian
+    static std::string Hex32(uint32_t value)
+    { return Hex8(value) + Hex8(value >> 8) + Hex8(value >> 16) + Hex8(value >> 24); }
+
+    static uint32_t ParseHex(const char* text, size_t digits)
+    {
+        uint32_t value = 0;
+        for (size_t i = 0; i < digits && isxdigit(uint8_t(text[i])); ++i)
+            value = (value << 4) | uint32_t(isdigit(uint8_t(text[i])) ? text[i] - '0' : (text[i] | 0x20) - 'a' + 10);
+        return value;
+    }
+
+    static uint32_t ParseHex32(const char* text)
+    {
+        uint32_t value = 0;
+        for (size_t i = 0; i < 4; ++i)
+            value |= ParseHex(text + 2 * i, 2) << (8 * i);
+        return value;
+    }
+
+private:
+    // One $packet#checksum, acknowledged unless in no-ack mode; false when gdb hung up
+    bool Receive(std::string& packet)
+    {
+        char c;
+        do
+        {
+            if (!ReadByte(c))
+                return false;
+        } while (c != '$'); // acks and a ^C while stopped are dropped
+
+        packet.clear();
+        while (ReadByte(c) && c != '#')
+            packet += c;
+        char checksum[2];
+        if (c != '#' || !ReadByte(checksum[0]) || !ReadByte(checksum[1]))
+            return false;
+
+        if (ack)
+        {
+            bool valid = ParseHex(checksum, 2) == Checksum(packet);
+            if (!Write(valid ? "+" : "-"))
+                return false;
+            if (!valid)
+                return Receive(packet);
+        }
+        return true;
+    }
+
+    bool Send(const std::string& reply)
+    {
+        char checksum[4];
+        snprintf(checksum, sizeof(checksum), "#%02x", Checksum(reply));
+        std::string packet = "$" + reply + checksum;
+        for (;;)
+        {
+            if (!Write(packet))
+                return false;
+            if (!ack)
+                return true;
+
+            char c;
+            do
+            {
+                if (!ReadByte(c))
+                    return false;
+            } while (c != '+' && c != '-');
+            if (c == '+')
+                return true;
+        }
+    }
+
+    // While running: takes a ^C; false when gdb hung up
+    bool Poll()
+    {
+        pollfd events = {client, POLLIN, 0};
+        while (poll(&events, 1, 0) > 0)
+        {
+            char c;
+            if (!ReadByte(c))
+                return false;
+            if (c == '\x03')
+                debug.Interrupt();
+        }
+        return true;
+    }
+
+    bool ReadByte(char& c)
+    { return recv(client, &c, 1, 0) == 1; }
+
+    bool Write(const std::string& data)
+    { return send(client, data.data(), data.size(), MSG_NOSIGNAL) == ssize_t(data.size()); }
+
+    static uint32_t Checksum(const std::string& data)
+    {
+        uint8_t sum = 0;
+        for (char c : data)
+            sum += uint8_t(c);
+        return sum;
+    }
+
+private:
+    Engine&     engine;
+    DebugUnit&  debug;
+    History*    history;
+    int         listener;
+    int         client;
+    std::string path; // of a Unix socket, removed at the end
+    bool        ack;
+
+    uint32_t pc;    // where the engine stopped, or resumes
+    bool     moved; // gdb changed pc
+};
+
+#endif // _GDB_STUB_H_
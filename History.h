@@ -0,0 +1,282 @@
+#ifndef _HISTORY_H_
+#define _HISTORY_H_ 1
+
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+#include "Engine.h"
+
+/**
+    Reverse execution: a bounded ring of undo records.
+
+    The engines report what every instruction overwrites as it retires: the
+    memory word before a store or AMO, then the register value before its
+    writeback (from a shadow register file, so nothing is read back from the
+    engine), then a marker with its pc and cycle. A handled trap logs the
+    registers the handler changed and a marker with its pc and cause. That is one
+    to three 16-byte records per instruction and no copying, so running forward
+    barely slows down.
+
+    Going back pops records newest first and writes the old values back, then
+    Engine::Rewind() drops everything in flight and resumes fetching at the pc
+    of the last instruction undone, with the cycle and instret it had. The
+    pipeline latches and the out-of-order queues are refilled rather than logged,
+    so execution from there on is architecturally exact but starts with a cold
+    pipeline. When the ring is full the oldest instructions fall out whole; going
+    back stops at the oldest one left.
+
+    Not rewound: CSRs and the CLINT, DataMemory a host trap handler wrote (an
+    undone ECALL runs again), and DRAM timing. Addresses are DataMemory words.
+*/
+class History
+{
+public:
+    enum Kind : uint64_t
+    {
+        INSTRUCTION, // where = pc
+        TRAP,        // where = pc, value = cause
+        REGISTER,    // where = index, value = old value
+        MEMORY,      // where = word address, value = old word
+    };
+
+    struct Record
+    {
+        uint64_t kind  : 2;
+        uint64_t cycle : 62; // INSTRUCTION, TRAP: when it retired
+        uint32_t where;
+        uint32_t value;
+    };
+
+    static_assert(sizeof(Record) == 16, "History::Record is not packed");
+
+    // The most records one instruction or trap logs
+    static constexpr size_t MIN_CAPACITY = 64;
+
+public:
+    // Keeps the last `capacity` records (16 bytes each)
+    explicit History(size_t capacity):
+        ring    (capacity),
+        top     (0),
+        count   (0),
+        floor   (0),
+        shadow  {},
+        resume  (0),
+        undone  (0)
+    {
+        if (capacity < MIN_CAPACITY)
+            throw "history too small";
+    }
+
+    // Starts recording from the engine's current state (attach before the first Step)
+    void Attach(const Engine& engine)
+    {
+        count = 0;
+        floor = engine.Cycles();
+        for (size_t i = 1; i < 32; ++i)
+            shadow[i] = engine.Register(i);
+    }
+
+    // Before a store or AMO writes `address`
+    void Store(uint32_t address, uint32_t old)
+    { Push(MEMORY, 0, address, old); }
+
+    // The instruction at `pc` retired at `cycle`, writing `value` to `rd` (0: none)
+    void Retire(uint32_t pc, uint32_t rd, uint32_t value, uint64_t cycle)
+    {
+        if (rd != 0)
+        {
+            Push(REGISTER, 0, rd, shadow[rd]);
+            shadow[rd] = value;
+        }
+        Push(INSTRUCTION, cycle, pc, 0);
+    }
+
+    // After HandleTrap(): `trap` is the state it was called with
+    void Trap(const MachineState& trap, const Engine& engine)
+    {
+        if (engine.Status().status != RUNNING)
+            return; // nothing changed, the machine stopped in front of it
+        for (size_t i = 1; i < 32; ++i)
+        {
+            if (engine.Register(i) != shadow[i])
+            {
+                Push(REGISTER, 0, i, shadow[i]);
+                shadow[i] = engine.Register(i);
+            }
+        }
+        Push(TRAP, engine.Cycles(), trap.pc, trap.cause);
+    }
+
+    // Instructions (and traps) that can be undone
+    size_t Depth() const
+    {
+        size_t markers = 0;
+        for (size_t n = 0; n < count; ++n)
+            markers += At(n).kind <= TRAP;
+        return markers;
+    }
+
+    size_t Capacity() const
+    { return ring.size(); }
+
+    // pc the engine resumes at after going back
+    uint32_t Resume() const
+    { return resume; }
+
+    // Undoes the last `instructions` instructions; returns how many it undid
+    size_t StepBack(Engine& engine, size_t instructions)
+    {
+        size_t n = 0;
+        if (instructions == 0)
+            return 0;
+        return Reverse(engine, NO_ADDRESS, [&](const Record&, bool) { return ++n >= instructions; });
+    }
+
+    // Undoes what retired in the last `cycles` cycles
+    size_t StepBackCycles(Engine& engine, size_t cycles)
+    {
+        uint64_t target = engine.Cycles() > cycles ? engine.Cycles() - cycles : 0;
+        if (Newest() <= target)
+            return 0;
+        return Reverse(engine, NO_ADDRESS, [&](const Record&, bool) { return Newest() <= target; });
+    }
+
+    // Runs back to the instruction that last wrote `address`, stopping in front of
+    // it; false if the history ran out first (then it is back at the oldest one)
+    bool RunBackToWrite(Engine& engine, uint32_t address)
+    {
+        bool found = false;
+        Reverse(engine, address, [&](const Record&, bool wrote) { return found = wrote; });
+        return found;
+    }
+
+    // Runs back to the last instruction at one of `breakpoints`, stopping in
+    // front of it; false if the history ran out first
+    bool ReverseContinue(Engine& engine, const std::vector<uint32_t>& breakpoints)
+    {
+        bool found = false;
+        Reverse(engine, NO_ADDRESS, [&](const Record& marker, bool)
+        {
+            found = std::find(breakpoints.begin(), breakpoints.end(), marker.where) != breakpoints.end();
+            return found;
+        });
+        return found;
+    }
+
+    void PrintStatistics(std::ostream& out) const
+    {
+        out << "history: " << Depth() << " instructions in " << count << " records (" << ring.size() * sizeof(Record) / 1024
+            << " KiB), " << undone << " undone\n";
+    }
+
+private:
+    static constexpr uint64_t NO_ADDRESS = UINT64_MAX;
+
+    const Record& At(size_t n) const // 0 = oldest
+    { return ring[(top + ring.size() - count + n) % ring.size()]; }
+
+    const Record& Top() const
+    { return ring[(top + ring.size() - 1) % ring.size()]; }
+
+    Record Pop()
+    {
+        top = (top + ring.size() - 1) % ring.size();
+        --count;
+        return ring[top];
+    }
+
+    void Push(Kind kind, uint64_t cycle, uint32_t where, uint32_t value)
+    {
+        if (count == ring.size())
+            DropOldest();
+        Record& record = ring[top];
+        record.kind  = kind;
+        record.cycle = cycle;
+        record.where = where;
+        record.value = value;
+        top = (top + 1) % ring.size();
+        ++count;
+    }
+
+    // Forgets the oldest instruction with everything it logged
+    void DropOldest()
+    {
+        while (count != 0)
+        {
+            const Record& oldest = At(0);
+            --count;
+            if (oldest.kind <= TRAP)
+            {
+                floor = oldest.cycle;
+                return;
+            }
+        }
+    }
+
+    // Cycle of the newest instruction still retired
+    uint64_t Newest() const
+    { return count != 0 ? Top().cycle : floor; }
+
+    /** Undoes instructions newest first until `stop(marker, wrote)` returns true
+        after one (`wrote`: it stored to `watch`) or the history runs out, then
+        rewinds the engine to the last one undone; returns how many it undid.
+    */
+    template <typename Stop>
+    size_t Reverse(Engine& engine, uint64_t watch, Stop stop)
+    {
+        size_t   instructions = engine.Instructions();
+        size_t   n            = 0;
+        uint32_t pc           = 0;
+        while (count != 0)
+        {
+            Record marker = Pop();
+            bool   wrote  = false;
+            while (count != 0 && Top().kind > TRAP)
+            {
+                Record record = Pop();
+                if (record.kind == MEMORY)
+                {
+                    engine.Memory()[record.where] = record.value;
+                    wrote |= record.where == watch;
+                }
+                else
+                {
+                    shadow[record.where] = record.value;
+                }
+            }
+
+            // a trap retires nothing, except the CSR instruction it ran
+            if (marker.kind == INSTRUCTION || marker.value == CAUSE_CSR)
+                --instructions;
+            pc = marker.where;
+            ++n;
+            if (stop(marker, wrote))
+                break;
+        }
+
+        if (n != 0)
+        {
+            engine.Rewind(pc, Newest(), instructions);
+            for (size_t i = 1; i < 32; ++i)
+                engine.SetRegister(i, shadow[i]);
+            resume  = pc;
+            undone += n;
+        }
+        return n;
+    }
+
+private:
+    std::vector<Record> ring;
+    size_t              top;   // next record to write
+    size_t              count; // records in the ring
+    uint64_t            floor; // cycle before the oldest instruction left
+
+    uint32_t shadow[32]; // the registers as the newest record left them
+    uint32_t resume;
+    uint64_t undone;
+};
+
+#endif // _HISTORY_H_
@@ -84,6 +84,11 @@ extern "C"
         uint32_t MEM_WEN  : 1; // MEM Write Enable
         uint32_t MEM2REG  : 1; // DMEM RD -> REG FILE
         uint32_t BRN_COND : 1; // B*?
+        uint32_t ALT      : 1; // funct7[5]: SUB / SRA(I)
+        uint32_t SRC1     : 2; // ALU left: 0 = rs1, 1 = PC, 2 = zero
+        uint32_t JUMP     : 2; // 0 = none, 1 = JAL (PC + imm), 2 = JALR (rs1 + imm)
+        uint32_t AMO      : 1; // LR/SC/AMO*: DMEM does the read-modify-write at rs1
+        uint32_t MULDIV   : 1; // M extension: ALUOP is funct3 (MUL .. REMU)
     };
 
     static_assert(sizeof(ControlUnitFlags) == sizeof(uint32_t));
@@ -118,31 +123,31 @@ union INSTRUCTION
     operator J_TYPE() const
     { return j_type; }
 
-    INSTRUCTION():
+    constexpr INSTRUCTION():
         raw(0)
     {}
-    INSTRUCTION(ControlUnitFlags flags):
+    constexpr INSTRUCTION(ControlUnitFlags flags):
         flags(flags)
     {}
-    INSTRUCTION(uint32_t value):
+    constexpr INSTRUCTION(uint32_t value):
         raw(value)
     {}
-    INSTRUCTION(R_TYPE instruction):
+    constexpr INSTRUCTION(R_TYPE instruction):
         r_type(instruction)
     {}
-    INSTRUCTION(I_TYPE instruction):
+    constexpr INSTRUCTION(I_TYPE instruction):
         i_type(instruction)
     {}
-    INSTRUCTION(U_TYPE instruction):
+    constexpr INSTRUCTION(U_TYPE instruction):
         u_type(instruction)
     {}
-    INSTRUCTION(S_TYPE instruction):
+    constexpr INSTRUCTION(S_TYPE instruction):
         s_type(instruction)
     {}
-    INSTRUCTION(B_TYPE instruction):
+    constexpr INSTRUCTION(B_TYPE instruction):
         b_type(instruction)
     {}
-    INSTRUCTION(J_TYPE instruction):
+    constexpr INSTRUCTION(J_TYPE instruction):
         j_type(instruction)
     {}
 
@@ -152,14 +157,14 @@ union INSTRUCTION
 
 static_assert(sizeof(INSTRUCTION) == sizeof(uint32_t));
 
-extern "C" INSTRUCTION MakeADDI(size_t rd, size_t rs1, int32_t imm)
+extern "C" constexpr INSTRUCTION MakeADDI(size_t rd, size_t rs1, int32_t imm)
 {
     assert(sizeof(I_TYPE) == sizeof(uint32_t));
     assert((-2048 <= imm) && (imm < 2048));
     assert(rd  < 32);
     assert(rs1 < 32);
 
-    I_TYPE retval;
+    I_TYPE retval{};
     retval.opcode = 0x13;
     retval.rd     = rd;
     retval.rs1    = rs1;
@@ -169,14 +174,14 @@ extern "C" INSTRUCTION MakeADDI(size_t rd, size_t rs1, int32_t imm)
     return retval;
 }
 
-extern "C" INSTRUCTION MakeADD(size_t rd, size_t rs1, size_t rs2)
+extern "C" constexpr INSTRUCTION MakeADD(size_t rd, size_t rs1, size_t rs2)
 {
     assert(sizeof(R_TYPE) == sizeof(uint32_t));
     assert(rd  < 32);
     assert(rs1 < 32);
     assert(rs2 < 32);
 
-    R_TYPE retval;
+    R_TYPE retval{};
     retval.opcode = 0x33;
     retval.rd     = rd;
     retval.rs1    = rs1;
@@ -187,14 +192,14 @@ extern "C" INSTRUCTION MakeADD(size_t rd, size_t rs1, size_t rs2)
     return retval;
 }
 
-extern "C" INSTRUCTION MakeSUB(size_t rd, size_t rs1, size_t rs2)
+extern "C" constexpr INSTRUCTION MakeSUB(size_t rd, size_t rs1, size_t rs2)
 {
     assert(sizeof(R_TYPE) == sizeof(uint32_t));
     assert(rd  < 32);
     assert(rs1 < 32);
     assert(rs2 < 32);
 
-    R_TYPE retval;
+    R_TYPE retval{};
     retval.opcode = 0x33;
     retval.rd     = rd;
     retval.rs1    = rs1;
@@ -204,13 +209,13 @@ extern "C" INSTRUCTION MakeSUB(size_t rd, size_t rs1, size_t rs2)
     return retval;
 }
 
-extern "C" INSTRUCTION MakeBEQ(size_t rs1, size_t rs2, int32_t delta)
+extern "C" constexpr INSTRUCTION MakeBEQ(size_t rs1, size_t rs2, int32_t delta)
 {
     assert(rs1 < 32);
     assert(rs2 < 32);
     assert((-4096 <= delta) && (delta < 4096));
 
-    B_TYPE retval;
+    B_TYPE retval{};
     retval.opcode = 0x63;
     retval.funct3 = 0x0;
     retval.imm12  = ((delta & 0x1000) >> 12);
@@ -222,13 +227,13 @@ extern "C" INSTRUCTION MakeBEQ(size_t rs1, size_t rs2, int32_t delta)
     return retval;
 }
 
-extern "C" INSTRUCTION MakeBNE(size_t rs1, size_t rs2, int32_t delta)
+extern "C" constexpr INSTRUCTION MakeBNE(size_t rs1, size_t rs2, int32_t delta)
 {
     assert(rs1 < 32);
     assert(rs2 < 32);
     assert((-4096 <= delta) && (delta < 4096));
 
-    B_TYPE retval;
+    B_TYPE retval{};
     retval.opcode = 0x63;
     retval.funct3 = 0x1;
     retval.imm12  = ((delta & 0x1000) >> 12);
@@ -240,4 +245,451 @@ extern "C" INSTRUCTION MakeBNE(size_t rs1, size_t rs2, int32_t delta)
     return retval;
 }
 
+extern "C" constexpr INSTRUCTION MakeBLT(size_t rs1, size_t rs2, int32_t delta)
+{
+    INSTRUCTION retval = MakeBEQ(rs1, rs2, delta);
+    retval.b_type.funct3 = 0x4;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeBGE(size_t rs1, size_t rs2, int32_t delta)
+{
+    INSTRUCTION retval = MakeBEQ(rs1, rs2, delta);
+    retval.b_type.funct3 = 0x5;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeBLTU(size_t rs1, size_t rs2, int32_t delta)
+{
+    INSTRUCTION retval = MakeBEQ(rs1, rs2, delta);
+    retval.b_type.funct3 = 0x6;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeBGEU(size_t rs1, size_t rs2, int32_t delta)
+{
+    INSTRUCTION retval = MakeBEQ(rs1, rs2, delta);
+    retval.b_type.funct3 = 0x7;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeANDI(size_t rd, size_t rs1, int32_t imm)
+{
+    INSTRUCTION retval = MakeADDI(rd, rs1, imm);
+    retval.i_type.funct3 = 0x7;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeSLTI(size_t rd, size_t rs1, int32_t imm)
+{
+    INSTRUCTION retval = MakeADDI(rd, rs1, imm);
+    retval.i_type.funct3 = 0x2;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeSLTIU(size_t rd, size_t rs1, int32_t imm)
+{
+    INSTRUCTION retval = MakeADDI(rd, rs1, imm);
+    retval.i_type.funct3 = 0x3;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeXORI(size_t rd, size_t rs1, int32_t imm)
+{
+    INSTRUCTION retval = MakeADDI(rd, rs1, imm);
+    retval.i_type.funct3 = 0x4;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeORI(size_t rd, size_t rs1, int32_t imm)
+{
+    INSTRUCTION retval = MakeADDI(rd, rs1, imm);
+    retval.i_type.funct3 = 0x6;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeSLLI(size_t rd, size_t rs1, size_t shamt)
+{
+    assert(shamt < 32);
+
+    INSTRUCTION retval = MakeADDI(rd, rs1, shamt);
+    retval.i_type.funct3 = 0x1;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeSRLI(size_t rd, size_t rs1, size_t shamt)
+{
+    assert(shamt < 32);
+
+    INSTRUCTION retval = MakeADDI(rd, rs1, shamt);
+    retval.i_type.funct3 = 0x5;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeSRAI(size_t rd, size_t rs1, size_t shamt)
+{
+    INSTRUCTION retval = MakeSRLI(rd, rs1, shamt);
+    retval.i_type.imm |= 0x400;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeXOR(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeADD(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x4;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeSLL(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeADD(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x1;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeSLT(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeADD(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x2;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeSLTU(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeADD(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x3;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeSRL(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeADD(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x5;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeSRA(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeSUB(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x5;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeOR(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeADD(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x6;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeAND(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeADD(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x7;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeLW(size_t rd, size_t rs1, int32_t imm)
+{
+    INSTRUCTION retval = MakeADDI(rd, rs1, imm);
+    retval.i_type.opcode = 0x03;
+    retval.i_type.funct3 = 0x2;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeLB(size_t rd, size_t rs1, int32_t imm)
+{
+    INSTRUCTION retval = MakeLW(rd, rs1, imm);
+    retval.i_type.funct3 = 0x0;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeLH(size_t rd, size_t rs1, int32_t imm)
+{
+    INSTRUCTION retval = MakeLW(rd, rs1, imm);
+    retval.i_type.funct3 = 0x1;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeLBU(size_t rd, size_t rs1, int32_t imm)
+{
+    INSTRUCTION retval = MakeLW(rd, rs1, imm);
+    retval.i_type.funct3 = 0x4;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeLHU(size_t rd, size_t rs1, int32_t imm)
+{
+    INSTRUCTION retval = MakeLW(rd, rs1, imm);
+    retval.i_type.funct3 = 0x5;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeSW(size_t rs2, size_t rs1, int32_t imm)
+{
+    assert(rs1 < 32);
+    assert(rs2 < 32);
+    assert((-2048 <= imm) && (imm < 2048));
+
+    S_TYPE retval{};
+    retval.opcode = 0x23;
+    retval.funct3 = 0x2;
+    retval.imm5   = (imm & 0x1f);
+    retval.imm7   = ((imm >> 5) & 0x7f);
+    retval.rs1    = rs1;
+    retval.rs2    = rs2;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeSB(size_t rs2, size_t rs1, int32_t imm)
+{
+    INSTRUCTION retval = MakeSW(rs2, rs1, imm);
+    retval.s_type.funct3 = 0x0;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeSH(size_t rs2, size_t rs1, int32_t imm)
+{
+    INSTRUCTION retval = MakeSW(rs2, rs1, imm);
+    retval.s_type.funct3 = 0x1;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeLUI(size_t rd, uint32_t imm20)
+{
+    assert(rd < 32);
+    assert(imm20 < (1 << 20));
+
+    U_TYPE retval{};
+    retval.opcode = 0x37;
+    retval.rd     = rd;
+    retval.imm    = imm20;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeAUIPC(size_t rd, uint32_t imm20)
+{
+    INSTRUCTION retval = MakeLUI(rd, imm20);
+    retval.u_type.opcode = 0x17;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeJAL(size_t rd, int32_t delta)
+{
+    assert(rd < 32);
+    assert((-(1 << 20) <= delta) && (delta < (1 << 20)));
+
+    J_TYPE retval{};
+    retval.opcode   = 0x6f;
+    retval.rd       = rd;
+    retval.imm20    = ((delta & 0x100000) >> 20);
+    retval.imm12_19 = ((delta & 0xff000)  >> 12);
+    retval.imm11    = ((delta & 0x800)    >> 11);
+    retval.imm1_10  = ((delta & 0x7fe)    >> 1);
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeJALR(size_t rd, size_t rs1, int32_t imm)
+{
+    INSTRUCTION retval = MakeADDI(rd, rs1, imm);
+    retval.i_type.opcode = 0x67;
+    return retval;
+}
+
+// FENCE rw, rw (a NOP: every engine keeps memory order)
+extern "C" constexpr INSTRUCTION MakeFENCE()
+{
+    INSTRUCTION retval = MakeADDI(0, 0, 0x033);
+    retval.i_type.opcode = 0x0f;
+    return retval;
+}
+
+// M extension
+extern "C" constexpr INSTRUCTION MakeMUL(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeADD(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x0;
+    retval.r_type.funct7 = 0x1;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeMULH(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeADD(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x1;
+    retval.r_type.funct7 = 0x1;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeMULHSU(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeADD(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x2;
+    retval.r_type.funct7 = 0x1;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeMULHU(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeADD(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x3;
+    retval.r_type.funct7 = 0x1;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeDIV(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeADD(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x4;
+    retval.r_type.funct7 = 0x1;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeDIVU(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeADD(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x5;
+    retval.r_type.funct7 = 0x1;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeREM(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeADD(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x6;
+    retval.r_type.funct7 = 0x1;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeREMU(size_t rd, size_t rs1, size_t rs2)
+{
+    INSTRUCTION retval = MakeADD(rd, rs1, rs2);
+    retval.r_type.funct3 = 0x7;
+    retval.r_type.funct7 = 0x1;
+    return retval;
+}
+
+// A extension, word only (aq/rl are ignored: harts synchronize at quantum boundaries)
+extern "C" constexpr INSTRUCTION MakeAMO(size_t funct5, size_t rd, size_t rs1, size_t rs2)
+{
+    assert(funct5 < 32);
+    assert(rd  < 32);
+    assert(rs1 < 32);
+    assert(rs2 < 32);
+
+    R_TYPE retval{};
+    retval.opcode = 0x2f;
+    retval.rd     = rd;
+    retval.rs1    = rs1;
+    retval.rs2    = rs2;
+    retval.funct3 = 2;
+    retval.funct7 = funct5 << 2;
+
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeLR(size_t rd, size_t rs1)
+{ return MakeAMO(0x02, rd, rs1, 0); }
+
+extern "C" constexpr INSTRUCTION MakeSC(size_t rd, size_t rs1, size_t rs2)
+{ return MakeAMO(0x03, rd, rs1, rs2); }
+
+extern "C" constexpr INSTRUCTION MakeECALL()
+{
+    I_TYPE retval{};
+    retval.opcode = 0x73;
+    retval.rd     = 0;
+    retval.rs1    = 0;
+    retval.funct3 = 0;
+    retval.imm    = 0;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeEBREAK()
+{
+    I_TYPE retval{};
+    retval.opcode = 0x73;
+    retval.rd     = 0;
+    retval.rs1    = 0;
+    retval.funct3 = 0;
+    retval.imm    = 1;
+    return retval;
+}
+
+// Zicsr: funct3 1 = CSRRW, 2 = CSRRS, 3 = CSRRC; 5, 6, 7 = the same with the 5-bit
+// immediate `rs1` instead of a register
+extern "C" constexpr INSTRUCTION MakeCSR(size_t funct3, size_t rd, size_t rs1, uint32_t csr)
+{
+    assert(funct3 != 0 && funct3 != 4 && funct3 < 8);
+    assert(rd  < 32);
+    assert(rs1 < 32);
+    assert(csr < 4096);
+
+    I_TYPE retval{};
+    retval.opcode = 0x73;
+    retval.rd     = rd;
+    retval.rs1    = rs1;
+    retval.funct3 = funct3;
+    retval.imm    = int32_t(csr << 20) >> 20;
+
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeCSRRW(size_t rd, uint32_t csr, size_t rs1)
+{ return MakeCSR(1, rd, rs1, csr); }
+
+extern "C" constexpr INSTRUCTION MakeCSRRS(size_t rd, uint32_t csr, size_t rs1)
+{ return MakeCSR(2, rd, rs1, csr); }
+
+extern "C" constexpr INSTRUCTION MakeCSRRC(size_t rd, uint32_t csr, size_t rs1)
+{ return MakeCSR(3, rd, rs1, csr); }
+
+extern "C" constexpr INSTRUCTION MakeCSRRWI(size_t rd, uint32_t csr, size_t uimm)
+{ return MakeCSR(5, rd, uimm, csr); }
+
+extern "C" constexpr INSTRUCTION MakeCSRRSI(size_t rd, uint32_t csr, size_t uimm)
+{ return MakeCSR(6, rd, uimm, csr); }
+
+extern "C" constexpr INSTRUCTION MakeCSRRCI(size_t rd, uint32_t csr, size_t uimm)
+{ return MakeCSR(7, rd, uimm, csr); }
+
+extern "C" constexpr INSTRUCTION MakeMRET()
+{
+    I_TYPE retval{};
+    retval.opcode = 0x73;
+    retval.rd     = 0;
+    retval.rs1    = 0;
+    retval.funct3 = 0;
+    retval.imm    = 0x302;
+    return retval;
+}
+
+extern "C" constexpr INSTRUCTION MakeWFI()
+{
+    I_TYPE retval{};
+    retval.opcode = 0x73;
+    retval.rd     = 0;
+    retval.rs1    = 0;
+    retval.funct3 = 0;
+    retval.imm    = 0x105;
+    return retval;
+}
+
+// SFENCE.VMA rs1, rs2 (the simulator flushes every address space)
+extern "C" constexpr INSTRUCTION MakeSFENCE_VMA(size_t rs1, size_t rs2)
+{
+    assert(rs1 < 32);
+    assert(rs2 < 32);
+
+    R_TYPE retval{};
+    retval.opcode = 0x73;
+    retval.rd     = 0;
+    retval.rs1    = rs1;
+    retval.rs2    = rs2;
+    retval.funct3 = 0;
+    retval.funct7 = 0x09;
+
+    return retval;
+}
+
 #endif // _ISA_H_
@@ -0,0 +1,820 @@
+#ifndef _JIT_H_
+#define _JIT_H_ 1
+
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+#include <sys/mman.h>
+
+#include "ISA.h"
+#include "Engine.h"
+#include "MMU.h"
+#include "CSR.h"
+#include "Spin.h"
+#include "Pipeline.h"
+
+/**
+    Dynamic binary translator: guest basic blocks are translated to x86-64 code
+    on first execution and run natively afterwards.
+
+    The guest registers live in a pinned Context (rbx), DataMemory in r12.
+    A block ends at a branch, jump, trapping instruction, AMO, CSR instruction or
+    after MAX_BLOCK_INSTRUCTIONS. Exits to a known target are chained: once the target
+    is translated the exit jumps straight into it. JALR and traps return to the
+    dispatcher.
+
+    Decoding goes through ControlUnit::Decode and the semantics follow the
+    pipeline's ALU, Comparator and DataMemory, so the architectural state matches
+    the other engines. Functional only: one cycle per instruction, plus the cycles
+    WFI sleeps. Interrupts are taken between blocks: the budget check on block
+    entry brings chained blocks back to the dispatcher by the next CLINT event.
+
+    The program is in its own InstructionMemory, which guest stores cannot
+    reach, so translations never go stale and need no invalidation.
+
+    Without an x86-64 host (or executable memory) every instruction is interpreted,
+    and so is everything while Sv32 translation is on (see MMU.h).
+*/
+class JitEngine : public Engine
+{
+private:
+    // Guest state the translated code works on (rbx points here)
+    struct Context
+    {
+        uint32_t  regs[32];
+        uint32_t  pc;
+        uint32_t  trap;         // TrapCode() of the last exit, NO_TRAP otherwise
+        uint64_t  instructions; // retired
+        uint64_t  limit;        // blocks return to the dispatcher once reached
+        uint32_t* memory;
+    };
+
+    // Prologue: enters `block` with rbx = context, r12 = memory; returns the exit to chain (or nullptr)
+    typedef uint8_t* (*EntryPoint)(Context* context, uint8_t* block);
+
+    static constexpr size_t CODE_SIZE              = 4 << 20;
+    static constexpr size_t MAX_BLOCK_INSTRUCTIONS = 64;
+    static constexpr size_t MAX_BLOCK_BYTES        = MAX_BLOCK_INSTRUCTIONS * 128;
+
+    static constexpr uint8_t EAX = 0;
+    static constexpr uint8_t ECX = 1;
+    static constexpr uint8_t EDX = 2;
+
+    // Out-of-line exit of the block being translated (load/store faults, budget)
+    struct Stub
+    {
+        size_t   fixup; // rel32 of the jcc to this stub
+        uint32_t pc;
+        uint32_t trap;
+        size_t   count; // instructions retired before it
+    };
+
+public:
+    const char* Name() const override
+    { return "jit"; }
+
+    const MachineState& Run() override
+    {
+        while (state.status == RUNNING)
+            RunFor(SIZE_MAX);
+        return state;
+    }
+
+    // One cycle per instruction; stops between blocks
+    const MachineState& RunFor(size_t instructions) override
+    {
+        uint64_t end = (instructions > UINT64_MAX - context.instructions) ? UINT64_MAX : context.instructions + instructions;
+        Remap();
+
+        while (state.status == RUNNING && context.instructions < end)
+        {
+            uint32_t    pc = context.pc;
+            INSTRUCTION instruction;
+            uint32_t    length, cause;
+            uint32_t    tval = 0; // the instruction, if it was interpreted
+
+            if ((cause = csrs.Interrupt(Cycles())) != 0)
+            {
+                pending_link = nullptr;
+                state.Trap(cause, pc);
+                TakeTrap();
+                continue;
+            }
+
+            // blocks come back to the dispatcher by the time an interrupt may be pending
+            uint64_t wake = csrs.NextInterrupt();
+            context.limit = std::min(end, wake > idle ? wake - idle : 0);
+
+            if (!mmu.Fetch(fetch, memory, pc, instruction, length, cause))
+            {
+                pending_link = nullptr;
+                state.Trap(cause, pc);
+                TakeTrap();
+                continue;
+            }
+
+            if (code == nullptr || IsInterpreted(instruction) || mmu.Enabled())
+            {
+                pending_link = nullptr;
+                tval         = instruction.raw;
+                Interpret(instruction, length);
+            }
+            else
+            {
+                uint8_t* block = blocks[pc >> 1];
+                if (block == nullptr)
+                    block = Translate(pc);
+
+                if (pending_link != nullptr && pending_generation == generation)
+                {
+                    // nothing is chained to a spin loop head, so every iteration comes back here
+                    if (fast_forward && spin.Closes(fetch, pc))
+                    {
+                        FastForward();
+                        if (state.status != RUNNING)
+                            continue;
+                    }
+                    else
+                    {
+                        Patch(pending_link + 1, block);
+                        ++chained;
+                    }
+                }
+
+                ++dispatches;
+                pending_link       = reinterpret_cast<EntryPoint>(code)(&context, block);
+                pending_generation = generation;
+            }
+
+            if (context.trap != NO_TRAP)
+            {
+                pending_link = nullptr;
+                state.Trap(context.trap - 1, context.pc, tval);
+                context.trap = NO_TRAP;
+                TakeTrap();
+            }
+        }
+        return state;
+    }
+
+public:
+    size_t Cycles() const override
+    { return context.instructions + idle; }
+    size_t Instructions() const override
+    { return context.instructions; }
+
+    uint32_t Register(size_t index) const override
+    { return context.regs[index]; }
+    void SetRegister(size_t index, uint32_t value) override
+    {
+        if (index != 0)
+            context.regs[index] = value;
+    }
+
+    const uint32_t* Memory() const override
+    { return memory.data(); }
+    uint32_t* Memory() override
+    { return memory.data(); }
+    size_t MemorySize() const override
+    { return memory.size(); }
+
+    void AttachMemory(uint32_t* words, size_t size) override
+    {
+        memory.Attach(words, size);
+        Remap();
+    }
+
+    GuestMemory& Guest() override
+    { return memory; }
+    const GuestMemory& Guest() const override
+    { return memory; }
+
+    Mmu& MMU() override
+    { return mmu; }
+    const Mmu& MMU() const override
+    { return mmu; }
+
+    CsrFile& Csrs() override
+    { return csrs; }
+    const CsrFile& Csrs() const override
+    { return csrs; }
+
+    void Idle(size_t cycles) override
+    { idle += cycles; }
+
+    void Rewind(uint32_t pc, size_t cycle, size_t instructions) override
+    {
+        context.pc           = pc;
+        context.instructions = instructions;
+        idle                 = cycle > instructions ? cycle - instructions : 0;
+        reservation.valid    = false;
+        state                = MachineState();
+    }
+
+    // Only the TLBs are modeled
+    uint64_t Events(PerformanceEvent event) const override
+    {
+        switch (event)
+        {
+        case EVENT_ITLB_MISSES: return mmu.ItlbMisses();
+        case EVENT_DTLB_MISSES: return mmu.DtlbMisses();
+        default:                return 0;
+        }
+    }
+
+    void PrintStatistics(std::ostream& out) const override
+    {
+        out << "instructions = " << context.instructions << '\n';
+        if (code == nullptr)
+        {
+            out << "interpreted (no x86-64 code buffer)\n";
+        }
+        else
+        {
+            out << "blocks translated = " << translated << " (" << translated_instructions << " instructions)\n";
+            out << "code size         = " << used << " bytes, flushes = " << flushes << '\n';
+            out << "dispatches        = " << dispatches << ", chained exits = " << chained << '\n';
+        }
+        mmu.PrintStatistics(out);
+        spin.PrintStatistics(out);
+        out.flush();
+    }
+
+protected:
+    void Fence() override
+    { mmu.Flush(); }
+
+    // A CSR instruction retires once it has executed
+    bool AccessCsr(MachineState& trap) override
+    {
+        if (!csrs.Execute(*this, trap))
+            return false;
+        if (trap.cause == CAUSE_CSR)
+            ++context.instructions;
+        return true;
+    }
+
+public:
+    JitEngine(const INSTRUCTION* program, size_t size):
+        program                (program, program + size),
+        memory                 (1000),
+        mapped                 (0),
+        context                (),
+        idle                   (0),
+        code                   (nullptr),
+        used                   (0),
+        generation             (0),
+        pending_link           (nullptr),
+        pending_generation     (0),
+        blocks                 (2 * size, nullptr),
+        translated             (0),
+        translated_instructions(0),
+        dispatches             (0),
+        chained                (0),
+        flushes                (0)
+    {
+        context.trap   = NO_TRAP;
+        context.memory = memory.data();
+        fetch.Attach(this->program.data(), this->program.size());
+
+#if defined(__x86_64__)
+        void* buffer = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer != MAP_FAILED)
+        {
+            code = static_cast<uint8_t*>(buffer);
+            Flush();
+            flushes = 0;
+        }
+#endif
+    }
+
+    ~JitEngine()
+    {
+        if (code != nullptr)
+            munmap(code, CODE_SIZE);
+    }
+
+    JitEngine(const JitEngine&) = delete;
+    JitEngine& operator=(const JitEngine&) = delete;
+
+private:
+    void TakeTrap()
+    {
+        if (HandleTrap())
+            context.pc = state.pc;
+        Remap(); // the handler may have mapped memory
+    }
+
+    // A chained exit reached a spin loop head: once its iterations repeat, skips
+    // them up to the block budget (the next event or the end of RunFor)
+    void FastForward()
+    {
+        if (!spin.Steady(*this))
+            return;
+        if (context.limit == UINT64_MAX)
+        {
+            state.Fail("spin loop that nothing can end");
+            return;
+        }
+        context.instructions += spin.Skip(context.limit + idle).instructions;
+    }
+
+    // Translations have the memory size and read-only pages built in
+    void Remap()
+    {
+        if (memory.Generation() == mapped)
+            return;
+
+        mapped         = memory.Generation();
+        context.memory = memory.data();
+        if (code != nullptr)
+            Flush();
+    }
+
+    // AMOs, CSR instructions, MRET and WFI are never translated, the dispatcher interprets them
+    static bool IsInterpreted(INSTRUCTION instruction)
+    {
+        return instruction.opcode() == 0x2f ||
+               (instruction.opcode() == 0x73 && (instruction.r_type.funct3 != 0 || instruction.raw == MakeMRET().raw || instruction.raw == MakeWFI().raw));
+    }
+
+    // Reference path: one instruction at context.pc (`length` bytes, in its 32-bit form)
+    void Interpret(INSTRUCTION instruction, uint32_t length)
+    {
+        uint32_t pc = context.pc;
+        uint32_t trap;
+
+        ControlUnitFlags flags = ControlUnit::Decode(instruction, trap);
+        if (trap != NO_TRAP)
+        {
+            context.trap = trap;
+            return;
+        }
+
+        uint32_t rs1   = context.regs[instruction.r_type.rs1];
+        uint32_t rs2   = context.regs[instruction.r_type.rs2];
+        uint32_t left  = flags.SRC1 == 0 ? rs1 : flags.SRC1 == 1 ? pc : 0;
+        uint32_t right = flags.SRC2 == 0 ? rs2 : flags.SRC2 == 6 ? length : Immediate::Select(instruction, flags.SRC2);
+        uint32_t next  = pc + length;
+
+        if (flags.BRN_COND)
+        {
+            if (Comparator::Compute(flags.ALUOP, rs1, rs2))
+                next = pc + Immediate::SBType(instruction);
+        }
+        else
+        {
+            if (flags.JUMP == 1)
+                next = pc + Immediate::UJType(instruction);
+            if (flags.JUMP == 2)
+                next = (rs1 + Immediate::IType(instruction)) & ~1u;
+
+            uint32_t result = flags.MULDIV ? ArithmeticLogicUnit::MultiplyDivide(flags.ALUOP, left, right)
+                                           : ArithmeticLogicUnit::Compute(flags.ALUOP, flags.ALT, left, right);
+            uint32_t funct3 = instruction.r_type.funct3;
+            uint32_t cause;
+
+            if ((flags.MEM_WEN || flags.MEM2REG) && mmu.Enabled() && !mmu.TranslateData(memory, result, flags.MEM_WEN || flags.AMO, result, cause))
+            {
+                context.trap = TrapCode(cause);
+                return;
+            }
+            if (((flags.MEM_WEN || flags.MEM2REG) && result >= memory.size()) || ((flags.MEM_WEN || flags.AMO) && !memory.Writable(result)))
+            {
+                context.trap = TrapCode(flags.MEM_WEN || flags.AMO ? CAUSE_STORE_ACCESS : CAUSE_LOAD_ACCESS);
+                return;
+            }
+            if (flags.MEM_WEN)
+                DataMemory::Store(memory.data(), memory.size(), result, funct3, rs2);
+            if (flags.AMO)
+                result = DataMemory::Atomic(memory.data(), result, instruction.r_type.funct7 >> 2, rs2, reservation);
+            else if (flags.MEM2REG)
+                result = DataMemory::Load(memory.data(), memory.size(), result, funct3);
+
+            if (flags.REG_WEN && instruction.r_type.rd != 0)
+                context.regs[instruction.r_type.rd] = result;
+        }
+
+        context.pc = next;
+        ++context.instructions;
+    }
+
+private:
+    // Drops every block and starts the buffer over with the prologue and epilogue
+    void Flush()
+    {
+        used = 0;
+        std::fill(blocks.begin(), blocks.end(), nullptr);
+        pending_link = nullptr;
+        ++generation;
+        ++flushes;
+
+        // prologue (code + 0): push rbx; push r12; mov rbx, rdi; mov r12, [rbx + memory]; jmp rsi
+        Byte(0x53);
+        Bytes({0x41, 0x54});
+        Bytes({0x48, 0x89, 0xfb});
+        Byte(0x4c);
+        Field(0x8b, 4, offsetof(Context, memory)); // r12 (REX.R)
+        Bytes({0xff, 0xe6});
+
+        // epilogue: pop r12; pop rbx; ret
+        epilogue = used;
+        Bytes({0x41, 0x5c});
+        Byte(0x5b);
+        Byte(0xc3);
+    }
+
+    uint8_t* Translate(uint32_t start)
+    {
+        if (CODE_SIZE - used < MAX_BLOCK_BYTES)
+            Flush();
+
+        uint8_t*          block = code + used;
+        std::vector<Stub> stubs;
+
+        // budget: mov rax, [rbx + instructions]; cmp rax, [rbx + limit]; jae exit
+        Byte(0x48);
+        Field(0x8b, EAX, offsetof(Context, instructions));
+        Byte(0x48);
+        Field(0x3b, EAX, offsetof(Context, limit));
+        stubs.push_back({Jcc(0x83), start, NO_TRAP, 0});
+
+        uint32_t pc    = start;
+        size_t   count = 0;
+        bool     open  = true;
+
+        while (open)
+        {
+            INSTRUCTION instruction;
+            uint32_t    length, cause, trap;
+
+            // the dispatcher traps on a fetch fault after the first instruction
+            if (!fetch.Fetch(pc, instruction, length, cause))
+            {
+                Exit(pc, count, true);
+                break;
+            }
+
+            ControlUnitFlags flags = ControlUnit::Decode(instruction, trap);
+            size_t           rd    = instruction.r_type.rd;
+            size_t           rs1   = instruction.r_type.rs1;
+            size_t           rs2   = instruction.r_type.rs2;
+
+            if (trap != NO_TRAP && trap != TrapCode(CAUSE_CSR))
+            {
+                Exit(pc, count, false, trap);
+                break;
+            }
+            if (flags.AMO || trap != NO_TRAP)
+            {
+                // the dispatcher interprets it
+                Exit(pc, count, false);
+                break;
+            }
+
+            if (flags.BRN_COND)
+            {
+                static const uint8_t JCC[8] = {0x84, 0x85, 0, 0, 0x8c, 0x8d, 0x82, 0x83}; // je jne - - jl jge jb jae
+
+                LoadRegister(EAX, rs1);
+                LoadRegister(ECX, rs2);
+                Bytes({0x39, 0xc8}); // cmp eax, ecx
+                size_t taken = Jcc(JCC[flags.ALUOP]);
+                Exit(pc + length, count + 1, true);
+                Patch(code + taken, code + used);
+                Exit(pc + Immediate::SBType(instruction), count + 1, true);
+                break;
+            }
+
+            // ALU LEFT in eax, ALU RIGHT in ecx
+            if (flags.SRC1 == 0)
+                LoadRegister(EAX, rs1);
+            else
+                MoveImmediate(EAX, flags.SRC1 == 1 ? pc : 0);
+            if (flags.SRC2 == 0)
+                LoadRegister(ECX, rs2);
+            else
+                MoveImmediate(ECX, flags.SRC2 == 6 ? length : Immediate::Select(instruction, flags.SRC2));
+
+            if (flags.JUMP == 2)
+            {
+                // edx = (rs1 + imm) & ~1, before rd is written
+                LoadRegister(EDX, rs1);
+                Bytes({0x81, 0xc2});
+                Dword(Immediate::IType(instruction));
+                Bytes({0x83, 0xe2, 0xfe});
+            }
+
+            if (flags.MULDIV)
+                MultiplyDivide(flags.ALUOP);
+            else
+                Arithmetic(flags.ALUOP, flags.ALT);
+
+            if (flags.MEM_WEN || flags.MEM2REG)
+            {
+                // cmp eax, size; jae fault
+                Byte(0x3d);
+                Dword(memory.size());
+                stubs.push_back({Jcc(0x83), pc, TrapCode(flags.MEM_WEN ? CAUSE_STORE_ACCESS : CAUSE_LOAD_ACCESS), count});
+            }
+
+            if (flags.MEM_WEN && !memory.ReadOnlyPages().empty())
+            {
+                // mov edx, eax; shr edx, 10; mov rcx, pages; cmp byte [rcx + rdx], 0; jne fault
+                Bytes({0x89, 0xc2});
+                Bytes({0xc1, 0xea, 0x0a});
+                Bytes({0x48, 0xb9});
+                Qword(uint64_t(memory.ReadOnlyPages().data()));
+                Bytes({0x80, 0x3c, 0x11, 0x00});
+                stubs.push_back({Jcc(0x85), pc, TrapCode(CAUSE_STORE_ACCESS), count});
+            }
+
+            if (flags.MEM_WEN)
+            {
+                LoadRegister(ECX, rs2);
+                switch (instruction.s_type.funct3)
+                {
+                case 0:
+                    Bytes({0x41, 0x88, 0x0c, 0x84}); // mov [r12 + rax * 4], cl
+                    break;
+                case 1:
+                    Bytes({0x66, 0x41, 0x89, 0x0c, 0x84}); // mov [r12 + rax * 4], cx
+                    break;
+                default:
+                    Bytes({0x41, 0x89, 0x0c, 0x84}); // mov [r12 + rax * 4], ecx
+                    break;
+                }
+            }
+
+            if (flags.MEM2REG)
+            {
+                Bytes({0x41, 0x8b, 0x04, 0x84}); // mov eax, [r12 + rax * 4]
+                switch (instruction.i_type.funct3)
+                {
+                case 0:
+                    Bytes({0x0f, 0xbe, 0xc0}); // movsx eax, al
+                    break;
+                case 1:
+                    Bytes({0x0f, 0xbf, 0xc0}); // movsx eax, ax
+                    break;
+                case 4:
+                    Bytes({0x0f, 0xb6, 0xc0}); // movzx eax, al
+                    break;
+                case 5:
+                    Bytes({0x0f, 0xb7, 0xc0}); // movzx eax, ax
+                    break;
+                }
+            }
+
+            if (flags.REG_WEN && rd != 0)
+                Field(0x89, EAX, 4 * rd); // mov [rbx + rd], eax
+
+            ++count;
+            pc += length;
+
+            if (flags.JUMP == 1)
+            {
+                Exit(pc - length + Immediate::UJType(instruction), count, true);
+                open = false;
+            }
+            else if (flags.JUMP == 2)
+            {
+                Retire(count);
+                Field(0x89, EDX, offsetof(Context, pc)); // mov [rbx + pc], edx
+                Leave(false);
+                open = false;
+            }
+            else if (count == MAX_BLOCK_INSTRUCTIONS)
+            {
+                Exit(pc, count, true);
+                open = false;
+            }
+        }
+
+        for (const Stub& stub : stubs)
+        {
+            Patch(code + stub.fixup, code + used);
+            Exit(stub.pc, stub.count, false, stub.trap);
+        }
+
+        blocks[start >> 1] = block;
+        ++translated;
+        translated_instructions += count;
+        return block;
+    }
+
+    // Block exit: retires `count` instructions, sets the guest pc and the trap
+    void Exit(uint32_t pc, size_t count, bool chain, uint32_t trap = NO_TRAP)
+    {
+        Retire(count);
+        Field(0xc7, 0, offsetof(Context, pc)); // mov dword [rbx + pc], pc
+        Dword(pc);
+        if (trap != NO_TRAP)
+        {
+            Field(0xc7, 0, offsetof(Context, trap));
+            Dword(trap);
+        }
+        Leave(chain);
+    }
+
+    void Retire(size_t count)
+    {
+        if (count == 0)
+            return;
+
+        Byte(0x48); // add qword [rbx + instructions], count
+        Field(0x81, 0, offsetof(Context, instructions));
+        Dword(count);
+    }
+
+    // Returns to the dispatcher; a chained exit returns the address of its jmp,
+    // which the dispatcher later points at the translated target
+    void Leave(bool chain)
+    {
+        if (chain)
+            Bytes({0x48, 0x8d, 0x05, 0x00, 0x00, 0x00, 0x00}); // lea rax, [rip] (the jmp below)
+        else
+            Bytes({0x31, 0xc0}); // xor eax, eax
+
+        Byte(0xe9); // jmp epilogue
+        Dword(0);
+        Patch(code + used - 4, code + epilogue);
+    }
+
+    void LoadRegister(uint8_t reg, size_t index)
+    {
+        if (index == 0)
+            Bytes({0x31, uint8_t(0xc0 | (reg << 3) | reg)}); // xor reg, reg
+        else
+            Field(0x8b, reg, 4 * index); // mov reg, [rbx + index]
+    }
+
+    // eax = eax op ecx, like ArithmeticLogicUnit::Compute
+    void Arithmetic(uint32_t ALUOP, bool ALT)
+    {
+        switch (ALUOP)
+        {
+        case ArithmeticLogicUnit::ADD:
+            Bytes({uint8_t(ALT ? 0x29 : 0x01), 0xc8}); // sub / add eax, ecx
+            break;
+        case ArithmeticLogicUnit::SL:
+            Bytes({0xd3, 0xe0}); // shl eax, cl
+            break;
+        case ArithmeticLogicUnit::SR:
+            Bytes({0xd3, uint8_t(ALT ? 0xf8 : 0xe8)}); // sar / shr eax, cl
+            break;
+        case ArithmeticLogicUnit::SLT:
+        case ArithmeticLogicUnit::SLTU:
+            Bytes({0x39, 0xc8}); // cmp eax, ecx; setl / setb al; movzx eax, al
+            Bytes({0x0f, uint8_t(ALUOP == ArithmeticLogicUnit::SLT ? 0x9c : 0x92), 0xc0});
+            Bytes({0x0f, 0xb6, 0xc0});
+            break;
+        case ArithmeticLogicUnit::XOR:
+            Bytes({0x31, 0xc8});
+            break;
+        case ArithmeticLogicUnit::OR:
+            Bytes({0x09, 0xc8});
+            break;
+        case ArithmeticLogicUnit::AND:
+            Bytes({0x21, 0xc8});
+            break;
+        }
+    }
+
+    // eax = eax op ecx for the M extension; divides call ArithmeticLogicUnit::MultiplyDivide
+    void MultiplyDivide(uint32_t funct3)
+    {
+        switch (funct3)
+        {
+        case ArithmeticLogicUnit::MUL:
+            Bytes({0x0f, 0xaf, 0xc1}); // imul eax, ecx
+            return;
+        case ArithmeticLogicUnit::MULH:
+            Bytes({0x48, 0x63, 0xc0}); // movsxd rax, eax
+            Bytes({0x48, 0x63, 0xc9}); // movsxd rcx, ecx
+            break;
+        case ArithmeticLogicUnit::MULHSU:
+            Bytes({0x48, 0x63, 0xc0}); // movsxd rax, eax
+            Bytes({0x89, 0xc9});       // mov ecx, ecx (zero-extends)
+            break;
+        case ArithmeticLogicUnit::MULHU:
+            Bytes({0x89, 0xc0});       // mov eax, eax
+            Bytes({0x89, 0xc9});       // mov ecx, ecx
+            break;
+        default:
+        {
+            // the RISC-V results for a zero divisor and overflow, where div/idiv would fault;
+            // rbx and r12 are callee-saved, rsp is 8 mod 16 inside blocks
+            uint32_t (*helper)(uint32_t, uint32_t, uint32_t) = &ArithmeticLogicUnit::MultiplyDivide;
+            uint64_t address = reinterpret_cast<uint64_t>(helper);
+
+            Byte(0xbf);                      // mov edi, funct3
+            Dword(funct3);
+            Bytes({0x89, 0xc6});             // mov esi, eax
+            Bytes({0x89, 0xca});             // mov edx, ecx
+            Bytes({0x48, 0xb8});             // mov rax, helper
+            Dword(uint32_t(address));
+            Dword(uint32_t(address >> 32));
+            Bytes({0x48, 0x83, 0xec, 0x08}); // sub rsp, 8
+            Bytes({0xff, 0xd0});             // call rax
+            Bytes({0x48, 0x83, 0xc4, 0x08}); // add rsp, 8
+            return;
+        }
+        }
+
+        Bytes({0x48, 0x0f, 0xaf, 0xc1}); // imul rax, rcx
+        Bytes({0x48, 0xc1, 0xe8, 0x20}); // shr rax, 32
+    }
+
+    void MoveImmediate(uint8_t reg, uint32_t value)
+    {
+        Byte(0xb8 + reg);
+        Dword(value);
+    }
+
+    // opcode with a [rbx + offset] operand
+    void Field(uint8_t opcode, uint8_t reg, size_t offset)
+    {
+        Byte(opcode);
+        if (offset < 0x80)
+        {
+            Byte(0x43 | (reg << 3));
+            Byte(offset);
+        }
+        else
+        {
+            Byte(0x83 | (reg << 3));
+            Dword(offset);
+        }
+    }
+
+    // jcc rel32 (to be patched); returns the offset of rel32
+    size_t Jcc(uint8_t condition)
+    {
+        Bytes({0x0f, condition});
+        Dword(0);
+        return used - 4;
+    }
+
+    static void Patch(uint8_t* rel32, const uint8_t* target)
+    {
+        int32_t displacement = int32_t(target - (rel32 + 4));
+        memcpy(rel32, &displacement, sizeof(displacement));
+    }
+
+    void Byte(uint8_t value)
+    { code[used++] = value; }
+
+    void Bytes(std::initializer_list<uint8_t> values)
+    {
+        for (uint8_t value : values)
+            Byte(value);
+    }
+
+    void Dword(uint32_t value)
+    {
+        memcpy(code + used, &value, sizeof(value));
+        used += sizeof(value);
+    }
+
+    void Qword(uint64_t value)
+    {
+        memcpy(code + used, &value, sizeof(value));
+        used += sizeof(value);
+    }
+
+private:
+    std::vector<INSTRUCTION> program;
+    ExpansionCache           fetch;
+    GuestMemory              memory;
+    size_t                   mapped; // memory.Generation() the translations were made for
+    Mmu                      mmu;
+    CsrFile                  csrs;
+    Reservation              reservation;
+    Context                  context;
+    uint64_t                 idle; // cycles skipped by WFI
+
+    uint8_t* code; // CODE_SIZE bytes: prologue, epilogue, blocks
+    size_t   used;
+    size_t   epilogue;
+    size_t   generation; // bumped by Flush()
+
+    uint8_t* pending_link; // chained exit taken by the last dispatch
+    size_t   pending_generation;
+
+    SpinDetector spin;
+
+    std::vector<uint8_t*> blocks; // translation by pc / 2
+
+    size_t translated;
+    size_t translated_instructions;
+    size_t dispatches;
+    size_t chained;
+    size_t flushes;
+};
+
+#endif // _JIT_H_
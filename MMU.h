@@ -0,0 +1,300 @@
+#ifndef _MMU_H_
+#define _MMU_H_ 1
+
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+#include "ISA.h"
+#include "RVC.h"
+#include "Engine.h"
+
+/**
+    Sv32 virtual memory.
+
+    satp (MODE = bit 31, PPN = bits 21:0) turns translation on for fetch, loads and
+    stores. The machine has no privilege levels, so every access is checked like
+    S-mode with SUM set: U pages are accessible too.
+
+    Page tables live in DataMemory. A table is one page of 1024 PTE words, and the
+    PTE for VPN[i] is word PPN * 1024 + VPN[i]. Data addresses are word addresses,
+    so word A has the virtual byte address 4 A (A below 2^30) and its physical word
+    is PPN * 1024 + A % 1024. Fetch translates the pc, and the PPN of an executable
+    leaf points into the program image. The walker does not set A and D: a leaf
+    without A, or a store to a leaf without D, faults (Svade).
+
+    Fetch and data each have a direct-mapped software TLB. The entry of virtual
+    page VPN is entries[VPN % size], tagged with VPN and holding the physical page
+    and the leaf's permission bits. A hit costs an index and a compare. A miss
+    walks the tables and is charged the modeled walk latency. A satp write and
+    SFENCE.VMA flush both TLBs.
+*/
+
+struct MmuConfig
+{
+    size_t itlb_entries = 32; // power of two
+    size_t dtlb_entries = 64;
+    size_t walk_latency = 20; // cycles of a TLB miss
+};
+
+class Mmu
+{
+public:
+    // PTE bits
+    static constexpr uint32_t PTE_V = 1 << 0;
+    static constexpr uint32_t PTE_R = 1 << 1;
+    static constexpr uint32_t PTE_W = 1 << 2;
+    static constexpr uint32_t PTE_X = 1 << 3;
+    static constexpr uint32_t PTE_A = 1 << 6;
+    static constexpr uint32_t PTE_D = 1 << 7;
+
+    enum Access
+    {
+        FETCH,
+        LOAD,
+        STORE, // and AMOs
+    };
+
+public:
+    explicit Mmu(const MmuConfig& config = MmuConfig()):
+        satp   (0),
+        config (config),
+        itlb   (config.itlb_entries),
+        dtlb   (config.dtlb_entries),
+        latency(0),
+        faults (0)
+    {
+        if (!Tlb::PowerOfTwo(config.itlb_entries) || !Tlb::PowerOfTwo(config.dtlb_entries))
+            throw "MMU: TLB sizes must be powers of two";
+    }
+
+    void Configure(const MmuConfig& config)
+    {
+        *this = Mmu(config);
+    }
+
+    uint32_t Satp() const
+    { return satp; }
+
+    void SetSatp(uint32_t value)
+    {
+        satp = value;
+        Flush();
+    }
+
+    bool Enabled() const
+    { return (satp >> 31) != 0; }
+
+    // SFENCE.VMA (every address space)
+    void Flush()
+    {
+        itlb.Flush();
+        dtlb.Flush();
+    }
+
+    // Physical word of data word `address`; false with `cause` set on a fault
+    bool TranslateData(const GuestMemory& memory, uint32_t address, bool store, uint32_t& physical, uint32_t& cause)
+    {
+        Access access = store ? STORE : LOAD;
+        if (address >= (1u << 30))
+        {
+            cause = Fault(access);
+            return false;
+        }
+
+        uint32_t ppn;
+        if (!Translate(dtlb, memory, address >> 10, access, ppn, cause))
+            return false;
+        physical = (ppn << 10) | (address & 0x3ff);
+        return true;
+    }
+
+    // ExpansionCache::Fetch at virtual `pc`; a 32-bit instruction may straddle two pages
+    bool Fetch(ExpansionCache& cache, const GuestMemory& memory, uint32_t pc, INSTRUCTION& instruction, uint32_t& length, uint32_t& cause)
+    {
+        if (!Enabled())
+            return cache.Fetch(pc, instruction, length, cause);
+
+        uint32_t physical;
+        if ((pc & 0x1) != 0)
+        {
+            cause = CAUSE_FETCH_MISALIGNED;
+            return false;
+        }
+        if (!TranslateFetch(memory, pc, physical, cause))
+            return false;
+        if ((pc & 0xfff) != 0xffe || !cache.Contains(physical) || InstructionLength(cache.Parcel(physical)) == 2)
+            return cache.Fetch(physical, instruction, length, cause);
+
+        // the upper parcel is on the next virtual page
+        uint32_t upper;
+        if (!TranslateFetch(memory, pc + 2, upper, cause))
+            return false;
+        if (!cache.Contains(upper))
+        {
+            cause = CAUSE_FETCH_ACCESS;
+            return false;
+        }
+        instruction = INSTRUCTION(cache.Parcel(physical) | uint32_t(cache.Parcel(upper)) << 16);
+        length      = 4;
+        return true;
+    }
+
+    size_t ItlbMisses() const
+    { return itlb.misses; }
+    size_t DtlbMisses() const
+    { return dtlb.misses; }
+
+    // Walk cycles charged since the last call
+    size_t TakeLatency()
+    {
+        size_t cycles = latency;
+        latency = 0;
+        return cycles;
+    }
+
+    void PrintStatistics(std::ostream& out) const
+    {
+        if (itlb.hits + itlb.misses + dtlb.hits + dtlb.misses == 0)
+            return;
+        out << "ITLB: " << itlb.hits << " hits, " << itlb.misses << " misses (" << itlb.entries.size() << " entries)\n";
+        out << "DTLB: " << dtlb.hits << " hits, " << dtlb.misses << " misses (" << dtlb.entries.size() << " entries)\n";
+        out << "faulting translations = " << faults << ", walk latency = " << config.walk_latency << '\n';
+    }
+
+private:
+    struct Tlb
+    {
+        struct Entry
+        {
+            uint32_t vpn   = 0;
+            uint32_t ppn   = 0;
+            uint32_t flags = 0; // leaf PTE bits, 0 = empty
+        };
+
+        explicit Tlb(size_t size):
+            entries(size),
+            hits   (0),
+            misses (0)
+        {}
+
+        static bool PowerOfTwo(size_t size)
+        { return size != 0 && (size & (size - 1)) == 0; }
+
+        void Flush()
+        { std::fill(entries.begin(), entries.end(), Entry()); }
+
+        std::vector<Entry> entries;
+        size_t             hits;
+        size_t             misses;
+    };
+
+    static uint32_t Fault(Access access)
+    { return access == FETCH ? CAUSE_FETCH_PAGE_FAULT : access == LOAD ? CAUSE_LOAD_PAGE_FAULT : CAUSE_STORE_PAGE_FAULT; }
+
+    static uint32_t AccessFault(Access access)
+    { return access == FETCH ? CAUSE_FETCH_ACCESS : access == LOAD ? CAUSE_LOAD_ACCESS : CAUSE_STORE_ACCESS; }
+
+    // The leaf bits `access` needs
+    static bool Permits(uint32_t flags, Access access)
+    {
+        switch (access)
+        {
+        case FETCH: return (flags & PTE_X) != 0;
+        case LOAD:  return (flags & PTE_R) != 0;
+        default:    return (flags & (PTE_W | PTE_D)) == (PTE_W | PTE_D);
+        }
+    }
+
+    bool TranslateFetch(const GuestMemory& memory, uint32_t pc, uint32_t& physical, uint32_t& cause)
+    {
+        uint32_t ppn;
+        if (!Translate(itlb, memory, pc >> 12, FETCH, ppn, cause))
+            return false;
+        if (ppn >= (1u << 20))
+        {
+            cause = CAUSE_FETCH_ACCESS;
+            return false;
+        }
+        physical = (ppn << 12) | (pc & 0xfff);
+        return true;
+    }
+
+    bool Translate(Tlb& tlb, const GuestMemory& memory, uint32_t vpn, Access access, uint32_t& ppn, uint32_t& cause)
+    {
+        Tlb::Entry& entry = tlb.entries[vpn & (tlb.entries.size() - 1)];
+        if (entry.flags != 0 && entry.vpn == vpn)
+        {
+            ++tlb.hits;
+        }
+        else
+        {
+            ++tlb.misses;
+            latency += config.walk_latency;
+            if (!Walk(memory, vpn, access, entry, cause))
+            {
+                entry = Tlb::Entry();
+                ++faults;
+                return false;
+            }
+        }
+
+        if (!Permits(entry.flags, access))
+        {
+            cause = Fault(access);
+            ++faults;
+            return false;
+        }
+        ppn = entry.ppn;
+        return true;
+    }
+
+    // Two-level Sv32 walk of virtual page `vpn` into `entry`
+    bool Walk(const GuestMemory& memory, uint32_t vpn, Access access, Tlb::Entry& entry, uint32_t& cause)
+    {
+        uint32_t table = satp & 0x3fffff;
+        uint32_t index = vpn >> 10;
+        for (int level = 1; level >= 0; --level)
+        {
+            size_t address = size_t(table) * 1024 + index;
+            if (address >= memory.size())
+            {
+                cause = AccessFault(access);
+                return false;
+            }
+
+            uint32_t pte = memory[address];
+            if (!(pte & PTE_V) || ((pte & PTE_W) && !(pte & PTE_R)))
+                break;
+
+            if (pte & (PTE_R | PTE_X))
+            {
+                // leaf; a superpage must be aligned and covers VPN[0] too
+                uint32_t ppn = pte >> 10;
+                if ((level == 1 && (ppn & 0x3ff) != 0) || !(pte & PTE_A))
+                    break;
+                entry.vpn   = vpn;
+                entry.ppn   = level == 1 ? ppn | (vpn & 0x3ff) : ppn;
+                entry.flags = pte & 0xff;
+                return true;
+            }
+            table = pte >> 10;
+            index = vpn & 0x3ff;
+        }
+
+        cause = Fault(access);
+        return false;
+    }
+
+private:
+    uint32_t  satp;
+    MmuConfig config;
+    Tlb       itlb;
+    Tlb       dtlb;
+    size_t    latency; // walk cycles not yet taken
+    size_t    faults;
+};
+
+#endif // _MMU_H_
@@ -0,0 +1,210 @@
+#ifndef _MULTI_HART_H_
+#define _MULTI_HART_H_ 1
+
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Engine.h"
+
+/**
+    Multi-hart machine: N harts share one guest DataMemory, each hart is an
+    Engine on its own host thread.
+
+    Harts run in parallel one quantum (`quantum` engine cycles) at a time. Inside
+    a quantum their plain loads and stores reach the shared words in whatever
+    order the host runs them (relaxed); AMOs and LR/SC are host atomics, so they
+    stay atomic across harts. At a quantum boundary every hart waits at a
+    barrier and the last one to arrive does the boundary step alone, in hart
+    order: it records which harts stopped and decides whether the run is over.
+    So a hart never starts quantum q + 1 before all the others finished quantum q.
+
+    Every hart starts at pc 0 with a0 = its hart id. Engines are created and
+    destroyed on their hart's thread (pipeline wires are per thread).
+*/
+class MultiHart
+{
+public:
+    // Creates the engine of hart `hart` (called on that hart's thread)
+    typedef std::function<Engine*(size_t hart)> EngineFactory;
+
+    struct Hart
+    {
+        MachineState state;
+        uint32_t     regs[32]     = {};
+        size_t       cycles       = 0;
+        size_t       instructions = 0;
+        double       wait_ms      = 0; // at quantum barriers
+    };
+
+public:
+    MultiHart(size_t harts, size_t quantum, size_t memory_size = 1000):
+        quantum(quantum),
+        harts  (harts),
+        memory (memory_size),
+        quanta (0),
+        done   (false),
+        waiting(0),
+        phase  (0)
+    {
+        if (harts == 0 || quantum == 0)
+            throw "bad multi-hart config";
+    }
+
+    // Runs until every hart stopped or after `max_quanta` quanta
+    void Run(const EngineFactory& factory, size_t max_quanta = SIZE_MAX)
+    {
+        this->max_quanta = max_quanta;
+
+        std::vector<std::thread> threads;
+        for (size_t id = 0; id < harts.size(); ++id)
+            threads.emplace_back(&MultiHart::RunHart, this, id, std::cref(factory));
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    // The first hart that did not halt decides, otherwise hart 0's exit code
+    int ExitCode() const
+    {
+        for (const Hart& hart : harts)
+            if (hart.state.status != HALTED)
+                return hart.state.ExitCode();
+        return harts[0].state.ExitCode();
+    }
+
+    void PrintStatus(std::ostream& out) const
+    {
+        for (size_t id = 0; id < harts.size(); ++id)
+        {
+            out << "hart " << id << ": ";
+            harts[id].state.Print(out);
+        }
+    }
+
+    void PrintStatistics(std::ostream& out) const
+    {
+        out << "harts = " << harts.size() << ", quantum = " << quantum << ", quanta = " << quanta << '\n';
+        for (size_t id = 0; id < harts.size(); ++id)
+        {
+            const Hart& hart = harts[id];
+            out << "hart " << id << ": cycles = " << hart.cycles << ", instructions = " << hart.instructions
+                << ", barrier wait = " << hart.wait_ms << " ms" << '\n';
+        }
+        out.flush();
+    }
+
+public:
+    const Hart& GetHart(size_t id) const
+    { return harts[id]; }
+    size_t Harts() const
+    { return harts.size(); }
+    size_t Quanta() const
+    { return quanta; }
+
+    uint32_t* Memory()
+    { return memory.data(); }
+    size_t MemorySize() const
+    { return memory.size(); }
+
+private:
+    void RunHart(size_t id, const EngineFactory& factory)
+    {
+        Hart&                   hart = harts[id];
+        std::unique_ptr<Engine> engine;
+
+        try
+        {
+            engine.reset(factory(id));
+            engine->AttachMemory(memory.data(), memory.size());
+            engine->SetRegister(10, uint32_t(id));
+        }
+        catch (const char* message)
+        {
+            hart.state.Fail(message);
+        }
+
+        for (;;)
+        {
+            if (hart.state.status == RUNNING)
+            {
+                try
+                {
+                    hart.state = engine->RunFor(quantum);
+                }
+                catch (const char* message)
+                {
+                    hart.state.Fail(message);
+                }
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            ArriveAndWait();
+            hart.wait_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            if (done)
+                break;
+        }
+
+        if (engine != nullptr)
+        {
+            for (size_t i = 0; i < 32; ++i)
+                hart.regs[i] = engine->Register(i);
+            hart.cycles       = engine->Cycles();
+            hart.instructions = engine->Instructions();
+        }
+    }
+
+    // Barrier of all harts; the last one to arrive runs Boundary()
+    void ArriveAndWait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        size_t                       current = phase;
+
+        if (++waiting == harts.size())
+        {
+            Boundary();
+            waiting = 0;
+            ++phase;
+            released.notify_all();
+        }
+        else
+        {
+            released.wait(lock, [&] { return phase != current; });
+        }
+    }
+
+    // Every hart is parked at the barrier
+    void Boundary()
+    {
+        ++quanta;
+
+        bool running = false;
+        for (const Hart& hart : harts)
+            running = running || hart.state.status == RUNNING;
+
+        done = !running || quanta >= max_quanta;
+    }
+
+private:
+    size_t                quantum;
+    size_t                max_quanta;
+    std::vector<Hart>     harts;
+    std::vector<uint32_t> memory; // shared DataMemory
+
+    size_t quanta;
+    bool   done;
+
+    std::mutex              mutex;
+    std::condition_variable released;
+    size_t                  waiting;
+    size_t                  phase;
+};
+
+#endif // _MULTI_HART_H_
@@ -0,0 +1,900 @@
+#ifndef _OUT_OF_ORDER_H_
+#define _OUT_OF_ORDER_H_ 1
+
+#include <iostream>
+#include <cstdint>
+#include <vector>
+#include <deque>
+
+#include "ISA.h"
+#include "DRAM.h"
+#include "Engine.h"
+#include "MMU.h"
+#include "CSR.h"
+#include "Spin.h"
+#include "StateHash.h"
+#include "History.h"
+#include "Debug.h"
+#include "Pipeline.h"
+
+struct OutOfOrderConfig
+{
+    size_t width    = 2;  // fetch, dispatch, issue and commit per cycle
+    size_t rob_size = 32; // reorder buffer entries
+    size_t iq_size  = 16; // issue queue entries
+    size_t lsq_size = 16; // load/store queue entries
+
+    size_t mul_latency = 3;  // pipelined multiplier
+    size_t div_latency = 32; // iterative divider, one divide at a time
+};
+
+/**
+    Out-of-order core: register renaming over a physical register file,
+    an issue queue picking the oldest ready instructions, a load/store queue
+    and a reorder buffer retiring in program order.
+
+    Branches and jumps are predicted not taken and resolved at execute; a mispredict
+    squashes everything younger and restores the rename table from the ROB.
+    Traps are kept in the ROB entry and only taken when the instruction
+    commits, so wrong-path garbage is harmless. AMOs only issue at the head of
+    the ROB: nothing can squash them after they wrote memory.
+
+    Reuses the decoder, immediates, ALU, comparator and load/store semantics
+    of the in-order pipeline.
+*/
+class OutOfOrderCore : public Engine
+{
+private:
+    static constexpr size_t NONE = SIZE_MAX;
+
+    struct Fetched
+    {
+        uint32_t    pc;
+        INSTRUCTION instr;  // 32-bit form (RVC expanded)
+        uint32_t    length; // 2 (RVC) or 4
+        size_t      ready;  // cycle when it leaves decode
+        uint32_t    trap;  // fetch fault
+    };
+
+    struct Entry
+    {
+        size_t           seq;
+        uint32_t         pc;
+        INSTRUCTION      instr;
+        uint32_t         length;
+        ControlUnitFlags flags;
+
+        size_t rd;
+        size_t preg;     // destination (0 = none)
+        size_t old_preg; // previous mapping of rd, freed at commit
+        size_t src1;
+        size_t src2;     // 0 when the instruction has no rs2
+
+        bool     issued;
+        size_t   issued_at;
+        size_t   complete_at;
+        uint32_t address; // loads and stores, valid once issued
+        uint32_t data;    // store data, the old word of an AMO
+        bool     taken;   // branch outcome, valid once issued
+        uint32_t target;  // branch or jump target
+        bool     resolved;
+
+        uint32_t trap; // TrapCode() or NO_TRAP
+    };
+
+public:
+    const char* Name() const override
+    { return "ooo"; }
+
+    // One clock cycle
+    void Step()
+    {
+        if (!Commit())
+            return;
+
+        Resolve();
+        Issue();
+        Dispatch();
+        Fetch();
+
+        rob_histogram[rob.size()]++;
+        iq_histogram [iq.size()]++;
+        lsq_histogram[lsq.size()]++;
+
+        ++now;
+        if (hash != nullptr)
+            hash->Sample(*this);
+        if (looped)
+            FastForward();
+    }
+
+    const MachineState& Run() override
+    {
+        while (state.status == RUNNING)
+            Step();
+        return state;
+    }
+
+    const MachineState& RunFor(size_t cycles) override
+    {
+        for (end = (cycles > SIZE_MAX - now) ? SIZE_MAX : now + cycles; state.status == RUNNING && now < end; )
+            Step();
+        end = SIZE_MAX;
+        return state;
+    }
+
+public:
+    size_t Cycles() const override
+    { return now; }
+    size_t Instructions() const override
+    { return retired; }
+
+    uint32_t Register(size_t index) const override
+    { return prf[arch_rat[index]]; }
+    void SetRegister(size_t index, uint32_t value) override
+    {
+        if (index != 0)
+            prf[arch_rat[index]] = value;
+    }
+
+    const uint32_t* Memory() const override
+    { return memory.data(); }
+    uint32_t* Memory() override
+    { return memory.data(); }
+    size_t MemorySize() const override
+    { return memory.size(); }
+
+    void AttachMemory(uint32_t* words, size_t size) override
+    { memory.Attach(words, size); }
+
+    GuestMemory& Guest() override
+    { return memory; }
+    const GuestMemory& Guest() const override
+    { return memory; }
+
+    Mmu& MMU() override
+    { return mmu; }
+    const Mmu& MMU() const override
+    { return mmu; }
+
+    CsrFile& Csrs() override
+    { return csrs; }
+    const CsrFile& Csrs() const override
+    { return csrs; }
+
+    // The ROB is empty after the WFI
+    void Idle(size_t cycles) override
+    { now += cycles; }
+
+    void Rewind(uint32_t pc, size_t cycle, size_t instructions) override
+    {
+        Flush(pc);
+        now               = cycle;
+        retired           = instructions;
+        commit_ready      = 0;
+        divider_free      = 0;
+        reservation.valid = false;
+        state             = MachineState();
+    }
+
+    uint64_t Events(PerformanceEvent event) const override
+    { return Count(event) + spin.Skipped(event); }
+
+    void PrintStatistics(std::ostream& out) const override
+    {
+        out << "cycles = " << now << '\n';
+        out << "instructions = " << retired << '\n';
+        out << "IPC             = " << (now ? double(retired) / now : 0.0) << '\n';
+        out << "mispredicts     = " << mispredicts << '\n';
+        out << "squashed        = " << squashed << '\n';
+        out << "forwarded loads = " << forwarded << '\n';
+        out << "dispatch stalls: rob = " << stall_rob << ", iq = " << stall_iq << ", lsq = " << stall_lsq << '\n';
+        PrintOccupancy(out, "ROB", rob_histogram);
+        PrintOccupancy(out, "IQ ", iq_histogram);
+        PrintOccupancy(out, "LSQ", lsq_histogram);
+        muldiv.Print(out);
+        mmu.PrintStatistics(out);
+        spin.PrintStatistics(out);
+        out.flush();
+    }
+
+protected:
+    // Occurrences of `event` in simulated cycles
+    uint64_t Count(PerformanceEvent event) const
+    {
+        switch (event)
+        {
+        case EVENT_LOADS:       return loads;
+        case EVENT_STORES:      return stores;
+        case EVENT_SQUASHED:    return squashed;
+        case EVENT_FORWARDED:   return forwarded;
+        case EVENT_MISPREDICTS: return mispredicts;
+        case EVENT_ITLB_MISSES: return mmu.ItlbMisses();
+        case EVENT_DTLB_MISSES: return mmu.DtlbMisses();
+        default:                return 0;
+        }
+    }
+
+    void Fence() override
+    { mmu.Flush(); }
+
+    // A CSR instruction retires once it has executed
+    bool AccessCsr(MachineState& trap) override
+    {
+        if (!csrs.Execute(*this, trap))
+            return false;
+        if (trap.cause == CAUSE_CSR)
+            ++retired;
+        return true;
+    }
+
+public:
+    OutOfOrderCore(const INSTRUCTION* program, size_t size, const OutOfOrderConfig& config = OutOfOrderConfig()):
+        config       (config),
+        program      (program, program + size),
+        memory       (1000),
+        dram         (nullptr),
+        cosim        (nullptr),
+        hash         (nullptr),
+        history      (nullptr),
+        debug        (nullptr),
+        prf          (32 + config.rob_size),
+        prf_ready    (32 + config.rob_size),
+        rat          (32),
+        arch_rat     (32),
+        rob_histogram(config.rob_size + 1),
+        iq_histogram (config.iq_size  + 1),
+        lsq_histogram(config.lsq_size + 1),
+        now          (0),
+        fetch_pc     (0),
+        fetch_fault  (false),
+        next_seq     (0),
+        debugged     (SIZE_MAX),
+        commit_ready (0),
+        divider_free (0),
+        end          (SIZE_MAX),
+        committed    (0),
+        branch       (0),
+        looped       (false),
+        retired      (0),
+        loads        (0),
+        stores       (0),
+        mispredicts  (0),
+        squashed     (0),
+        forwarded    (0),
+        stall_rob    (0),
+        stall_iq     (0),
+        stall_lsq    (0)
+    {
+        if (config.width == 0 || config.rob_size == 0 || config.iq_size == 0 || config.lsq_size == 0 ||
+            config.mul_latency == 0 || config.div_latency == 0)
+            throw "bad out-of-order config";
+
+        fetch.Attach(this->program.data(), this->program.size());
+
+        for (size_t i = 0; i < 32; ++i)
+            rat[i] = arch_rat[i] = i;
+        for (size_t p = 32; p < prf.size(); ++p)
+            free_list.push_back(p);
+    }
+
+    // Times data accesses through `dram` (loads at issue, stores at commit)
+    void SetDRAM(DRAMController* dram)
+    { this->dram = dram; }
+
+    // Checks every committed instruction against `cosim` (attach before the first Step)
+    void SetCoSimulator(CoSimulator* cosim)
+    { this->cosim = cosim; }
+
+    // Folds every committed instruction into `hash` (attach before the first Step)
+    void SetStateHash(StateHash* hash)
+    { this->hash = hash; }
+
+    // Logs undo records into `history` (attach before the first Step)
+    void SetHistory(History* history)
+    {
+        this->history = history;
+        if (history != nullptr)
+            history->Attach(*this);
+    }
+
+    // Stops at the breakpoints and watchpoints of `debug`, checked at commit
+    void SetDebugUnit(DebugUnit* debug)
+    { this->debug = debug; }
+
+private:
+    static void PrintOccupancy(std::ostream& out, const char* name, const std::vector<size_t>& histogram)
+    {
+        size_t cycles = 0;
+        size_t sum    = 0;
+        for (size_t n = 0; n < histogram.size(); ++n)
+        {
+            cycles += histogram[n];
+            sum    += n * histogram[n];
+        }
+
+        out << name << " occupancy: avg = " << (cycles ? double(sum) / cycles : 0.0)
+            << ", full = " << (cycles ? 100.0 * histogram.back() / cycles : 0.0) << "%, histogram =";
+        // quartiles of the capacity
+        size_t capacity = histogram.size() - 1;
+        for (size_t q = 0; q < 4; ++q)
+        {
+            size_t from = q * capacity / 4 + (q ? 1 : 0);
+            size_t to   = (q + 1) * capacity / 4;
+            size_t part = 0;
+            for (size_t n = from; n <= to; ++n)
+                part += histogram[n];
+            out << ' ' << (cycles ? 100.0 * part / cycles : 0.0) << '%';
+        }
+        out << '\n';
+    }
+
+    Entry* Find(size_t seq)
+    {
+        for (Entry& entry : rob)
+            if (entry.seq == seq)
+                return &entry;
+        return nullptr;
+    }
+
+    bool Ready(size_t preg) const
+    { return prf_ready[preg] <= now; }
+
+    static bool IsControl(ControlUnitFlags flags)
+    { return flags.BRN_COND || flags.JUMP != 0; }
+
+    // Stage 5 - Commit; returns false if the machine stopped
+    bool Commit()
+    {
+        for (size_t n = 0; n < config.width && !rob.empty(); ++n)
+        {
+            Entry& head = rob.front();
+
+            // asked once per instruction, when it reaches the head (an AMO waits for it)
+            if (debug != nullptr && head.seq != debugged)
+            {
+                debugged = head.seq;
+                if (debug->Stop(head.pc))
+                {
+                    state.Trap(CAUSE_DEBUG, head.pc, head.instr.raw);
+                    HandleTrap();
+                    return false;
+                }
+            }
+
+            // an interrupt replaces the head, unless it is an AMO that already wrote memory
+            uint32_t interrupt = head.flags.AMO && head.issued ? 0 : csrs.Interrupt(now);
+            if (interrupt == 0)
+            {
+                if (!head.issued || head.complete_at > now || commit_ready > now)
+                    break;
+                if (IsControl(head.flags) && !head.resolved)
+                    break;
+            }
+
+            if (interrupt != 0 || head.trap != NO_TRAP)
+            {
+                if (interrupt != 0)
+                    state.Trap(interrupt, head.pc);
+                else
+                    state.Trap(head.trap - 1, head.pc, head.instr.raw);
+
+                MachineState trap   = state;
+                bool         resume = HandleTrap();
+                if (cosim != nullptr)
+                    cosim->Trap(trap, *this);
+                if (hash != nullptr)
+                    hash->Trap(trap, *this);
+                if (history != nullptr)
+                    history->Trap(trap, *this);
+                if (!resume)
+                    return false;
+
+                Flush(state.pc);
+                break;
+            }
+
+            if (head.flags.MULDIV)
+                muldiv.Record(head.flags.ALUOP, head.complete_at - head.issued_at);
+
+            if (history != nullptr && head.address < memory.size() && (head.flags.MEM_WEN || head.flags.AMO))
+                history->Store(head.address, head.flags.AMO ? head.data : memory[head.address]);
+
+            if (head.flags.MEM_WEN)
+            {
+                DataMemory::Store(memory.data(), memory.size(), head.address, head.instr.r_type.funct3, head.data);
+                if (dram != nullptr && head.address < memory.size())
+                    commit_ready = dram->Write(head.address, now);
+                lsq.pop_front();
+                ++stores;
+            }
+            else if (head.flags.MEM2REG)
+            {
+                lsq.pop_front();
+                ++loads;
+            }
+
+            if (debug != nullptr && (head.flags.MEM_WEN || head.flags.MEM2REG))
+                debug->Access(head.pc, head.address, head.flags.MEM2REG, head.flags.MEM_WEN || head.flags.AMO, memory[head.address], now);
+
+            if (head.preg != 0)
+            {
+                arch_rat[head.rd] = head.preg;
+                free_list.push_back(head.old_preg);
+            }
+
+            if (cosim != nullptr || hash != nullptr)
+            {
+                // an AMO wrote at execute, but nothing younger touched memory since
+                bool     memory  = head.flags.MEM_WEN || head.flags.AMO;
+                uint32_t rd      = head.preg != 0 ? head.rd : 0;
+                uint32_t address = memory ? head.address : 0;
+                uint32_t word    = memory ? this->memory[head.address] : 0;
+                if (cosim != nullptr)
+                    cosim->Retire(head.pc, rd, prf[head.preg], memory, address, word);
+                if (hash != nullptr)
+                    hash->Retire(head.pc, rd, prf[head.preg], memory, address, word);
+            }
+            if (history != nullptr)
+                history->Retire(head.pc, head.preg != 0 ? head.rd : 0, prf[head.preg], now);
+
+            if (TRACE)
+                std::cout << "commit pc = " << head.pc << ", instr = " << std::hex << head.instr.raw << std::dec << '\n';
+
+            looped    = head.pc <= committed;
+            branch    = committed;
+            committed = head.pc;
+
+            rob.pop_front();
+            ++retired;
+        }
+
+        if (cosim != nullptr && cosim->Diverged())
+        {
+            state.Fail("co-simulation divergence");
+            return false;
+        }
+        return true;
+    }
+
+    // After a cycle in which a spin loop head committed: once its iterations
+    // repeat, skips them up to the next event, moving every cycle stamp along
+    void FastForward()
+    {
+        looped = false;
+        if (!fast_forward || dram != nullptr || cosim != nullptr || hash != nullptr || history != nullptr || debug != nullptr || mmu.Enabled())
+            return;
+        if (!spin.Closes(fetch, committed, branch) || !spin.Steady(*this))
+            return;
+
+        uint64_t horizon = std::min<uint64_t>(csrs.NextInterrupt(), end);
+        if (horizon == UINT64_MAX)
+        {
+            state.Fail("spin loop that nothing can end");
+            return;
+        }
+        SpinDetector::Counts skip = spin.Skip(horizon);
+        retired      += skip.instructions;
+        now          += skip.cycles;
+        commit_ready += skip.cycles;
+        divider_free += skip.cycles;
+        for (Fetched& fetched : fetch_queue)
+            fetched.ready += skip.cycles;
+        for (Entry& entry : rob)
+        {
+            entry.issued_at   += skip.cycles;
+            entry.complete_at += skip.cycles;
+        }
+        for (size_t& ready : prf_ready)
+            if (ready != NONE)
+                ready += skip.cycles;
+    }
+
+    // Drops everything in flight and fetches from `target`
+    void Flush(uint32_t target)
+    {
+        rob.clear();
+        iq.clear();
+        lsq.clear();
+        fetch_queue.clear();
+
+        rat = arch_rat;
+        free_list.clear();
+        std::vector<bool> mapped(prf.size(), false);
+        for (size_t preg : arch_rat)
+            mapped[preg] = true;
+        for (size_t p = 1; p < prf.size(); ++p)
+        {
+            prf_ready[p] = 0;
+            if (!mapped[p])
+                free_list.push_back(p);
+        }
+
+        fetch_pc    = target;
+        fetch_fault = false;
+    }
+
+    // Branch resolution: the oldest mispredicted branch redirects fetch
+    void Resolve()
+    {
+        for (size_t i = 0; i < rob.size(); ++i)
+        {
+            Entry& entry = rob[i];
+            if (!IsControl(entry.flags) || !entry.issued || entry.resolved || entry.complete_at > now)
+                continue;
+
+            entry.resolved = true;
+            if (entry.taken)
+            {
+                ++mispredicts;
+                Squash(i);
+                fetch_pc    = entry.target;
+                fetch_fault = false;
+                fetch_queue.clear();
+                return;
+            }
+        }
+    }
+
+    // Drops every entry younger than rob[index], youngest first
+    void Squash(size_t index)
+    {
+        size_t seq = rob[index].seq;
+
+        while (rob.size() > index + 1)
+        {
+            Entry& entry = rob.back();
+            if (entry.preg != 0)
+            {
+                rat[entry.rd] = entry.old_preg;
+                free_list.push_back(entry.preg);
+            }
+            rob.pop_back();
+            ++squashed;
+        }
+
+        while (!iq.empty() && iq.back() > seq)
+            iq.pop_back();
+        while (!lsq.empty() && lsq.back() > seq)
+            lsq.pop_back();
+    }
+
+    // Stage 4 - Issue and execute
+    void Issue()
+    {
+        size_t issued = 0;
+        bool   memory_port = false; // one DataMemory port
+
+        for (size_t i = 0; i < iq.size() && issued < config.width; )
+        {
+            Entry& entry = *Find(iq[i]);
+            bool   is_memory = entry.flags.MEM_WEN || entry.flags.MEM2REG;
+
+            if (!Ready(entry.src1) || !Ready(entry.src2) || (is_memory && memory_port))
+            {
+                ++i;
+                continue;
+            }
+            if (entry.flags.MEM2REG && !LoadReady(entry))
+            {
+                ++i;
+                continue;
+            }
+            if (entry.flags.AMO && (rob.front().seq != entry.seq || (debug != nullptr && debugged != entry.seq)))
+            {
+                ++i;
+                continue;
+            }
+            if (entry.flags.MULDIV && entry.flags.ALUOP >= ArithmeticLogicUnit::DIV && divider_free > now)
+            {
+                ++muldiv.blocked[entry.flags.ALUOP];
+                ++i;
+                continue;
+            }
+
+            Execute(entry);
+            entry.issued    = true;
+            entry.issued_at = now;
+            iq.erase(iq.begin() + i);
+            ++issued;
+            memory_port = memory_port || is_memory;
+        }
+    }
+
+    // A load waits until every older store knows its address and every older AMO is done
+    bool LoadReady(const Entry& load)
+    {
+        for (size_t seq : lsq)
+        {
+            if (seq >= load.seq)
+                break;
+            const Entry& older = *Find(seq);
+            if ((older.flags.MEM_WEN || older.flags.AMO) && !older.issued)
+                return false;
+        }
+        return true;
+    }
+
+    void Execute(Entry& entry)
+    {
+        uint32_t left  = entry.flags.SRC1 == 0 ? prf[entry.src1] : entry.flags.SRC1 == 1 ? entry.pc : 0;
+        uint32_t right = entry.flags.SRC2 == 0 ? prf[entry.src2] :
+                         entry.flags.SRC2 == 6 ? entry.length : Immediate::Select(entry.instr, entry.flags.SRC2);
+
+        entry.complete_at = now + 1;
+
+        if (entry.flags.BRN_COND)
+        {
+            entry.taken  = Comparator::Compute(entry.flags.ALUOP, prf[entry.src1], prf[entry.src2]);
+            entry.target = entry.pc + Immediate::SBType(entry.instr);
+            return;
+        }
+        if (entry.flags.JUMP == 1)
+        {
+            entry.taken  = true;
+            entry.target = entry.pc + Immediate::UJType(entry.instr);
+        }
+        if (entry.flags.JUMP == 2)
+        {
+            entry.taken  = true;
+            entry.target = (prf[entry.src1] + Immediate::IType(entry.instr)) & ~1u;
+        }
+
+        uint32_t result;
+        if (entry.flags.MULDIV)
+        {
+            result = ArithmeticLogicUnit::MultiplyDivide(entry.flags.ALUOP, left, right);
+            if (entry.flags.ALUOP >= ArithmeticLogicUnit::DIV)
+            {
+                entry.complete_at = now + config.div_latency;
+                divider_free      = entry.complete_at;
+            }
+            else
+            {
+                entry.complete_at = now + config.mul_latency;
+            }
+        }
+        else
+        {
+            result = ArithmeticLogicUnit::Compute(entry.flags.ALUOP, entry.flags.ALT, left, right);
+        }
+
+        if (entry.flags.MEM_WEN)
+        {
+            entry.address = result;
+            entry.data    = prf[entry.src2];
+            if (Translate(entry, true) && (entry.address >= memory.size() || !memory.Writable(entry.address)))
+                entry.trap = TrapCode(CAUSE_STORE_ACCESS);
+            entry.complete_at += mmu.TakeLatency();
+            return;
+        }
+        if (entry.flags.AMO)
+        {
+            entry.address     = result;
+            entry.complete_at = now + 2;
+            if (!Translate(entry, true))
+                result = 0;
+            else if (entry.address >= memory.size() || !memory.Writable(entry.address))
+                entry.trap = TrapCode(CAUSE_STORE_ACCESS);
+            else
+            {
+                entry.data = memory[entry.address];
+                result     = DataMemory::Atomic(memory.data(), entry.address, entry.instr.r_type.funct7 >> 2, prf[entry.src2], reservation);
+            }
+            entry.complete_at += mmu.TakeLatency();
+        }
+        else if (entry.flags.MEM2REG)
+        {
+            entry.address = result;
+            if (!Translate(entry, false))
+            {
+                result = 0;
+            }
+            else
+            {
+                if (entry.address >= memory.size())
+                    entry.trap = TrapCode(CAUSE_LOAD_ACCESS);
+                result = Load(entry);
+            }
+            entry.complete_at += mmu.TakeLatency();
+        }
+
+        if (entry.preg != 0)
+        {
+            prf[entry.preg]       = result;
+            prf_ready[entry.preg] = entry.complete_at;
+        }
+    }
+
+    // Virtual to physical entry.address while Sv32 is on; false with entry.trap set on a fault
+    bool Translate(Entry& entry, bool store)
+    {
+        uint32_t cause;
+        if (!mmu.Enabled() || mmu.TranslateData(memory, entry.address, store, entry.address, cause))
+            return true;
+        entry.trap = TrapCode(cause);
+        return false;
+    }
+
+    // Memory value merged with every older store to the same address
+    uint32_t Load(Entry& load)
+    {
+        uint32_t word   = load.address < memory.size() ? memory[load.address] : 0;
+        bool     bypass = false;
+
+        for (size_t seq : lsq)
+        {
+            if (seq >= load.seq)
+                break;
+            const Entry& older = *Find(seq);
+            if (older.flags.MEM_WEN && older.address == load.address)
+            {
+                DataMemory::Store(&word, 1, 0, older.instr.r_type.funct3, older.data);
+                bypass = true;
+            }
+        }
+
+        if (bypass)
+            ++forwarded;
+        else if (dram != nullptr && load.address < memory.size())
+            load.complete_at = dram->Read(load.address, now);
+        else
+            load.complete_at = now + 2;
+
+        if (load.address >= memory.size())
+            return 0;
+        return DataMemory::Load(&word, 1, 0, load.instr.r_type.funct3);
+    }
+
+    // Stage 3 - Rename and dispatch
+    void Dispatch()
+    {
+        for (size_t n = 0; n < config.width && !fetch_queue.empty(); ++n)
+        {
+            const Fetched& fetched = fetch_queue.front();
+            if (fetched.ready > now)
+                break;
+
+            Entry entry = {};
+            entry.seq   = next_seq;
+            entry.pc    = fetched.pc;
+            entry.instr  = fetched.instr;
+            entry.length = fetched.length;
+            entry.flags = ControlUnit::Decode(fetched.instr, entry.trap);
+            if (fetched.trap != NO_TRAP)
+                entry.trap = fetched.trap;
+
+            bool is_memory = entry.flags.MEM_WEN || entry.flags.MEM2REG;
+
+            if (rob.size() >= config.rob_size)
+            {
+                ++stall_rob;
+                break;
+            }
+            if (entry.trap == NO_TRAP && iq.size() >= config.iq_size)
+            {
+                ++stall_iq;
+                break;
+            }
+            if (is_memory && lsq.size() >= config.lsq_size)
+            {
+                ++stall_lsq;
+                break;
+            }
+
+            if (entry.trap == NO_TRAP)
+            {
+                // R, S and SB types read rs2, JALR reads rs1 for the target
+                bool has_rs1 = entry.flags.SRC1 == 0 || entry.flags.JUMP == 2;
+                bool has_rs2 = entry.flags.SRC2 == 0 || entry.flags.SRC2 == 2 || entry.flags.SRC2 == 3 || entry.flags.AMO;
+
+                entry.src1 = has_rs1 ? rat[entry.instr.r_type.rs1] : 0;
+                entry.src2 = has_rs2 ? rat[entry.instr.r_type.rs2] : 0;
+                entry.rd   = entry.instr.r_type.rd;
+
+                if (entry.flags.REG_WEN && entry.rd != 0)
+                {
+                    entry.preg     = free_list.front();
+                    entry.old_preg = rat[entry.rd];
+                    free_list.pop_front();
+                    prf_ready[entry.preg] = NONE;
+                    rat[entry.rd] = entry.preg;
+                }
+
+                iq.push_back(entry.seq);
+                if (is_memory)
+                    lsq.push_back(entry.seq);
+            }
+            else
+            {
+                entry.issued = true;
+                entry.complete_at = now;
+            }
+
+            rob.push_back(entry);
+            fetch_queue.pop_front();
+            ++next_seq;
+        }
+    }
+
+    // Stages 1, 2 - Fetch and decode (predicts not taken)
+    void Fetch()
+    {
+        for (size_t n = 0; n < config.width && fetch_queue.size() < 2 * config.width && !fetch_fault; ++n)
+        {
+            INSTRUCTION instruction;
+            uint32_t    length, cause;
+            bool        fetched = mmu.Fetch(fetch, memory, fetch_pc, instruction, length, cause);
+            size_t      ready   = now + 1 + mmu.TakeLatency();
+            if (!fetched)
+            {
+                // stops fetching until a redirect, the fault only counts if it commits
+                fetch_queue.push_back({fetch_pc, MakeADDI(0, 0, 0), 4, ready, TrapCode(cause)});
+                fetch_fault = true;
+                break;
+            }
+
+            fetch_queue.push_back({fetch_pc, instruction, length, ready, NO_TRAP});
+            fetch_pc += length;
+        }
+    }
+
+private:
+    OutOfOrderConfig config;
+
+    std::vector<INSTRUCTION> program;
+    ExpansionCache           fetch;
+    GuestMemory              memory; // one word per address, like DataMemory
+    Mmu                      mmu;
+    CsrFile                  csrs;
+    Reservation              reservation;
+    DRAMController*          dram;
+    CoSimulator*             cosim;
+    StateHash*               hash;
+    History*                 history;
+    DebugUnit*               debug;
+
+    std::vector<uint32_t> prf;       // physical registers, 0 is x0
+    std::vector<size_t>   prf_ready; // cycle when the value is available
+    std::vector<size_t>   rat;       // speculative rename table
+    std::vector<size_t>   arch_rat;  // committed rename table
+    std::deque<size_t>    free_list;
+
+    std::deque<Fetched> fetch_queue;
+    std::deque<Entry>   rob;
+    std::vector<size_t> iq;  // seq, oldest first
+    std::deque<size_t>  lsq; // seq, oldest first
+
+    std::vector<size_t> rob_histogram; // cycles per occupancy
+    std::vector<size_t> iq_histogram;
+    std::vector<size_t> lsq_histogram;
+
+private:
+    size_t   now;
+    uint32_t fetch_pc;
+    bool     fetch_fault; // a faulting fetch is queued
+    size_t   next_seq;
+    size_t   debugged;     // seq of the last head the DebugUnit saw
+    size_t   commit_ready; // a store is still occupying the DRAM queue
+    size_t   divider_free; // the iterative divider is busy before this cycle
+    size_t   end;          // of the current RunFor()
+
+    uint32_t     committed; // pc of the last committed instruction
+    uint32_t     branch;    // and of the one before it
+    bool         looped;    // it followed a backward branch or jump (a loop head)
+    SpinDetector spin;
+
+    size_t retired;
+    size_t loads;  // committed, AMOs included
+    size_t stores;
+    size_t mispredicts;
+    size_t squashed;
+    size_t forwarded;
+    size_t stall_rob;
+    size_t stall_iq;
+    size_t stall_lsq;
+
+    MulDivStatistics muldiv; // retired M instructions
+};
+
+#endif // _OUT_OF_ORDER_H_
@@ -0,0 +1,2861 @@
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_ 1
+
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ISA.h"
+#include "RVC.h"
+#include "DRAM.h"
+#include "Engine.h"
+#include "MMU.h"
+#include "CSR.h"
+#include "Spin.h"
+#include "StateHash.h"
+#include "History.h"
+#include "CoSim.h"
+#include "Debug.h"
+
+
+// Pipeline state is per thread, so every thread can run its own Pipeline
+inline thread_local size_t GLOBAL_STAGE = 0;
+inline thread_local size_t ISSUE_WIDTH  = 1; // 1 or 2 (dual-issue lane 1)
+inline thread_local size_t STALL_CYCLES = 0; // extra cycles requested by blocks during this stage (memory latency)
+
+inline bool TRACE = true; // print wires and block activity every stage (set once at startup)
+
+// Advances to the next stage; stalled cycles are skipped at once
+inline void NextStage()
+{
+    GLOBAL_STAGE += 1 + STALL_CYCLES;
+    STALL_CYCLES  = 0;
+}
+
+// Adds the latency of an access that issued now and completes at `ready`
+inline void StallUntil(size_t ready)
+{
+    size_t now = GLOBAL_STAGE + STALL_CYCLES;
+    if (ready > now + 1)
+        STALL_CYCLES += ready - now - 1;
+}
+
+// TRAP wires carry the exception code + 1 down the pipeline, NO_TRAP otherwise
+constexpr uint32_t NO_TRAP = 0;
+
+inline uint32_t TrapCode(uint32_t cause)
+{ return cause + 1; }
+
+class BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "BaseBlock";
+
+public:
+    virtual ~BaseBlock()
+    {}
+
+    virtual const char* Type() const
+    { return TypeName; }
+
+    virtual void step() = 0;
+};
+
+class Wire : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "Wire";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    { stage = GLOBAL_STAGE; }
+
+public:
+    Wire(const char* name = nullptr):
+        name (name),
+        value(0),
+        stage(GLOBAL_STAGE)
+    {}
+
+public:
+    const char* GetName() const
+    { return name; }
+
+public:
+    template<class T = uint32_t>
+    T OldValue() const
+    {
+        return static_cast<T>(value);
+    }
+
+    template<class T = uint32_t>
+    T GetValue()
+    {
+        if (stage != GLOBAL_STAGE)
+            step();
+        return static_cast<T>(value);
+    }
+
+    template<class T>
+    void SetValue(T __value)
+    { value = __value; }
+
+public:
+    Wire& operator=(const Wire& other)
+    {
+        if (this == &other)
+            return *this;
+
+        value = other.value;
+        return *this;
+    }
+    Wire& operator=(INSTRUCTION instruction)
+    {
+        value = instruction.raw;
+        return *this;
+    }
+    Wire& operator=(uint32_t __value)
+    {
+        value = __value;
+        return *this;
+    }
+
+public:
+    operator uint32_t()
+    { return GetValue(); }
+
+//protected:
+    const char* name;
+    uint32_t    value;
+    size_t      stage;
+};
+
+class FlipFlop : public Wire
+{
+public:
+    static constexpr const char* TypeName = "FlipFlop";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        if (stage != GLOBAL_STAGE)
+        {
+            value = input->OldValue();
+            stage = GLOBAL_STAGE;
+        }
+    }
+
+public:
+    FlipFlop(Wire* input, const char* name = nullptr):
+        Wire (name),
+        input(input)
+    {}
+
+public:
+    Wire* input;
+};
+
+inline thread_local std::unordered_map<const char*, Wire*> Wires;
+
+inline Wire* GetWire(const char* name);
+
+inline void FillWires()
+{
+    // Fetch FlipFlop (before fetch stage)
+    Wires["Fetch FlipFlop IN"]  = new Wire    ("PC_NEXT");
+    Wires["Fetch FlipFlop OUT"] = new FlipFlop(Wires["Fetch FlipFlop IN"], "PC");
+
+    // Fetch NextInstruction
+    Wires["PC"]      = Wires["Fetch FlipFlop OUT"];
+    Wires["PC_EX"]   = new Wire("PC_EX");
+    Wires["PC_TARGET"] = new Wire("PC_TARGET");
+    Wires["PC_R"]    = new Wire("PC_R");
+    Wires["PC_NEXT"] = Wires["Fetch FlipFlop IN"];
+
+    // Fetch IMEM
+    Wires["IMEM A"] = Wires["PC"];
+    Wires["IMEM D"] = new Wire("IMEM D");
+    Wires["IMEM TRAP"] = new Wire("IMEM TRAP");
+    Wires["IMEM LEN"]  = new Wire("IMEM LEN");
+
+    // Decode PC_DE
+    Wires["PC_DE"]  = new FlipFlop(Wires["PC"],       "PC_DE");
+    Wires["LEN_DE"] = new FlipFlop(Wires["IMEM LEN"], "LEN_DE");
+
+    // Decode FlipFlop (before decode stage)
+    Wires["Decode FlipFlop INSTR IN"]  = Wires["IMEM D"];
+    Wires["Decode FlipFlop INSTR OUT"] = new FlipFlop(Wires["Decode FlipFlop INSTR IN"], "INSTRUCTION");
+    Wires["INSTRUCTION"] = Wires["Decode FlipFlop INSTR OUT"];
+
+    Wires["Decode FlipFlop PC IN"]  = Wires["PC"];
+    Wires["Decode FlipFlop PC OUT"] = new Wire();
+
+    Wires["Decode FlipFlop PC_R IN"]  = Wires["PC_R"];
+    Wires["Decode FlipFlop PC_R OUT"] = new FlipFlop(Wires["Decode FlipFlop PC_R IN"], "PC_RF");
+    Wires["PC_RF"] = Wires["Decode FlipFlop PC_R OUT"];
+    Wires["PC_RD"] = Wires["PC_R"];
+
+    // Decode RegFile
+    Wires["Decode RegFile INSTR"] = Wires["INSTRUCTION"];
+    Wires["WB_A"]  = new Wire("WB_A");
+    Wires["WB_D"]  = new Wire("WB_D");
+    Wires["WB_WE"] = new Wire("WB_WE");
+    Wires["RS1"]   = new Wire("RS1");
+    Wires["RS2"]   = new Wire("RS2");
+
+    // Decode CU
+    Wires["Decode CU INSTR"] = Wires["INSTRUCTION"];
+    Wires["Decode CU FLAGS"] = new Wire();
+    Wires["CU FLAGS"] = Wires["Decode CU FLAGS"];
+    Wires["CU IMM"]   = new Wire("CU IMM");
+    Wires["CU DISP"]  = new Wire("CU DISP");
+
+    Wires["V_DE"] = new Wire("V_DE");
+
+    // Decode traps (fetch faults pass through the CU)
+    Wires["Decode TRAP"] = new FlipFlop(Wires["IMEM TRAP"], "Decode TRAP");
+    Wires["CU TRAP"]     = new Wire("CU TRAP");
+
+    // Execute
+    Wires["V_EX"]                = new FlipFlop(Wires["V_DE"],        "V_EX");
+    Wires["CONTROL_EX"]          = new FlipFlop(Wires["CU FLAGS"],    "CONTROL_EX");
+    Wires["Execute RS1"]         = new FlipFlop(Wires["RS1"],         "RS1_EX");
+    Wires["Execute RS2"]         = new FlipFlop(Wires["RS2"],         "RS2_EX");
+    Wires["Execute INSTRUCTION"] = new FlipFlop(Wires["INSTRUCTION"], "INSTR_EX");
+    Wires["PC_EX"]               = new FlipFlop(Wires["PC_DE"],       "PC_EX");
+    Wires["LEN_EX"]              = new FlipFlop(Wires["LEN_DE"],      "LEN_EX");
+    Wires["Execute TRAP"]        = new FlipFlop(Wires["CU TRAP"],     "TRAP_EX");
+    Wires["IMM_EX"]              = new FlipFlop(Wires["CU IMM"],      "IMM_EX");
+    Wires["PC_DISP"]             = new FlipFlop(Wires["CU DISP"],     "PC_DISP");
+
+    Wires["WE_GEN WB_WE"]  = new Wire("Execute WB_WE");
+    Wires["WE_GEN MEM_WE"] = new Wire("Execute MEM_WE");
+
+    Wires["HU_RS1"] = new Wire("HU_RS1");
+    Wires["HU_RS2"] = new Wire("HU_RS2");
+    Wires["RS1V"] = new Wire("RS1V");
+    Wires["RS2V"] = new Wire("RS2V");
+    Wires["SRC2"] = new Wire("SRC2");
+
+    Wires["SRC1"] = new Wire("SRC1");
+
+    Wires["ALU LEFT"]   = Wires["SRC1"];
+    Wires["ALU RIGHT"]  = Wires["SRC2"];
+    Wires["ALU RESULT"] = new Wire("ALU RESULT");
+
+    Wires["CMP LEFT"]   = Wires["RS1V"];
+    Wires["CMP RIGHT"]  = Wires["RS2V"];
+    Wires["CMP RESULT"] = new Wire("CMP RESULT");
+
+    // Memory
+    Wires["Memory WE_GEN WB_WE"]  = new FlipFlop(Wires["WE_GEN WB_WE"],  "Memory WE_GEN WB_WE");
+    Wires["Memory WE_GEN MEM_WE"] = new FlipFlop(Wires["WE_GEN MEM_WE"], "MEM_WE");
+    Wires["MEM_WE"] = Wires["Memory WE_GEN MEM_WE"];
+
+    Wires["Memory CONTROL_EX"]  = new FlipFlop(Wires["CONTROL_EX"],          "Memory CONTROL_EX");
+    Wires["Memory RS2"]         = new FlipFlop(Wires["RS2V"],                "Memory RS2"); // store data (after forwarding)
+    Wires["Memory ALU"]         = new FlipFlop(Wires["ALU RESULT"],          "Memory ALU");
+    Wires["Memory INSTRUCTION"] = new FlipFlop(Wires["Execute INSTRUCTION"], "Memory INSTRUCTION");
+
+    Wires["DMEM WE"] = Wires["MEM_WE"];
+    Wires["DMEM WD"] = Wires["Memory RS2"];
+    Wires["DMEM A"]  = Wires["Memory ALU"];
+    Wires["DMEM RD"] = new Wire("DMEM RD");
+
+    Wires["Memory WB_D"] = new Wire();
+
+    // Memory TrapUnit
+    Wires["V_MEM"]       = new FlipFlop(Wires["V_EX"],         "V_MEM");
+    Wires["PC_MEM"]      = new FlipFlop(Wires["PC_EX"],        "PC_MEM");
+    Wires["LEN_MEM"]     = new FlipFlop(Wires["LEN_EX"],       "LEN_MEM");
+    Wires["Memory TRAP"] = new FlipFlop(Wires["Execute TRAP"], "Memory TRAP");
+    Wires["DMEM TRAP"]   = new Wire("DMEM TRAP");
+    Wires["IRQ"]         = new Wire("IRQ");
+
+    // Memory stage runs before Execute, so its result (ALU or DMEM RD) is ready to forward
+    Wires["BP_MEM"]  = Wires["Memory WB_D"];
+
+    Wires["Memory HU_MEM_RD"] = Wires["Memory INSTRUCTION"];
+
+    // Write Back
+    Wires["WB CONTROL_EX"] = new FlipFlop(Wires["Memory CONTROL_EX"], "WB CONTROL_EX");
+
+    Wires["WB_WE"] = new FlipFlop(GetWire("Memory WE_GEN WB_WE"), "WB_WE");
+    Wires["WB_D"]  = new FlipFlop(GetWire("Memory WB_D"),         "WB_D");
+    Wires["WB_A"]  = new FlipFlop(GetWire("Memory INSTRUCTION"),  "WB_A");
+
+    Wires["BP_WB"]        = Wires["WB_D"];
+    Wires["WB HU_MEM_RD"] = Wires["WB_A"];
+
+    // Lane 1 (dual-issue, ALU only)
+    // Fetch: second IMEM port and pair issue logic
+    Wires["IMEM D1"]     = new Wire("IMEM D1");
+    Wires["IMEM LEN1"]   = new Wire("IMEM LEN1");
+    Wires["ISSUE"]       = new Wire("ISSUE");
+    Wires["ISSUE INSTR"] = new Wire("ISSUE INSTR");
+
+    // Decode
+    Wires["INSTRUCTION 1"] = new FlipFlop(Wires["ISSUE INSTR"], "INSTRUCTION 1");
+    Wires["ISSUE_DE"]      = new FlipFlop(Wires["ISSUE"],       "ISSUE_DE");
+    Wires["RS1 1"]         = new Wire("RS1 1");
+    Wires["RS2 1"]         = new Wire("RS2 1");
+    Wires["CU FLAGS 1"]    = new Wire("CU FLAGS 1");
+    Wires["CU IMM 1"]      = new Wire("CU IMM 1");
+    Wires["V_DE 1"]        = new Wire("V_DE 1");
+
+    // Execute
+    Wires["V_EX 1"]                = new FlipFlop(Wires["V_DE 1"],        "V_EX 1");
+    Wires["CONTROL_EX 1"]          = new FlipFlop(Wires["CU FLAGS 1"],    "CONTROL_EX 1");
+    Wires["Execute RS1 1"]         = new FlipFlop(Wires["RS1 1"],         "RS1_EX 1");
+    Wires["Execute RS2 1"]         = new FlipFlop(Wires["RS2 1"],         "RS2_EX 1");
+    Wires["Execute INSTRUCTION 1"] = new FlipFlop(Wires["INSTRUCTION 1"], "INSTR_EX 1");
+    Wires["IMM_EX 1"]              = new FlipFlop(Wires["CU IMM 1"],      "IMM_EX 1");
+
+    Wires["WE_GEN WB_WE 1"]  = new Wire("Execute WB_WE 1");
+    Wires["WE_GEN MEM_WE 1"] = new Wire("Execute MEM_WE 1");
+
+    Wires["HU_RS1 1"] = new Wire("HU_RS1 1");
+    Wires["HU_RS2 1"] = new Wire("HU_RS2 1");
+    Wires["RS1V 1"]   = new Wire("RS1V 1");
+    Wires["RS2V 1"]   = new Wire("RS2V 1");
+    Wires["SRC2 1"]   = new Wire("SRC2 1");
+
+    Wires["ALU LEFT 1"]   = Wires["RS1V 1"];
+    Wires["ALU RIGHT 1"]  = Wires["SRC2 1"];
+    Wires["ALU RESULT 1"] = new Wire("ALU RESULT 1");
+
+    // Memory (lane 1 has no DMEM port)
+    Wires["Memory WE_GEN WB_WE 1"] = new FlipFlop(Wires["WE_GEN WB_WE 1"],        "Memory WE_GEN WB_WE 1");
+    Wires["Memory ALU 1"]          = new FlipFlop(Wires["ALU RESULT 1"],          "Memory ALU 1");
+    Wires["Memory INSTRUCTION 1"]  = new FlipFlop(Wires["Execute INSTRUCTION 1"], "Memory INSTRUCTION 1");
+    Wires["V_MEM 1"]               = new FlipFlop(Wires["V_EX 1"],                "V_MEM 1");
+
+    Wires["BP_MEM 1"]           = Wires["Memory ALU 1"];
+    Wires["Memory WB_D 1"]      = Wires["Memory ALU 1"];
+    Wires["Memory HU_MEM_RD 1"] = Wires["Memory INSTRUCTION 1"];
+
+    // Write Back
+    Wires["WB_WE 1"] = new FlipFlop(GetWire("Memory WE_GEN WB_WE 1"), "WB_WE 1");
+    Wires["WB_D 1"]  = new FlipFlop(GetWire("Memory WB_D 1"),         "WB_D 1");
+    Wires["WB_A 1"]  = new FlipFlop(GetWire("Memory INSTRUCTION 1"),  "WB_A 1");
+
+    Wires["BP_WB 1"]        = Wires["WB_D 1"];
+    Wires["WB HU_MEM_RD 1"] = Wires["WB_A 1"];
+}
+
+inline void FreeWires()
+{
+    // Wires has aliases, every wire is deleted once
+    std::unordered_set<Wire*> unique;
+    for (auto& wire : Wires)
+        unique.insert(wire.second);
+    for (Wire* wire : unique)
+        delete wire;
+
+    Wires.clear();
+}
+
+// Empties the pipeline: every valid bit, flag and latch goes to 0
+inline void ClearWires()
+{
+    for (auto& wire : Wires)
+        wire.second->value = 0;
+}
+
+inline Wire* GetWire(const char* name)
+{
+    if (Wires.find(name) == Wires.end())
+    {
+        std::cerr << "bad wire = " << name << std::endl;
+        throw "bad wire";
+    }
+
+    return Wires[name];
+}
+
+inline void PrintWires();
+
+// Decode results of one instruction word, computed once (see ControlUnit::Predecode)
+struct DecodedInstruction
+{
+    uint32_t         raw   = 0;
+    ControlUnitFlags flags = {};
+    uint32_t         trap  = NO_TRAP;
+    uint32_t         imm   = 0; // ALU SRC2 operand picked by flags.SRC2
+    uint32_t         disp  = 0; // PC_DISP of JAL, JALR or B*
+    bool             valid = false;
+};
+
+class InstructionMemory : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "InstructionMemory";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        uint32_t    pc = address->GetValue();
+        INSTRUCTION fetched;
+        uint32_t    bytes, cause;
+
+        if (mmu->Fetch(fetch, *tables, pc, fetched, bytes, cause))
+        {
+            if (dram != nullptr)
+                StallUntil(dram->Read(pc, GLOBAL_STAGE + STALL_CYCLES));
+
+            *instruction = fetched;
+            *length      = bytes;
+            *trap        = NO_TRAP;
+
+            // second read port for the dual-issue pair (0 = no instruction)
+            uint32_t bytes1;
+            if (mmu->Fetch(fetch, *tables, pc + bytes, fetched, bytes1, cause))
+            {
+                *instruction1 = fetched;
+                *length1      = bytes1;
+            }
+            else
+            {
+                *instruction1 = 0;
+                *length1      = 0;
+            }
+        }
+        else
+        {
+            // may be the wrong path: the fault only counts if it reaches the TrapUnit
+            *instruction  = MakeADDI(0, 0, 0);
+            *length       = 4;
+            *instruction1 = 0;
+            *length1      = 0;
+            *trap         = TrapCode(cause);
+        }
+        STALL_CYCLES += mmu->TakeLatency();
+    }
+
+public:
+    InstructionMemory():
+        address     (GetWire("IMEM A")),
+        instruction (GetWire("IMEM D")),
+        instruction1(GetWire("IMEM D1")),
+        length      (GetWire("IMEM LEN")),
+        length1     (GetWire("IMEM LEN1")),
+        trap        (GetWire("IMEM TRAP")),
+        dram  (nullptr),
+        mmu   (nullptr),
+        tables(nullptr),
+        memory(nullptr),
+        size  (0)
+    {}
+
+    ~InstructionMemory()
+    {
+        if (memory != nullptr)
+            delete[] memory;
+    }
+
+    size_t SetMemory(INSTRUCTION* array, size_t size)
+    {
+        INSTRUCTION* ptr = new (std::nothrow) INSTRUCTION[size];
+        if (ptr == nullptr)
+            return 0;
+
+        memcpy(ptr, array, size * sizeof(INSTRUCTION));
+        this->memory = ptr;
+        this->size   = size;
+        fetch.Attach(ptr, size);
+        decoded.assign(2 * size, DecodedInstruction());
+        return size;
+    }
+
+    // Patches the code word at `address`; its predecoded entries are decoded again on next use
+    void Write(uint32_t address, INSTRUCTION instruction)
+    {
+        size_t offset = address >> 2;
+        if ((address & 0x3) != 0 || offset >= size)
+            throw "bad instruction address";
+
+        memory[offset] = instruction;
+        decoded[2 * offset].valid     = false;
+        decoded[2 * offset + 1].valid = false;
+    }
+
+    // The instruction at `pc` in its 32-bit form (see ExpansionCache::Fetch)
+    bool Fetch(uint32_t pc, INSTRUCTION& instruction)
+    {
+        uint32_t bytes, cause;
+        return fetch.Fetch(pc, instruction, bytes, cause);
+    }
+
+    ExpansionCache& Code()
+    { return fetch; }
+
+public:
+    Wire* address;
+    Wire* instruction;
+    Wire* instruction1; // instruction at address + length
+    Wire* length;       // 2 (RVC) or 4
+    Wire* length1;
+    Wire* trap;
+
+public:
+    DRAMController*    dram;   // optional timing backend
+    Mmu*               mmu;    // translates the pc while satp enables Sv32
+    const GuestMemory* tables; // page tables (DataMemory)
+
+    // Predecode cache indexed by pc / 2, filled by the ControlUnit
+    std::vector<DecodedInstruction> decoded;
+
+private:
+    INSTRUCTION*   memory;
+    size_t         size;
+    ExpansionCache fetch; // 16-bit aligned fetch, RVC parcels expanded once
+};
+
+class IssueUnit : public BaseBlock
+{
+public:
+    /** ISSUE codes:
+            0 = single-issue pipeline (no pairing logic)
+            1 = pair issued to both lanes
+            2.. reason why the instruction after slot 0 stays for the next cycle
+    */
+    constexpr static size_t SINGLE          = 0;
+    constexpr static size_t DUAL            = 1;
+    constexpr static size_t SLOT0_BRANCH    = 2; // control: slot 1 would be on the not-taken path
+    constexpr static size_t SLOT1_MEMORY    = 3; // structural: one DMEM port (lane 0)
+    constexpr static size_t SLOT1_BRANCH    = 4; // structural: one branch unit (lane 0)
+    constexpr static size_t SLOT1_OTHER     = 5; // structural: lane 1 only has an ALU
+    constexpr static size_t RAW             = 6; // data: slot 1 reads the result of slot 0
+    constexpr static size_t NO_SLOT1        = 7; // end of instruction memory
+    constexpr static size_t REASONS         = 8;
+
+    static const char* ReasonName(size_t reason)
+    {
+        static const char* names[REASONS] = {
+            "single-issue", "dual", "slot 0 branch", "slot 1 load/store",
+            "slot 1 branch", "slot 1 not ALU", "RAW in pair", "no slot 1",
+        };
+        return reason < REASONS ? names[reason] : "?";
+    }
+
+public:
+    static constexpr const char* TypeName = "IssueUnit";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        INSTRUCTION slot0(*instruction0);
+        INSTRUCTION slot1(*instruction1);
+
+        size_t reason = Check(slot0, slot1);
+
+        *issue = reason;
+        if (reason == DUAL)
+            *issued = slot1;
+        else
+            *issued = MakeADDI(0, 0, 0); // NOP keeps lane 1 decode quiet
+    }
+
+    static size_t Check(INSTRUCTION slot0, INSTRUCTION slot1)
+    {
+        uint32_t opcode0 = slot0.opcode();
+        uint32_t opcode1 = slot1.opcode();
+
+        if (slot1.raw == 0)
+            return NO_SLOT1;
+        if (opcode0 == 0x63 || opcode0 == 0x6f || opcode0 == 0x67)
+            return SLOT0_BRANCH;
+        if (opcode1 == 0x03 || opcode1 == 0x23)
+            return SLOT1_MEMORY;
+        if (opcode1 == 0x63 || opcode1 == 0x6f || opcode1 == 0x67)
+            return SLOT1_BRANCH;
+        if (opcode1 != 0x13 && opcode1 != 0x33)
+            return SLOT1_OTHER;
+
+        // lane 1 has no trap path and no multiplier/divider: any other funct7 stays in lane 0
+        uint32_t funct3 = slot1.r_type.funct3;
+        uint32_t funct7 = slot1.r_type.funct7;
+        bool     alt    = (funct3 == 5) || (opcode1 == 0x33 && funct3 == 0);
+        if ((opcode1 == 0x33 || funct3 == 1 || funct3 == 5) && funct7 != 0 && !(funct7 == 0x20 && alt))
+            return SLOT1_OTHER;
+
+        // slot 0 result is not visible to slot 1 in the same cycle
+        // (WAW is fine: lane 1 writes back and forwards after lane 0)
+        bool     writes0 = (opcode0 == 0x13 || opcode0 == 0x33 || opcode0 == 0x03 || opcode0 == 0x37 || opcode0 == 0x17 || opcode0 == 0x2f);
+        uint32_t rd0     = slot0.r_type.rd;
+        if (writes0 && rd0 != 0)
+        {
+            if (slot1.r_type.rs1 == rd0)
+                return RAW;
+            if (opcode1 == 0x33 && slot1.r_type.rs2 == rd0)
+                return RAW;
+        }
+
+        return DUAL;
+    }
+
+public:
+    IssueUnit():
+        instruction0(GetWire("IMEM D")),
+        instruction1(GetWire("IMEM D1")),
+        issue       (GetWire("ISSUE")),
+        issued      (GetWire("ISSUE INSTR"))
+    {}
+
+public:
+    Wire* instruction0;
+    Wire* instruction1;
+
+public:
+    Wire* issue;  // ISSUE code
+    Wire* issued; // lane 1 instruction (NOP unless dual)
+};
+
+class NextInstruction : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "NextInstruction";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        if (!PC_R->GetValue<bool>())
+        { *PC_NEXT = *PC + *LEN + (*ISSUE == IssueUnit::DUAL ? uint32_t(*LEN1) : 0); }
+        else
+        { *PC_NEXT = *PC_TARGET; }
+    }
+
+public:
+    NextInstruction():
+        PC       (GetWire("PC")),
+        PC_R     (GetWire("PC_R")),
+        PC_TARGET(GetWire("PC_TARGET")),
+        ISSUE    (GetWire("ISSUE")),
+        LEN      (GetWire("IMEM LEN")),
+        LEN1     (GetWire("IMEM LEN1")),
+        PC_NEXT  (GetWire("PC_NEXT"))
+    {}
+
+public:
+    Wire* PC;
+    Wire* PC_R;
+    Wire* PC_TARGET;
+    Wire* ISSUE;
+    Wire* LEN;  // of the instruction at PC
+    Wire* LEN1; // of the one after it (dual issue)
+
+public:
+    Wire* PC_NEXT;
+};
+
+// Immediate formats of the instruction word
+class Immediate
+{
+public:
+    // I-type (imm type == int32)
+    static uint32_t IType(INSTRUCTION instr)
+    { return instr.i_type.imm; }
+
+    static uint32_t SType(INSTRUCTION instr)
+    {
+        bool     sign  = (instr.s_type.imm7 & 0x40);
+        uint32_t value = ((instr.s_type.imm7 & 0x3f) << 5) + instr.s_type.imm5;
+
+        if (!sign)
+            return value;
+        else
+            return -((~value & 0x7ff) + 1);
+    }
+
+    static uint32_t SBType(INSTRUCTION instr)
+    {
+        uint32_t value = (instr.b_type.imm11 << 11) + (instr.b_type.imm6 << 5) + (instr.b_type.imm4 << 1);
+
+        if (!instr.b_type.imm12)
+            return value;
+        else
+            return -((~value & 0xfff) + 1);
+    }
+
+    // U-type (imm type == int32)
+    static uint32_t UType(INSTRUCTION instr)
+    { return instr.u_type.imm << 12; }
+
+    static uint32_t UJType(INSTRUCTION instr)
+    {
+        uint32_t value = (instr.j_type.imm12_19 << 12) + (instr.j_type.imm11 << 11) + (instr.j_type.imm1_10 << 1);
+
+        if (!instr.j_type.imm20)
+            return value;
+        else
+            return -((~value & 0xfffff) + 1);
+    }
+
+    // Immediate picked by ALU_SRC2 (see SRC2_SELECTOR)
+    static uint32_t Select(INSTRUCTION instr, uint32_t ALU_SRC2)
+    {
+        switch (ALU_SRC2)
+        {
+        case 1:
+            return IType(instr);
+        case 2:
+            return SType(instr);
+        case 3:
+            return SBType(instr);
+        case 4:
+            return UType(instr);
+        case 5:
+            return UJType(instr);
+        case 6:
+            return 4; // link offset (the ControlUnit uses 2 after an RVC JAL / JALR)
+        default:
+            return 0;
+        }
+    }
+
+    // Displacement for BranchTarget: JAL, JALR or B*
+    static uint32_t Displacement(INSTRUCTION instr)
+    {
+        switch (instr.opcode())
+        {
+        case 0x6f:
+            return UJType(instr);
+        case 0x67:
+            return IType(instr);
+        default:
+            return SBType(instr);
+        }
+    }
+};
+
+// Decodes the funct3 / funct7 dependent part of one major opcode into `flags`;
+// returns the trap code (NO_TRAP for a legal instruction)
+typedef uint32_t (*OpcodeDecoder)(INSTRUCTION instruction, ControlUnitFlags& flags);
+
+inline uint32_t DecodeIllegal(INSTRUCTION, ControlUnitFlags&)
+{ return TrapCode(CAUSE_ILLEGAL_INSTRUCTION); }
+
+inline uint32_t DecodeLegal(INSTRUCTION, ControlUnitFlags&)
+{ return NO_TRAP; }
+
+inline uint32_t DecodeJALR(INSTRUCTION instruction, ControlUnitFlags&)
+{ return instruction.i_type.funct3 != 0 ? TrapCode(CAUSE_ILLEGAL_INSTRUCTION) : NO_TRAP; }
+
+inline uint32_t DecodeBranch(INSTRUCTION instruction, ControlUnitFlags& flags)
+{
+    uint32_t funct3 = instruction.b_type.funct3;
+    flags.ALUOP = funct3;
+    return (funct3 == 2 || funct3 == 3) ? TrapCode(CAUSE_ILLEGAL_INSTRUCTION) : NO_TRAP;
+}
+
+inline uint32_t DecodeLoad(INSTRUCTION instruction, ControlUnitFlags&)
+{
+    uint32_t funct3 = instruction.i_type.funct3;
+    return (funct3 == 3 || funct3 > 5) ? TrapCode(CAUSE_ILLEGAL_INSTRUCTION) : NO_TRAP;
+}
+
+inline uint32_t DecodeStore(INSTRUCTION instruction, ControlUnitFlags&)
+{ return instruction.s_type.funct3 > 2 ? TrapCode(CAUSE_ILLEGAL_INSTRUCTION) : NO_TRAP; }
+
+inline uint32_t DecodeOpImm(INSTRUCTION instruction, ControlUnitFlags& flags)
+{
+    uint32_t funct3 = instruction.r_type.funct3;
+    uint32_t funct7 = instruction.r_type.funct7;
+    flags.ALUOP = funct3;
+    flags.ALT   = (funct3 == 5) && (funct7 >> 5); // SRAI
+
+    if ((funct3 == 1 && funct7 != 0) || (funct3 == 5 && funct7 != 0 && funct7 != 0x20))
+        return TrapCode(CAUSE_ILLEGAL_INSTRUCTION); // bad shift
+    return NO_TRAP;
+}
+
+inline uint32_t DecodeOp(INSTRUCTION instruction, ControlUnitFlags& flags)
+{
+    uint32_t funct3 = instruction.r_type.funct3;
+    uint32_t funct7 = instruction.r_type.funct7;
+    flags.ALUOP  = funct3;
+    flags.ALT    = funct7 >> 5;  // SUB, SRA
+    flags.MULDIV = (funct7 == 1); // MUL .. REMU
+
+    if (funct7 != 0 && funct7 != 1 && !(funct7 == 0x20 && (funct3 == 0 || funct3 == 5)))
+        return TrapCode(CAUSE_ILLEGAL_INSTRUCTION);
+    return NO_TRAP;
+}
+
+inline uint32_t DecodeAMO(INSTRUCTION instruction, ControlUnitFlags&)
+{
+    if (instruction.r_type.funct3 != 2)
+        return TrapCode(CAUSE_ILLEGAL_INSTRUCTION); // .W only
+
+    switch (instruction.r_type.funct7 >> 2)
+    {
+    case 0x02: // LR
+        return instruction.r_type.rs2 != 0 ? TrapCode(CAUSE_ILLEGAL_INSTRUCTION) : NO_TRAP;
+    case 0x00: case 0x01: case 0x03: case 0x04: case 0x08:
+    case 0x0c: case 0x10: case 0x14: case 0x18: case 0x1c:
+        return NO_TRAP;
+    default:
+        return TrapCode(CAUSE_ILLEGAL_INSTRUCTION);
+    }
+}
+
+// ECALL, EBREAK, SFENCE.VMA, MRET, WFI and the CSR instructions (the TrapUnit stops or redirects the machine)
+inline uint32_t DecodeSystem(INSTRUCTION instruction, ControlUnitFlags&)
+{
+    if (instruction.r_type.funct3 != 0 && instruction.r_type.funct3 != 4)
+        return TrapCode(CAUSE_CSR);
+    if (instruction.raw == MakeMRET().raw || instruction.raw == MakeWFI().raw)
+        return TrapCode(CAUSE_CSR);
+    if (instruction.raw == MakeECALL().raw)
+        return TrapCode(CAUSE_ECALL);
+    if (instruction.raw == MakeEBREAK().raw)
+        return TrapCode(CAUSE_BREAKPOINT);
+    if ((instruction.raw & 0xfe007fff) == MakeSFENCE_VMA(0, 0).raw)
+        return TrapCode(CAUSE_SFENCE_VMA);
+    return TrapCode(CAUSE_ILLEGAL_INSTRUCTION);
+}
+
+// One row per opcode (instruction[6:0]): the flags fixed by the opcode and its decoder
+struct OpcodeRow
+{
+    ControlUnitFlags flags;
+    OpcodeDecoder    decode;
+};
+
+constexpr OpcodeRow MakeOpcodeRow(OpcodeDecoder decode, uint32_t SRC1, uint32_t SRC2, uint32_t JUMP,
+                                  bool REG_WEN, bool MEM_WEN, bool MEM2REG, bool BRN_COND, bool AMO = false)
+{
+    OpcodeRow row = {{}, decode};
+    row.flags.SRC1     = SRC1;
+    row.flags.SRC2     = SRC2;
+    row.flags.JUMP     = JUMP;
+    row.flags.REG_WEN  = REG_WEN;
+    row.flags.MEM_WEN  = MEM_WEN;
+    row.flags.MEM2REG  = MEM2REG;
+    row.flags.BRN_COND = BRN_COND;
+    row.flags.AMO      = AMO;
+    return row;
+}
+
+/** ALU_SRC2:
+        0 = R-type
+        1 = I-type  (imm[11:0])
+        2 = S-type  (imm[11:5]    + imm[4:0])
+        3 = SB-type (imm[12|10:5] + imm[4:1|11])
+        4 = U-type  (imm[31:12])
+        5 = UJ-type (imm[20|10:1|11|19:12])
+        6 = 4       (link address, with SRC1 = PC)
+        7 = 0       (AMO address = rs1)
+
+    SRC1: 0 = rs1, 1 = PC, 2 = zero. JUMP: 1 = JAL (PC + imm), 2 = JALR (rs1 + imm).
+    funct3[14:12] field always represent operation
+*/
+constexpr std::array<OpcodeRow, 128> MakeOpcodeTable()
+{
+    std::array<OpcodeRow, 128> table = {};
+    for (size_t opcode = 0; opcode < table.size(); ++opcode)
+        table[opcode] = {{}, DecodeIllegal}; // not in RV32I Base Instruction Set
+
+    //                          decoder       SRC1 SRC2 JUMP REG_WEN MEM_WEN MEM2REG BRN_COND
+    table[0x37] = MakeOpcodeRow(DecodeLegal,  2,   4,   0,   true,   false,  false,  false); // LUI   (rd = imm)
+    table[0x17] = MakeOpcodeRow(DecodeLegal,  1,   4,   0,   true,   false,  false,  false); // AUIPC (rd = PC + imm)
+    table[0x6f] = MakeOpcodeRow(DecodeLegal,  1,   6,   1,   true,   false,  false,  false); // JAL   (rd = PC + 4, PC = PC + imm)
+    table[0x67] = MakeOpcodeRow(DecodeJALR,   1,   6,   2,   true,   false,  false,  false); // JALR  (rd = PC + 4, PC = rs1 + imm)
+    table[0x63] = MakeOpcodeRow(DecodeBranch, 0,   3,   0,   false,  false,  false,  true);  // B*    (if (rs1 op rs2) PC += imm)
+    table[0x03] = MakeOpcodeRow(DecodeLoad,   0,   1,   0,   true,   false,  true,   false); // L{B,H,W}{_,U} (funct3 = width)
+    table[0x23] = MakeOpcodeRow(DecodeStore,  0,   2,   0,   false,  true,   false,  false); // S{B,H,W}
+    table[0x13] = MakeOpcodeRow(DecodeOpImm,  0,   1,   0,   true,   false,  false,  false); // (OP)I (rd = rs1 op imm)
+    table[0x33] = MakeOpcodeRow(DecodeOp,     0,   0,   0,   true,   false,  false,  false); // (OP)  (rd = rs1 op rs2)
+    table[0x0f] = MakeOpcodeRow(DecodeLegal,  0,   0,   0,   false,  false,  false,  false); // FENCE, FENCE.I: a NOP
+    table[0x73] = MakeOpcodeRow(DecodeSystem, 0,   0,   0,   false,  false,  false,  false); // ECALL, EBREAK, SFENCE.VMA, CSR*
+
+    // AMO (rd = M[rs1], M[rs1] = rd op rs2; LR.W, SC.W): DMEM does the write, not MEM_WEN
+    table[0x2f] = MakeOpcodeRow(DecodeAMO,    0,   7,   0,   true,   false,  true,   false, true);
+    return table;
+}
+
+constexpr std::array<OpcodeRow, 128> OPCODE_TABLE = MakeOpcodeTable();
+
+class ControlUnit : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "ControlUnit";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        const DecodedInstruction& decoded = Lookup(*PC_DE + (lane == 0 ? 0 : uint32_t(*LEN_DE)), INSTRUCTION(*raw_instruction));
+
+        *CU_flags = INSTRUCTION(decoded.flags);
+        *CU_imm   = decoded.flags.SRC2 == 6 ? uint32_t(*LEN_DE) : decoded.imm; // link address
+        if (CU_disp != nullptr)
+            *CU_disp = decoded.disp;
+
+        if (CU_trap != nullptr)
+            *CU_trap = (*fetch_trap != NO_TRAP) ? uint32_t(*fetch_trap) : decoded.trap;
+    }
+
+    // Predecode cache entry of `pc` if that is where this word came from (bubbles and
+    // fetch faults carry a NOP), otherwise the word is decoded into `miss`
+    const DecodedInstruction& Lookup(uint32_t pc, INSTRUCTION instruction)
+    {
+        size_t      index = pc >> 1;
+        INSTRUCTION fetched;
+        if (imem != nullptr && index < imem->decoded.size())
+        {
+            DecodedInstruction& entry = imem->decoded[index];
+            if (entry.valid && entry.raw == instruction.raw)
+                return entry;
+            if (imem->Fetch(pc, fetched) && fetched.raw == instruction.raw)
+            {
+                entry = Predecode(instruction);
+                return entry;
+            }
+        }
+
+        if (!miss.valid || miss.raw != instruction.raw)
+            miss = Predecode(instruction);
+        return miss;
+    }
+
+    // Everything Decode and Execute need from one instruction word
+    static DecodedInstruction Predecode(INSTRUCTION instruction)
+    {
+        DecodedInstruction decoded;
+        decoded.raw   = instruction.raw;
+        decoded.flags = Decode(instruction, decoded.trap);
+        decoded.imm   = Immediate::Select(instruction, decoded.flags.SRC2);
+        decoded.disp  = Immediate::Displacement(instruction);
+        decoded.valid = true;
+        return decoded;
+    }
+
+    // Illegal instructions set `trap` and decode as a NOP
+    static ControlUnitFlags Decode(INSTRUCTION instruction, uint32_t& trap)
+    {
+        const OpcodeRow& row   = OPCODE_TABLE[instruction.opcode()];
+        ControlUnitFlags flags = row.flags;
+
+        trap = row.decode(instruction, flags);
+
+        // a trapping instruction must not write anything
+        if (trap != NO_TRAP)
+            flags = {};
+        return flags;
+    }
+
+public:
+    ControlUnit(InstructionMemory* imem = nullptr, size_t lane = 0):
+        raw_instruction(GetWire(lane == 0 ? "Decode CU INSTR" : "INSTRUCTION 1")),
+        PC_DE          (GetWire("PC_DE")),
+        LEN_DE         (GetWire("LEN_DE")),
+        fetch_trap     (lane == 0 ? GetWire("Decode TRAP") : nullptr),
+        CU_flags       (GetWire(lane == 0 ? "Decode CU FLAGS" : "CU FLAGS 1")),
+        CU_imm         (GetWire(lane == 0 ? "CU IMM" : "CU IMM 1")),
+        CU_disp        (lane == 0 ? GetWire("CU DISP") : nullptr),
+        CU_trap        (lane == 0 ? GetWire("CU TRAP") : nullptr),
+        imem           (imem),
+        lane           (lane)
+    {}
+
+public:
+    Wire* raw_instruction;
+    Wire* PC_DE;      // lane 1 decodes the instruction at PC_DE + LEN_DE
+    Wire* LEN_DE;     // length of the lane 0 instruction
+    Wire* fetch_trap; // lane 0 only: the IssueUnit keeps lane 1 trap-free
+
+public:
+    Wire* CU_flags;
+    Wire* CU_imm;
+    Wire* CU_disp; // lane 0 only: lane 1 has no branches
+    Wire* CU_trap;
+
+private:
+    InstructionMemory* imem; // owns the predecode cache (nullptr: decode every word)
+    size_t             lane;
+    DecodedInstruction miss; // last word that is not cached
+};
+
+class RegisterFile : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "RegisterFile";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        size_t rd  = INSTRUCTION(*WB_A).r_type.rd;
+        size_t rs1 = INSTRUCTION(*instruction).r_type.rs1;
+        size_t rs2 = INSTRUCTION(*instruction).r_type.rs2;
+
+        if (WB_WE->GetValue<bool>() && rd != 0)
+        {
+            if (TRACE)
+                std::cout << "WB RegisterFile offset = " << rd << std::endl;
+            regs[rd] = *WB_D;
+        }
+
+        if (ISSUE_WIDTH > 1)
+        {
+            // second write port: lane 1 is younger, so it writes last
+            size_t rd1 = INSTRUCTION(*WB_A1).r_type.rd;
+            if (WB_WE1->GetValue<bool>() && rd1 != 0)
+            {
+                if (TRACE)
+                    std::cout << "WB RegisterFile offset (lane 1) = " << rd1 << std::endl;
+                regs[rd1] = *WB_D1;
+            }
+        }
+
+        if (TRACE)
+            std::cout << "rs1 = " << rs1 << ", rs2 = " << rs2 << std::endl;
+        *RS1 = regs[rs1];
+        *RS2 = regs[rs2];
+
+        if (ISSUE_WIDTH > 1)
+        {
+            // read ports 3 and 4
+            *RS1_1 = regs[INSTRUCTION(*instruction1).r_type.rs1];
+            *RS2_1 = regs[INSTRUCTION(*instruction1).r_type.rs2];
+        }
+    }
+
+public:
+    RegisterFile():
+        instruction (GetWire("INSTRUCTION")),
+        instruction1(GetWire("INSTRUCTION 1")),
+        WB_A  (GetWire("WB_A")),
+        WB_D  (GetWire("WB_D")),
+        WB_WE (GetWire("WB_WE")),
+        WB_A1 (GetWire("WB_A 1")),
+        WB_D1 (GetWire("WB_D 1")),
+        WB_WE1(GetWire("WB_WE 1")),
+        RS1   (GetWire("RS1")),
+        RS2   (GetWire("RS2")),
+        RS1_1 (GetWire("RS1 1")),
+        RS2_1 (GetWire("RS2 1")),
+        regs  {}
+    {}
+
+public:
+    Wire* instruction;
+    Wire* instruction1; // lane 1
+    Wire* WB_A;  // write back address (inside instruction)
+    Wire* WB_D;  // write back data
+    Wire* WB_WE; // write back write enable
+    Wire* WB_A1; // lane 1 write back port
+    Wire* WB_D1;
+    Wire* WB_WE1;
+
+public:
+    Wire* RS1;
+    Wire* RS2;
+    Wire* RS1_1; // lane 1
+    Wire* RS2_1;
+
+public:
+    uint32_t regs[32];
+};
+
+class WriteEnableGenerator : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "WriteEnableGenerator";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        ControlUnitFlags flags = INSTRUCTION(*CONTROL_EX).flags;
+
+        if (!flags.BRN_COND && V_EX->GetValue<bool>())
+        {
+            *MEM_WE = flags.MEM_WEN;
+            *WB_WE  = flags.REG_WEN;
+        }
+        else
+        {
+            *MEM_WE = false;
+            *WB_WE  = false;
+        }
+    }
+
+public:
+    WriteEnableGenerator(size_t lane = 0):
+        V_EX      (GetWire(lane == 0 ? "V_EX"          : "V_EX 1")),
+        CONTROL_EX(GetWire(lane == 0 ? "CONTROL_EX"    : "CONTROL_EX 1")),
+        MEM_WE    (GetWire(lane == 0 ? "WE_GEN MEM_WE" : "WE_GEN MEM_WE 1")),
+        WB_WE     (GetWire(lane == 0 ? "WE_GEN WB_WE"  : "WE_GEN WB_WE 1"))
+    {}
+
+public:
+    Wire* V_EX;
+    Wire* CONTROL_EX;
+
+public:
+    Wire* MEM_WE;
+    Wire* WB_WE;
+};
+
+class HazardUnit : public BaseBlock
+{
+public:
+    /** HU_RS codes (RS_TO_RSV inputs):
+            0 = register file
+            1 = BP_MEM   (lane 0, Memory stage)
+            2 = BP_WB    (lane 0, WB stage)
+            3 = BP_MEM 1 (lane 1, Memory stage)
+            4 = BP_WB 1  (lane 1, WB stage)
+    */
+    static constexpr const char* TypeName = "HazardUnit";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        uint32_t rs1 = INSTRUCTION(HU_EX_INSTR->OldValue()).r_type.rs1;
+        uint32_t rs2 = INSTRUCTION(HU_EX_INSTR->OldValue()).r_type.rs2;
+
+        *HU_RS1 = 0x0;
+        *HU_RS2 = 0x0;
+
+        if (TRACE)
+        {
+            std::cout << "REG_WE_M  = " << *REG_WE_M  << '\n';
+            std::cout << "REG_WE_WB = " << *REG_WE_WB << '\n';
+        }
+
+        // producers from the oldest to the youngest, so the youngest one wins
+        // (WB_WE already includes the valid bit, REG_WEN and !BRN_COND)
+        Forward(rs1, rs2, *REG_WE_WB, HU_MEM_RDWB, 0x2);
+        if (ISSUE_WIDTH > 1)
+            Forward(rs1, rs2, *REG_WE_WB1, HU_MEM_RDWB1, 0x4);
+
+        // BP_MEM carries the Memory stage result, so loads forward as well
+        Forward(rs1, rs2, *REG_WE_M, HU_MEM_RDMEM, 0x1);
+        if (ISSUE_WIDTH > 1)
+            Forward(rs1, rs2, *REG_WE_M1, HU_MEM_RDMEM1, 0x3);
+    }
+
+private:
+    void Forward(uint32_t rs1, uint32_t rs2, bool write_enable, Wire* producer, uint32_t code)
+    {
+        uint32_t rd = INSTRUCTION(producer->OldValue()).r_type.rd;
+        if (!write_enable || rd == 0)
+            return;
+
+        if (rs1 == rd)
+            *HU_RS1 = code;
+        if (rs2 == rd)
+            *HU_RS2 = code;
+    }
+
+public:
+    HazardUnit(size_t lane = 0):
+        // not on scheme !!!
+        REG_WE_M     (GetWire("Memory WE_GEN WB_WE")),
+        REG_WE_WB    (GetWire("WB_WE")),
+        REG_WE_M1    (GetWire("Memory WE_GEN WB_WE 1")),
+        REG_WE_WB1   (GetWire("WB_WE 1")),
+
+        HU_EX_INSTR  (GetWire(lane == 0 ? "Execute INSTRUCTION" : "Execute INSTRUCTION 1")),
+        HU_MEM_RDMEM (GetWire("Memory HU_MEM_RD")),
+        HU_MEM_RDWB  (GetWire("WB HU_MEM_RD")),
+        HU_MEM_RDMEM1(GetWire("Memory HU_MEM_RD 1")),
+        HU_MEM_RDWB1 (GetWire("WB HU_MEM_RD 1")),
+        HU_RS1       (GetWire(lane == 0 ? "HU_RS1" : "HU_RS1 1")),
+        HU_RS2       (GetWire(lane == 0 ? "HU_RS2" : "HU_RS2 1"))
+    {}
+
+public:
+    Wire* REG_WE_M;
+    Wire* REG_WE_WB;
+    Wire* REG_WE_M1;
+    Wire* REG_WE_WB1;
+
+    Wire* HU_EX_INSTR;
+    Wire* HU_MEM_RDMEM;
+    Wire* HU_MEM_RDWB;
+    Wire* HU_MEM_RDMEM1;
+    Wire* HU_MEM_RDWB1;
+
+public:
+    Wire* HU_RS1;
+    Wire* HU_RS2;
+};
+
+class RS_TO_RSV : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "RS_TO_RSV";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        if (*HU_RS != 0 && V_EX->GetValue<bool>())
+            ++forwarded;
+
+        switch(*HU_RS)
+        {
+        case 0:
+            *RSV = *RS;
+            break;
+        case 1:
+            *RSV = *BP_MEM;
+            break;
+        case 2:
+            *RSV = *BP_WB;
+            break;
+        case 3:
+            *RSV = *BP_MEM1;
+            break;
+        case 4:
+            *RSV = *BP_WB1;
+            break;
+        default:
+            throw "bad HU_RS for RSV selector";
+        }
+    }
+
+public:
+    RS_TO_RSV(size_t number):
+        RS    (nullptr),
+        HU_RS (nullptr),
+        BP_MEM(GetWire("BP_MEM")),
+        BP_WB (GetWire("BP_WB")),
+        BP_MEM1(GetWire("BP_MEM 1")),
+        BP_WB1 (GetWire("BP_WB 1")),
+        V_EX   (GetWire(number <= 2 ? "V_EX" : "V_EX 1")),
+        forwarded(0)
+    {
+        switch(number)
+        {
+            case 1:
+            {
+                RS    = GetWire("RS1");
+                HU_RS = GetWire("HU_RS1");
+                RSV   = GetWire("RS1V");
+                break;
+            }
+            case 2:
+            {
+                RS    = GetWire("RS2");
+                HU_RS = GetWire("HU_RS2");
+                RSV   = GetWire("RS2V");
+                break;
+            }
+            case 3: // lane 1
+            {
+                RS    = GetWire("RS1 1");
+                HU_RS = GetWire("HU_RS1 1");
+                RSV   = GetWire("RS1V 1");
+                break;
+            }
+            case 4: // lane 1
+            {
+                RS    = GetWire("RS2 1");
+                HU_RS = GetWire("HU_RS2 1");
+                RSV   = GetWire("RS2V 1");
+                break;
+            }
+            default:
+                throw "bad number in RS_TO_RSV(number)";
+        }
+    }
+
+public:
+    Wire* RS;
+    Wire* HU_RS;
+    Wire* BP_MEM;
+    Wire* BP_WB;
+    Wire* BP_MEM1;
+    Wire* BP_WB1;
+    Wire* V_EX;
+
+public:
+    Wire* RSV;
+
+public:
+    size_t forwarded; // operands taken from the bypass network
+};
+
+class SRC1_SELECTOR : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "SRC1_SELECTOR";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        switch (INSTRUCTION(*CONTROL_EX).flags.SRC1)
+        {
+        case 0: /// reg
+            *SRC1 = *RS1V;
+            break;
+        case 1: /// PC (AUIPC, link address)
+            *SRC1 = *PC_EX;
+            break;
+        case 2: /// zero (LUI)
+            *SRC1 = 0;
+            break;
+        default:
+            throw "bad ALU_SRC1";
+        }
+    }
+
+public:
+    SRC1_SELECTOR():
+        RS1V      (GetWire("RS1V")),
+        PC_EX     (GetWire("PC_EX")),
+        CONTROL_EX(GetWire("CONTROL_EX")),
+        SRC1      (GetWire("SRC1"))
+    {}
+
+public:
+    Wire* RS1V;
+    Wire* PC_EX;
+    Wire* CONTROL_EX;
+
+public:
+    Wire* SRC1;
+};
+
+class SRC2_SELECTOR : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "SRC2_SELECTOR";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        uint32_t ALU_SRC2 = INSTRUCTION(*CONTROL_EX).flags.SRC2;
+        if (TRACE)
+            std::cout << "ALU_SRC2 = " << ALU_SRC2 << std::endl;
+
+        // 0 = reg; otherwise the ControlUnit already picked the immediate (or the
+        // link offset 4 / AMO offset 0) when it decoded the instruction
+        if (ALU_SRC2 == 0)
+            *SRC2 = *RS2V;
+        else
+            *SRC2 = *IMM_EX;
+    }
+
+public:
+    SRC2_SELECTOR(size_t lane = 0):
+        RS2V      (GetWire(lane == 0 ? "RS2V"       : "RS2V 1")),
+        IMM_EX    (GetWire(lane == 0 ? "IMM_EX"     : "IMM_EX 1")),
+        CONTROL_EX(GetWire(lane == 0 ? "CONTROL_EX" : "CONTROL_EX 1")),
+        SRC2      (GetWire(lane == 0 ? "SRC2"       : "SRC2 1"))
+    {}
+
+public:
+    Wire* RS2V;
+    Wire* IMM_EX;
+    Wire* CONTROL_EX;
+
+public:
+    Wire* SRC2;
+};
+
+// Per-op counters of the M extension, indexed by funct3
+struct MulDivStatistics
+{
+    size_t count  [8] = {};
+    size_t latency[8] = {}; // cycles from issue to result, summed
+    size_t blocked[8] = {}; // cycles a ready op waited for the busy divider
+
+    void Record(uint32_t funct3, size_t cycles)
+    {
+        ++count[funct3];
+        latency[funct3] += cycles;
+    }
+
+    // Prints nothing if the program ran no M instruction
+    void Print(std::ostream& out) const
+    {
+        static const char* names[8] = {"mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu"};
+
+        size_t total = 0;
+        for (size_t n : count)
+            total += n;
+        if (total == 0)
+            return;
+
+        out << "M extension:" << '\n';
+        for (size_t op = 0; op < 8; ++op)
+        {
+            if (count[op] == 0)
+                continue;
+            out << "  " << names[op] << ": count = " << count[op]
+                << ", avg latency = " << double(latency[op]) / count[op];
+            if (blocked[op] != 0)
+                out << ", divider busy = " << blocked[op];
+            out << '\n';
+        }
+    }
+};
+
+class ArithmeticLogicUnit : public BaseBlock
+{
+public:
+    constexpr static size_t ADD  = 0;
+    constexpr static size_t SLT  = 2;
+    constexpr static size_t SLTU = 3;
+    constexpr static size_t XOR  = 4;
+    constexpr static size_t OR   = 6;
+    constexpr static size_t AND  = 7;
+    constexpr static size_t SL   = 1;
+    constexpr static size_t SR   = 5;
+
+    // M extension (funct3 with MULDIV)
+    constexpr static size_t MUL    = 0;
+    constexpr static size_t MULH   = 1;
+    constexpr static size_t MULHSU = 2;
+    constexpr static size_t MULHU  = 3;
+    constexpr static size_t DIV    = 4;
+    constexpr static size_t DIVU   = 5;
+    constexpr static size_t REM    = 6;
+    constexpr static size_t REMU   = 7;
+
+public:
+    static constexpr const char* TypeName = "ArithmeticLogicUnit";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step()
+    {
+        ControlUnitFlags flags = INSTRUCTION(*CONTROL_EX).flags;
+
+        if (!flags.MULDIV)
+        {
+            *RESULT = Compute(flags.ALUOP, flags.ALT, *SRC1, *SRC2);
+            return;
+        }
+
+        *RESULT = MultiplyDivide(flags.ALUOP, *SRC1, *SRC2);
+        if (V_EX->GetValue<bool>())
+        {
+            // the unit holds Execute (and everything behind it) for `latency` cycles,
+            // overlapping a Memory stage stall of the same cycle
+            size_t latency = (flags.ALUOP < DIV) ? mul_latency : div_latency;
+            StallUntil(GLOBAL_STAGE + latency);
+            statistics.Record(flags.ALUOP, latency);
+        }
+    }
+
+    static uint32_t Compute(uint32_t ALUOP, bool ALT, uint32_t left, uint32_t right)
+    {
+        switch (ALUOP)
+        {
+        case ADD:
+            return ALT ? left - right : left + right;
+        case AND:
+            return left & right;
+        case OR:
+            return left | right;
+        case XOR:
+            return left ^ right;
+        case SL:
+            return left << (right & 0x1f);
+        case SR:
+            if (ALT)
+                return (int32_t) left >> (right & 0x1f);
+            return left >> (right & 0x1f);
+        case SLT:
+            return (int32_t) left < (int32_t) right;
+        case SLTU:
+            return left < right;
+        default:
+            throw "bad ALUOP";
+        }
+    }
+
+    // M extension, funct3 selects the op; division by zero and overflow do not trap
+    static uint32_t MultiplyDivide(uint32_t funct3, uint32_t left, uint32_t right)
+    {
+        int32_t sleft  = int32_t(left);
+        int32_t sright = int32_t(right);
+
+        switch (funct3)
+        {
+        case MUL:
+            return left * right;
+        case MULH:
+            return uint32_t((int64_t(sleft) * int64_t(sright)) >> 32);
+        case MULHSU:
+            return uint32_t((int64_t(sleft) * int64_t(right)) >> 32);
+        case MULHU:
+            return uint32_t((uint64_t(left) * uint64_t(right)) >> 32);
+        case DIV:
+            if (right == 0)
+                return UINT32_MAX;
+            if (sleft == INT32_MIN && sright == -1)
+                return left;
+            return uint32_t(sleft / sright);
+        case DIVU:
+            return right == 0 ? UINT32_MAX : left / right;
+        case REM:
+            if (right == 0)
+                return left;
+            if (sleft == INT32_MIN && sright == -1)
+                return 0;
+            return uint32_t(sleft % sright);
+        case REMU:
+            return right == 0 ? left : left % right;
+        default:
+            throw "bad M funct3";
+        }
+    }
+
+public:
+    ArithmeticLogicUnit(size_t lane = 0):
+        SRC1       (GetWire(lane == 0 ? "ALU LEFT"   : "ALU LEFT 1")),
+        SRC2       (GetWire(lane == 0 ? "ALU RIGHT"  : "ALU RIGHT 1")),
+        CONTROL_EX (GetWire(lane == 0 ? "CONTROL_EX" : "CONTROL_EX 1")),
+        V_EX       (GetWire(lane == 0 ? "V_EX"       : "V_EX 1")),
+        RESULT     (GetWire(lane == 0 ? "ALU RESULT" : "ALU RESULT 1")),
+        mul_latency(1),
+        div_latency(32)
+    {}
+
+public:
+    Wire* SRC1;
+    Wire* SRC2;
+    Wire* CONTROL_EX;
+    Wire* V_EX;
+
+public:
+    Wire* RESULT;
+
+public:
+    size_t           mul_latency; // cycles in Execute (lane 0 only runs M ops)
+    size_t           div_latency; // iterative divider
+    MulDivStatistics statistics;
+};
+
+class Comparator : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "Comparator";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        ControlUnitFlags flags = INSTRUCTION(*CONTROL_EX).flags;
+
+        // ALUOP only means CMPOP for B* (SLTI has funct3 = 2 too)
+        if (flags.BRN_COND)
+            *output = Compute(flags.ALUOP, *RS1V, *RS2V);
+        else
+            *output = false;
+    }
+
+    static bool Compute(uint32_t CMPOP, uint32_t left, uint32_t right)
+    {
+        switch (CMPOP)
+        {
+        case 0x0: // BEQ
+            return left == right;
+        case 0x1: // BNE
+            return left != right;
+        case 0x4: // BLT
+            return (int32_t) left <  (int32_t) right;
+        case 0x5: // BGE
+            return (int32_t) left >= (int32_t) right;
+        case 0x6: // BLTU
+            return left <  right;
+        case 0x7: // BGEU
+            return left >= right;
+        default:
+            throw "bad CMPOP";
+        }
+    }
+
+public:
+    Comparator():
+        CONTROL_EX (GetWire("CONTROL_EX")),
+        RS1V       (GetWire("RS1V")),
+        RS2V       (GetWire("RS2V")),
+        output     (GetWire("CMP RESULT"))
+    {}
+
+public:
+    Wire* CONTROL_EX;
+    Wire* RS1V;
+    Wire* RS2V;
+
+public:
+    Wire* output;
+};
+
+class BranchTarget : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "BranchTarget";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        if (INSTRUCTION(*CONTROL_EX).flags.JUMP == 2)
+            *PC_TARGET = (*RS1V + *PC_DISP) & ~1u; // JALR
+        else
+            *PC_TARGET = *PC_EX + *PC_DISP;
+    }
+
+public:
+    BranchTarget():
+        CONTROL_EX(GetWire("CONTROL_EX")),
+        RS1V      (GetWire("RS1V")),
+        PC_EX     (GetWire("PC_EX")),
+        PC_DISP   (GetWire("PC_DISP")),
+        PC_TARGET (GetWire("PC_TARGET"))
+    {}
+
+public:
+    Wire* CONTROL_EX;
+    Wire* RS1V;
+    Wire* PC_EX;
+    Wire* PC_DISP;
+
+public:
+    Wire* PC_TARGET;
+};
+
+class PC_R_Generator: public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "PC_R_Generator";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        bool BRN_COND = INSTRUCTION(*CONTROL_EX).flags.BRN_COND;
+        bool JUMP     = INSTRUCTION(*CONTROL_EX).flags.JUMP != 0;
+        bool CMP_EXIT = this->CMP_EXIT->GetValue<bool>();
+
+        // a squashed branch must not redirect fetch
+        if (((BRN_COND && CMP_EXIT) || JUMP) && V_EX->GetValue<bool>())
+        {
+            *PC_R = true;
+            ++redirects;
+        }
+        else
+            *PC_R = false;
+    }
+
+public:
+    PC_R_Generator():
+        CONTROL_EX (GetWire("CONTROL_EX")), // bits selector?
+        CMP_EXIT   (GetWire("CMP RESULT")),
+        V_EX       (GetWire("V_EX")),
+        PC_R       (GetWire("PC_R")),
+        redirects  (0)
+    {}
+
+public:
+    Wire* CONTROL_EX;
+    Wire* CMP_EXIT;
+    Wire* V_EX;
+    Wire* PC_R;
+
+public:
+    size_t redirects; // taken branches and jumps (fetch always predicts not taken)
+};
+
+class V_DE_Generator : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "V_DE_Generator";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        bool PC_RD = this->PC_RD->OldValue<bool>();
+        bool PC_RF = this->PC_RF->GetValue<bool>();
+
+        // NOR
+        if (PC_RF || PC_RD)
+            *V_DE = false;
+        else
+            *V_DE = true;
+
+        if (*V_DE)
+            ++issued;
+        else
+            ++squashed;
+    }
+
+public:
+    V_DE_Generator():
+        PC_RF(GetWire("PC_RF")),
+        PC_RD(GetWire("PC_RD")),
+        V_DE (GetWire("V_DE")),
+        issued  (0),
+        squashed(0)
+    {}
+
+public:
+    Wire* PC_RF; // PC_R Fetch
+    Wire* PC_RD; // PC_R Decode
+    Wire* V_DE;
+
+public:
+    size_t issued;   // instructions leaving decode on the correct path
+    size_t squashed; // and on the wrong path
+};
+
+class V_DE1_Generator : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "V_DE1_Generator";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        size_t issue = *ISSUE_DE;
+
+        // lane 1 is valid only if the pair was issued and lane 0 survived
+        *V_DE1 = V_DE->GetValue<bool>() && issue == IssueUnit::DUAL;
+
+        if (*V_DE)
+        {
+            ++groups;
+            ++reasons[issue < IssueUnit::REASONS ? issue : IssueUnit::SINGLE];
+        }
+    }
+
+    void PrintStatistics(std::ostream& out, size_t cycles, size_t instructions) const
+    {
+        out << "issue groups    = " << groups << '\n';
+        out << "dual-issue rate = " << (groups ? 100.0 * reasons[IssueUnit::DUAL] / groups : 0.0) << "%\n";
+        out << "IPC             = " << (cycles ? double(instructions) / cycles : 0.0) << '\n';
+        out << "single-issue reasons:" << '\n';
+        for (size_t reason = IssueUnit::SLOT0_BRANCH; reason < IssueUnit::REASONS; ++reason)
+            out << "    " << IssueUnit::ReasonName(reason) << " = " << reasons[reason] << '\n';
+        out.flush();
+    }
+
+public:
+    V_DE1_Generator():
+        V_DE    (GetWire("V_DE")),
+        ISSUE_DE(GetWire("ISSUE_DE")),
+        V_DE1   (GetWire("V_DE 1")),
+        groups  (0),
+        reasons {}
+    {}
+
+public:
+    Wire* V_DE;
+    Wire* ISSUE_DE;
+    Wire* V_DE1;
+
+public:
+    size_t groups;                      // issue groups leaving decode on the correct path
+    size_t reasons[IssueUnit::REASONS]; // per ISSUE code
+};
+
+// LR.W reservation of one hart: SC.W stores if the word still holds `value`
+struct Reservation
+{
+    bool     valid   = false;
+    uint32_t address = 0;
+    uint32_t value   = 0;
+};
+
+class DataMemory : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "DataMemory";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        uint32_t funct3 = INSTRUCTION(*INSTR).r_type.funct3;
+        bool     store  = MEM_WE->GetValue<bool>();
+        bool     load   = REG_WE->GetValue<bool>() && INSTRUCTION(*FLAGS).flags.MEM2REG;
+
+        size_t size = memory.size();
+
+        bool     atomic = load && INSTRUCTION(*FLAGS).flags.AMO;
+
+        *TRAP    = NO_TRAP;
+        physical = *A;
+        if (*IRQ != NO_TRAP)
+        {
+            // the instruction does not retire, so it must not touch memory
+            *RD = 0;
+            return;
+        }
+        if ((store || load) && mmu != nullptr && mmu->Enabled())
+        {
+            uint32_t cause;
+            bool     mapped = mmu->TranslateData(memory, *A, store || atomic, physical, cause);
+            STALL_CYCLES += mmu->TakeLatency();
+            if (!mapped)
+            {
+                *TRAP = TrapCode(cause);
+                *RD   = 0;
+                return;
+            }
+        }
+
+        if ((physical >= size && (store || load)) || ((store || atomic) && !memory.Writable(physical)))
+        {
+            *TRAP = TrapCode(store || atomic ? CAUSE_STORE_ACCESS : CAUSE_LOAD_ACCESS);
+            *RD   = 0;
+            return;
+        }
+
+        if (dram != nullptr && physical < size)
+        {
+            size_t now = GLOBAL_STAGE + STALL_CYCLES;
+            if (atomic)
+                StallUntil(dram->Write(physical, dram->Read(physical, now)));
+            else if (store)
+                StallUntil(dram->Write(physical, now));
+            else if (load)
+                StallUntil(dram->Read(physical, now));
+        }
+
+        if (load)
+            ++loads;
+        else if (store)
+            ++stores;
+
+        if ((store || atomic) && history != nullptr)
+            history->Store(physical, memory[physical]);
+
+        if (atomic)
+        {
+            *RD = Atomic(memory.data(), physical, INSTRUCTION(*INSTR).r_type.funct7 >> 2, *WD, reservation);
+            return;
+        }
+
+        if (store)
+            Store(memory.data(), size, physical, funct3, *WD);
+
+        *RD = Load(memory.data(), size, physical, funct3);
+    }
+
+    /** funct5 of an AMO (A extension, word only):
+            0x02 = LR, 0x03 = SC, 0x01 = SWAP, 0x00 = ADD, 0x04 = XOR, 0x08 = OR,
+            0x0c = AND, 0x10 = MIN, 0x14 = MAX, 0x18 = MINU, 0x1c = MAXU
+        host atomics on the word, so harts sharing the memory see each AMO whole;
+        returns rd (the old word, or 0 / 1 for SC success / failure)
+    */
+    static uint32_t Atomic(uint32_t* memory, uint32_t address, uint32_t funct5, uint32_t data, Reservation& reservation)
+    {
+        uint32_t* word = memory + address;
+
+        switch (funct5)
+        {
+        case 0x02:
+            reservation = {true, address, __atomic_load_n(word, __ATOMIC_SEQ_CST)};
+            return reservation.value;
+        case 0x03:
+        {
+            // succeeds if the word still holds what LR read (an ABA store in between goes unnoticed)
+            uint32_t expected = reservation.value;
+            bool     success  = reservation.valid && reservation.address == address &&
+                                __atomic_compare_exchange_n(word, &expected, data, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+            reservation.valid = false;
+            return success ? 0 : 1;
+        }
+        case 0x01:
+            return __atomic_exchange_n(word, data, __ATOMIC_SEQ_CST);
+        case 0x00:
+            return __atomic_fetch_add(word, data, __ATOMIC_SEQ_CST);
+        case 0x04:
+            return __atomic_fetch_xor(word, data, __ATOMIC_SEQ_CST);
+        case 0x08:
+            return __atomic_fetch_or(word, data, __ATOMIC_SEQ_CST);
+        case 0x0c:
+            return __atomic_fetch_and(word, data, __ATOMIC_SEQ_CST);
+        default:
+            break;
+        }
+
+        uint32_t old = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+        for (;;)
+        {
+            uint32_t value;
+            switch (funct5)
+            {
+            case 0x10:
+                value = int32_t(old) < int32_t(data) ? old : data;
+                break;
+            case 0x14:
+                value = int32_t(old) > int32_t(data) ? old : data;
+                break;
+            case 0x18:
+                value = old < data ? old : data;
+                break;
+            case 0x1c:
+                value = old > data ? old : data;
+                break;
+            default:
+                throw "DMEM bad AMO";
+            }
+            if (__atomic_compare_exchange_n(word, &old, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+                return old;
+        }
+    }
+
+    /** funct3 (bits 1:0 = byte, half, word; bit 2 = unsigned):
+            0 = LB/SB, 1 = LH/SH, 2 = LW/SW, 4 = LBU, 5 = LHU
+        every address holds one word, byte and half accesses use its low bits
+    */
+    static uint32_t Load(const uint32_t* memory, size_t size, uint32_t address, uint32_t funct3)
+    {
+        if (address >= size)
+            return 0;
+
+        switch (funct3)
+        {
+        case 0:
+            return int32_t(int8_t (memory[address] & 0x000000ff));
+        case 1:
+            return int32_t(int16_t(memory[address] & 0x0000ffff));
+        case 2:
+            return memory[address];
+        case 4:
+            return memory[address] & 0x000000ff;
+        case 5:
+            return memory[address] & 0x0000ffff;
+        default:
+            return 0; // not a load, RD is unused
+        }
+    }
+
+    static void Store(uint32_t* memory, size_t size, uint32_t address, uint32_t funct3, uint32_t data)
+    {
+        if (address >= size)
+            return;
+
+        switch (funct3)
+        {
+        case 0:
+            memory[address] = (memory[address] & 0xffffff00) | (data & 0x000000ff);
+            break;
+        case 1:
+            memory[address] = (memory[address] & 0xffff0000) | (data & 0x0000ffff);
+            break;
+        case 2:
+            memory[address] = data;
+            break;
+        default:
+            throw "DMEM bad count";
+        }
+    }
+
+public:
+    DataMemory():
+        INSTR (GetWire("Memory INSTRUCTION")),
+        FLAGS (GetWire("Memory CONTROL_EX")),
+        MEM_WE(GetWire("DMEM WE")),
+        WD    (GetWire("DMEM WD")),
+        A     (GetWire("DMEM A")),
+        REG_WE(GetWire("Memory WE_GEN WB_WE")),
+        RD    (GetWire("DMEM RD")),
+        TRAP  (GetWire("DMEM TRAP")),
+        IRQ   (GetWire("IRQ")),
+        dram  (nullptr),
+        mmu   (nullptr),
+        history(nullptr),
+        memory(1000),
+        physical(0),
+        loads   (0),
+        stores  (0)
+    {}
+
+public:
+    Wire* INSTR;  // funct3: byte, half, word
+    Wire* FLAGS;
+    Wire* MEM_WE; // memory write enable
+    Wire* WD;     // write data
+    Wire* A;      // address
+    Wire* REG_WE; // valid load (with MEM2REG) or AMO
+
+public:
+    Wire* RD;   // read data
+    Wire* TRAP; // access and page faults
+    Wire* IRQ;  // an interrupt replaces the instruction
+
+public:
+    DRAMController* dram; // optional timing backend
+    Mmu*            mmu;  // translates A while satp enables Sv32
+    History*        history; // old words of stores and AMOs
+
+public:
+    GuestMemory memory;
+    Reservation reservation; // LR.W
+    uint32_t    physical;    // word accessed by the last step
+    size_t      loads;       // performed, AMOs included
+    size_t      stores;
+};
+
+class DMEM_RD_OR_ALU : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "DMEM_RD_OR_ALU";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        ControlUnitFlags flags = INSTRUCTION(*flag).flags;
+
+        if (flags.MEM2REG)
+            *WB_D = *RD;
+        else
+            *WB_D = *ALU;
+    }
+
+public:
+    DMEM_RD_OR_ALU():
+        flag(GetWire("Memory CONTROL_EX")),
+        RD  (GetWire("DMEM RD")),
+        ALU (GetWire("Memory ALU")),
+        WB_D(GetWire("Memory WB_D"))
+    {}
+
+public:
+    Wire* flag;
+    Wire* RD;
+    Wire* ALU;
+
+public:
+    Wire* WB_D;
+};
+
+
+class TrapUnit : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "TrapUnit";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    // Everything older has written back by the end of this stage and nothing
+    // younger has, so stopping here is precise
+    void step() override
+    {
+        uint32_t trap = *IRQ != NO_TRAP ? uint32_t(*IRQ) : *MEM_TRAP != NO_TRAP ? uint32_t(*MEM_TRAP) : uint32_t(*DMEM_TRAP);
+
+        looped = false;
+        if (!V_MEM->GetValue<bool>())
+            return;
+        if (trap != NO_TRAP)
+        {
+            state->Trap(trap - 1, *PC_MEM, *INSTR);
+            return;
+        }
+
+        // lane 1 never branches, so a backward branch retired alone right before
+        uint32_t pc = *PC_MEM;
+        looped = pc <= last;
+        branch = last;
+        last   = V_MEM1->GetValue<bool>() ? pc + *LEN_MEM : pc;
+        retired += 1 + V_MEM1->GetValue<bool>();
+    }
+
+public:
+    TrapUnit(MachineState* state):
+        V_MEM    (GetWire("V_MEM")),
+        V_MEM1   (GetWire("V_MEM 1")),
+        PC_MEM   (GetWire("PC_MEM")),
+        LEN_MEM  (GetWire("LEN_MEM")),
+        INSTR    (GetWire("Memory INSTRUCTION")),
+        MEM_TRAP (GetWire("Memory TRAP")),
+        DMEM_TRAP(GetWire("DMEM TRAP")),
+        IRQ      (GetWire("IRQ")),
+        state    (state),
+        retired  (0),
+        last     (0),
+        branch   (0),
+        looped   (false)
+    {}
+
+public:
+    Wire* V_MEM;
+    Wire* V_MEM1; // lane 1 retires with lane 0
+    Wire* PC_MEM;
+    Wire* LEN_MEM;
+    Wire* INSTR;     // tval of CSR instructions
+    Wire* MEM_TRAP;  // fetch and decode traps
+    Wire* DMEM_TRAP; // access faults
+    Wire* IRQ;       // interrupts
+
+public:
+    MachineState* state;
+    size_t        retired; // instructions that left Memory without a trap
+    uint32_t      last;    // pc of the last one
+    uint32_t      branch;  // and of the one before it
+    bool          looped;  // it followed a backward branch or jump (a loop head)
+};
+
+// Takes a pending interrupt in front of the instruction in Memory: DataMemory
+// skips it and the TrapUnit stops there, so mepc is that instruction
+class InterruptUnit : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "InterruptUnit";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        uint32_t cause = V_MEM->GetValue<bool>() ? csrs->Interrupt(GLOBAL_STAGE) : 0;
+        if (cause == 0 && debug != nullptr && V_MEM->GetValue<bool>() && debug->Stop(*PC_MEM))
+            cause = CAUSE_DEBUG;
+        *IRQ = cause != 0 ? TrapCode(cause) : NO_TRAP;
+    }
+
+public:
+    InterruptUnit(CsrFile* csrs):
+        V_MEM (GetWire("V_MEM")),
+        PC_MEM(GetWire("PC_MEM")),
+        IRQ   (GetWire("IRQ")),
+        csrs  (csrs),
+        debug (nullptr)
+    {}
+
+public:
+    Wire* V_MEM;
+    Wire* PC_MEM;
+    Wire* IRQ;
+
+public:
+    CsrFile*   csrs;
+    DebugUnit* debug; // stops in front of the instruction like an interrupt
+};
+
+// Reports every instruction that leaves the Memory stage without a trap to a
+// CoSimulator, a StateHash, a History and the watchpoints of a DebugUnit (only in
+// STAGE_MEMORY while one is attached)
+class RetireMonitor : public BaseBlock
+{
+public:
+    static constexpr const char* TypeName = "RetireMonitor";
+
+public:
+    const char* Type() const override
+    { return TypeName; }
+
+    void step() override
+    {
+        if (!V_MEM->GetValue<bool>() || state->status != RUNNING)
+            return;
+
+        bool     reg_we = REG_WE->GetValue<bool>();
+        bool     memory = MEM_WE->GetValue<bool>() || (reg_we && INSTRUCTION(*FLAGS).flags.AMO);
+        uint32_t rd     = reg_we ? INSTRUCTION(*INSTR).r_type.rd : 0;
+
+        bool load = reg_we && INSTRUCTION(*FLAGS).flags.MEM2REG;
+        if (debug != nullptr && (load || memory))
+            debug->Access(*PC_MEM, dmem->physical, load, memory, dmem->memory[dmem->physical], GLOBAL_STAGE);
+
+        Retire(*PC_MEM, rd, rd != 0 ? uint32_t(*WB_D) : 0, memory, memory ? dmem->physical : 0, memory ? dmem->memory[dmem->physical] : 0);
+
+        // lane 1 is the next instruction and only writes registers
+        if (ISSUE_WIDTH == 2 && REG_WE1->GetValue<bool>())
+        {
+            uint32_t rd1 = INSTRUCTION(*INSTR1).r_type.rd;
+            Retire(*PC_MEM + *LEN_MEM, rd1, rd1 != 0 ? uint32_t(*WB_D1) : 0, false, 0, 0);
+        }
+    }
+
+    void Retire(uint32_t pc, uint32_t rd, uint32_t value, bool memory, uint32_t address, uint32_t word)
+    {
+        if (cosim != nullptr)
+            cosim->Retire(pc, rd, value, memory, address, word);
+        if (hash != nullptr)
+            hash->Retire(pc, rd, value, memory, address, word);
+        if (history != nullptr)
+            history->Retire(pc, rd, value, GLOBAL_STAGE);
+    }
+
+public:
+    RetireMonitor(MachineState* state, const DataMemory* dmem):
+        V_MEM  (GetWire("V_MEM")),
+        PC_MEM (GetWire("PC_MEM")),
+        LEN_MEM(GetWire("LEN_MEM")),
+        INSTR  (GetWire("Memory INSTRUCTION")),
+        FLAGS  (GetWire("Memory CONTROL_EX")),
+        REG_WE (GetWire("Memory WE_GEN WB_WE")),
+        MEM_WE (GetWire("DMEM WE")),
+        WB_D   (GetWire("Memory WB_D")),
+        INSTR1 (GetWire("Memory INSTRUCTION 1")),
+        REG_WE1(GetWire("Memory WE_GEN WB_WE 1")),
+        WB_D1  (GetWire("Memory WB_D 1")),
+        state  (state),
+        dmem   (dmem),
+        cosim  (nullptr),
+        hash   (nullptr),
+        history(nullptr),
+        debug  (nullptr)
+    {}
+
+public:
+    Wire* V_MEM;
+    Wire* PC_MEM;
+    Wire* LEN_MEM;
+    Wire* INSTR;
+    Wire* FLAGS;
+    Wire* REG_WE;
+    Wire* MEM_WE;
+    Wire* WB_D;
+    Wire* INSTR1;
+    Wire* REG_WE1;
+    Wire* WB_D1;
+
+public:
+    const MachineState* state;
+    const DataMemory*   dmem;
+    CoSimulator*        cosim;
+    StateHash*          hash;
+    History*            history;
+    DebugUnit*          debug;
+};
+
+inline void PrintWires()
+{
+    // Prints output wires of all stages
+    std::cout << "-----------------------------------------------------" << std::endl;
+
+    std::cout << "Fetch:" << '\n';
+    std::cout << "Fetch instr = 0x" << std::hex << (Wires["IMEM D"]->OldValue()) << std::dec << (INSTRUCTION(Wires["IMEM D"]->OldValue()).opcode() == 0x63 ? " B*": " ADDI") << '\n';
+    //std::cout << "Fetch instr = 0x" << std::hex << (Wires["IMEM D"]->OldValue()) << ' ' << INSTRUCTION(Wires["IMEM D"]->OldValue()).opcode() << std::dec << '\n';
+    std::cout << "PC_R        = "   << (Wires["PC_R"]->OldValue()) << '\n';
+    std::cout << "PC          = "   << (Wires["PC"]->OldValue())   << '\n';
+    std::cout << '\n';
+
+    ControlUnitFlags flagsD = INSTRUCTION(Wires["CU FLAGS"]->OldValue()).flags;
+    std::cout << "Decode:" << '\n';
+    std::cout << "Decode instr = 0x" << std::hex << (Wires["INSTRUCTION"]->OldValue()) << std::dec << (INSTRUCTION(Wires["INSTRUCTION"]->OldValue()).opcode() == 0x63 ? " B*": " ADDI") << '\n';
+    std::cout << "PC_DE        = "   << (Wires["PC_DE"]->OldValue()) << '\n';
+    std::cout << "RF.RS1       = "   << (Wires["RS1"]->OldValue()) << '\n';
+    std::cout << "RF.RS2       = "   << (Wires["RS2"]->OldValue()) << '\n';
+    std::cout << "CU.flags     = "   << flagsD.ALUOP << ' ' << flagsD.SRC2 << ' ' << flagsD.BRN_COND << flagsD.MEM2REG << flagsD.MEM_WEN << flagsD.REG_WEN << '\n';
+    std::cout << "PC_RF        = "   << (Wires["PC_RF"]->OldValue()) << '\n';
+    std::cout << "PC_RD        = "   << (Wires["PC_RD"]->OldValue()) << '\n';
+    std::cout << "V_DE         = "   << (Wires["V_DE"]->OldValue()) << '\n';
+    std::cout << '\n';
+
+    ControlUnitFlags flagsE = INSTRUCTION(Wires["CONTROL_EX"]->OldValue()).flags;
+    std::cout << "Execute:" << '\n';
+    std::cout << "Execute instr = 0x" << std::hex << (Wires["Execute INSTRUCTION"]->OldValue()) << std::dec << (INSTRUCTION(Wires["Execute INSTRUCTION"]->OldValue()).opcode() == 0x63 ? " B*": " ADDI") << '\n';
+    std::cout << "PC_EX         = "   << (Wires["PC_EX"]->OldValue()) << '\n';
+    std::cout << "V_EX          = "   << (Wires["V_EX"]->OldValue())  << '\n';
+    std::cout << "WE_GEN WB_WE  = "   << (Wires["WE_GEN WB_WE"]->OldValue())  << '\n';
+    std::cout << "WE_GEN MEM_WE = "   << (Wires["WE_GEN MEM_WE"]->OldValue()) << '\n';
+    std::cout << "CONTROL_EX    = "   << flagsE.ALUOP << ' ' << flagsE.SRC2 << ' ' << flagsE.REG_WEN << flagsE.MEM_WEN << flagsE.MEM2REG << flagsE.BRN_COND << '\n';
+    std::cout << "RF.RS1        = "   << (Wires["Execute RS1"]->OldValue()) << '\n';
+    std::cout << "RS1V          = "   << (Wires["RS1V"]->OldValue()) << '\n';
+    std::cout << "SRC2          = "   << (Wires["SRC2"]->OldValue()) << '\n';
+    std::cout << "ALU           = "   << (Wires["ALU RESULT"]->OldValue()) << '\n';
+    std::cout << '\n';
+
+    ControlUnitFlags flagsM = INSTRUCTION(Wires["Memory CONTROL_EX"]->OldValue()).flags;
+    std::cout << "Memory:" << '\n';
+    std::cout << "Memory instr      = 0x" << std::hex << (Wires["Memory INSTRUCTION"]->OldValue()) << std::dec << (INSTRUCTION(Wires["Memory INSTRUCTION"]->OldValue()).opcode() == 0x63 ? " B*": " ADDI")  << '\n';
+    std::cout << "Memory CONTROL_EX = "   << flagsM.ALUOP << ' ' << flagsM.SRC2 << ' ' << flagsM.REG_WEN << flagsM.MEM_WEN << flagsM.MEM2REG << flagsM.BRN_COND << '\n';
+    std::cout << "WB_WE             = "   << (Wires["Memory WE_GEN WB_WE"]->OldValue()) << '\n';
+    std::cout << "WB_D              = "   << (Wires["Memory WB_D"]->OldValue())         << '\n';
+    std::cout << '\n';
+
+    ControlUnitFlags flagsWB = INSTRUCTION(Wires["WB CONTROL_EX"]->OldValue()).flags;
+    std::cout << "WB:" << '\n';
+    std::cout << "WB instr      = 0x" << std::hex << (Wires["WB_A"]->OldValue()) << std::dec << (INSTRUCTION(Wires["WB_A"]->OldValue()).opcode() == 0x63 ? " B*": " ADDI")  << '\n';
+    std::cout << "WB CONTROL_EX = "   << flagsWB.ALUOP << ' ' << flagsWB.SRC2 << ' ' << flagsWB.REG_WEN << flagsWB.MEM_WEN << flagsWB.MEM2REG << flagsWB.BRN_COND << '\n';
+    std::cout << "WB_WE         = "   << (Wires["WB_WE"]->OldValue()) << '\n';
+    std::cout << "WB_A          = "   << INSTRUCTION(Wires["WB_A"]->OldValue()).r_type.rd << '\n';
+    std::cout << "WB_D          = "   << (Wires["WB_D"]->OldValue())  << '\n';
+
+    if (ISSUE_WIDTH > 1)
+    {
+        std::cout << '\n';
+        std::cout << "Lane 1:" << '\n';
+        std::cout << "Fetch ISSUE   = "   << IssueUnit::ReasonName(Wires["ISSUE"]->OldValue()) << '\n';
+        std::cout << "Decode instr  = 0x" << std::hex << (Wires["INSTRUCTION 1"]->OldValue()) << std::dec << '\n';
+        std::cout << "V_DE 1        = "   << (Wires["V_DE 1"]->OldValue()) << '\n';
+        std::cout << "Execute instr = 0x" << std::hex << (Wires["Execute INSTRUCTION 1"]->OldValue()) << std::dec << '\n';
+        std::cout << "V_EX 1        = "   << (Wires["V_EX 1"]->OldValue()) << '\n';
+        std::cout << "ALU 1         = "   << (Wires["ALU RESULT 1"]->OldValue()) << '\n';
+        std::cout << "Memory WB_D 1 = "   << (Wires["Memory WB_D 1"]->OldValue()) << '\n';
+        std::cout << "WB_WE 1       = "   << (Wires["WB_WE 1"]->OldValue()) << '\n';
+        std::cout << "WB_A 1        = "   << INSTRUCTION(Wires["WB_A 1"]->OldValue()).r_type.rd << '\n';
+        std::cout << "WB_D 1        = "   << (Wires["WB_D 1"]->OldValue()) << '\n';
+    }
+
+    std::cout << "-----------------------------------------------------" << std::endl;
+}
+
+// FillWires() has to run before any block looks its wires up
+class WireTable
+{
+public:
+    // new wires take GLOBAL_STAGE as their last step, so restart the clock first
+    // (a previous Pipeline on this thread left it at its last cycle)
+    WireTable()
+    {
+        GLOBAL_STAGE = 0;
+        STALL_CYCLES = 0;
+        FillWires();
+    }
+    ~WireTable()
+    { FreeWires(); }
+};
+
+// In-order 5-stage pipeline (optionally dual-issue). Wires and stages are
+// thread-local globals, so only one Pipeline may exist per thread.
+class Pipeline : public Engine, private WireTable
+{
+public:
+    const char* Name() const override
+    { return ISSUE_WIDTH == 2 ? "inorder-2" : "inorder"; }
+
+    // One stage of every block; the first three only fill the pipeline
+    void Step()
+    {
+        if (steps >= 2)
+        {
+            // we need to do FlipFlop (Fetch -> Decode) for PC_R before execute stage as we recalculate PC_R value
+            dynamic_cast<FlipFlop*>(Wires["PC_RF"])->step();
+        }
+
+        if (steps >= 3)
+        {
+            if (TRACE)
+            {
+                std::cout << "PC_RF = " << Wires["PC_RF"]->value << '\n';
+                std::cout << "PC_RD = " << Wires["PC_RD"]->value << '\n';
+            }
+
+            for(BaseBlock* block : STAGE_MEMORY)
+                block->step();
+        }
+        if (steps >= 2)
+        {
+            for(BaseBlock* block : STAGE_EXECUTE)
+                block->step();
+        }
+        if (steps >= 1)
+        {
+            for(BaseBlock* block : STAGE_DECODE)
+                block->step();
+        }
+        for(BaseBlock* block : STAGE_FETCH)
+            block->step();
+
+        if (TRACE)
+            PrintWires();
+
+        NextStage();
+        ++steps;
+
+        if (TRACE && steps > 3)
+        {
+            std::cout << "*** r1 = " << RF.regs[1] << std::endl;
+            std::cout << "*** r2 = " << RF.regs[2] << std::endl;
+        }
+
+        // the TrapUnit stopped the machine during this stage
+        if (state.status == TRAP)
+        {
+            MachineState trap   = state;
+            bool         resume = HandleTrap();
+
+            if (RETIRE.cosim != nullptr)
+                RETIRE.cosim->Trap(trap, *this);
+            if (RETIRE.hash != nullptr)
+                RETIRE.hash->Trap(trap, *this);
+            if (RETIRE.history != nullptr)
+                RETIRE.history->Trap(trap, *this);
+            if (resume)
+                FlushPipeline(state.pc);
+        }
+
+        if (RETIRE.cosim != nullptr && RETIRE.cosim->Diverged())
+            state.Fail("co-simulation divergence");
+        if (RETIRE.hash != nullptr)
+            RETIRE.hash->Sample(*this);
+
+        if (TRAP_UNIT.looped && state.status == RUNNING && fast_forward)
+            FastForward();
+    }
+
+    const MachineState& Run() override
+    { return RunFor(SIZE_MAX); }
+
+    const MachineState& RunFor(size_t cycles) override
+    {
+        end = (cycles > SIZE_MAX - GLOBAL_STAGE) ? SIZE_MAX : GLOBAL_STAGE + cycles;
+
+        // simulator errors still throw, but only unwind once
+        try
+        {
+            while (state.status == RUNNING && GLOBAL_STAGE < end)
+                Step();
+        }
+        catch(const char* message)
+        {
+            state.Fail(message);
+        }
+        return state;
+    }
+
+    // A spin loop head retired: once its iterations repeat, skips them up to the
+    // next event. The wires only compare GLOBAL_STAGE for equality, so moving it
+    // by whole iterations leaves the pipeline where the same iteration would.
+    void FastForward()
+    {
+        if (DMEM.dram != nullptr || IMEM.dram != nullptr || Monitored() || mmu.Enabled())
+            return;
+        if (!spin.Closes(IMEM.Code(), TRAP_UNIT.last, TRAP_UNIT.branch) || !spin.Steady(*this))
+            return;
+
+        uint64_t horizon = std::min<uint64_t>(csrs.NextInterrupt(), end);
+        if (horizon == UINT64_MAX)
+        {
+            state.Fail("spin loop that nothing can end");
+            return;
+        }
+        SpinDetector::Counts skip = spin.Skip(horizon);
+        GLOBAL_STAGE      += skip.cycles;
+        TRAP_UNIT.retired += skip.instructions;
+    }
+
+    // Drops every instruction in flight and refills the pipeline from `target`
+    void FlushPipeline(uint32_t target)
+    {
+        ClearWires();
+        *GetWire("PC_NEXT") = target;
+        steps = 0;
+    }
+
+public:
+    size_t Cycles() const override
+    { return GLOBAL_STAGE; }
+    size_t Instructions() const override
+    { return TRAP_UNIT.retired; }
+
+    uint32_t Register(size_t index) const override
+    { return RF.regs[index]; }
+    void SetRegister(size_t index, uint32_t value) override
+    {
+        if (index != 0)
+            RF.regs[index] = value;
+    }
+
+    const uint32_t* Memory() const override
+    { return DMEM.memory.data(); }
+    uint32_t* Memory() override
+    { return DMEM.memory.data(); }
+    size_t MemorySize() const override
+    { return DMEM.memory.size(); }
+
+    void AttachMemory(uint32_t* words, size_t size) override
+    { DMEM.memory.Attach(words, size); }
+
+    GuestMemory& Guest() override
+    { return DMEM.memory; }
+    const GuestMemory& Guest() const override
+    { return DMEM.memory; }
+
+    Mmu& MMU() override
+    { return mmu; }
+    const Mmu& MMU() const override
+    { return mmu; }
+
+    CsrFile& Csrs() override
+    { return csrs; }
+    const CsrFile& Csrs() const override
+    { return csrs; }
+
+    // The pipeline is empty after the WFI
+    void Idle(size_t cycles) override
+    { GLOBAL_STAGE += cycles; }
+
+    void Rewind(uint32_t pc, size_t cycle, size_t instructions) override
+    {
+        GLOBAL_STAGE           = cycle;
+        STALL_CYCLES           = 0;
+        TRAP_UNIT.retired      = instructions;
+        DMEM.reservation.valid = false;
+        state                  = MachineState();
+
+        // every FlipFlop latches again at the next stage, whatever stage it last saw
+        for (auto& wire : Wires)
+            wire.second->stage = cycle - 1;
+        FlushPipeline(pc);
+    }
+
+    uint64_t Events(PerformanceEvent event) const override
+    { return Count(event) + spin.Skipped(event); }
+
+    void PrintStatistics(std::ostream& out) const override
+    {
+        out << "cycles = " << Cycles() << '\n';
+        out << "instructions = " << Instructions() << std::endl;
+        if (ISSUE_WIDTH == 2)
+            V_DE1_GEN.PrintStatistics(out, Cycles(), Instructions());
+        ALU.statistics.Print(out);
+        mmu.PrintStatistics(out);
+        spin.PrintStatistics(out);
+        out.flush();
+    }
+
+protected:
+    // Occurrences of `event` in simulated cycles
+    uint64_t Count(PerformanceEvent event) const
+    {
+        switch (event)
+        {
+        case EVENT_LOADS:       return DMEM.loads;
+        case EVENT_STORES:      return DMEM.stores;
+        case EVENT_SQUASHED:    return V_DE_GEN.squashed;
+        case EVENT_FORWARDED:   return RS1V_SEL.forwarded + RS2V_SEL.forwarded + RS1V_SEL1.forwarded + RS2V_SEL1.forwarded;
+        case EVENT_MISPREDICTS: return PC_R_GEN.redirects;
+        case EVENT_ITLB_MISSES: return mmu.ItlbMisses();
+        case EVENT_DTLB_MISSES: return mmu.DtlbMisses();
+        default:                return 0;
+        }
+    }
+
+    void Fence() override
+    { mmu.Flush(); }
+
+    // A CSR instruction retires once it has executed
+    bool AccessCsr(MachineState& trap) override
+    {
+        if (!csrs.Execute(*this, trap))
+            return false;
+        if (trap.cause == CAUSE_CSR)
+            ++TRAP_UNIT.retired;
+        return true;
+    }
+
+    bool Monitored() const
+    { return RETIRE.cosim != nullptr || RETIRE.hash != nullptr || RETIRE.history != nullptr || RETIRE.debug != nullptr; }
+
+    // Runs the RetireMonitor while something is attached to it
+    void Monitor(bool monitored)
+    {
+        if (!monitored && Monitored())
+            STAGE_MEMORY.push_back(&RETIRE);
+        else if (monitored && !Monitored())
+            STAGE_MEMORY.pop_back();
+    }
+
+public:
+    Pipeline(const INSTRUCTION* program, size_t size, size_t width = 1):
+        WireTable(),
+        CU       (&IMEM),
+        RS1V_SEL (1),
+        RS2V_SEL (2),
+        IRQ_UNIT (&csrs),
+        TRAP_UNIT(&state),
+        RETIRE   (&state, &DMEM),
+        CU1      (&IMEM, 1),
+        HU1      (1),
+        WE_GEN1  (1),
+        RS1V_SEL1(3),
+        RS2V_SEL1(4),
+        SRC2_SEL1(1),
+        ALU1     (1),
+        steps    (0),
+        end      (SIZE_MAX)
+    {
+        GLOBAL_STAGE = 0;
+        STALL_CYCLES = 0;
+        ISSUE_WIDTH  = width;
+
+        IMEM.SetMemory(const_cast<INSTRUCTION*>(program), size);
+        IMEM.mmu    = &mmu;
+        IMEM.tables = &DMEM.memory;
+        DMEM.mmu    = &mmu;
+
+        STAGE_FETCH   = {
+            dynamic_cast<FlipFlop*>(Wires["PC"]),
+            &IMEM,
+            &NPC,
+        };
+        STAGE_DECODE  = {
+            dynamic_cast<FlipFlop*>(Wires["INSTRUCTION"]),
+            dynamic_cast<FlipFlop*>(Wires["PC_DE"]),
+            dynamic_cast<FlipFlop*>(Wires["LEN_DE"]),
+            dynamic_cast<FlipFlop*>(Wires["PC_RF"]),
+            dynamic_cast<FlipFlop*>(Wires["Decode TRAP"]),
+            &V_DE_GEN,
+            &CU,
+            &RF,
+        };
+        STAGE_EXECUTE = {
+            dynamic_cast<FlipFlop*>(Wires["Execute INSTRUCTION"]),
+            dynamic_cast<FlipFlop*>(Wires["CONTROL_EX"]),
+            dynamic_cast<FlipFlop*>(Wires["Execute RS1"]),
+            dynamic_cast<FlipFlop*>(Wires["Execute RS2"]),
+            dynamic_cast<FlipFlop*>(Wires["PC_EX"]),
+            dynamic_cast<FlipFlop*>(Wires["LEN_EX"]),
+            dynamic_cast<FlipFlop*>(Wires["V_EX"]),
+            dynamic_cast<FlipFlop*>(Wires["Execute TRAP"]),
+            dynamic_cast<FlipFlop*>(Wires["IMM_EX"]),
+            dynamic_cast<FlipFlop*>(Wires["PC_DISP"]),
+            &HU,
+            &WE_GEN,
+            &RS1V_SEL,
+            &RS2V_SEL,
+            &SRC1_SEL,
+            &SRC2_SEL,
+            &ALU,
+            &CMP,
+            &BR_TARGET,
+            &PC_R_GEN,
+        };
+        STAGE_MEMORY  = {
+            dynamic_cast<FlipFlop*>(Wires["WB_WE"]),
+            dynamic_cast<FlipFlop*>(Wires["WB_D"]),
+            dynamic_cast<FlipFlop*>(Wires["WB_A"]),
+
+            dynamic_cast<FlipFlop*>(Wires["Memory INSTRUCTION"]),
+            dynamic_cast<FlipFlop*>(Wires["Memory WE_GEN MEM_WE"]),
+            dynamic_cast<FlipFlop*>(Wires["Memory WE_GEN WB_WE"]),
+            dynamic_cast<FlipFlop*>(Wires["Memory CONTROL_EX"]),
+            dynamic_cast<FlipFlop*>(Wires["Memory RS2"]),
+            dynamic_cast<FlipFlop*>(Wires["Memory ALU"]),
+            dynamic_cast<FlipFlop*>(Wires["V_MEM"]),
+            dynamic_cast<FlipFlop*>(Wires["PC_MEM"]),
+            dynamic_cast<FlipFlop*>(Wires["LEN_MEM"]),
+            dynamic_cast<FlipFlop*>(Wires["Memory TRAP"]),
+
+            &IRQ_UNIT,
+            &DMEM,
+            &RSEL,
+            &TRAP_UNIT,
+        };
+
+        if (ISSUE_WIDTH == 2)
+        {
+            // pair logic runs between IMEM and NextInstruction
+            STAGE_FETCH.insert(STAGE_FETCH.begin() + 2, &ISSUE);
+
+            STAGE_DECODE.insert(STAGE_DECODE.begin(), {
+                dynamic_cast<FlipFlop*>(Wires["INSTRUCTION 1"]),
+                dynamic_cast<FlipFlop*>(Wires["ISSUE_DE"]),
+            });
+            STAGE_DECODE.insert(STAGE_DECODE.end() - 1, {
+                &V_DE1_GEN,
+                &CU1,
+            });
+
+            STAGE_EXECUTE.insert(STAGE_EXECUTE.begin(), {
+                dynamic_cast<FlipFlop*>(Wires["Execute INSTRUCTION 1"]),
+                dynamic_cast<FlipFlop*>(Wires["CONTROL_EX 1"]),
+                dynamic_cast<FlipFlop*>(Wires["Execute RS1 1"]),
+                dynamic_cast<FlipFlop*>(Wires["Execute RS2 1"]),
+                dynamic_cast<FlipFlop*>(Wires["V_EX 1"]),
+                dynamic_cast<FlipFlop*>(Wires["IMM_EX 1"]),
+            });
+            STAGE_EXECUTE.insert(STAGE_EXECUTE.end(), {
+                &HU1,
+                &WE_GEN1,
+                &RS1V_SEL1,
+                &RS2V_SEL1,
+                &SRC2_SEL1,
+                &ALU1,
+            });
+
+            STAGE_MEMORY.insert(STAGE_MEMORY.begin(), {
+                dynamic_cast<FlipFlop*>(Wires["WB_WE 1"]),
+                dynamic_cast<FlipFlop*>(Wires["WB_D 1"]),
+                dynamic_cast<FlipFlop*>(Wires["WB_A 1"]),
+
+                dynamic_cast<FlipFlop*>(Wires["Memory INSTRUCTION 1"]),
+                dynamic_cast<FlipFlop*>(Wires["Memory WE_GEN WB_WE 1"]),
+                dynamic_cast<FlipFlop*>(Wires["Memory ALU 1"]),
+                dynamic_cast<FlipFlop*>(Wires["V_MEM 1"]),
+            });
+        }
+    }
+
+    // Cycles a multiply and a divide hold Execute (0 keeps the current value)
+    void SetMulDivLatency(size_t mul_latency, size_t div_latency)
+    {
+        if (mul_latency != 0)
+            ALU.mul_latency = mul_latency;
+        if (div_latency != 0)
+            ALU.div_latency = div_latency;
+    }
+
+    // Checks every retired instruction against `cosim` (attach before the first Step)
+    void SetCoSimulator(CoSimulator* cosim)
+    {
+        bool monitored = Monitored();
+        RETIRE.cosim = cosim;
+        Monitor(monitored);
+    }
+
+    // Folds every retired instruction into `hash` (attach before the first Step)
+    void SetStateHash(StateHash* hash)
+    {
+        bool monitored = Monitored();
+        RETIRE.hash = hash;
+        Monitor(monitored);
+    }
+
+    // Logs undo records into `history` (attach before the first Step)
+    void SetHistory(History* history)
+    {
+        bool monitored = Monitored();
+        RETIRE.history = history;
+        DMEM.history   = history;
+        if (history != nullptr)
+            history->Attach(*this);
+        Monitor(monitored);
+    }
+
+    // Stops at the breakpoints and watchpoints of `debug` (single issue only)
+    void SetDebugUnit(DebugUnit* debug)
+    {
+        if (debug != nullptr && ISSUE_WIDTH != 1)
+            throw "debugging needs a single-issue pipeline";
+        bool monitored = Monitored();
+        IRQ_UNIT.debug = debug;
+        RETIRE.debug   = debug;
+        Monitor(monitored);
+    }
+
+    // Times DataMemory (and optionally InstructionMemory) through `dram`
+    void SetDRAM(DRAMController* dram, bool imem)
+    {
+        DMEM.dram = dram;
+        if (imem)
+            IMEM.dram = dram;
+    }
+
+public:
+    // Sv32 translation for IMEM and DMEM
+    Mmu mmu;
+
+    // Zicsr / Zicntr
+    CsrFile csrs;
+
+    // Stage 1 - Fetch
+    InstructionMemory IMEM;
+    NextInstruction   NPC;
+
+    // Stage 2 - Decode
+    V_DE_Generator  V_DE_GEN;
+    ControlUnit     CU;
+    RegisterFile    RF;
+
+    // Stage 3 - Execute
+    HazardUnit           HU;
+    WriteEnableGenerator WE_GEN;
+    RS_TO_RSV            RS1V_SEL;
+    RS_TO_RSV            RS2V_SEL;
+    SRC1_SELECTOR        SRC1_SEL;
+    SRC2_SELECTOR        SRC2_SEL;
+    ArithmeticLogicUnit  ALU;
+
+    Comparator     CMP;
+    BranchTarget   BR_TARGET;
+    PC_R_Generator PC_R_GEN;
+
+    // Stage 4 - Memory
+    InterruptUnit       IRQ_UNIT;
+    DataMemory          DMEM;
+    DMEM_RD_OR_ALU      RSEL;
+    TrapUnit            TRAP_UNIT;
+    RetireMonitor       RETIRE;
+
+    // Lane 1 (dual-issue)
+    IssueUnit            ISSUE;
+    V_DE1_Generator      V_DE1_GEN;
+    ControlUnit          CU1;
+    HazardUnit           HU1;
+    WriteEnableGenerator WE_GEN1;
+    RS_TO_RSV            RS1V_SEL1;
+    RS_TO_RSV            RS2V_SEL1;
+    SRC2_SELECTOR        SRC2_SEL1;
+    ArithmeticLogicUnit  ALU1;
+
+public:
+    std::vector<BaseBlock*> STAGE_FETCH;
+    std::vector<BaseBlock*> STAGE_DECODE;
+    std::vector<BaseBlock*> STAGE_EXECUTE;
+    std::vector<BaseBlock*> STAGE_MEMORY;
+
+private:
+    size_t       steps; // stages stepped so far
+    size_t       end;   // of the current RunFor()
+    SpinDetector spin;
+};
+
+#endif // _PIPELINE_H_
@@ -0,0 +1,243 @@
+#ifndef _RVC_H_
+#define _RVC_H_ 1
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "ISA.h"
+#include "Engine.h"
+
+/**
+    C extension (RV32C without the floating-point loads and stores).
+
+    Code is a word image; fetch is 16-bit aligned. A parcel whose low two bits
+    are not 11 is a compressed instruction and is expanded to the 32-bit
+    INSTRUCTION it stands for, so decode only ever sees 32-bit words. The
+    engines advance the pc by the instruction length (2 or 4), and JAL / JALR
+    link pc + length.
+
+    Reserved and unsupported parcels expand to 0, which is an illegal instruction.
+*/
+
+// Length of the instruction whose first parcel is `parcel`: 2 (RVC) or 4
+constexpr uint32_t InstructionLength(uint32_t parcel)
+{ return (parcel & 0x3) == 0x3 ? 4 : 2; }
+
+// bits [hi:lo] of `parcel` moved to bit `to`
+constexpr uint32_t ParcelField(uint32_t parcel, uint32_t hi, uint32_t lo, uint32_t to)
+{ return ((parcel >> lo) & ((1u << (hi - lo + 1)) - 1)) << to; }
+
+// Sign-extends the `bits` low bits of `value`
+constexpr int32_t SignExtend(uint32_t value, uint32_t bits)
+{ return int32_t(value << (32 - bits)) >> (32 - bits); }
+
+constexpr INSTRUCTION ExpandCompressed(uint16_t parcel)
+{
+    uint32_t funct3 = parcel >> 13;
+    size_t   rd     = ParcelField(parcel, 11, 7, 0);    // rd / rs1
+    size_t   rs2    = ParcelField(parcel, 6, 2, 0);
+    size_t   rd_    = ParcelField(parcel, 4, 2, 0) + 8; // rd' / rs2' (x8 .. x15)
+    size_t   rs1_   = ParcelField(parcel, 9, 7, 0) + 8; // rs1' / rd'
+
+    // imm[5|4:0] of C.ADDI, C.LI, C.ANDI
+    int32_t imm6 = SignExtend(ParcelField(parcel, 12, 12, 5) | ParcelField(parcel, 6, 2, 0), 6);
+    // uimm[5:3|2|6] of C.LW, C.SW
+    int32_t word = ParcelField(parcel, 12, 10, 3) | ParcelField(parcel, 6, 6, 2) | ParcelField(parcel, 5, 5, 6);
+    // offset[11|4|9:8|10|6|7|3:1|5] of C.J, C.JAL
+    int32_t jump = SignExtend(ParcelField(parcel, 12, 12, 11) | ParcelField(parcel, 11, 11, 4) | ParcelField(parcel, 10, 9, 8) |
+                              ParcelField(parcel, 8, 8, 10) | ParcelField(parcel, 7, 7, 6) | ParcelField(parcel, 6, 6, 7) |
+                              ParcelField(parcel, 5, 3, 1) | ParcelField(parcel, 2, 2, 5), 12);
+    // offset[8|4:3|7:6|2:1|5] of C.BEQZ, C.BNEZ
+    int32_t branch = SignExtend(ParcelField(parcel, 12, 12, 8) | ParcelField(parcel, 11, 10, 3) | ParcelField(parcel, 6, 5, 6) |
+                                ParcelField(parcel, 4, 3, 1) | ParcelField(parcel, 2, 2, 5), 9);
+    // shamt[5] must be 0 on RV32
+    bool shamt5 = (parcel >> 12) & 1;
+
+    switch (parcel & 0x3)
+    {
+    case 0:
+        switch (funct3)
+        {
+        case 0: // C.ADDI4SPN (nzuimm[5:4|9:6|2|3])
+        {
+            int32_t imm = ParcelField(parcel, 12, 11, 4) | ParcelField(parcel, 10, 7, 6) |
+                          ParcelField(parcel, 6, 6, 2)   | ParcelField(parcel, 5, 5, 3);
+            return imm == 0 ? INSTRUCTION() : MakeADDI(rd_, 2, imm);
+        }
+        case 2: // C.LW
+            return MakeLW(rd_, rs1_, word);
+        case 6: // C.SW
+            return MakeSW(rd_, rs1_, word);
+        default: // C.FLD, C.FLW, C.FSD, C.FSW, reserved
+            return INSTRUCTION();
+        }
+
+    case 1:
+        switch (funct3)
+        {
+        case 0: // C.ADDI, C.NOP
+            return MakeADDI(rd, rd, imm6);
+        case 1: // C.JAL
+            return MakeJAL(1, jump);
+        case 2: // C.LI
+            return MakeADDI(rd, 0, imm6);
+        case 3:
+            if (rd == 2)
+            {
+                // C.ADDI16SP (nzimm[9|4|6|8:7|5])
+                int32_t imm = SignExtend(ParcelField(parcel, 12, 12, 9) | ParcelField(parcel, 6, 6, 4) | ParcelField(parcel, 5, 5, 6) |
+                                         ParcelField(parcel, 4, 3, 7)   | ParcelField(parcel, 2, 2, 5), 10);
+                return imm == 0 ? INSTRUCTION() : MakeADDI(2, 2, imm);
+            }
+            // C.LUI (nzimm[17|16:12])
+            return imm6 == 0 ? INSTRUCTION() : MakeLUI(rd, uint32_t(imm6) & 0xfffff);
+        case 4:
+            switch (ParcelField(parcel, 11, 10, 0))
+            {
+            case 0: // C.SRLI
+                return shamt5 ? INSTRUCTION() : MakeSRLI(rs1_, rs1_, rs2);
+            case 1: // C.SRAI
+                return shamt5 ? INSTRUCTION() : MakeSRAI(rs1_, rs1_, rs2);
+            case 2: // C.ANDI
+                return MakeANDI(rs1_, rs1_, imm6);
+            default:
+                if (shamt5)
+                    return INSTRUCTION(); // C.SUBW, C.ADDW: RV64 only
+                switch (ParcelField(parcel, 6, 5, 0))
+                {
+                case 0:  return MakeSUB(rs1_, rs1_, rd_);
+                case 1:  return MakeXOR(rs1_, rs1_, rd_);
+                case 2:  return MakeOR (rs1_, rs1_, rd_);
+                default: return MakeAND(rs1_, rs1_, rd_);
+                }
+            }
+        case 5: // C.J
+            return MakeJAL(0, jump);
+        case 6: // C.BEQZ
+            return MakeBEQ(rs1_, 0, branch);
+        default: // C.BNEZ
+            return MakeBNE(rs1_, 0, branch);
+        }
+
+    default:
+        switch (funct3)
+        {
+        case 0: // C.SLLI
+            return shamt5 ? INSTRUCTION() : MakeSLLI(rd, rd, rs2);
+        case 2: // C.LWSP (uimm[5|4:2|7:6])
+        {
+            int32_t imm = ParcelField(parcel, 12, 12, 5) | ParcelField(parcel, 6, 4, 2) | ParcelField(parcel, 3, 2, 6);
+            return rd == 0 ? INSTRUCTION() : MakeLW(rd, 2, imm);
+        }
+        case 4:
+            if (!shamt5)
+            {
+                if (rs2 != 0)
+                    return MakeADD(rd, 0, rs2); // C.MV
+                return rd == 0 ? INSTRUCTION() : MakeJALR(0, rd, 0); // C.JR
+            }
+            if (rs2 != 0)
+                return MakeADD(rd, rd, rs2); // C.ADD
+            return rd == 0 ? MakeEBREAK() : MakeJALR(1, rd, 0); // C.EBREAK, C.JALR
+        case 6: // C.SWSP (uimm[5:2|7:6])
+        {
+            int32_t imm = ParcelField(parcel, 12, 9, 2) | ParcelField(parcel, 8, 7, 6);
+            return MakeSW(rs2, 2, imm);
+        }
+        default: // C.FLDSP, C.FLWSP, C.FSDSP, C.FSWSP
+            return INSTRUCTION();
+        }
+    }
+}
+
+/**
+    Fetch side of a code image: 16-bit aligned fetch, with every compressed
+    parcel expanded once. The expansion of the parcel at pc is kept in a slot
+    per halfword and reused while the image still holds the same parcel there,
+    so patched code needs no invalidation.
+*/
+class ExpansionCache
+{
+public:
+    ExpansionCache():
+        image     (nullptr),
+        size      (0),
+        expansions(0)
+    {}
+
+    void Attach(const INSTRUCTION* image, size_t size)
+    {
+        this->image = image;
+        this->size  = size;
+        slots.assign(2 * size, Slot());
+    }
+
+    // The instruction at `pc` as its 32-bit form and its length; false with `cause`
+    // set if `pc` is odd or the instruction does not lie inside the image
+    bool Fetch(uint32_t pc, INSTRUCTION& instruction, uint32_t& length, uint32_t& cause)
+    {
+        if ((pc & 0x1) != 0)
+        {
+            cause = CAUSE_FETCH_MISALIGNED;
+            return false;
+        }
+        if ((pc >> 2) >= size)
+        {
+            cause = CAUSE_FETCH_ACCESS;
+            return false;
+        }
+
+        uint16_t parcel = Parcel(pc);
+        length = InstructionLength(parcel);
+        if (length == 4)
+        {
+            if ((pc & 0x2) == 0)
+                instruction = image[pc >> 2];
+            else if ((pc >> 2) + 1 < size)
+                instruction = INSTRUCTION(parcel | uint32_t(Parcel(pc + 2)) << 16);
+            else
+            {
+                cause = CAUSE_FETCH_ACCESS;
+                return false;
+            }
+            return true;
+        }
+
+        Slot& slot = slots[pc >> 1];
+        if (!slot.valid || slot.parcel != parcel)
+        {
+            slot.word   = ExpandCompressed(parcel).raw;
+            slot.parcel = parcel;
+            slot.valid  = true;
+            ++expansions;
+        }
+        instruction = INSTRUCTION(slot.word);
+        return true;
+    }
+
+    uint16_t Parcel(uint32_t pc) const
+    { return uint16_t(image[pc >> 2].raw >> ((pc & 0x2) * 8)); }
+
+    // The parcel at `pc` is inside the image
+    bool Contains(uint32_t pc) const
+    { return (pc >> 2) < size; }
+
+    size_t Expansions() const
+    { return expansions; }
+
+private:
+    struct Slot
+    {
+        uint32_t word   = 0;
+        uint16_t parcel = 0;
+        bool     valid  = false;
+    };
+
+    const INSTRUCTION* image;
+    size_t             size;  // words
+    std::vector<Slot>  slots; // one per halfword
+    size_t             expansions;
+};
+
+#endif // _RVC_H_
@@ -0,0 +1,249 @@
+#ifndef _SPIN_H_
+#define _SPIN_H_ 1
+
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+
+#include "ISA.h"
+#include "RVC.h"
+#include "Engine.h"
+
+/**
+    Fast-forward of guest spin loops.
+
+    A spin loop is straight-line code from `head` to a branch or JAL back to
+    `head` that cannot change anything it reads: loads, ALU (not M) and upper
+    immediate instructions, branches, and no register written after the body
+    read it. Once an iteration took the closing branch, every later one loads
+    the same words, computes the same values and takes it again. Only an
+    interrupt or another hart storing to the shared memory ends it, and neither
+    happens before the next CLINT event or the end of RunFor().
+
+    The engines report every iteration (head retiring again right after the
+    branch). When the last PERIODS iterations took the same cycles, instructions
+    and events, the engine is in a steady state and Skip() hands it whole
+    iterations up to the horizon to add to its counts at once: cycle, instret
+    and the hpmcounters read as if it had run them. A few iterations before the
+    horizon are simulated again, so whatever ends the loop is still taken at
+    the right instruction. Per-unit statistics (histograms, pairing) only cover
+    the simulated cycles.
+*/
+class SpinDetector
+{
+public:
+    static constexpr size_t   MAX_LENGTH = 16; // instructions in a loop body
+    static constexpr size_t   PERIODS    = 4;  // equal iterations before a skip
+    static constexpr uint32_t ANY        = UINT32_MAX;
+
+    // An engine's counts at one point, or the difference of two
+    struct Counts
+    {
+        uint64_t cycles       = 0;
+        uint64_t instructions = 0;
+        uint64_t events[EVENT_COUNT] = {};
+
+        bool operator==(const Counts& other) const
+        {
+            for (size_t e = 0; e < EVENT_COUNT; ++e)
+                if (events[e] != other.events[e])
+                    return false;
+            return cycles == other.cycles && instructions == other.instructions;
+        }
+    };
+
+public:
+    SpinDetector():
+        head      (ANY),
+        length    (0),
+        equal     (0),
+        skips     (0),
+        iterations(0),
+        cycles    (0),
+        skipped   {}
+    {}
+
+    // `head` starts a spin loop closed by the instruction at `branch` (ANY: whichever it is)
+    bool Closes(ExpansionCache& code, uint32_t head, uint32_t branch = ANY)
+    {
+        uint32_t closing, count;
+        if (!Analyze(code, head, closing, count) || (branch != ANY && branch != closing))
+            return false;
+
+        if (head != this->head || count != length)
+        {
+            this->head = head;
+            length     = count;
+            equal      = 0;
+            last       = Counts();
+        }
+        return true;
+    }
+
+    // After an iteration of the loop Closes() accepted: true once the last
+    // PERIODS iterations took the same counts
+    bool Steady(const Engine& engine)
+    {
+        Counts now;
+        now.cycles       = engine.Cycles();
+        now.instructions = engine.Instructions();
+        for (size_t e = 1; e < EVENT_COUNT; ++e)
+            now.events[e] = engine.Events(PerformanceEvent(e));
+
+        Counts delta = Difference(now, last);
+        if (last.instructions == 0 || delta.instructions != length)
+            equal = 0; // something else ran in between
+        else if (equal != 0 && delta == period)
+            ++equal;
+        else
+            equal = 1;
+
+        period = delta;
+        last   = now;
+        return equal >= PERIODS;
+    }
+
+    // Whole iterations of the steady loop that end before cycle `horizon`, minus
+    // one; the engine adds their cycles and instructions, the events are kept here
+    Counts Skip(uint64_t horizon)
+    {
+        Counts skip;
+        if (period.cycles == 0 || horizon <= last.cycles || (horizon - last.cycles) / period.cycles < 2)
+            return skip;
+
+        uint64_t n = (horizon - last.cycles) / period.cycles - 1;
+        skip.cycles       = n * period.cycles;
+        skip.instructions = n * period.instructions;
+        for (size_t e = 0; e < EVENT_COUNT; ++e)
+        {
+            skip.events[e]  = n * period.events[e];
+            skipped[e]     += skip.events[e];
+            last.events[e] += skip.events[e];
+        }
+        last.cycles       += skip.cycles;
+        last.instructions += skip.instructions;
+
+        ++skips;
+        iterations += n;
+        cycles     += skip.cycles;
+        return skip;
+    }
+
+    // Occurrences of `event` in skipped iterations
+    uint64_t Skipped(PerformanceEvent event) const
+    { return skipped[event]; }
+
+    void PrintStatistics(std::ostream& out) const
+    {
+        if (skips != 0)
+            out << "spin loops: " << skips << " fast-forwards, " << iterations << " iterations, " << cycles << " cycles skipped\n";
+    }
+
+private:
+    static Counts Difference(const Counts& left, const Counts& right)
+    {
+        Counts result;
+        result.cycles       = left.cycles - right.cycles;
+        result.instructions = left.instructions - right.instructions;
+        for (size_t e = 0; e < EVENT_COUNT; ++e)
+            result.events[e] = left.events[e] - right.events[e];
+        return result;
+    }
+
+    static uint32_t Register(uint32_t index)
+    { return index != 0 ? 1u << index : 0; }
+
+    // Finds the closing branch and counts the body; false unless it is a spin loop
+    static bool Analyze(ExpansionCache& code, uint32_t head, uint32_t& branch, uint32_t& count)
+    {
+        uint32_t written = 0; // registers the body wrote so far
+        uint32_t read    = 0; // registers it read before writing them
+        uint32_t pc      = head;
+
+        for (count = 1; count <= MAX_LENGTH; ++count)
+        {
+            INSTRUCTION instruction;
+            uint32_t    length, cause;
+            if (!code.Fetch(pc, instruction, length, cause))
+                return false;
+
+            uint32_t rd     = instruction.r_type.rd;
+            uint32_t rs1    = Register(instruction.r_type.rs1);
+            uint32_t rs2    = Register(instruction.r_type.rs2);
+            uint32_t target = ANY; // odd, never a head
+            uint32_t uses   = 0;
+            bool     writes = true;
+
+            switch (instruction.opcode())
+            {
+            case 0x03: // loads
+            case 0x13: // OP-IMM
+                uses = rs1;
+                break;
+            case 0x33:
+                if (instruction.r_type.funct7 == 0x01)
+                    return false; // M: the ALU statistics count them
+                uses = rs1 | rs2;
+                break;
+            case 0x17: // AUIPC, LUI
+            case 0x37:
+                break;
+            case 0x63:
+                uses   = rs1 | rs2;
+                writes = false;
+                target = pc + BranchOffset(instruction);
+                break;
+            case 0x6f:
+                target = pc + JumpOffset(instruction);
+                if (target != head)
+                    return false;
+                break;
+            default:
+                return false; // stores, AMOs, JALR, SYSTEM, FENCE
+            }
+
+            read |= uses & ~written;
+            if (writes && rd != 0)
+            {
+                if (read & Register(rd))
+                    return false; // carries a value from one iteration to the next
+                written |= Register(rd);
+            }
+
+            // branches out of the body are the loop's exits, never taken while it spins
+            if (target == head)
+            {
+                branch = pc;
+                return true;
+            }
+            pc += length;
+        }
+        return false;
+    }
+
+    static uint32_t BranchOffset(INSTRUCTION instruction)
+    {
+        uint32_t offset = (instruction.b_type.imm11 << 11) | (instruction.b_type.imm6 << 5) | (instruction.b_type.imm4 << 1);
+        return instruction.b_type.imm12 ? offset | 0xfffff000 : offset;
+    }
+
+    static uint32_t JumpOffset(INSTRUCTION instruction)
+    {
+        uint32_t offset = (instruction.j_type.imm12_19 << 12) | (instruction.j_type.imm11 << 11) | (instruction.j_type.imm1_10 << 1);
+        return instruction.j_type.imm20 ? offset | 0xfff00000 : offset;
+    }
+
+private:
+    uint32_t head;   // loop the samples belong to
+    uint32_t length; // its instructions per iteration
+    Counts   last;   // counts after the last iteration
+    Counts   period; // what it cost
+    size_t   equal;  // iterations in a row with that cost
+
+    size_t   skips;
+    uint64_t iterations;
+    uint64_t cycles;
+    uint64_t skipped[EVENT_COUNT];
+};
+
+#endif // _SPIN_H_
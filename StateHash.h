@@ -0,0 +1,156 @@
+#ifndef _STATE_HASH_H_
+#define _STATE_HASH_H_ 1
+
+#include <iostream>
+#include <iomanip>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Engine.h"
+
+/**
+    Rolling hash of the architectural updates an engine retires.
+
+    Each retired instruction folds its pc, its register writeback (rd, value) and
+    the memory word it stored into the hash, in program order, so an update costs
+    a few multiplies and nothing is ever rehashed. Engines that retire the same
+    instructions with the same results agree on the hash at every instruction,
+    whatever their timing; once two runs differ, their hashes differ from then on.
+
+    Every `interval` cycles the engine records a Checkpoint (cycle, instret, hash).
+    Two runs of the same configuration have the same checkpoint cycles, and
+    FirstDivergence() finds the first checkpoint they disagree on by binary
+    search. Rerunning both up to there with a smaller interval narrows it down to
+    the cycle in O(log n) runs (`--hash-compare` in main.cpp reads the other run's
+    printed checkpoints back). Regression tests compare Digest() alone.
+
+    A handled trap folds in its cause, its pc and the registers the handler left.
+    Memory a host trap handler writes (read(), for instance) only shows up
+    through what the guest later loads from it.
+*/
+class StateHash
+{
+public:
+    struct Checkpoint
+    {
+        uint64_t cycle;
+        uint64_t instructions;
+        uint64_t hash;
+
+        bool operator==(const Checkpoint& other) const
+        { return cycle == other.cycle && instructions == other.instructions && hash == other.hash; }
+    };
+
+public:
+    // A checkpoint every `interval` cycles, none for 0
+    explicit StateHash(uint64_t interval = 0):
+        hash    (SEED),
+        interval(interval),
+        next    (interval != 0 ? interval : UINT64_MAX)
+    {}
+
+    // The engine retired the instruction at `pc`; `word` is the memory word after its store or AMO
+    void Retire(uint32_t pc, uint32_t rd, uint32_t value, bool memory, uint32_t address, uint32_t word)
+    {
+        hash = Mix(hash, (uint64_t(pc) << 5) | rd);
+        if (rd != 0)
+            hash = Mix(hash, value);
+        if (memory)
+            hash = Mix(hash, (uint64_t(address) << 32) | word);
+    }
+
+    // After HandleTrap(): `trap` is the state it was called with
+    void Trap(const MachineState& trap, const Engine& engine)
+    {
+        hash = Mix(hash, (uint64_t(trap.cause) << 32) | trap.pc);
+        for (size_t i = 1; i < 32; ++i)
+            hash = Mix(hash, engine.Register(i));
+    }
+
+    // Once per engine cycle (or stage): records a checkpoint when an interval ended
+    void Sample(const Engine& engine)
+    {
+        uint64_t cycle = engine.Cycles();
+        if (cycle < next)
+            return;
+        checkpoints.push_back({cycle, engine.Instructions(), hash});
+        next = (cycle / interval + 1) * interval;
+    }
+
+    uint64_t Digest() const
+    { return hash; }
+
+    const std::vector<Checkpoint>& Checkpoints() const
+    { return checkpoints; }
+
+    /** Index of the first checkpoint `left` and `right` disagree on (the shorter
+        size if one is a prefix of the other). Checkpoints after a divergence stay
+        different, so a binary search finds it.
+    */
+    static size_t FirstDivergence(const std::vector<Checkpoint>& left, const std::vector<Checkpoint>& right)
+    {
+        size_t low  = 0;
+        size_t high = std::min(left.size(), right.size());
+        while (low < high)
+        {
+            size_t middle = low + (high - low) / 2;
+            if (left[middle] == right[middle])
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return low;
+    }
+
+    // The checkpoint lines PrintCheckpoints() wrote, skipping any other output of the run
+    static std::vector<Checkpoint> ReadCheckpoints(std::istream& in)
+    {
+        std::vector<Checkpoint> checkpoints;
+        std::string             line;
+        while (std::getline(in, line))
+        {
+            unsigned long long cycle, instructions, hash;
+            if (sscanf(line.c_str(), "checkpoint: cycle = %llu, instret = %llu, hash = 0x%llx", &cycle, &instructions, &hash) == 3)
+                checkpoints.push_back({cycle, instructions, hash});
+        }
+        return checkpoints;
+    }
+
+    static void PrintCheckpoint(std::ostream& out, const Checkpoint& checkpoint)
+    {
+        out << "checkpoint: cycle = " << checkpoint.cycle << ", instret = " << checkpoint.instructions << ", hash = ";
+        PrintHash(out, checkpoint.hash);
+        out << '\n';
+    }
+
+    static void PrintHash(std::ostream& out, uint64_t hash)
+    { out << "0x" << std::hex << std::setw(16) << std::setfill('0') << hash << std::dec << std::setfill(' '); }
+
+    void PrintCheckpoints(std::ostream& out) const
+    {
+        for (const Checkpoint& checkpoint : checkpoints)
+            PrintCheckpoint(out, checkpoint);
+    }
+
+private:
+    static constexpr uint64_t SEED = 0xcbf29ce484222325;
+
+    static uint64_t Mix(uint64_t hash, uint64_t value)
+    {
+        hash = (hash ^ value) * 0x9e3779b97f4a7c15;
+        return hash ^ (hash >> 29);
+    }
+
+private:
+    uint64_t hash;
+    uint64_t interval;
+    uint64_t next; // cycle of the next checkpoint
+
+    std::vector<Checkpoint> checkpoints;
+};
+
+#endif // _STATE_HASH_H_
@@ -0,0 +1,430 @@
+#ifndef _SYSCALL_H_
+#define _SYSCALL_H_ 1
+
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+#include <cerrno>
+#include <ctime>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "Engine.h"
+
+/**
+    Syscall proxy: services the guest's ECALLs on the host with the Linux
+    (and newlib) RISC-V ABI: a7 = number, a0 .. a5 = arguments, a0 = result or
+    -errno. mmap places host file pages straight into DataMemory (see
+    GuestMemory::Map). It is a TrapHandler, so the ECALL is serviced when it traps at the
+    Memory / commit boundary, after the engine drained everything older, and
+    the engine resumes at pc + 4 with a clean pipeline.
+
+    A buffer argument is a DataMemory address (one word per address) and the
+    buffer is the bytes of the words from there on, four per word, little-endian:
+    the host layout of DataMemory. read() and write() go straight between the
+    guest words and the host file, without copying. Console output (fd 1 and 2)
+    is the exception: small writes are gathered in one buffer and reach the host
+    in batches, so output-heavy programs do not pay a host call per write.
+
+    exit and exit_group never get here (Engine::HandleTrap() halts on them).
+*/
+
+constexpr uint32_t SYSCALL_OPENAT          = 56;
+constexpr uint32_t SYSCALL_CLOSE           = 57;
+constexpr uint32_t SYSCALL_LSEEK           = 62;
+constexpr uint32_t SYSCALL_READ            = 63;
+constexpr uint32_t SYSCALL_WRITE           = 64;
+constexpr uint32_t SYSCALL_FSTAT           = 80;
+constexpr uint32_t SYSCALL_CLOCK_GETTIME   = 113; // 32-bit timespec
+constexpr uint32_t SYSCALL_BRK             = 214;
+constexpr uint32_t SYSCALL_MUNMAP          = 215;
+constexpr uint32_t SYSCALL_MMAP            = 222; // mmap2: offset in 4 KiB pages
+constexpr uint32_t SYSCALL_CLOCK_GETTIME64 = 403;
+
+class SyscallProxy
+{
+public:
+    static constexpr size_t OUTPUT_BUFFER = 64 * 1024;
+
+public:
+    // console = false drops what the guest writes to fd 1 and 2 (a rerun)
+    explicit SyscallProxy(bool console = true):
+        fds        {0, 1, 2},
+        console    (console),
+        output_fd  (-1),
+        brk        (0),
+        calls      (0),
+        host_writes(0),
+        written    (0)
+    {
+        output.reserve(OUTPUT_BUFFER);
+    }
+
+    ~SyscallProxy()
+    {
+        Flush();
+        for (size_t fd = 3; fd < fds.size(); ++fd)
+            if (fds[fd] >= 0)
+                close(fds[fd]);
+    }
+
+    SyscallProxy(const SyscallProxy&) = delete;
+    SyscallProxy& operator=(const SyscallProxy&) = delete;
+
+    // TrapHandler: `context` is the SyscallProxy; other traps are left unhandled
+    static bool Handler(Engine& engine, MachineState& state, void* context)
+    {
+        if (state.cause != CAUSE_ECALL)
+            return false;
+
+        SyscallProxy* proxy = static_cast<SyscallProxy*>(context);
+        engine.SetRegister(10, proxy->Call(engine));
+        state.pc += 4;
+        return true;
+    }
+
+    // Services the call in a7, returns a0
+    uint32_t Call(Engine& engine)
+    {
+        uint32_t a[6];
+        for (size_t i = 0; i < 6; ++i)
+            a[i] = engine.Register(10 + i);
+
+        ++calls;
+        switch (engine.Register(17))
+        {
+        case SYSCALL_OPENAT:
+            return OpenAt(engine, a[0], a[1], a[2], a[3]);
+        case SYSCALL_CLOSE:
+            return Close(a[0]);
+        case SYSCALL_LSEEK:
+            return Seek(a[0], a[1], a[2]);
+        case SYSCALL_READ:
+            return Read(engine, a[0], a[1], a[2]);
+        case SYSCALL_WRITE:
+            return Write(engine, a[0], a[1], a[2]);
+        case SYSCALL_FSTAT:
+            return Stat(engine, a[0], a[1]);
+        case SYSCALL_CLOCK_GETTIME:
+            return ClockGetTime(engine, a[0], a[1], false);
+        case SYSCALL_CLOCK_GETTIME64:
+            return ClockGetTime(engine, a[0], a[1], true);
+        case SYSCALL_BRK:
+            return Break(engine, a[0]);
+        case SYSCALL_MMAP:
+            return MapFile(engine, a[0], a[1], a[2], a[3], a[4], a[5]);
+        case SYSCALL_MUNMAP:
+            return Unmap(engine, a[0], a[1]);
+        default:
+            return Error(ENOSYS);
+        }
+    }
+
+    // Hands the buffered console output to the host
+    void Flush()
+    {
+        size_t done = 0;
+        while (done < output.size())
+        {
+            ssize_t count = write(output_fd, output.data() + done, output.size() - done);
+            ++host_writes;
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                break;
+            done += count;
+        }
+        output.clear();
+        output_fd = -1;
+    }
+
+    size_t Calls() const
+    { return calls; }
+
+    void PrintStatistics(std::ostream& out) const
+    {
+        out << "syscalls = " << calls << ", bytes written = " << written
+            << ", host writes = " << host_writes << '\n';
+    }
+
+private:
+    static uint32_t Error(int error)
+    { return uint32_t(-error); }
+
+    static uint32_t Result(ssize_t result)
+    { return result < 0 ? Error(errno) : uint32_t(result); }
+
+    // Host fd of guest fd `fd`, or -1
+    int Host(uint32_t fd) const
+    { return fd < fds.size() ? fds[fd] : -1; }
+
+    // The `size` bytes at word `address`, or nullptr if they are not all in DataMemory
+    static char* Bytes(Engine& engine, uint32_t address, size_t size)
+    {
+        size_t bytes = engine.MemorySize() * sizeof(uint32_t);
+        size_t start = size_t(address) * sizeof(uint32_t);
+        if (start > bytes || size > bytes - start)
+            return nullptr;
+        return reinterpret_cast<char*>(engine.Memory() + address);
+    }
+
+    // Bytes() the host writes: nullptr if they are not all in DataMemory or a page is read-only
+    static char* WritableBytes(Engine& engine, uint32_t address, size_t size)
+    {
+        char* bytes = Bytes(engine, address, size);
+        if (bytes == nullptr || !engine.Guest().Writable(address, (size + sizeof(uint32_t) - 1) / sizeof(uint32_t)))
+            return nullptr;
+        return bytes;
+    }
+
+    // Guest O_* flags (asm-generic) to the host's
+    static int OpenFlags(uint32_t flags)
+    {
+        int host = flags & 3; // O_RDONLY, O_WRONLY, O_RDWR
+        if (flags & 000000100) host |= O_CREAT;
+        if (flags & 000000200) host |= O_EXCL;
+        if (flags & 000001000) host |= O_TRUNC;
+        if (flags & 000002000) host |= O_APPEND;
+        if (flags & 000200000) host |= O_DIRECTORY;
+        if (flags & 002000000) host |= O_CLOEXEC;
+        return host;
+    }
+
+    uint32_t OpenAt(Engine& engine, uint32_t dirfd, uint32_t path, uint32_t flags, uint32_t mode)
+    {
+        // the path has to end inside DataMemory
+        const char* name = Bytes(engine, path, 0);
+        size_t      room = name == nullptr ? 0 : (engine.MemorySize() - path) * sizeof(uint32_t);
+        size_t      size = 0;
+        while (size < room && name[size] != '\0')
+            ++size;
+        if (size == room)
+            return Error(EFAULT);
+
+        int dir = int32_t(dirfd) == -100 ? AT_FDCWD : Host(dirfd); // AT_FDCWD
+        if (dir == -1)
+            return Error(EBADF);
+
+        int host = openat(dir, name, OpenFlags(flags), mode_t(mode));
+        if (host < 0)
+            return Error(errno);
+
+        for (size_t fd = 0; fd < fds.size(); ++fd)
+        {
+            if (fds[fd] < 0)
+            {
+                fds[fd] = host;
+                return fd;
+            }
+        }
+        fds.push_back(host);
+        return fds.size() - 1;
+    }
+
+    uint32_t Close(uint32_t fd)
+    {
+        int host = Host(fd);
+        if (host < 0)
+            return Error(EBADF);
+
+        if (host == output_fd)
+            Flush();
+        fds[fd] = -1;
+        // the console stays open for the simulator
+        return host > 2 ? Result(close(host)) : 0;
+    }
+
+    uint32_t Seek(uint32_t fd, uint32_t offset, uint32_t whence)
+    {
+        int host = Host(fd);
+        if (host < 0)
+            return Error(EBADF);
+
+        if (host == output_fd)
+            Flush();
+        off_t position = lseek(host, off_t(int32_t(offset)), int(whence));
+        if (position < 0)
+            return Error(errno);
+        if (position > INT32_MAX)
+            return Error(EOVERFLOW);
+        return uint32_t(position);
+    }
+
+    uint32_t Read(Engine& engine, uint32_t fd, uint32_t address, uint32_t size)
+    {
+        int   host   = Host(fd);
+        char* buffer = WritableBytes(engine, address, size);
+        if (host < 0)
+            return Error(EBADF);
+        if (buffer == nullptr)
+            return Error(EFAULT);
+
+        // a prompt has to be out before the guest waits for input
+        if (output_fd >= 0)
+            Flush();
+        return Result(read(host, buffer, size));
+    }
+
+    uint32_t Write(Engine& engine, uint32_t fd, uint32_t address, uint32_t size)
+    {
+        int         host   = Host(fd);
+        const char* buffer = Bytes(engine, address, size);
+        if (host < 0)
+            return Error(EBADF);
+        if (buffer == nullptr)
+            return Error(EFAULT);
+
+        written += size;
+        if (host == 1 || host == 2)
+        {
+            if (!console)
+                return size;
+            if (host != output_fd || output.size() + size > OUTPUT_BUFFER)
+                Flush();
+            if (size < OUTPUT_BUFFER)
+            {
+                output.insert(output.end(), buffer, buffer + size);
+                output_fd = host;
+                return size;
+            }
+        }
+
+        ++host_writes;
+        return Result(write(host, buffer, size));
+    }
+
+    uint32_t Stat(Engine& engine, uint32_t fd, uint32_t address)
+    {
+        // struct stat of rv32 Linux (asm-generic stat64), 26 words
+        uint32_t* words = reinterpret_cast<uint32_t*>(WritableBytes(engine, address, 26 * sizeof(uint32_t)));
+        int       host  = Host(fd);
+        if (host < 0)
+            return Error(EBADF);
+        if (words == nullptr)
+            return Error(EFAULT);
+
+        if (host == output_fd)
+            Flush();
+        struct stat info;
+        if (fstat(host, &info) < 0)
+            return Error(errno);
+
+        size_t i   = 0;
+        auto   put = [&](uint64_t value, size_t count)
+        {
+            words[i++] = uint32_t(value);
+            if (count == 2)
+                words[i++] = uint32_t(value >> 32);
+        };
+        put(info.st_dev, 2);
+        put(info.st_ino, 2);
+        put(info.st_mode, 1);
+        put(info.st_nlink, 1);
+        put(info.st_uid, 1);
+        put(info.st_gid, 1);
+        put(info.st_rdev, 2);
+        put(0, 2); // __pad1
+        put(info.st_size, 2);
+        put(info.st_blksize, 1);
+        put(0, 1); // __pad2
+        put(info.st_blocks, 2);
+        for (const timespec& time : {info.st_atim, info.st_mtim, info.st_ctim})
+        {
+            put(time.tv_sec, 1);
+            put(time.tv_nsec, 1);
+        }
+        put(0, 2); // __unused4, __unused5
+        return 0;
+    }
+
+    // timespec of 32-bit (sec, nsec) or 64-bit fields (clock_gettime64)
+    uint32_t ClockGetTime(Engine& engine, uint32_t clock, uint32_t address, bool time64)
+    {
+        uint32_t* words = reinterpret_cast<uint32_t*>(WritableBytes(engine, address, (time64 ? 4 : 2) * sizeof(uint32_t)));
+        if (words == nullptr)
+            return Error(EFAULT);
+
+        timespec time;
+        if (clock_gettime(clockid_t(int32_t(clock)), &time) < 0)
+            return Error(errno);
+
+        if (time64)
+        {
+            words[0] = uint32_t(time.tv_sec);
+            words[1] = uint32_t(uint64_t(time.tv_sec) >> 32);
+            words[2] = uint32_t(time.tv_nsec);
+            words[3] = 0;
+        }
+        else
+        {
+            words[0] = uint32_t(time.tv_sec);
+            words[1] = uint32_t(time.tv_nsec);
+        }
+        return 0;
+    }
+
+    // The break starts half way up DataMemory (the stack grows down from the
+    // end) and may move anywhere up to the end; a failed brk returns the old one
+    uint32_t Break(Engine& engine, uint32_t address)
+    {
+        if (brk == 0)
+            brk = engine.MemorySize() / 2;
+        if (address != 0 && address <= engine.MemorySize())
+            brk = address;
+        return brk;
+    }
+
+    /** mmap of a host file (or MAP_ANONYMOUS zero pages) into DataMemory, with
+        no copy: without PROT_WRITE the pages are read-only, MAP_SHARED writes
+        reach the file, MAP_PRIVATE is copy-on-write. The address is a word
+        address on a page (GuestMemory::PAGE_WORDS); without MAP_FIXED the
+        mapping goes right after the end of DataMemory.
+    */
+    uint32_t MapFile(Engine& engine, uint32_t address, uint32_t length, uint32_t prot, uint32_t flags, uint32_t fd, uint32_t page)
+    {
+        GuestMemory& memory = engine.Guest();
+        size_t       words  = (size_t(length) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+        int          host   = (flags & 0x20) ? -1 : Host(fd); // MAP_ANONYMOUS
+        if (length == 0)
+            return Error(EINVAL);
+        if (host < 0 && !(flags & 0x20))
+            return Error(EBADF);
+
+        if (!(flags & 0x10)) // MAP_FIXED
+            address = (memory.size() + GuestMemory::PAGE_WORDS - 1) / GuestMemory::PAGE_WORDS * GuestMemory::PAGE_WORDS;
+
+        GuestMemory::MapMode mode = !(prot & 0x2) ? GuestMemory::READ_ONLY :   // PROT_WRITE
+                                    (flags & 0x1) ? GuestMemory::SHARED :      // MAP_SHARED
+                                                    GuestMemory::COPY_ON_WRITE;
+        if (host == output_fd)
+            Flush();
+        int error = memory.Map(host, uint64_t(page) * 4096, address, words, mode);
+        return error != 0 ? Error(error) : address;
+    }
+
+    // The words become zero pages again (DataMemory does not shrink)
+    uint32_t Unmap(Engine& engine, uint32_t address, uint32_t length)
+    {
+        size_t words = (size_t(length) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+        if (length == 0 || address >= engine.MemorySize())
+            return Error(EINVAL);
+
+        int error = engine.Guest().Map(-1, 0, address, words, GuestMemory::COPY_ON_WRITE);
+        return error != 0 ? Error(error) : 0;
+    }
+
+private:
+    std::vector<int>  fds;       // host fd of each guest fd (-1 = closed)
+    bool              console;
+    std::vector<char> output;    // console output not yet written
+    int               output_fd; // fd the buffered output goes to, or -1
+    uint32_t          brk;       // 0 until the first brk
+
+    size_t calls;
+    size_t host_writes;
+    size_t written; // bytes
+};
+
+#endif // _SYSCALL_H_
@@ -0,0 +1,506 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <filesystem>
+#include <iterator>
+
+#include "ISA.h"
+#include "Pipeline.h"
+#include "OutOfOrder.h"
+#include "JIT.h"
+
+/**
+    Batch runner: simulates many program images in parallel and writes one
+    JSON line per job.
+
+    Jobs come from a manifest (one "image [key=value ...]" per line) or from
+    every file in a directory. Settings given on the command line are the
+    defaults of every job. Each image file is read once and shared read-only by
+    every job that runs it.
+
+    Jobs run on a work-stealing pool: each worker takes its own jobs newest
+    first and, when it runs out, steals the oldest job of another worker, so
+    long and short jobs balance. A job stops at its cycle limit or timeout.
+*/
+
+typedef std::vector<INSTRUCTION> Image;
+
+struct Settings
+{
+    std::string      engine  = "inorder"; // inorder, inorder-2, ooo, jit
+    size_t           cycles  = 0;         // limit (0 = none)
+    double           timeout = 0.0;       // seconds of host time (0 = none)
+    OutOfOrderConfig ooo;
+
+    std::vector<std::pair<size_t, uint32_t>> registers; // initial values (xN=value)
+};
+
+struct Job
+{
+    size_t                       index;
+    std::string                  path;
+    Settings                     settings;
+    std::shared_ptr<const Image> image; // nullptr if it could not be read
+};
+
+class WorkStealingPool
+{
+public:
+    typedef std::function<void()> Task;
+
+public:
+    explicit WorkStealingPool(size_t workers):
+        queues(workers),
+        next  (0),
+        steals(0)
+    {}
+
+    // Before Run(): tasks are dealt round-robin to the workers
+    void Submit(Task task)
+    {
+        queues[next].tasks.push_back(std::move(task));
+        next = (next + 1) % queues.size();
+    }
+
+    // Runs every submitted task, returns when all are done
+    void Run()
+    {
+        std::vector<std::thread> threads;
+        for (size_t worker = 0; worker < queues.size(); ++worker)
+            threads.emplace_back([this, worker] { Work(worker); });
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    size_t Steals() const
+    { return steals; }
+
+private:
+    struct Queue
+    {
+        std::mutex       lock;
+        std::deque<Task> tasks;
+    };
+
+    void Work(size_t worker)
+    {
+        Task task;
+        while (Pop(worker, task) || Steal(worker, task))
+            task();
+    }
+
+    bool Pop(size_t worker, Task& task)
+    {
+        Queue&                      queue = queues[worker];
+        std::lock_guard<std::mutex> guard(queue.lock);
+
+        if (queue.tasks.empty())
+            return false;
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    // No task is submitted while running, so empty queues everywhere mean done
+    bool Steal(size_t worker, Task& task)
+    {
+        for (size_t i = 1; i < queues.size(); ++i)
+        {
+            Queue&                      victim = queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+
+            if (victim.tasks.empty())
+                continue;
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            ++steals;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    std::vector<Queue>  queues;
+    size_t              next;
+    std::atomic<size_t> steals;
+};
+
+// Applies one "key=value" setting; returns false if the key is unknown or the value bad
+bool ApplySetting(Settings& settings, const std::string& key, const std::string& value)
+{
+    try
+    {
+        if (key == "engine")
+        {
+            if (value != "inorder" && value != "inorder-2" && value != "ooo" && value != "jit")
+                return false;
+            settings.engine = value;
+        }
+        else if (key == "cycles")
+            settings.cycles = std::stoull(value, nullptr, 0);
+        else if (key == "timeout")
+            settings.timeout = std::stod(value);
+        else if (key == "issue-width")
+            settings.ooo.width = std::stoull(value, nullptr, 0);
+        else if (key == "rob")
+            settings.ooo.rob_size = std::stoull(value, nullptr, 0);
+        else if (key == "iq")
+            settings.ooo.iq_size = std::stoull(value, nullptr, 0);
+        else if (key == "lsq")
+            settings.ooo.lsq_size = std::stoull(value, nullptr, 0);
+        else if (key.size() > 1 && key[0] == 'x' && isdigit(key[1]))
+        {
+            size_t index = std::stoull(key.substr(1));
+            if (index == 0 || index >= 32)
+                return false;
+            settings.registers.emplace_back(index, uint32_t(std::stoll(value, nullptr, 0)));
+        }
+        else
+            return false;
+    }
+    catch (const std::exception&)
+    {
+        return false;
+    }
+    return true;
+}
+
+bool ApplySetting(Settings& settings, const std::string& setting)
+{
+    size_t equals = setting.find('=');
+    if (equals == std::string::npos)
+        return false;
+    return ApplySetting(settings, setting.substr(0, equals), setting.substr(equals + 1));
+}
+
+std::shared_ptr<const Image> ReadImage(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return nullptr;
+
+    std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    // whole 16-bit parcels; an RVC image may end half way through a word
+    if (bytes.empty() || bytes.size() % 2 != 0)
+        return nullptr;
+
+    auto image = std::make_shared<Image>((bytes.size() + sizeof(INSTRUCTION) - 1) / sizeof(INSTRUCTION));
+    memcpy(image->data(), bytes.data(), bytes.size());
+    return image;
+}
+
+Engine* MakeEngine(const Job& job)
+{
+    const Settings& settings = job.settings;
+    const Image&    image    = *job.image;
+
+    if (settings.engine == "ooo")
+        return new OutOfOrderCore(image.data(), image.size(), settings.ooo);
+    if (settings.engine == "jit")
+        return new JitEngine(image.data(), image.size());
+    return new Pipeline(image.data(), image.size(), settings.engine == "inorder-2" ? 2 : 1);
+}
+
+std::string JsonString(const std::string& text)
+{
+    std::string result = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            result += '\\';
+            result += c;
+        }
+        else if (uint8_t(c) < 0x20)
+        {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            result += escape;
+        }
+        else
+            result += c;
+    }
+    return result + "\"";
+}
+
+class Runner
+{
+public:
+    Runner(std::ostream& out):
+        out         (out),
+        instructions(0)
+    {}
+
+    void Run(const Job& job)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        std::ostringstream line;
+        line << "{\"job\": " << job.index << ", \"image\": " << JsonString(job.path)
+             << ", \"engine\": " << JsonString(job.settings.engine);
+
+        if (job.image == nullptr)
+        {
+            line << ", \"status\": \"error\", \"message\": \"cannot read the image\"}";
+            Write(line.str(), "error");
+            return;
+        }
+
+        // simulation slices between the limit checks
+        constexpr size_t SLICE = 1 << 12;
+
+        Engine*     engine = nullptr;
+        const char* status;
+        try
+        {
+            engine = MakeEngine(job);
+            for (const auto& preset : job.settings.registers)
+                engine->SetRegister(preset.first, preset.second);
+
+            const Settings& settings = job.settings;
+            while (true)
+            {
+                size_t slice = SLICE;
+                if (settings.cycles != 0)
+                {
+                    if (engine->Cycles() >= settings.cycles)
+                        break;
+                    slice = std::min(slice, settings.cycles - engine->Cycles());
+                }
+                if (settings.timeout > 0 && Seconds(start) >= settings.timeout)
+                    break;
+
+                if (engine->RunFor(slice).status != RUNNING)
+                    break;
+            }
+        }
+        catch (const char* message)
+        {
+            line << ", \"status\": \"error\", \"message\": " << JsonString(message) << "}";
+            Write(line.str(), "error");
+            delete engine;
+            return;
+        }
+
+        const MachineState& state = engine->Status();
+        switch (state.status)
+        {
+        case RUNNING:
+            status = (job.settings.cycles != 0 && engine->Cycles() >= job.settings.cycles) ? "cycle_limit" : "timeout";
+            break;
+        case HALTED:
+            status = "halted";
+            break;
+        case TRAP:
+            status = "trap";
+            break;
+        default:
+            status = "error";
+            break;
+        }
+
+        line << ", \"status\": \"" << status << "\"";
+        if (state.status == HALTED)
+            line << ", \"exit_code\": " << state.exit_code;
+        if (state.status == TRAP)
+            line << ", \"cause\": " << state.cause << ", \"cause_name\": " << JsonString(MachineState::CauseName(state.cause))
+                 << ", \"pc\": " << state.pc;
+        if (state.status == ERROR)
+            line << ", \"message\": " << JsonString(state.message);
+
+        line << ", \"cycles\": " << engine->Cycles() << ", \"instructions\": " << engine->Instructions()
+             << ", \"wall_ms\": " << Seconds(start) * 1e3 << ", \"registers\": [";
+        for (size_t i = 0; i < 32; ++i)
+            line << (i ? ", " : "") << engine->Register(i);
+        line << "]}";
+
+        instructions += engine->Instructions();
+        delete engine;
+        Write(line.str(), status);
+    }
+
+    void PrintSummary(std::ostream& out, double seconds) const
+    {
+        out << "jobs: ";
+        for (const auto& count : statuses)
+            out << count.first << " = " << count.second << "  ";
+        out << "\nwall time = " << seconds << " s, simulated instructions = " << instructions
+            << " (" << instructions / seconds / 1e6 << " MIPS)" << std::endl;
+    }
+
+    bool AllHalted() const
+    {
+        for (const auto& count : statuses)
+            if (count.first != "halted")
+                return false;
+        return true;
+    }
+
+private:
+    static double Seconds(std::chrono::steady_clock::time_point start)
+    { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }
+
+    void Write(const std::string& line, const char* status)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        out << line << '\n';
+        statuses[status]++;
+    }
+
+private:
+    std::ostream&                 out;
+    std::mutex                    lock;
+    std::map<std::string, size_t> statuses;
+    std::atomic<size_t>           instructions;
+};
+
+// Returns the value of "--name=value" or nullptr if `arg` is another option
+const char* OptionValue(const char* arg, const char* name)
+{
+    size_t length = strlen(name);
+    if (strncmp(arg, name, length) == 0 && arg[length] == '=')
+        return arg + length + 1;
+    return nullptr;
+}
+
+int main(int argc, char* argv[])
+{
+    Settings    defaults;
+    size_t      threads = std::max(1u, std::thread::hardware_concurrency());
+    const char* output  = nullptr;
+    const char* input   = nullptr;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value;
+
+        if ((value = OptionValue(arg, "--threads")))
+            threads = std::max(1ul, strtoul(value, nullptr, 0));
+        else if ((value = OptionValue(arg, "--output")))
+            output = value;
+        else if (strncmp(arg, "--", 2) == 0)
+        {
+            if (!ApplySetting(defaults, arg + 2))
+            {
+                std::cerr << "bad option " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (input == nullptr)
+            input = arg;
+        else
+        {
+            std::cerr << "one manifest or directory only" << std::endl;
+            return 1;
+        }
+    }
+
+    if (input == nullptr)
+    {
+        std::cerr << "usage: riscv-sim-batch [options] MANIFEST|DIRECTORY" << std::endl;
+        return 1;
+    }
+
+    TRACE = false;
+
+    std::vector<Job> jobs;
+    std::error_code  error;
+
+    if (std::filesystem::is_directory(input, error))
+    {
+        std::vector<std::string> paths;
+        for (const auto& entry : std::filesystem::directory_iterator(input))
+            if (entry.is_regular_file())
+                paths.push_back(entry.path().string());
+        std::sort(paths.begin(), paths.end());
+
+        for (const std::string& path : paths)
+            jobs.push_back({jobs.size(), path, defaults, nullptr});
+    }
+    else
+    {
+        std::ifstream manifest(input);
+        if (!manifest)
+        {
+            std::cerr << "cannot open " << input << std::endl;
+            return 1;
+        }
+
+        // image paths are relative to the manifest
+        std::filesystem::path base = std::filesystem::path(input).parent_path();
+        std::string           text;
+
+        for (size_t number = 1; std::getline(manifest, text); ++number)
+        {
+            std::istringstream fields(text);
+            std::string        path;
+            std::string        setting;
+
+            if (!(fields >> path) || path[0] == '#')
+                continue;
+
+            Job job = {jobs.size(), (base / path).string(), defaults, nullptr};
+            while (fields >> setting)
+            {
+                if (!ApplySetting(job.settings, setting))
+                {
+                    std::cerr << input << ":" << number << ": bad setting " << setting << std::endl;
+                    return 1;
+                }
+            }
+            jobs.push_back(job);
+        }
+    }
+
+    // every image is read once and shared by its jobs
+    std::map<std::string, std::shared_ptr<const Image>> images;
+    for (Job& job : jobs)
+    {
+        auto found = images.find(job.path);
+        if (found == images.end())
+            found = images.emplace(job.path, ReadImage(job.path)).first;
+        job.image = found->second;
+    }
+
+    std::ofstream file;
+    if (output != nullptr)
+    {
+        file.open(output);
+        if (!file)
+        {
+            std::cerr << "cannot write " << output << std::endl;
+            return 1;
+        }
+    }
+
+    size_t           workers = std::min(threads, std::max<size_t>(jobs.size(), 1));
+    Runner           runner(output != nullptr ? file : std::cout);
+    WorkStealingPool pool(workers);
+
+    for (const Job& job : jobs)
+        pool.Submit([&runner, &job] { runner.Run(job); });
+
+    auto start = std::chrono::steady_clock::now();
+    pool.Run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    runner.PrintSummary(std::cerr, seconds);
+    std::cerr << "threads = " << workers << ", steals = " << pool.Steals() << std::endl;
+
+    return runner.AllHalted() ? 0 : 1;
+}
@@ -0,0 +1,507 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+
+#include "ISA.h"
+#include "Assembler.h"
+#include "Pipeline.h"
+#include "OutOfOrder.h"
+#include "JIT.h"
+
+/**
+    Simulator throughput benchmark.
+
+    Every kernel runs under every engine configuration: one warm-up run,
+    then the best of N timed runs. Reports simulated MIPS and host ns per
+    simulated cycle, writes them as CSV and compares them with a baseline
+    (same format) to catch slowdowns.
+*/
+
+struct Kernel
+{
+    const char*              name;
+    std::vector<INSTRUCTION> program;
+    uint32_t                 expected; // a0 at EBREAK
+};
+
+struct Config
+{
+    const char* name;
+    Engine* (*make)(const std::vector<INSTRUCTION>& program, DRAMController* dram);
+};
+
+struct Result
+{
+    std::string kernel;
+    std::string config;
+    size_t      cycles       = 0;
+    size_t      instructions = 0;
+    double      mips         = 0.0; // simulated instructions per host microsecond
+    double      ns_per_cycle = 0.0; // host time per simulated cycle
+};
+
+// sum of 1..20000
+Kernel LoopKernel()
+{
+    constexpr auto program = ASSEMBLE(R"(
+            li   t0, 20000
+            li   a0, 0
+        loop:                   # a0 += t0
+            add  a0, a0, t0
+            addi t0, t0, -1
+            bnez t0, loop
+            ebreak
+    )");
+
+    return {"loop", {program.begin(), program.end()}, 200010000};
+}
+
+// fills 100 words, copies them 50 times, returns the checksum of the copy
+Kernel MemcpyKernel()
+{
+    uint32_t expected = 0;
+    for (uint32_t i = 0; i < 100; ++i)
+        expected += i * 8 + 1;
+
+    constexpr auto program = ASSEMBLE(R"(
+            li   t0, 0          # t0 = i * 4
+            li   t1, 400        # end
+        fill:                   # src[i] = i * 8 + 1
+            add  t2, t0, t0
+            addi t2, t2, 1
+            sw   t2, 0(t0)
+            addi t0, t0, 4
+            bne  t0, t1, fill
+            li   t3, 50         # repetitions
+        outer:
+            li   t0, 0
+        copy:                   # dst[i] = src[i]
+            lw   t2, 0(t0)
+            sw   t2, 400(t0)
+            addi t0, t0, 4
+            bne  t0, t1, copy
+            addi t3, t3, -1
+            bnez t3, outer
+            li   a0, 0          # checksum
+            li   t0, 0
+        sum:
+            lw   t2, 400(t0)
+            add  a0, a0, t2
+            addi t0, t0, 4
+            bne  t0, t1, sum
+            ebreak
+    )");
+
+    return {"memcpy", {program.begin(), program.end()}, expected};
+}
+
+// 200 nodes linked as k -> (k + 77) % 200, 20480 dependent loads
+Kernel PointerChaseKernel()
+{
+    uint32_t node = 0;
+    for (size_t hop = 0; hop < 20480; ++hop)
+        node = (node + 77) % 200;
+
+    constexpr auto program = ASSEMBLE(R"(
+            li   t0, 0          # t0 = k * 4
+            li   t1, 800        # n * 4
+        build:                  # next = (k + 77) * 4
+            addi t2, t0, 308
+            blt  t2, t1, link
+            addi t2, t2, -800
+        link:
+            sw   t2, 0(t0)
+            addi t0, t0, 4
+            bne  t0, t1, build
+            li   t3, 20480      # hops
+            li   a0, 0          # p = node 0
+        chase:                  # p = *p
+            lw   a0, 0(a0)
+            addi t3, t3, -1
+            bnez t3, chase
+            ebreak
+    )");
+
+    return {"pointer_chase", {program.begin(), program.end()}, node * 4};
+}
+
+// xorshift32 drives three unpredictable branches per iteration
+Kernel BranchKernel()
+{
+    uint32_t x   = 0x12345678;
+    uint32_t sum = 0;
+    for (size_t i = 0; i < 3000; ++i)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        if (x & 1)
+            sum += 1;
+        if (x & 2)
+            sum += 3;
+        if (int32_t(x) < 0)
+            sum += 5;
+    }
+
+    constexpr auto program = ASSEMBLE(R"(
+            li   t0, 0x12345678 # x
+            li   t3, 3000       # iterations
+            li   a0, 0
+        loop:                   # xorshift32
+            slli t1, t0, 13
+            xor  t0, t0, t1
+            srli t1, t0, 17
+            xor  t0, t0, t1
+            slli t1, t0, 5
+            xor  t0, t0, t1
+            andi t1, t0, 1
+            beqz t1, bit1
+            addi a0, a0, 1
+        bit1:
+            andi t1, t0, 2
+            beqz t1, sign
+            addi a0, a0, 3
+        sign:
+            bgez t0, next
+            addi a0, a0, 5
+        next:
+            addi t3, t3, -1
+            bnez t3, loop
+            ebreak
+    )");
+
+    return {"branch", {program.begin(), program.end()}, sum};
+}
+
+// recursive fib(17): JAL calls, JALR returns, stack in memory
+Kernel CallKernel()
+{
+    constexpr auto program = ASSEMBLE(R"(
+            li   sp, 984
+            li   a0, 17
+            call fib            # fib(17)
+            ebreak
+        fib:                    # if (n < 2) return n
+            li   t0, 2
+            blt  a0, t0, done
+            addi sp, sp, -12
+            sw   ra, 0(sp)
+            sw   a0, 4(sp)
+            addi a0, a0, -1
+            call fib            # fib(n - 1)
+            sw   a0, 8(sp)
+            lw   a0, 4(sp)
+            addi a0, a0, -2
+            call fib            # fib(n - 2)
+            lw   t0, 8(sp)
+            add  a0, a0, t0
+            lw   ra, 0(sp)
+            addi sp, sp, 12
+        done:
+            ret
+    )");
+
+    return {"call", {program.begin(), program.end()}, 1597};
+}
+
+Engine* MakeInOrder(const std::vector<INSTRUCTION>& program, DRAMController*)
+{ return new Pipeline(program.data(), program.size(), 1); }
+
+Engine* MakeDualIssue(const std::vector<INSTRUCTION>& program, DRAMController*)
+{ return new Pipeline(program.data(), program.size(), 2); }
+
+// InstructionMemory and DataMemory both timed by the DRAM model
+Engine* MakeInOrderDram(const std::vector<INSTRUCTION>& program, DRAMController* dram)
+{
+    Pipeline* pipeline = new Pipeline(program.data(), program.size(), 1);
+    pipeline->SetDRAM(dram, true);
+    return pipeline;
+}
+
+Engine* MakeOutOfOrder(const std::vector<INSTRUCTION>& program, DRAMController*)
+{ return new OutOfOrderCore(program.data(), program.size()); }
+
+Engine* MakeOutOfOrderDram(const std::vector<INSTRUCTION>& program, DRAMController* dram)
+{
+    OutOfOrderCore* core = new OutOfOrderCore(program.data(), program.size());
+    core->SetDRAM(dram);
+    return core;
+}
+
+Engine* MakeOutOfOrderWide(const std::vector<INSTRUCTION>& program, DRAMController*)
+{
+    OutOfOrderConfig config;
+    config.width    = 4;
+    config.rob_size = 64;
+    config.iq_size  = 32;
+    config.lsq_size = 32;
+    return new OutOfOrderCore(program.data(), program.size(), config);
+}
+
+Engine* MakeJit(const std::vector<INSTRUCTION>& program, DRAMController*)
+{ return new JitEngine(program.data(), program.size()); }
+
+// Runs once; returns host seconds or a negative value if the result is wrong
+double RunOnce(const Kernel& kernel, const Config& config, Result& result)
+{
+    DRAMController dram;
+    Engine*        engine = config.make(kernel.program, &dram);
+
+    auto start = std::chrono::steady_clock::now();
+    const MachineState& state = engine->Run();
+    auto stop  = std::chrono::steady_clock::now();
+
+    bool ok = state.status == HALTED && engine->Register(10) == kernel.expected;
+    if (!ok)
+    {
+        std::cerr << kernel.name << " on " << config.name << ": a0 = " << engine->Register(10)
+                  << ", expected " << kernel.expected << ", ";
+        state.Print(std::cerr);
+    }
+
+    result.cycles       = engine->Cycles();
+    result.instructions = engine->Instructions();
+    delete engine;
+
+    return ok ? std::chrono::duration<double>(stop - start).count() : -1.0;
+}
+
+// Reads a results CSV into `results`; reports the file or the line and
+// returns false if it cannot be opened or a row is malformed
+bool ReadResults(const char* path, std::vector<Result>& results)
+{
+    std::ifstream in(path);
+    std::string   line;
+    size_t        number = 1;
+
+    if (!std::getline(in, line)) // header
+    {
+        std::cerr << path << ": cannot read baseline" << std::endl;
+        return false;
+    }
+    while (std::getline(in, line))
+    {
+        std::stringstream fields(line);
+        Result            result;
+        std::string       value;
+
+        ++number;
+        try
+        {
+            std::getline(fields, result.kernel, ',');
+            std::getline(fields, result.config, ',');
+            std::getline(fields, value, ',');
+            result.cycles = std::stoull(value);
+            std::getline(fields, value, ',');
+            result.instructions = std::stoull(value);
+            std::getline(fields, value, ',');
+            result.mips = std::stod(value);
+            std::getline(fields, value, ',');
+            result.ns_per_cycle = std::stod(value);
+        }
+        catch (const std::exception&)
+        {
+            std::cerr << path << ':' << number << ": malformed line: " << line << std::endl;
+            return false;
+        }
+        results.push_back(result);
+    }
+    return true;
+}
+
+void WriteResults(const char* path, const std::vector<Result>& results)
+{
+    std::ofstream out(path);
+    out << "kernel,engine,cycles,instructions,mips,ns_per_cycle\n";
+    for (const Result& result : results)
+        out << result.kernel << ',' << result.config << ',' << result.cycles << ',' << result.instructions << ','
+            << result.mips << ',' << result.ns_per_cycle << '\n';
+}
+
+// Individual entries are noisy on a shared host, so the verdict is taken on
+// the geometric mean of the ns/cycle ratios. Returns false if that got slower
+// than `tolerance` (0.25 = 25%), or if an entry has no baseline row. A
+// different retired instruction count is an engine bug, not noise: it is
+// reported and clears `correct`.
+bool Compare(const std::vector<Result>& results, const std::vector<Result>& baseline, double tolerance, bool& correct)
+{
+    double log_sum = 0.0;
+    size_t count   = 0;
+    size_t missing = 0;
+
+    for (const Result& result : results)
+    {
+        auto base = std::find_if(baseline.begin(), baseline.end(), [&](const Result& other)
+            { return other.kernel == result.kernel && other.config == result.config; });
+
+        std::cout << result.kernel << '/' << result.config << ": ";
+        if (base == baseline.end())
+        {
+            std::cout << "NOT IN BASELINE\n";
+            ++missing;
+            continue;
+        }
+
+        double ratio = result.ns_per_cycle / base->ns_per_cycle;
+        log_sum += std::log(ratio);
+        ++count;
+
+        std::cout << (ratio >= 1 ? "+" : "") << 100.0 * (ratio - 1.0) << "% ns/cycle";
+        if (ratio - 1.0 > tolerance)
+            std::cout << "  slower";
+        if (result.cycles != base->cycles)
+            std::cout << "  (simulated cycles " << base->cycles << " -> " << result.cycles << ")";
+        if (result.instructions != base->instructions)
+        {
+            std::cout << "  INSTRUCTIONS " << base->instructions << " -> " << result.instructions;
+            correct = false;
+        }
+        std::cout << '\n';
+    }
+
+    if (missing != 0)
+    {
+        std::cout << missing << " entries not in the baseline" << std::endl;
+        return false;
+    }
+    if (count == 0)
+        return true;
+
+    double change = std::exp(log_sum / count) - 1.0;
+    std::cout << "geometric mean: " << (change >= 0 ? "+" : "") << 100.0 * change << "% ns/cycle";
+    if (change > tolerance)
+    {
+        std::cout << "  REGRESSION (tolerance " << 100.0 * tolerance << "%)" << std::endl;
+        return false;
+    }
+    std::cout << std::endl;
+    return true;
+}
+
+// Returns the value of "--name=value" or nullptr if `arg` is another option
+const char* OptionValue(const char* arg, const char* name)
+{
+    size_t length = strlen(name);
+    if (strncmp(arg, name, length) == 0 && arg[length] == '=')
+        return arg + length + 1;
+    return nullptr;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t      repetitions = 10;
+    size_t      warmup      = 1;
+    double      tolerance   = 0.25;
+    const char* output      = "bench_results.csv";
+    const char* baseline    = nullptr;
+    const char* filter      = nullptr;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value;
+
+        if ((value = OptionValue(arg, "--repetitions")))
+            repetitions = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--warmup")))
+            warmup = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--tolerance")))
+            tolerance = strtod(value, nullptr);
+        else if ((value = OptionValue(arg, "--output")))
+            output = value;
+        else if ((value = OptionValue(arg, "--baseline")))
+            baseline = value;
+        else if ((value = OptionValue(arg, "--filter")))
+            filter = value;
+        else
+        {
+            std::cerr << "unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    TRACE = false;
+
+    std::vector<Kernel> kernels = {
+        LoopKernel(),
+        MemcpyKernel(),
+        PointerChaseKernel(),
+        BranchKernel(),
+        CallKernel(),
+    };
+    std::vector<Config> configs = {
+        {"inorder",      MakeInOrder},
+        {"inorder-2",    MakeDualIssue},
+        {"inorder-dram", MakeInOrderDram},
+        {"ooo",          MakeOutOfOrder},
+        {"ooo-4",        MakeOutOfOrderWide},
+        {"ooo-dram",     MakeOutOfOrderDram},
+        {"jit",          MakeJit},
+    };
+
+    std::vector<Result> results;
+    bool                correct = true;
+
+    for (const Kernel& kernel : kernels)
+    {
+        if (filter != nullptr && strstr(kernel.name, filter) == nullptr)
+            continue;
+
+        for (const Config& config : configs)
+        {
+            Result result;
+            result.kernel = kernel.name;
+            result.config = config.name;
+
+            for (size_t i = 0; i < warmup; ++i)
+                RunOnce(kernel, config, result);
+
+            double best = -1.0;
+            for (size_t i = 0; i < repetitions; ++i)
+            {
+                double seconds = RunOnce(kernel, config, result);
+                if (seconds < 0)
+                {
+                    correct = false;
+                    break;
+                }
+                if (best < 0 || seconds < best)
+                    best = seconds;
+            }
+            if (best <= 0)
+                continue;
+
+            result.mips         = result.instructions / best / 1e6;
+            result.ns_per_cycle = best * 1e9 / result.cycles;
+            results.push_back(result);
+
+            std::cout << kernel.name << '/' << config.name << ": cycles = " << result.cycles
+                      << ", instructions = " << result.instructions
+                      << ", IPC = " << double(result.instructions) / result.cycles
+                      << ", " << result.mips << " MIPS, " << result.ns_per_cycle << " ns/cycle" << std::endl;
+        }
+    }
+
+    WriteResults(output, results);
+
+    bool fast = true;
+    if (baseline != nullptr)
+    {
+        std::vector<Result> base;
+        if (!ReadResults(baseline, base))
+            return 1;
+        fast = Compare(results, base, tolerance, correct);
+    }
+
+    if (!correct)
+        return 2;
+    return fast ? 0 : 1;
+}
@@ -0,0 +1,758 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <random>
+#include <algorithm>
+
+#include "ISA.h"
+#include "Pipeline.h"
+#include "OutOfOrder.h"
+#include "JIT.h"
+#include "CoSim.h"
+
+/**
+    Differential fuzzer: generates seeded random RV32IMAC programs from the
+    Make* builders (and packed pairs of compressed ALU instructions), runs each one on every engine configuration and compares
+    the final architectural state with the single-issue pipeline.
+
+    Programs favour hazards: sources are mostly the registers written just
+    before, loads feed the next instruction or branch, and branches come in
+    dependent runs. Control flow only goes forward except for one bounded loop
+    around the body, so every program stops.
+
+    Worker threads take the next seed from a shared counter. A mismatch is
+    shrunk by delta debugging to the shortest program on which the same two
+    configurations still disagree.
+*/
+
+// One instruction of a generated program. Branches and jumps keep their
+// target as an instruction index, so removing instructions keeps them valid.
+struct Op
+{
+    static constexpr size_t NONE = SIZE_MAX;
+
+    INSTRUCTION instr;
+    size_t      target = NONE; // B*, JAL, JALR
+    size_t      base   = NONE; // JALR: the AUIPC that set rs1
+};
+
+typedef std::vector<Op>          Program;
+typedef std::vector<INSTRUCTION> Image;
+
+// Encodes the targets into the branch and jump immediates
+Image Assemble(const Program& program)
+{
+    Image image;
+    image.reserve(program.size());
+
+    for (size_t i = 0; i < program.size(); ++i)
+    {
+        const Op&   op    = program[i];
+        INSTRUCTION instr = op.instr;
+        int32_t     delta = int32_t(op.target - i) * 4;
+
+        if (op.target != Op::NONE)
+        {
+            switch (instr.opcode())
+            {
+            case 0x63:
+            {
+                uint32_t funct3 = instr.b_type.funct3;
+                instr = MakeBEQ(instr.b_type.rs1, instr.b_type.rs2, delta);
+                instr.b_type.funct3 = funct3;
+                break;
+            }
+            case 0x6f:
+                instr = MakeJAL(instr.j_type.rd, delta);
+                break;
+            case 0x67:
+                if (op.base != Op::NONE)
+                    instr = MakeJALR(instr.i_type.rd, instr.i_type.rs1, int32_t(op.target - op.base) * 4);
+                break;
+            }
+        }
+        image.push_back(instr);
+    }
+    return image;
+}
+
+// Drops program[first, first + count) and moves the targets behind it
+Program Remove(const Program& program, size_t first, size_t count)
+{
+    Program result;
+    for (size_t i = 0; i < program.size(); ++i)
+    {
+        if (i >= first && i < first + count)
+            continue;
+
+        Op op = program[i];
+        if (op.target != Op::NONE && op.target >= first)
+            op.target = op.target >= first + count ? op.target - count : first;
+        if (op.base != Op::NONE && op.base >= first)
+            op.base = op.base >= first + count ? op.base - count : Op::NONE;
+        result.push_back(op);
+    }
+    return result;
+}
+
+class ProgramGenerator
+{
+public:
+    // Registers with a fixed role; the body never writes them
+    static constexpr size_t BASE    = 28; // DataMemory pointer
+    static constexpr size_t COUNTER = 29; // loop iterations
+
+public:
+    ProgramGenerator(uint64_t seed, size_t length):
+        random(seed),
+        length(length)
+    {}
+
+    Program Generate()
+    {
+        Program program;
+
+        // 3 to 8 live registers out of x1 .. x15 keep dependencies dense
+        std::vector<size_t> all = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+        std::shuffle(all.begin(), all.end(), random);
+        pool.assign(all.begin(), all.begin() + Uniform(3, 8));
+        recent.clear();
+
+        for (size_t rd : pool)
+            SetRegister(program, rd, Interesting());
+        program.push_back({MakeADDI(BASE,    0, int32_t(Uniform(16, 900)))});
+        program.push_back({MakeADDI(COUNTER, 0, int32_t(Uniform(1, 3)))});
+
+        size_t loop = program.size();
+        while (program.size() - loop < length)
+            Snippet(program);
+
+        // forward targets stop at the loop tail; none lands on a JALR without its AUIPC
+        size_t tail = program.size();
+        for (size_t i = loop; i < tail; ++i)
+        {
+            Op& op = program[i];
+            if (op.target == Op::NONE)
+                continue;
+            op.target = std::min(op.target, tail);
+            if (op.target < tail && program[op.target].base != Op::NONE)
+                ++op.target;
+        }
+
+        program.push_back({MakeADDI(COUNTER, COUNTER, -1)});
+        program.push_back({MakeBNE(COUNTER, 0, 0), loop});
+        program.push_back({MakeEBREAK()});
+        return program;
+    }
+
+private:
+    typedef INSTRUCTION (*RType)(size_t, size_t, size_t);
+    typedef INSTRUCTION (*IType)(size_t, size_t, int32_t);
+    typedef INSTRUCTION (*Shift)(size_t, size_t, size_t);
+    typedef INSTRUCTION (*Branch)(size_t, size_t, int32_t);
+
+    void Snippet(Program& program)
+    {
+        static const RType  R[]      = {MakeADD, MakeSUB, MakeSLL, MakeSLT, MakeSLTU, MakeXOR, MakeSRL, MakeSRA, MakeOR, MakeAND,
+                                        MakeMUL, MakeMULH, MakeMULHSU, MakeMULHU, MakeDIV, MakeDIVU, MakeREM, MakeREMU};
+        static const IType  I[]      = {MakeADDI, MakeSLTI, MakeSLTIU, MakeXORI, MakeORI, MakeANDI};
+        static const Shift  SHIFT[]  = {MakeSLLI, MakeSRLI, MakeSRAI};
+        static const IType  LOAD[]   = {MakeLB, MakeLH, MakeLW, MakeLBU, MakeLHU};
+        static const IType  STORE[]  = {MakeSB, MakeSH, MakeSW};
+        static const Branch BRANCH[] = {MakeBEQ, MakeBNE, MakeBLT, MakeBGE, MakeBLTU, MakeBGEU};
+        static const size_t AMO[]    = {0x00, 0x01, 0x04, 0x08, 0x0c, 0x10, 0x14, 0x18, 0x1c};
+
+        size_t kind = Uniform(0, 99);
+        // every random draw is its own statement: argument order is unspecified
+        if (kind < 21)
+        {
+            size_t rs1 = Source();
+            size_t rs2 = Source();
+            program.push_back({Pick(R)(Dest(), rs1, rs2)});
+        }
+        else if (kind < 25)
+        {
+            // two RVC parcels fill one word, so targets stay word indexes
+            uint32_t low  = Compressed();
+            uint32_t high = Compressed();
+            program.push_back({INSTRUCTION(low | high << 16)});
+        }
+        else if (kind < 37)
+        {
+            size_t  rs1 = Source();
+            int32_t imm = Immediate();
+            program.push_back({Pick(I)(Dest(), rs1, imm)});
+        }
+        else if (kind < 42)
+        {
+            size_t rs1   = Source();
+            size_t shamt = Uniform(0, 31);
+            program.push_back({Pick(SHIFT)(Dest(), rs1, shamt)});
+        }
+        else if (kind < 45)
+        {
+            uint32_t imm20 = uint32_t(random()) & 0xfffff;
+            if (Uniform(0, 1))
+                program.push_back({MakeLUI(Dest(), imm20)});
+            else
+                program.push_back({MakeAUIPC(Dest(), imm20 & 0xff)});
+        }
+        else if (kind < 55)
+        {
+            // load, then use it at once (in a branch half of the time)
+            int32_t offset = Offset();
+            size_t  rd     = Dest();
+            program.push_back({Pick(LOAD)(rd, BASE, offset)});
+            if (Uniform(0, 1))
+            {
+                Branches(program, 1, BRANCH, rd);
+            }
+            else
+            {
+                size_t rs2 = Source();
+                program.push_back({Pick(R)(Dest(), rd, rs2)});
+            }
+        }
+        else if (kind < 63)
+        {
+            size_t  rs2    = Source();
+            int32_t offset = Offset();
+            program.push_back({Pick(STORE)(rs2, BASE, offset)});
+        }
+        else if (kind < 67)
+        {
+            // store to load forwarding, maybe through a narrower access
+            int32_t offset = Offset();
+            size_t  rs2    = Source();
+            program.push_back({Pick(STORE)(rs2, BASE, offset)});
+            program.push_back({Pick(LOAD)(Dest(), BASE, offset)});
+        }
+        else if (kind < 80)
+        {
+            Branches(program, Uniform(1, 3), BRANCH, Source());
+        }
+        else if (kind < 84)
+        {
+            program.push_back({MakeJAL(Dest(), 0), program.size() + Uniform(1, 4)});
+        }
+        else if (kind < 87)
+        {
+            size_t link = Dest();
+            size_t auipc = program.size();
+            program.push_back({MakeAUIPC(link, 0)});
+            program.push_back({MakeJALR(Dest(), link, 0), auipc + Uniform(2, 5), auipc});
+        }
+        else if (kind < 93)
+        {
+            size_t funct5 = Pick(AMO);
+            size_t rs2    = Source();
+            switch (Uniform(0, 2))
+            {
+            case 0:
+                program.push_back({MakeAMO(funct5, Dest(), BASE, rs2)});
+                break;
+            case 1:
+                program.push_back({MakeLR(Dest(), BASE)});
+                break;
+            default:
+                program.push_back({MakeSC(Dest(), BASE, rs2)});
+                break;
+            }
+        }
+        else if (kind < 96)
+        {
+            program.push_back({Uniform(0, 1) ? MakeFENCE() : MakeECALL()});
+        }
+        else if (Uniform(0, 7) != 0)
+        {
+            // the rest are faults, which end the program: keep them rare
+            Snippet(program);
+        }
+        else if (kind < 99)
+        {
+            // a data access through a live register, which may fault
+            size_t  rs1    = Source();
+            size_t  rs2    = Source();
+            int32_t offset = Offset();
+            if (Uniform(0, 1))
+                program.push_back({Pick(LOAD)(Dest(), rs1, offset)});
+            else
+                program.push_back({Pick(STORE)(rs2, rs1, offset)});
+        }
+        else
+        {
+            // any 32-bit word: often illegal, the decoders must agree. Control transfers
+            // become other opcodes and rd is a live register, so the loop still ends.
+            INSTRUCTION word = uint32_t(random()) | 0x3;
+            if (word.opcode() == 0x63 || word.opcode() == 0x6f || word.opcode() == 0x67)
+                word.raw &= ~0x40u;
+            word.r_type.rd = Dest();
+            program.push_back({word});
+        }
+    }
+
+    // A compressed ALU instruction (RVC parcel) writing a live register
+    uint32_t Compressed()
+    {
+        size_t   rd    = Dest();
+        size_t   rs2   = Source();
+        uint32_t imm   = Uniform(0, 63); // imm[5:0]
+        uint32_t shamt = Uniform(0, 31);
+        bool     prime = rd >= 8 && rd < 16; // x8 .. x15 fit the 3-bit register fields
+
+        // rs2 = 0 would turn C.MV / C.ADD into C.JR / C.JALR
+        if (rs2 == 0)
+            rs2 = rd;
+        uint32_t full = (rd << 7) | (rs2 << 2);
+
+        switch (Uniform(0, prime ? 8 : 4))
+        {
+        case 0: // C.ADDI
+            return ((imm >> 5) << 12) | (rd << 7) | ((imm & 0x1f) << 2) | 0x1;
+        case 1: // C.LI
+            return (0x2 << 13) | ((imm >> 5) << 12) | (rd << 7) | ((imm & 0x1f) << 2) | 0x1;
+        case 2: // C.SLLI
+            return (rd << 7) | (shamt << 2) | 0x2;
+        case 3: // C.MV
+            return (0x4 << 13) | full | 0x2;
+        case 4: // C.ADD
+            return (0x9 << 12) | full | 0x2;
+        case 5: // C.SRLI, C.SRAI
+            return (0x4 << 13) | (Uniform(0, 1) << 10) | ((rd - 8) << 7) | (shamt << 2) | 0x1;
+        case 6: // C.ANDI
+            return (0x4 << 13) | ((imm >> 5) << 12) | (0x2 << 10) | ((rd - 8) << 7) | ((imm & 0x1f) << 2) | 0x1;
+        default: // C.SUB C.XOR C.OR C.AND
+        {
+            size_t rs2_ = rs2 >= 8 && rs2 < 16 ? rs2 : rd;
+            return (0x4 << 13) | (0x3 << 10) | ((rd - 8) << 7) | (Uniform(0, 3) << 5) | ((rs2_ - 8) << 2) | 0x1;
+        }
+        }
+    }
+
+    // `count` dependent forward branches, the first one reads `rs1`
+    void Branches(Program& program, size_t count, const Branch (&branch)[6], size_t rs1)
+    {
+        for (size_t n = 0; n < count; ++n)
+        {
+            size_t left  = n == 0 ? rs1 : Source();
+            size_t right = Uniform(0, 3) == 0 ? 0 : Source();
+            program.push_back({Pick(branch)(left, right, 0), program.size() + Uniform(1, 4)});
+        }
+    }
+
+    void SetRegister(Program& program, size_t rd, uint32_t value)
+    {
+        uint32_t upper = (value + 0x800) >> 12;
+        int32_t  lower = int32_t(value - (upper << 12));
+
+        program.push_back({MakeLUI(rd, upper & 0xfffff)});
+        program.push_back({MakeADDI(rd, rd, lower)});
+    }
+
+    uint32_t Interesting()
+    {
+        static const uint32_t VALUES[] = {0, 1, 2, 0xffffffff, 0x7fffffff, 0x80000000, 0x80000001, 0xff, 0x100, 0xffff, 0x8000};
+        if (Uniform(0, 2) == 0)
+            return uint32_t(random());
+        return Pick(VALUES);
+    }
+
+    // Hazard bias: mostly one of the last registers written
+    size_t Source()
+    {
+        size_t choice = Uniform(0, 9);
+        if (choice < 6 && !recent.empty())
+            return recent[Uniform(0, recent.size() - 1)];
+        if (choice == 9)
+            return 0;
+        return Pick(pool);
+    }
+
+    size_t Dest()
+    {
+        size_t rd = Pick(pool);
+        recent.push_back(rd);
+        if (recent.size() > 2)
+            recent.erase(recent.begin());
+        return rd;
+    }
+
+    int32_t Offset()
+    { return int32_t(Uniform(0, 16)) - 8; }
+
+    int32_t Immediate()
+    {
+        static const int32_t EDGES[] = {0, 1, -1, 2047, -2048, 0x7ff, 31, 32};
+        return Uniform(0, 1) ? Pick(EDGES) : int32_t(Uniform(0, 4095)) - 2048;
+    }
+
+    size_t Uniform(size_t low, size_t high)
+    { return std::uniform_int_distribution<size_t>(low, high)(random); }
+
+    template<class T, size_t N>
+    T Pick(const T (&items)[N])
+    { return items[Uniform(0, N - 1)]; }
+
+    size_t Pick(const std::vector<size_t>& items)
+    { return items[Uniform(0, items.size() - 1)]; }
+
+private:
+    std::mt19937_64     random;
+    size_t              length;
+    std::vector<size_t> pool;
+    std::vector<size_t> recent;
+};
+
+// An engine and its settings; configs[0] is the reference
+struct Config
+{
+    const char*      name;
+    const char*      engine; // inorder, inorder-2, ooo, jit
+    OutOfOrderConfig ooo;
+    bool             dram;
+};
+
+std::vector<Config> DefaultConfigs()
+{
+    OutOfOrderConfig narrow;
+    narrow.width    = 1;
+    narrow.rob_size = 4;
+    narrow.iq_size  = 2;
+    narrow.lsq_size = 2;
+
+    OutOfOrderConfig wide;
+    wide.width    = 4;
+    wide.rob_size = 64;
+    wide.iq_size  = 32;
+    wide.lsq_size = 32;
+
+    return {
+        {"inorder",      "inorder",   OutOfOrderConfig(), false},
+        {"inorder-2",    "inorder-2", OutOfOrderConfig(), false},
+        {"inorder-dram", "inorder",   OutOfOrderConfig(), true },
+        {"ooo",          "ooo",       OutOfOrderConfig(), false},
+        {"ooo-narrow",   "ooo",       narrow,             false},
+        {"ooo-wide",     "ooo",       wide,               false},
+        {"ooo-dram",     "ooo",       OutOfOrderConfig(), true },
+        {"jit",          "jit",       OutOfOrderConfig(), false},
+    };
+}
+
+// ECALLs other than exit are skipped, every other trap stops the program
+bool SkipECALL(Engine&, MachineState& state, void*)
+{
+    if (state.cause != CAUSE_ECALL)
+        return false;
+    state.pc += 4;
+    return true;
+}
+
+// Runs `image` on `config` for at most `cycles` and returns its final state
+EngineState Execute(const Config& config, const Image& image, size_t cycles, size_t& instructions)
+{
+    DRAMController          dram;
+    std::unique_ptr<Engine> engine;
+
+    if (strcmp(config.engine, "jit") == 0)
+    {
+        engine.reset(new JitEngine(image.data(), image.size()));
+    }
+    else if (strcmp(config.engine, "ooo") == 0)
+    {
+        OutOfOrderCore* core = new OutOfOrderCore(image.data(), image.size(), config.ooo);
+        if (config.dram)
+            core->SetDRAM(&dram);
+        engine.reset(core);
+    }
+    else
+    {
+        Pipeline* pipeline = new Pipeline(image.data(), image.size(), strcmp(config.engine, "inorder-2") == 0 ? 2 : 1);
+        if (config.dram)
+            pipeline->SetDRAM(&dram, true);
+        engine.reset(pipeline);
+    }
+
+    engine->SetTrapHandler(SkipECALL, nullptr);
+    engine->RunFor(cycles);
+    instructions += engine->Instructions();
+
+    EngineState state(*engine);
+    state.name = config.name;
+    return state;
+}
+
+bool SameState(const EngineState& left, const EngineState& right)
+{
+    return left.state == right.state && memcmp(left.regs, right.regs, sizeof(left.regs)) == 0 && left.memory == right.memory;
+}
+
+class Fuzzer
+{
+public:
+    Fuzzer(const std::vector<Config>& configs, size_t length, size_t cycles, bool minimize, const char* output):
+        configs     (configs),
+        length      (length),
+        cycles      (cycles),
+        minimize    (minimize),
+        output      (output),
+        programs    (0),
+        instructions(0),
+        failures    (0)
+    {}
+
+    // Checks seeds first .. first + count - 1 (count 0 = until `seconds` pass)
+    void Run(uint64_t first, size_t count, double seconds, size_t threads)
+    {
+        std::atomic<uint64_t> next(first);
+        auto                  start = std::chrono::steady_clock::now();
+
+        auto work = [&]
+        {
+            size_t executed = 0;
+            for (;;)
+            {
+                if (seconds > 0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= seconds)
+                    break;
+
+                uint64_t seed = next++;
+                if (count != 0 && seed - first >= count)
+                    break;
+
+                Check(seed, executed);
+                ++programs;
+            }
+            instructions += executed;
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t n = 0; n < threads; ++n)
+            workers.emplace_back(work);
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    void PrintSummary(std::ostream& out, double seconds) const
+    {
+        out << "programs = " << programs << ", configs = " << configs.size() << ", failures = " << failures
+            << "\nwall time = " << seconds << " s, " << programs / seconds << " programs/s ("
+            << size_t(programs / seconds * 3600) << " per hour), simulated instructions = " << instructions
+            << " (" << instructions / seconds / 1e6 << " MIPS)" << std::endl;
+    }
+
+    size_t Failures() const
+    { return failures; }
+
+private:
+    void Check(uint64_t seed, size_t& executed)
+    {
+        Program program = ProgramGenerator(seed, length).Generate();
+        Image   image   = Assemble(program);
+
+        size_t      before    = executed;
+        EngineState reference = Execute(configs[0], image, cycles, executed);
+
+        // generated programs always stop: this one is a generator bug
+        if (reference.state.status == RUNNING)
+        {
+            ++failures;
+            std::lock_guard<std::mutex> guard(lock);
+            std::cout << "seed " << seed << ": " << configs[0].name << " did not stop within " << cycles << " cycles" << std::endl;
+            return;
+        }
+
+        // candidates while minimizing get a budget of cycles, shorter programs run shorter
+        size_t budget = std::min(cycles, (executed - before) * 100 + 10000);
+        for (size_t n = 1; n < configs.size(); ++n)
+        {
+            EngineState tested = Execute(configs[n], image, cycles, executed);
+            if (!SameState(reference, tested))
+            {
+                Report(seed, program, configs[n], budget);
+                return;
+            }
+        }
+    }
+
+    // A candidate only counts if the reference stops on it
+    bool Differ(const Program& program, const Config& config, size_t budget) const
+    {
+        size_t      ignored   = 0;
+        Image       image     = Assemble(program);
+        EngineState reference = Execute(configs[0], image, budget, ignored);
+        return reference.state.status != RUNNING && !SameState(reference, Execute(config, image, budget, ignored));
+    }
+
+    // Delta debugging: removes ever smaller chunks while the mismatch stays
+    Program Minimize(Program program, const Config& config, size_t budget) const
+    {
+        for (size_t chunk = program.size() / 2; chunk >= 1; )
+        {
+            bool removed = false;
+            for (size_t first = 0; first < program.size(); )
+            {
+                Program candidate = Remove(program, first, std::min(chunk, program.size() - first));
+                if (!candidate.empty() && Differ(candidate, config, budget))
+                {
+                    program = candidate;
+                    removed = true;
+                }
+                else
+                {
+                    first += chunk;
+                }
+            }
+            if (!removed)
+                chunk /= 2;
+        }
+        return program;
+    }
+
+    void Report(uint64_t seed, const Program& original, const Config& config, size_t budget)
+    {
+        ++failures;
+
+        Program     program = minimize ? Minimize(original, config, budget) : original;
+        Image       image   = Assemble(program);
+        size_t      ignored = 0;
+        std::string path;
+
+        std::ostringstream text;
+        text << "seed " << seed << ": " << config.name << " differs from " << configs[0].name << '\n';
+        CompareState(Execute(configs[0], image, budget, ignored), Execute(config, image, budget, ignored), text);
+
+        text << (minimize ? "minimized to " : "program of ") << image.size() << " instructions (from " << original.size() << "):\n";
+        for (size_t i = 0; i < image.size(); ++i)
+        {
+            uint32_t word = image[i].raw;
+            if (InstructionLength(word) == 4)
+                text << "  " << i * 4 << ": " << ReferenceISS::Disassemble(word) << '\n';
+            else
+                for (uint32_t half = 0; half < 2; ++half)
+                    text << "  " << i * 4 + 2 * half << ": c." << ReferenceISS::Disassemble(ExpandCompressed(word >> (16 * half)).raw) << '\n';
+        }
+
+        if (output != nullptr)
+        {
+            path = std::string(output) + "/fuzz-" + std::to_string(seed) + ".bin";
+            std::ofstream file(path, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(image.data()), image.size() * sizeof(INSTRUCTION));
+            text << (file ? "written to " : "cannot write ") << path << '\n';
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        std::cout << text.str() << std::flush;
+    }
+
+private:
+    std::vector<Config> configs;
+    size_t              length;
+    size_t              cycles;
+    bool                minimize;
+    const char*         output;
+
+    std::mutex          lock;
+    std::atomic<size_t> programs;
+    std::atomic<size_t> instructions;
+    std::atomic<size_t> failures;
+};
+
+// Returns the value of "--name=value" or nullptr if `arg` is another option
+const char* OptionValue(const char* arg, const char* name)
+{
+    size_t length = strlen(name);
+    if (strncmp(arg, name, length) == 0 && arg[length] == '=')
+        return arg + length + 1;
+    return nullptr;
+}
+
+int main(int argc, char* argv[])
+{
+    uint64_t    seed     = 1;
+    size_t      count    = 1000;
+    double      seconds  = 0;
+    size_t      length   = 64;
+    size_t      cycles   = 1000000;
+    size_t      threads  = std::max(1u, std::thread::hardware_concurrency());
+    bool        minimize = true;
+    const char* output   = nullptr;
+    std::string names;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value;
+
+        if ((value = OptionValue(arg, "--seed")))
+            seed = strtoull(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--programs")))
+            count = strtoull(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--time")))
+            seconds = strtod(value, nullptr);
+        else if ((value = OptionValue(arg, "--length")))
+            length = strtoull(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--cycles")))
+            cycles = strtoull(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--threads")))
+            threads = std::max(1ul, strtoul(value, nullptr, 0));
+        else if ((value = OptionValue(arg, "--configs")))
+            names = value;
+        else if ((value = OptionValue(arg, "--output")))
+            output = value;
+        else if (strcmp(arg, "--no-minimize") == 0)
+            minimize = false;
+        else
+        {
+            std::cerr << "bad option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    // branch offsets must fit the B-type immediate
+    if (length == 0 || length > 512 || cycles == 0 || (count == 0 && seconds <= 0))
+    {
+        std::cerr << "--length must be 1 .. 512, --cycles positive, and --programs or --time nonzero" << std::endl;
+        return 1;
+    }
+
+    // the reference stays first, --configs picks the others
+    std::vector<Config> configs = DefaultConfigs();
+    if (!names.empty())
+    {
+        std::vector<Config> selected = {configs[0]};
+        std::istringstream  list(names);
+        std::string         name;
+
+        while (std::getline(list, name, ','))
+        {
+            auto found = std::find_if(configs.begin(), configs.end(), [&](const Config& config) { return name == config.name; });
+            if (found == configs.end())
+            {
+                std::cerr << "unknown config " << name << std::endl;
+                return 1;
+            }
+            if (found != configs.begin())
+                selected.push_back(*found);
+        }
+        configs = selected;
+    }
+
+    TRACE = false;
+
+    Fuzzer fuzzer(configs, length, cycles, minimize, output);
+
+    auto start = std::chrono::steady_clock::now();
+    fuzzer.Run(seed, count, seconds, threads);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    fuzzer.PrintSummary(std::cerr, elapsed);
+    return fuzzer.Failures() == 0 ? 0 : 1;
+}
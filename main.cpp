@@ -1,1400 +1,658 @@
 #include <iostream>
 #include <cstdint>
 #include <cstring>
-#include <cassert>
-#include <unordered_map>
+#include <memory>
+#include <string>
+#include <fstream>
 #include <vector>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "ISA.h"
+#include "Assembler.h"
+#include "Pipeline.h"
+#include "OutOfOrder.h"
+#include "JIT.h"
+#include "MultiHart.h"
+#include "Syscall.h"
+#include "GdbStub.h"
 
 
-size_t GLOBAL_STAGE = 0;
-
-class BaseBlock
+// Returns the value of "--name=value" or nullptr if `arg` is another option
+const char* OptionValue(const char* arg, const char* name)
 {
-public:
-    static constexpr const char* TypeName = "BaseBlock";
-
-public:
-    virtual const char* Type() const
-    { return TypeName; }
+    size_t length = strlen(name);
+    if (strncmp(arg, name, length) == 0 && arg[length] == '=')
+        return arg + length + 1;
+    return nullptr;
+}
 
-    virtual void step() = 0;
+// --map=FILE@ADDRESS[,cow|,shared]: a host file in DataMemory from word ADDRESS on
+struct FileMapping
+{
+    std::string          path;
+    size_t               address;
+    GuestMemory::MapMode mode;
 };
 
-class Wire : public BaseBlock
+bool ParseMapping(const char* value, FileMapping& mapping)
 {
-public:
-    static constexpr const char* TypeName = "Wire";
-
-public:
-    const char* Type() const override
-    { return TypeName; }
-
-    void step() override
-    { stage = GLOBAL_STAGE; }
-
-public:
-    Wire(const char* name = nullptr):
-        name (name),
-        value(0),
-        stage(GLOBAL_STAGE)
-    {}
-
-public:
-    const char* GetName() const
-    { return name; }
-
-public:
-    template<class T = uint32_t>
-    T OldValue() const
-    {
-        return static_cast<T>(value);
-    }
-
-    template<class T = uint32_t>
-    T GetValue()
-    {
-        if (stage != GLOBAL_STAGE)
-            step();
-        return static_cast<T>(value);
-    }
-
-    template<class T>
-    void SetValue(T __value)
-    { value = __value; }
+    std::string text  = value;
+    size_t      at    = text.rfind('@');
+    size_t      comma = text.find(',', at == std::string::npos ? 0 : at);
+    if (at == std::string::npos || at == 0)
+        return false;
+
+    std::string mode = comma == std::string::npos ? "" : text.substr(comma + 1);
+    if (mode == "")
+        mapping.mode = GuestMemory::READ_ONLY;
+    else if (mode == "cow")
+        mapping.mode = GuestMemory::COPY_ON_WRITE;
+    else if (mode == "shared")
+        mapping.mode = GuestMemory::SHARED;
+    else
+        return false;
+
+    char* end;
+    mapping.path    = text.substr(0, at);
+    mapping.address = strtoul(text.c_str() + at + 1, &end, 0);
+    return end == text.c_str() + (comma == std::string::npos ? text.size() : comma) &&
+           mapping.address % GuestMemory::PAGE_WORDS == 0;
+}
 
-public:
-    Wire& operator=(const Wire& other)
-    {
-        if (this == &other)
-            return *this;
+// --watch=ADDRESS[+WORDS][,write|read|access|change][,stop]: a watchpoint on DataMemory words
+struct WatchOption
+{
+    uint32_t address;
+    uint32_t words;
+    uint32_t kind;
+    bool     stop;
+};
 
-        value = other.value;
-        return *this;
-    }
-    Wire& operator=(INSTRUCTION instruction)
-    {
-        value = instruction.raw;
-        return *this;
-    }
-    Wire& operator=(uint32_t __value)
+bool ParseWatch(const char* value, WatchOption& watch)
+{
+    char* end;
+    watch.address = strtoul(value, &end, 0);
+    watch.words   = *end == '+' ? strtoul(end + 1, &end, 0) : 1;
+    watch.kind    = DebugUnit::WATCH_WRITE;
+    watch.stop    = false;
+    if (end == value || watch.words == 0)
+        return false;
+
+    std::string text = end;
+    while (!text.empty())
     {
-        value = __value;
-        return *this;
+        if (text[0] != ',')
+            return false;
+        size_t      comma = text.find(',', 1);
+        std::string flag  = text.substr(1, comma == std::string::npos ? std::string::npos : comma - 1);
+        if (flag == "write")
+            watch.kind = DebugUnit::WATCH_WRITE;
+        else if (flag == "read")
+            watch.kind = DebugUnit::WATCH_READ;
+        else if (flag == "access")
+            watch.kind = DebugUnit::WATCH_ACCESS;
+        else if (flag == "change")
+            watch.kind = DebugUnit::WATCH_CHANGE;
+        else if (flag == "stop")
+            watch.stop = true;
+        else
+            return false;
+        text = comma == std::string::npos ? "" : text.substr(comma);
     }
+    return true;
+}
 
-public:
-    operator uint32_t()
-    { return GetValue(); }
-
-//protected:
-    const char* name;
-    uint32_t    value;
-    size_t      stage;
-};
-
-class FlipFlop : public Wire
+// Maps every --map file into the engine's DataMemory (zero copy)
+bool MapFiles(Engine& engine, const std::vector<FileMapping>& mappings)
 {
-public:
-    static constexpr const char* TypeName = "FlipFlop";
-
-public:
-    const char* Type() const override
-    { return TypeName; }
-
-    void step() override
+    for (const FileMapping& mapping : mappings)
     {
-        if (stage != GLOBAL_STAGE)
+        int         fd    = open(mapping.path.c_str(), mapping.mode == GuestMemory::SHARED ? O_RDWR : O_RDONLY);
+        struct stat info;
+        int         error = (fd < 0 || fstat(fd, &info) < 0) ? errno : 0;
+        if (error == 0)
         {
-            value = input->OldValue();
-            stage = GLOBAL_STAGE;
+            size_t words = (info.st_size + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+            error = engine.Guest().Map(fd, 0, mapping.address, words ? words : 1, mapping.mode);
         }
-    }
-
-public:
-    FlipFlop(Wire* input, const char* name = nullptr):
-        Wire (name),
-        input(input)
-    {}
-
-public:
-    Wire* input;
-};
-
-std::unordered_map<const char*, Wire*> Wires;
-
-Wire* GetWire(const char* name);
-
-void FillWires()
-{
-    // Fetch FlipFlop (before fetch stage)
-    Wires["Fetch FlipFlop IN"]  = new Wire    ("PC_NEXT");
-    Wires["Fetch FlipFlop OUT"] = new FlipFlop(Wires["Fetch FlipFlop IN"], "PC");
-
-    // Fetch NextInstruction
-    Wires["PC"]      = Wires["Fetch FlipFlop OUT"];
-    Wires["PC_EX"]   = new Wire("PC_EX");
-    Wires["PC_DISP"] = new Wire("PC_DISP");
-    Wires["PC_R"]    = new Wire("PC_R");
-    Wires["PC_NEXT"] = Wires["Fetch FlipFlop IN"];
-
-    // Fetch IMEM
-    Wires["IMEM A"] = Wires["PC"];
-    Wires["IMEM D"] = new Wire("IMEM D");
-
-    // Decode PC_DE
-    Wires["PC_DE"] = new FlipFlop(Wires["PC"], "PC_DE");
+        if (fd >= 0)
+            close(fd);
 
-    // Decode FlipFlop (before decode stage)
-    Wires["Decode FlipFlop INSTR IN"]  = Wires["IMEM D"];
-    Wires["Decode FlipFlop INSTR OUT"] = new FlipFlop(Wires["Decode FlipFlop INSTR IN"], "INSTRUCTION");
-    Wires["INSTRUCTION"] = Wires["Decode FlipFlop INSTR OUT"];
-
-    Wires["Decode FlipFlop PC IN"]  = Wires["PC"];
-    Wires["Decode FlipFlop PC OUT"] = new Wire();
-
-    Wires["Decode FlipFlop PC_R IN"]  = Wires["PC_R"];
-    Wires["Decode FlipFlop PC_R OUT"] = new FlipFlop(Wires["Decode FlipFlop PC_R IN"], "PC_RF");
-    Wires["PC_RF"] = Wires["Decode FlipFlop PC_R OUT"];
-    Wires["PC_RD"] = Wires["PC_R"];
-
-    // Decode RegFile
-    Wires["Decode RegFile INSTR"] = Wires["INSTRUCTION"];
-    Wires["WB_A"]  = new Wire("WB_A");
-    Wires["WB_D"]  = new Wire("WB_D");
-    Wires["WB_WE"] = new Wire("WB_WE");
-    Wires["RS1"]   = new Wire("RS1");
-    Wires["RS2"]   = new Wire("RS2");
-
-    // Decode CU
-    Wires["Decode CU INSTR"] = Wires["INSTRUCTION"];
-    Wires["Decode CU FLAGS"] = new Wire();
-    Wires["CU FLAGS"] = Wires["Decode CU FLAGS"];
-
-    Wires["V_DE"] = new Wire("V_DE");
-
-    // Execute
-    Wires["V_EX"]                = new FlipFlop(Wires["V_DE"],        "V_EX");
-    Wires["CONTROL_EX"]          = new FlipFlop(Wires["CU FLAGS"],    "CONTROL_EX");
-    Wires["Execute RS1"]         = new FlipFlop(Wires["RS1"],         "RS1_EX");
-    Wires["Execute RS2"]         = new FlipFlop(Wires["RS2"],         "RS2_EX");
-    Wires["Execute INSTRUCTION"] = new FlipFlop(Wires["INSTRUCTION"], "INSTR_EX");
-    Wires["PC_EX"]               = new FlipFlop(Wires["PC_DE"],       "PC_EX");
-
-    Wires["WE_GEN WB_WE"]  = new Wire("Execute WB_WE");
-    Wires["WE_GEN MEM_WE"] = new Wire("Execute MEM_WE");
-
-    Wires["HU_RS1"] = new Wire("HU_RS1");
-    Wires["HU_RS2"] = new Wire("HU_RS2");
-    Wires["RS1V"] = new Wire("RS1V");
-    Wires["RS2V"] = new Wire("RS2V");
-    Wires["SRC2"] = new Wire("SRC2");
-    Wires["IMM VALUE 1"] = new Wire("IMM VALUE 1");
-    Wires["IMM VALUE 2"] = new Wire("IMM VALUE 2");
-    Wires["IMM VALUE 3"] = new Wire("IMM VALUE 3");
-    Wires["IMM VALUE 4"] = new Wire("IMM VALUE 4");
-    Wires["IMM VALUE 5"] = new Wire("IMM VALUE 5");
-
-    Wires["ALU LEFT"]   = Wires["RS1V"];
-    Wires["ALU RIGHT"]  = Wires["SRC2"];
-    Wires["ALU RESULT"] = new Wire("ALU RESULT");
-
-    Wires["CMP LEFT"]   = Wires["RS1V"];
-    Wires["CMP RIGHT"]  = Wires["RS2V"];
-    Wires["CMP RESULT"] = new Wire("CMP RESULT");
-
-    // Memory
-    Wires["Memory WE_GEN WB_WE"]  = new FlipFlop(Wires["WE_GEN WB_WE"],  "Memory WE_GEN WB_WE");
-    Wires["Memory WE_GEN MEM_WE"] = new FlipFlop(Wires["WE_GEN MEM_WE"], "MEM_WE");
-    Wires["MEM_WE"] = Wires["Memory WE_GEN MEM_WE"];
-
-    Wires["Memory CONTROL_EX"]  = new FlipFlop(Wires["CONTROL_EX"],          "Memory CONTROL_EX");
-    Wires["Memory RS1"]         = new FlipFlop(Wires["Execute RS1"],         "Memory RS1");
-    Wires["Memory ALU"]         = new FlipFlop(Wires["ALU RESULT"],          "Memory ALU");
-    Wires["Memory INSTRUCTION"] = new FlipFlop(Wires["Execute INSTRUCTION"], "Memory INSTRUCTION");
-
-    Wires["DMEM WE"] = Wires["MEM_WE"];
-    Wires["DMEM WD"] = Wires["Memory RS1"];
-    Wires["DMEM A"]  = Wires["Memory ALU"];
-    Wires["DMEM RD"] = new Wire("DMEM RD");
-
-    Wires["BP_MEM"]  = Wires["Memory ALU"];
-
-    Wires["Memory WB_D"] = new Wire();
-
-    Wires["Memory HU_MEM_RD"] = Wires["Memory INSTRUCTION"];
-
-    // Write Back
-    Wires["WB CONTROL_EX"] = new FlipFlop(Wires["Memory CONTROL_EX"], "WB CONTROL_EX");
-
-    Wires["WB_WE"] = new FlipFlop(GetWire("Memory WE_GEN WB_WE"), "WB_WE");
-    Wires["WB_D"]  = new FlipFlop(GetWire("Memory WB_D"),         "WB_D");
-    Wires["WB_A"]  = new FlipFlop(GetWire("Memory INSTRUCTION"),  "WB_A");
-
-    Wires["BP_WB"]        = Wires["WB_D"];
-    Wires["WB HU_MEM_RD"] = Wires["WB_A"];
+        if (error != 0)
+        {
+            std::cerr << "--map " << mapping.path << ": " << strerror(error) << std::endl;
+            return false;
+        }
+    }
+    return true;
 }
 
-Wire* GetWire(const char* name)
+// --itlb, --dtlb, --walk-latency and --satp (translation is on from the first fetch)
+void SetupMmu(Engine& engine, const MmuConfig& config, uint32_t satp)
 {
-    if (Wires.find(name) == Wires.end())
-    {
-        std::cerr << "bad wire = " << name << std::endl;
-        throw "bad wire";
-    }
-
-    return Wires[name];
+    engine.MMU().Configure(config);
+    engine.MMU().SetSatp(satp);
 }
 
-void PrintWires();
-
-class InstructionMemory : public BaseBlock
+int main(int argc, char* argv[])
 {
-public:
-    static constexpr const char* TypeName = "InstructionMemory";
-
-public:
-    const char* Type() const override
-    { return TypeName; }
-
-    void step() override
+    bool       use_dram      = false;
+    bool       use_dram_imem = false;
+    DRAMConfig dram_config;
+
+    bool             use_ooo  = false;
+    bool             use_jit  = false;
+    bool             validate = false;
+    bool             cosim    = false;
+    bool             spin     = true; // fast-forward spin loops
+    bool             hash     = false;
+    size_t           interval = 0;    // cycles between state hash checkpoints
+    const char*      compare  = nullptr; // output of another run to compare the checkpoints with
+    const char*      gdb      = nullptr; // PORT or unix:PATH to serve gdb on
+    OutOfOrderConfig ooo_config;
+
+    size_t  records       = 0;  // undo history, 0 = off
+    size_t  back          = 0;  // instructions to step back after the run
+    int64_t back_to_write = -1; // word to run back to the last write of
+
+    size_t harts   = 1;
+    size_t quantum = 1000;
+
+    size_t mul_latency = 0; // 0 = the engine's default
+    size_t div_latency = 0;
+
+    std::vector<FileMapping> mappings;
+    std::vector<WatchOption> watches;
+
+    MmuConfig mmu_config;
+    uint32_t  satp = 0;
+
+    for (int i = 1; i < argc; ++i)
     {
-        size_t offset = address->GetValue() >> 2;
-        if (offset < size)
+        const char* arg = argv[i];
+        const char* value;
+
+        if (strcmp(arg, "--dram") == 0)
+            use_dram = true;
+        else if (strcmp(arg, "--dram-imem") == 0)
+            use_dram = use_dram_imem = true;
+        else if ((value = OptionValue(arg, "--dram-channels")))
+            dram_config.channels = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--dram-banks")))
+            dram_config.banks = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--dram-row-size")))
+            dram_config.row_size = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--dram-policy")))
+            dram_config.open_page = (strcmp(value, "closed") != 0);
+        else if ((value = OptionValue(arg, "--dram-tRCD")))
+            dram_config.tRCD = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--dram-tCL")))
+            dram_config.tCL = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--dram-tRP")))
+            dram_config.tRP = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--dram-tBURST")))
+            dram_config.tBURST = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--dram-tREFI")))
+            dram_config.tREFI = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--dram-tRFC")))
+            dram_config.tRFC = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--width")))
+        {
+            ISSUE_WIDTH = strtoul(value, nullptr, 0);
+            if (ISSUE_WIDTH != 1 && ISSUE_WIDTH != 2)
+            {
+                std::cerr << "--width must be 1 or 2" << std::endl;
+                return 1;
+            }
+        }
+        else if ((value = OptionValue(arg, "--dram-queue")))
+            dram_config.queue_depth = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--engine")))
+        {
+            use_ooo = (strcmp(value, "ooo") == 0);
+            use_jit = (strcmp(value, "jit") == 0);
+            if (!use_ooo && !use_jit && strcmp(value, "inorder") != 0)
+            {
+                std::cerr << "--engine must be inorder, ooo or jit" << std::endl;
+                return 1;
+            }
+        }
+        else if ((value = OptionValue(arg, "--issue-width")))
+            ooo_config.width = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--rob")))
+            ooo_config.rob_size = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--iq")))
+            ooo_config.iq_size = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--lsq")))
+            ooo_config.lsq_size = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--mul-latency")))
+            mul_latency = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--div-latency")))
+            div_latency = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--harts")))
+            harts = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--quantum")))
+            quantum = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--map")))
+        {
+            FileMapping mapping;
+            if (!ParseMapping(value, mapping))
+            {
+                std::cerr << "--map must be FILE@ADDRESS[,cow|,shared], ADDRESS a multiple of " << GuestMemory::PAGE_WORDS << std::endl;
+                return 1;
+            }
+            mappings.push_back(mapping);
+        }
+        else if ((value = OptionValue(arg, "--satp")))
+            satp = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--itlb")))
+            mmu_config.itlb_entries = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--dtlb")))
+            mmu_config.dtlb_entries = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--walk-latency")))
+            mmu_config.walk_latency = strtoul(value, nullptr, 0);
+        else if (strcmp(arg, "--quiet") == 0)
+            TRACE = false;
+        else if (strcmp(arg, "--validate") == 0)
+            validate = true;
+        else if (strcmp(arg, "--cosim") == 0)
+            cosim = true;
+        else if (strcmp(arg, "--no-fast-forward") == 0)
+            spin = false;
+        else if (strcmp(arg, "--hash") == 0)
+            hash = true;
+        else if ((value = OptionValue(arg, "--hash-interval")))
         {
-            *instruction = memory[offset];
+            hash     = true;
+            interval = strtoul(value, nullptr, 0);
+        }
+        else if ((value = OptionValue(arg, "--hash-compare")))
+        {
+            hash    = true;
+            compare = value;
+        }
+        else if ((value = OptionValue(arg, "--history")))
+            records = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--step-back")))
+            back = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--back-to-write")))
+            back_to_write = strtoul(value, nullptr, 0);
+        else if ((value = OptionValue(arg, "--gdb")))
+            gdb = value;
+        else if ((value = OptionValue(arg, "--watch")))
+        {
+            WatchOption watch;
+            if (!ParseWatch(value, watch))
+            {
+                std::cerr << "--watch must be ADDRESS[+WORDS][,write|read|access|change][,stop]" << std::endl;
+                return 1;
+            }
+            watches.push_back(watch);
         }
         else
         {
-            throw "InstructionMemory bad address";
+            std::cerr << "unknown option " << arg << std::endl;
+            return 1;
         }
     }
 
-public:
-    InstructionMemory():
-        address    (GetWire("IMEM A")),
-        instruction(GetWire("IMEM D")),
-        memory(nullptr),
-        size  (0)
-    {}
-
-    ~InstructionMemory()
+    static constexpr auto program = ASSEMBLE(R"(
+            addi x1, x0, 20     # r1 = rax (sum)
+            addi x2, x0, 10     # r2 = rcx (cycle counter)
+        loop:
+            beq  x2, x0, done   # for(r2 = 10; r2 != 0; --r2)
+            addi x1, x1, 15     #   r1 += 15;
+            addi x2, x2, -1
+            beq  x0, x0, loop   # absolute short jump
+        done:
+            addi x1, x1, 1      # r1 += 1
+            addi x1, x1, 2      # r1 += 2
+            ebreak              # halt, exit code = a0
+    )");
+
+    const INSTRUCTION* cmds  = program.data();
+    size_t             count = program.size();
+
+    for (size_t entries : {mmu_config.itlb_entries, mmu_config.dtlb_entries})
     {
-        if (memory != nullptr)
-            delete memory;
+        if (entries == 0 || (entries & (entries - 1)) != 0)
+        {
+            std::cerr << "--itlb and --dtlb must be powers of two" << std::endl;
+            return 1;
+        }
     }
 
-    size_t SetMemory(INSTRUCTION* array, size_t size)
+    if ((back != 0 || back_to_write >= 0) && records == 0)
+        records = 1 << 20;
+    if (records != 0 && records < History::MIN_CAPACITY)
     {
-        INSTRUCTION* ptr = new (std::nothrow) INSTRUCTION[size];
-        if (ptr == nullptr)
-            return 0;
-
-        memcpy(ptr, array, size * sizeof(INSTRUCTION));
-        this->memory = ptr;
-        this->size   = size;
-        return size;
+        std::cerr << "--history must be at least " << History::MIN_CAPACITY << " records" << std::endl;
+        return 1;
     }
-
-public:
-    Wire* address;
-    Wire* instruction;
-
-private:
-    INSTRUCTION* memory;
-    size_t       size;
-};
-
-class NextInstruction : public BaseBlock
-{
-public:
-    static constexpr const char* TypeName = "NextInstruction";
-
-public:
-    const char* Type() const override
-    { return TypeName; }
-
-    void step() override
+    if (records != 0 && (use_dram || validate))
     {
-        if (!PC_R->GetValue<bool>())
-        { *PC_NEXT = *PC + 4; }
-        else
-        { *PC_NEXT = *PC_EX + *PC_DISP; }
+        std::cerr << "--history is not supported with --dram or --validate" << std::endl;
+        return 1;
     }
 
-public:
-    NextInstruction():
-        PC     (GetWire("PC")),
-        PC_R   (GetWire("PC_R")),
-        PC_EX  (GetWire("PC_EX")),
-        PC_DISP(GetWire("PC_DISP")),
-        PC_NEXT(GetWire("PC_NEXT"))
-    {}
-
-public:
-    Wire* PC;
-    Wire* PC_R;
-    Wire* PC_EX;
-    Wire* PC_DISP;
-
-public:
-    Wire* PC_NEXT;
-};
-
-class ControlUnit : public BaseBlock
-{
-public:
-    static constexpr const char* TypeName = "ControlUnit";
-
-public:
-    const char* Type() const override
-    { return TypeName; }
-
-    void step() override
+    std::vector<StateHash::Checkpoint> expected; // of the --hash-compare run
+    if (compare != nullptr)
     {
-        INSTRUCTION      instruction(*raw_instruction);
-        ControlUnitFlags flags;
-
-        uint32_t opcode  = instruction.opcode();
-        uint32_t command = opcode >> 2;
-        if ((opcode & 0x3) != 0x3)
-            throw "not in RV32I Base Instruction Set";
-
-        /** ALU_SRC2:
-                0 = R-type
-                1 = I-type  (imm[11:0])
-                2 = S-type  (imm[11:5]    + imm[4:0])
-                3 = SB-type (imm[12|10:5] + imm[4:1|11])
-                4 = U-type  (imm[31:12])
-                5 = UJ-type (imm[20|10:1|11|19:12])
-
-            funct3[14:12] field always represent operation
-        */
-        switch (command)
+        std::ifstream file(compare);
+        if (interval == 0 || !file)
         {
-        case 0x0d: // LUI   (load the upper 20 bits) (rd = imm)
-            throw "LUI is not supported";   // can not get imm directly
-            flags.ALUOP = 0;
-            flags.SRC2  = 4; // imm[31:12]
-
-            flags.REG_WEN  = true;  // REG Write Enable
-            flags.MEM_WEN  = false; // MEM Write Enable
-            flags.MEM2REG  = false; // DMEM RD -> REG FILE
-            flags.BRN_COND = false; // B*?
-            break;
-        case 0x05: // AUIPC (add upper immediate to pc) (rd = PC + imm)
-            throw "AUIPC is not supported"; // can not use ALU for rs1 == PC
-            flags.ALUOP = 0;
-            flags.SRC2  = 4; // imm[31:12]
-
-            flags.REG_WEN  = true;  // REG Write Enable
-            flags.MEM_WEN  = false; // MEM Write Enable
-            flags.MEM2REG  = false; // DMEM RD -> REG FILE
-            flags.BRN_COND = false; // B*?
-            break;
-        case 0x1b: // JAL   (rd = PC + 4, PC = PC + imm)
-            throw "JAL is not supported"; // how to do rd = PC + 4?
-            flags.ALUOP = 0;
-            flags.SRC2  = 5; // imm[20|10:1|11|19:12]
-
-            flags.REG_WEN  = true;  // REG Write Enable
-            flags.MEM_WEN  = false; // MEM Write Enable
-            flags.MEM2REG  = false; // DMEM RD -> REG FILE
-            flags.BRN_COND = true;  // B*?
-            break;
-        case 0x19: // JALR  (rd = PC + 4, PC = rs1 + imm)
-            throw "JALR is not supported"; // can not store ALU result in PC
-            flags.ALUOP = 0;
-            flags.SRC2  = 1; // imm[11:0]
-
-            flags.REG_WEN  = true;  // REG Write Enable
-            flags.MEM_WEN  = false; // MEM Write Enable
-            flags.MEM2REG  = false; // DMEM RD -> REG FILE
-            flags.BRN_COND = true;  // B*?
-            break;
-        case 0x18: // B*    (if (rs1 op rs2) then (PC += imm) else (PC += 4))
-            flags.ALUOP = instruction.r_type.funct3;
-            flags.SRC2  = 3; // imm[12|10:5] + imm[4:1|11]
-
-            flags.REG_WEN  = false; // REG Write Enable
-            flags.MEM_WEN  = false; // MEM Write Enable
-            flags.MEM2REG  = false; // DMEM RD -> REG FILE
-            flags.BRN_COND = true;  // B*?
-            break;
-        case 0x00: // L{B,H,W}{_,U}
-            flags.ALUOP = instruction.r_type.funct3;
-            flags.SRC2  = 1; // imm[11:0]
-
-            flags.REG_WEN  = true;  // REG Write Enable
-            flags.MEM_WEN  = false; // MEM Write Enable
-            flags.MEM2REG  = true;  // DMEM RD -> REG FILE
-            flags.BRN_COND = false; // B*?
-            break;
-        case 0x08: // S{B,H,W}
-            flags.ALUOP = instruction.r_type.funct3;
-            flags.SRC2  = 2; // imm[11:5] + imm[4:0]
-
-            flags.REG_WEN  = false; // REG Write Enable
-            flags.MEM_WEN  = true;  // MEM Write Enable
-            flags.MEM2REG  = false; // DMEM RD -> REG FILE
-            flags.BRN_COND = false; // B*?
-            break;
-        case 0x04: // (OP)I (rd = rs1 op imm)
-            flags.ALUOP = instruction.r_type.funct3;
-            flags.SRC2  = 1; // imm[11:0]
-
-            flags.REG_WEN  = true;  // REG Write Enable
-            flags.MEM_WEN  = false; // MEM Write Enable
-            flags.MEM2REG  = false; // DMEM RD -> REG FILE
-            flags.BRN_COND = false; // B*?
-            break;
-        case 0x0c: // (OP)  (rd = rs1 op rs2)
-            flags.ALUOP = instruction.r_type.funct3;
-            flags.SRC2  = 0; // reg
-
-            flags.REG_WEN  = true;  // REG Write Enable
-            flags.MEM_WEN  = false; // MEM Write Enable
-            flags.MEM2REG  = false; // DMEM RD -> REG FILE
-            flags.BRN_COND = false; // B*?
-            break;
-        case 0x03: // FENCE and FENCE.I
-            throw "FENCE and FENCE.I instructions are not supported";
-        case 0x1c: // ECALL and EBREAK
-            throw "ECALL and EBREAK instructions are not supported";
-        default:   // ???
-            throw "command not supported";
+            std::cerr << (interval == 0 ? "--hash-compare needs --hash-interval" : "--hash-compare: cannot read the file") << std::endl;
+            return 1;
         }
-
-        *CU_flags = ((INSTRUCTION) flags).raw;
+        expected = StateHash::ReadCheckpoints(file);
     }
 
-public:
-    ControlUnit():
-        raw_instruction(GetWire("Decode CU INSTR")),
-        CU_flags       (GetWire("Decode CU FLAGS"))
-    {}
-
-public:
-    Wire* raw_instruction;
-    Wire* CU_flags;
-};
-
-class RegisterFile : public BaseBlock
-{
-public:
-    static constexpr const char* TypeName = "RegisterFile";
-
-public:
-    const char* Type() const override
-    { return TypeName; }
-
-    void step() override
+    if (gdb != nullptr && (use_jit || ISSUE_WIDTH != 1 || harts != 1 || use_dram || validate || cosim || hash))
     {
-        size_t rd  = INSTRUCTION(*WB_A).r_type.rd;
-        size_t rs1 = INSTRUCTION(*instruction).r_type.rs1;
-        size_t rs2 = INSTRUCTION(*instruction).r_type.rs2;
-
-        if (WB_WE->GetValue<bool>() && rd != 0)
-        {
-            std::cout << "WB RegisterFile offset = " << rd << std::endl;
-            regs[rd] = *WB_D;
-        }
-
-        std::cout << "rs1 = " << rs1 << ", rs2 = " << rs2 << std::endl;
-        *RS1 = regs[rs1];
-        *RS2 = regs[rs2];
+        std::cerr << "--gdb is not supported by the jit engine, or with --width=2, --harts, --dram, --validate, --cosim or --hash" << std::endl;
+        return 1;
+    }
+    if (!watches.empty() && (use_jit || ISSUE_WIDTH != 1 || harts != 1 || validate || cosim || hash))
+    {
+        std::cerr << "--watch is not supported by the jit engine, or with --width=2, --harts, --validate, --cosim or --hash" << std::endl;
+        return 1;
     }
 
-public:
-    RegisterFile():
-        instruction (GetWire("INSTRUCTION")),
-        WB_A  (GetWire("WB_A")),
-        WB_D  (GetWire("WB_D")),
-        WB_WE (GetWire("WB_WE")),
-        RS1   (GetWire("RS1")),
-        RS2   (GetWire("RS2")),
-        regs  {}
-    {}
-
-public:
-    Wire* instruction;
-    Wire* WB_A;  // write back address (inside instruction)
-    Wire* WB_D;  // write back data
-    Wire* WB_WE; // write back write enable
-
-public:
-    Wire* RS1;
-    Wire* RS2;
-
-public:
-    uint32_t regs[32];
-};
-
-class WriteEnableGenerator : public BaseBlock
-{
-public:
-    static constexpr const char* TypeName = "WriteEnableGenerator";
+    if (ooo_config.width == 0 || ooo_config.rob_size == 0 || ooo_config.iq_size == 0 || ooo_config.lsq_size == 0)
+    {
+        std::cerr << "--issue-width, --rob, --iq and --lsq must be positive" << std::endl;
+        return 1;
+    }
+    if (dram_config.channels == 0 || dram_config.banks == 0 || dram_config.row_size == 0 || dram_config.queue_depth == 0)
+    {
+        std::cerr << "--dram-channels, --dram-banks, --dram-row-size and --dram-queue must be positive" << std::endl;
+        return 1;
+    }
+    if (dram_config.tREFI == 0 || dram_config.tRFC >= dram_config.tREFI)
+    {
+        std::cerr << "--dram-tREFI must be positive and greater than --dram-tRFC" << std::endl;
+        return 1;
+    }
 
-public:
-    const char* Type() const override
-    { return TypeName; }
+    if (mul_latency != 0)
+        ooo_config.mul_latency = mul_latency;
+    if (div_latency != 0)
+        ooo_config.div_latency = div_latency;
 
-    void step() override
+    if (harts != 1)
     {
-        ControlUnitFlags flags = INSTRUCTION(*CONTROL_EX).flags;
-
-        if (!flags.BRN_COND && V_EX->GetValue<bool>())
+        if (harts == 0 || quantum == 0)
         {
-            *MEM_WE = flags.MEM_WEN;
-            *WB_WE  = flags.REG_WEN;
+            std::cerr << "--harts and --quantum must be positive" << std::endl;
+            return 1;
         }
-        else
+        if (use_dram || validate || cosim || hash || records != 0 || !mappings.empty())
         {
-            *MEM_WE = false;
-            *WB_WE  = false;
+            std::cerr << "--dram, --validate, --cosim, --hash, --history and --map are not supported with several harts" << std::endl;
+            return 1;
         }
-    }
 
-public:
-    WriteEnableGenerator():
-        V_EX      (GetWire("V_EX")),
-        CONTROL_EX(GetWire("CONTROL_EX")),
-        MEM_WE    (GetWire("WE_GEN MEM_WE")),
-        WB_WE     (GetWire("WE_GEN WB_WE"))
-    {}
+        // the per-stage trace does not tell harts apart
+        TRACE = false;
 
-public:
-    Wire* V_EX;
-    Wire* CONTROL_EX;
-
-public:
-    Wire* MEM_WE;
-    Wire* WB_WE;
-};
+        size_t        width = ISSUE_WIDTH;
+        MultiHart     machine(harts, quantum);
+        machine.Run([&](size_t) -> Engine*
+        {
+            Engine* engine;
+            if (use_jit)
+            {
+                engine = new JitEngine(cmds, count);
+            }
+            else if (use_ooo)
+            {
+                engine = new OutOfOrderCore(cmds, count, ooo_config);
+            }
+            else
+            {
+                Pipeline* pipeline = new Pipeline(cmds, count, width);
+                pipeline->SetMulDivLatency(mul_latency, div_latency);
+                engine = pipeline;
+            }
+            SetupMmu(*engine, mmu_config, satp);
+            engine->SetFastForward(spin);
+            return engine;
+        });
+
+        machine.PrintStatus(std::cerr);
+        machine.PrintStatistics(std::cout);
+        return machine.ExitCode();
+    }
 
-class HazardUnit : public BaseBlock
-{
-public:
-    static constexpr const char* TypeName = "HazardUnit";
+    DRAMController DRAM(dram_config);
+    Engine*        engine;
 
-public:
-    const char* Type() const override
-    { return TypeName; }
+    // the reference runs on its own thread, behind the engine
+    std::vector<uint32_t>        words;
+    std::unique_ptr<CoSimulator> checker;
+    StateHash                    state_hash(interval);
+    std::unique_ptr<History>     history(records != 0 ? new History(records) : nullptr);
+    DebugUnit                    debug;
+    for (size_t i = 0; i < count; ++i)
+        words.push_back(cmds[i].raw);
 
-    void step() override
+    if (use_jit)
     {
-        uint32_t rs1    = INSTRUCTION(HU_EX_INSTR ->OldValue()).r_type.rs1;
-        uint32_t rs2    = INSTRUCTION(HU_EX_INSTR ->OldValue()).r_type.rs2;
-        uint32_t rd_mem = INSTRUCTION(HU_MEM_RDMEM->OldValue()).r_type.rd;
-        uint32_t rd_wb  = INSTRUCTION(HU_MEM_RDWB ->OldValue()).r_type.rd;
-
-        *HU_RS1 = 0x0;
-        *HU_RS2 = 0x0;
-
-        std::cout << "REG_WE_M  = " << *REG_WE_M  << '\n';
-        std::cout << "REG_WE_WB = " << *REG_WE_WB << '\n';
-
-        ControlUnitFlags flagsM = INSTRUCTION(HU_CONTROL_M->OldValue()).flags;
-        if (*REG_WE_M && !flagsM.BRN_COND && flagsM.REG_WEN && !flagsM.MEM2REG)
+        if (use_dram || cosim || hash || history != nullptr)
         {
-            // we only use BP_MEM (ALU result) when we will choose ALU result and write back
-            if (rs1 == rd_mem)
-                *HU_RS1 = 0x1;
-            if (rs2 == rd_mem)
-                *HU_RS2 = 0x1;
+            std::cerr << "--dram, --cosim, --hash and --history are not supported by the jit engine" << std::endl;
+            return 1;
         }
 
-        ControlUnitFlags flagsWB = INSTRUCTION(HU_CONTROL_WB->OldValue()).flags;
-        if (*REG_WE_WB && !flagsWB.BRN_COND && flagsM.REG_WEN)
+        engine = new JitEngine(cmds, count);
+        SetupMmu(*engine, mmu_config, satp);
+        if (!MapFiles(*engine, mappings))
         {
-            if (rs1 == rd_wb)
-                *HU_RS1 = 0x2;
-            if (rs2 == rd_wb)
-                *HU_RS2 = 0x2;
+            delete engine;
+            return 1;
         }
     }
-
-public:
-    HazardUnit():
-        // not on scheme !!!
-        HU_CONTROL_M (GetWire("Memory CONTROL_EX")),
-        HU_CONTROL_WB(GetWire("WB CONTROL_EX")),
-        REG_WE_M     (GetWire("Memory WE_GEN WB_WE")),
-        REG_WE_WB    (GetWire("WB_WE")),
-
-        HU_EX_INSTR (GetWire("Execute INSTRUCTION")),
-        HU_MEM_RDMEM(GetWire("Memory HU_MEM_RD")),
-        HU_MEM_RDWB (GetWire("WB HU_MEM_RD")),
-        HU_RS1      (GetWire("HU_RS1")),
-        HU_RS2      (GetWire("HU_RS2"))
-    {}
-
-public:
-    Wire* HU_CONTROL_M;
-    Wire* HU_CONTROL_WB;
-
-    Wire* REG_WE_M;
-    Wire* REG_WE_WB;
-
-    Wire* HU_EX_INSTR;
-    Wire* HU_MEM_RDMEM;
-    Wire* HU_MEM_RDWB;
-
-public:
-    Wire* HU_RS1;
-    Wire* HU_RS2;
-};
-
-class Immediate : public BaseBlock
-{
-public:
-    static constexpr const char* TypeName = "Immediate";
-
-public:
-    const char* Type() const override
-    { return TypeName; }
-
-    void step() override
+    else if (use_ooo)
     {
-        INSTRUCTION instr(*instruction);
-        /**
-            0 = R-type
-            1 = I-type  (imm[11:0])
-            2 = S-type  (imm[11:5]    + imm[4:0])
-            3 = SB-type (imm[12|10:5] + imm[4:1|11])
-            4 = U-type  (imm[31:12])
-            5 = UJ-type (imm[20|10:1|11|19:12])
-        */
-
-        // I-type (imm type == int32)
-        *output1 = instr.i_type.imm;
-
-        // S-type
+        if (use_dram_imem)
         {
-            bool     sign  = (instr.s_type.imm7 & 0x40);
-            uint32_t value = (instr.s_type.imm7 & 0x3f) + instr.s_type.imm5;
-
-            if (!sign)
-                *output2 = value;
-            else
-                *output2 = -((~value & 0x7ff) + 1);
+            std::cerr << "--dram-imem is not supported by the out-of-order engine" << std::endl;
+            return 1;
         }
 
-        // SB-type
+        OutOfOrderCore* core = new OutOfOrderCore(cmds, count, ooo_config);
+        engine = core;
+        if (use_dram)
+            core->SetDRAM(&DRAM);
+        SetupMmu(*core, mmu_config, satp);
+        if (!MapFiles(*core, mappings))
         {
-            uint32_t value = (instr.b_type.imm11 << 11) + (instr.b_type.imm6 << 5) + (instr.b_type.imm4 << 1);
-
-            if (!instr.b_type.imm12)
-                *output3 = value;
-            else
-                *output3 = -((~value & 0xfff) + 1);
+            delete engine;
+            return 1;
         }
-
-        // U-type (imm type == int32)
-        *output4 = instr.u_type.imm << 12;
-
-        // UJ-type
+        if (cosim)
         {
-            uint32_t value = (instr.j_type.imm12_19 << 12) + (instr.j_type.imm11 << 12) + (instr.j_type.imm1_10 << 1);
-
-            if (!instr.j_type.imm20)
-                *output5 = value;
-            else
-                *output5 = -((~value & 0xfffff) + 1);
+            checker.reset(new CoSimulator(words.data(), words.size(), *core));
+            core->SetCoSimulator(checker.get());
         }
-
-        *PC_DISP = *output3;
+        if (hash)
+            core->SetStateHash(&state_hash);
+        core->SetHistory(history.get());
+        if (gdb != nullptr || !watches.empty())
+            core->SetDebugUnit(&debug);
     }
-
-public:
-    Immediate():
-        instruction (GetWire("Execute INSTRUCTION")),
-        output1     (GetWire("IMM VALUE 1")),
-        output2     (GetWire("IMM VALUE 2")),
-        output3     (GetWire("IMM VALUE 3")),
-        output4     (GetWire("IMM VALUE 4")),
-        output5     (GetWire("IMM VALUE 5")),
-        PC_DISP     (GetWire("PC_DISP"))
-    {}
-
-public:
-    Wire* instruction;
-
-public:
-    Wire* output1;
-    Wire* output2;
-    Wire* output3;
-    Wire* output4;
-    Wire* output5;
-    Wire* PC_DISP;
-};
-
-class RS_TO_RSV : public BaseBlock
-{
-public:
-    static constexpr const char* TypeName = "RS_TO_RSV";
-
-public:
-    const char* Type() const override
-    { return TypeName; }
-
-    void step() override
+    else
     {
-        switch(*HU_RS)
+        Pipeline* pipeline = new Pipeline(cmds, count, ISSUE_WIDTH);
+        engine = pipeline;
+        pipeline->SetMulDivLatency(mul_latency, div_latency);
+        if (use_dram)
+            pipeline->SetDRAM(&DRAM, use_dram_imem);
+        SetupMmu(*pipeline, mmu_config, satp);
+        if (!MapFiles(*pipeline, mappings))
         {
-        case 0:
-            *RSV = *RS;
-            break;
-        case 1:
-            *RSV = *BP_MEM;
-            break;
-        case 2:
-            *RSV = *BP_WB;
-            break;
-        default:
-            throw "bad HU_RS for RSV selector";
+            delete engine;
+            return 1;
         }
-    }
-
-public:
-    RS_TO_RSV(size_t number):
-        RS    (nullptr),
-        HU_RS (nullptr),
-        BP_MEM(GetWire("BP_MEM")),
-        BP_WB (GetWire("BP_WB"))
-    {
-        switch(number)
+        if (cosim)
         {
-            case 1:
-            {
-                RS    = GetWire("RS1");
-                HU_RS = GetWire("HU_RS1");
-                RSV   = GetWire("RS1V");
-                break;
-            }
-            case 2:
-            {
-                RS    = GetWire("RS2");
-                HU_RS = GetWire("HU_RS2");
-                RSV   = GetWire("RS2V");
-                break;
-            }
-            default:
-                throw "bad number in RS_TO_RSV(number)";
+            checker.reset(new CoSimulator(words.data(), words.size(), *pipeline));
+            pipeline->SetCoSimulator(checker.get());
         }
+        if (hash)
+            pipeline->SetStateHash(&state_hash);
+        pipeline->SetHistory(history.get());
+        if (gdb != nullptr || !watches.empty())
+            pipeline->SetDebugUnit(&debug);
     }
 
-public:
-    Wire* RS;
-    Wire* HU_RS;
-    Wire* BP_MEM;
-    Wire* BP_WB;
-
-public:
-    Wire* RSV;
-};
-
-class SRC2_SELECTOR : public BaseBlock
-{
-public:
-    static constexpr const char* TypeName = "SRC2_SELECTOR";
-
-public:
-    const char* Type() const override
-    { return TypeName; }
+    // guest I/O goes through the host (write, read, openat, brk, ...)
+    SyscallProxy syscalls;
+    engine->SetTrapHandler(SyscallProxy::Handler, &syscalls);
+    engine->SetFastForward(spin);
 
-    void step() override
+    for (const WatchOption& watch : watches)
     {
-        uint32_t ALU_SRC2 = INSTRUCTION(*CONTROL_EX).flags.SRC2;
-        std::cout << "ALU_SRC2 = " << ALU_SRC2 << std::endl;
-
-        switch (ALU_SRC2)
+        if (watch.address >= engine->MemorySize() || watch.words > engine->MemorySize() - watch.address)
         {
-        case 0: /// reg
-            *SRC2 = *RS2V;
-            break;
-        case 1: /// I-type  (imm[11:0])
-            *SRC2 = *IMM_VALUE_1;
-            break;
-        case 2: /// S-type  (imm[11:5] + imm[4:0])
-            *SRC2 = *IMM_VALUE_2;
-            break;
-        case 3: /// SB-type (imm[12|10:5] + imm[4:1|11])
-            *SRC2 = *IMM_VALUE_3;
-            break;
-        case 4: /// U-type  (imm[31:12])
-            *SRC2 = *IMM_VALUE_4;
-            break;
-        case 5: /// UJ-type (imm[20|10:1|11|19:12])
-            *SRC2 = *IMM_VALUE_5;
-            break;
-        default:
-            throw "bad ALU_SRC2";
+            std::cerr << "--watch " << watch.address << "+" << watch.words << ": outside DataMemory" << std::endl;
+            delete engine;
+            return 1;
         }
+        debug.Watch(watch.address, watch.words, watch.kind, watch.stop, engine->Memory());
     }
 
-public:
-    SRC2_SELECTOR():
-        RS2V        (GetWire("RS2V")),
-        IMM_VALUE_1 (GetWire("IMM VALUE 1")),
-        IMM_VALUE_2 (GetWire("IMM VALUE 2")),
-        IMM_VALUE_3 (GetWire("IMM VALUE 3")),
-        IMM_VALUE_4 (GetWire("IMM VALUE 4")),
-        IMM_VALUE_5 (GetWire("IMM VALUE 5")),
-        CONTROL_EX  (GetWire("CONTROL_EX")),
-        SRC2        (GetWire("SRC2"))
-    {}
-
-public:
-    Wire* RS2V;
-    Wire* IMM_VALUE_1;
-    Wire* IMM_VALUE_2;
-    Wire* IMM_VALUE_3;
-    Wire* IMM_VALUE_4;
-    Wire* IMM_VALUE_5;
-    Wire* CONTROL_EX;
-
-public:
-    Wire* SRC2;
-};
-
-class ArithmeticLogicUnit : public BaseBlock
-{
-public:
-    constexpr static size_t ADD  = 0;
-    constexpr static size_t SLT  = 2;
-    constexpr static size_t SLTU = 3;
-    constexpr static size_t XOR  = 4;
-    constexpr static size_t OR   = 6;
-    constexpr static size_t AND  = 7;
-    constexpr static size_t SL   = 1;
-    constexpr static size_t SR   = 5;
-
-public:
-    static constexpr const char* TypeName = "ArithmeticLogicUnit";
-
-public:
-    const char* Type() const override
-    { return TypeName; }
-
-    void step()
+    // gdb drives the run instead, from the first instruction on
+    std::unique_ptr<GdbStub> stub(gdb != nullptr ? new GdbStub(*engine, debug, history.get()) : nullptr);
+    if (stub != nullptr)
     {
-        uint32_t ALUOP = INSTRUCTION(*CONTROL_EX).flags.ALUOP;
-
-        switch (ALUOP)
+        int error = stub->Listen(gdb);
+        if (error != 0)
         {
-        case ADD:
-            *RESULT = (*SRC1) + (*SRC2);
-            break;
-        case AND:
-            *RESULT = (*SRC1) & (*SRC2);
-            break;
-        case OR:
-            *RESULT = (*SRC1) | (*SRC2);
-            break;
-        case XOR:
-            *RESULT = (*SRC1) ^ (*SRC2);
-            break;
-        case SL:
-            *RESULT = (*SRC1) << (*SRC2);
-            break;
-        case SR:
-            *RESULT = (*SRC1) >> (*SRC2);
-            break;
-        case SLT:
-            *RESULT = (int32_t) (*SRC1) < (int32_t) (*SRC2);
-            break;
-        case SLTU:
-            *RESULT = (*SRC1) < (*SRC2);
-            break;
-        default:
-            throw "bad ALUOP";
+            std::cerr << "--gdb " << gdb << ": " << strerror(error) << std::endl;
+            delete engine;
+            return 1;
         }
+        std::cerr << "waiting for gdb on " << gdb << std::endl;
     }
 
-public:
-    ArithmeticLogicUnit():
-        SRC1      (GetWire("ALU LEFT")),
-        SRC2      (GetWire("ALU RIGHT")),
-        CONTROL_EX(GetWire("CONTROL_EX")),
-        RESULT    (GetWire("ALU RESULT"))
-    {}
-
-public:
-    Wire* SRC1;
-    Wire* SRC2;
-    Wire* CONTROL_EX;
-
-public:
-    Wire* RESULT;
-};
-
-class Comparator : public BaseBlock
-{
-public:
-    static constexpr const char* TypeName = "Comparator";
-
-public:
-    const char* Type() const override
-    { return TypeName; }
+    const MachineState& status = stub != nullptr ? stub->Serve() : engine->Run();
+    syscalls.Flush();
+    status.Print(std::cerr);
 
-    void step() override
+    if (TRACE)
     {
-        uint32_t CMPOP = INSTRUCTION(*CONTROL_EX).flags.ALUOP;
-
-        switch (CMPOP)
-        {
-        case 0x0: // BEQ
-            *output = ((*RS1V) == (*RS2V));
-            break;
-        case 0x1: // BNE
-            *output = ((*RS1V) != (*RS2V));
-            break;
-        case 0x4: // BLT
-            *output = ((int32_t) (*RS1V) <  (int32_t) (*RS2V));
-            break;
-        case 0x5: // BGE
-            *output = ((int32_t) (*RS1V) >= (int32_t) (*RS2V));
-            break;
-        case 0x6: // BLTU
-            *output = ((*RS1V) <  (*RS2V));
-            break;
-        case 0x7: // BGEU
-            *output = ((*RS1V) >= (*RS2V));
-            break;
-        default:
-            throw "bad CMPOP";
-        }
+        std::cout << "*** r1 = " << engine->Register(1) << std::endl;
+        std::cout << "*** r2 = " << engine->Register(2) << std::endl;
     }
 
-public:
-    Comparator():
-        CONTROL_EX (GetWire("CONTROL_EX")),
-        RS1V       (GetWire("RS1V")),
-        RS2V       (GetWire("RS2V")),
-        output     (GetWire("CMP RESULT"))
-    {}
-
-public:
-    Wire* CONTROL_EX;
-    Wire* RS1V;
-    Wire* RS2V;
-
-public:
-    Wire* output;
-};
-
-class PC_R_Generator: public BaseBlock
-{
-public:
-    static constexpr const char* TypeName = "PC_R_Generator";
-
-public:
-    const char* Type() const override
-    { return TypeName; }
-
-    void step() override
+    engine->PrintStatistics(std::cout);
+    if (syscalls.Calls() != 0)
+        syscalls.PrintStatistics(std::cout);
+    if (use_dram)
     {
-        bool BRN_COND = INSTRUCTION(*CONTROL_EX).flags.BRN_COND;
-        bool CMP_EXIT = this->CMP_EXIT->GetValue<bool>();
-
-        if (BRN_COND && CMP_EXIT)
-            *PC_R = true;
-        else
-            *PC_R = false;
+        DRAM.Drain();
+        DRAM.PrintStatistics(std::cout);
     }
-
-public:
-    PC_R_Generator():
-        CONTROL_EX (GetWire("CONTROL_EX")), // bits selector?
-        CMP_EXIT   (GetWire("CMP RESULT")),
-        PC_R       (GetWire("PC_R"))
-    {}
-
-public:
-    Wire* CONTROL_EX;
-    Wire* CMP_EXIT;
-    Wire* PC_R;
-};
-
-class V_DE_Generator : public BaseBlock
-{
-public:
-    static constexpr const char* TypeName = "V_DE_Generator";
-
-public:
-    const char* Type() const override
-    { return TypeName; }
-
-    void step() override
+    if (!watches.empty())
+        debug.PrintHits(std::cout);
+    if (hash)
     {
-        bool PC_RD = this->PC_RD->OldValue<bool>();
-        bool PC_RF = this->PC_RF->GetValue<bool>();
-
-        // NOR
-        if (PC_RF || PC_RD)
-            *V_DE = false;
-        else
-            *V_DE = true;
+        state_hash.PrintCheckpoints(std::cout);
+        std::cout << "state hash = ";
+        StateHash::PrintHash(std::cout, state_hash.Digest());
+        std::cout << std::endl;
     }
 
-public:
-    V_DE_Generator():
-        PC_RF(GetWire("PC_RF")),
-        PC_RD(GetWire("PC_RD")),
-        V_DE (GetWire("V_DE"))
-    {}
-
-public:
-    Wire* PC_RF; // PC_R Fetch
-    Wire* PC_RD; // PC_R Decode
-    Wire* V_DE;
-};
-
-class DataMemory : public BaseBlock
-{
-public:
-    static constexpr const char* TypeName = "DataMemory";
-
-public:
-    const char* Type() const override
-    { return TypeName; }
-
-    void step() override
+    int exit_code = status.ExitCode();
+    if (compare != nullptr)
     {
-        if (*A < size)
+        // checkpoints stay different after a divergence, so the first one is a binary search away
+        const std::vector<StateHash::Checkpoint>& checkpoints = state_hash.Checkpoints();
+        size_t first = StateHash::FirstDivergence(checkpoints, expected);
+        if (first == checkpoints.size() && first == expected.size())
         {
-            uint32_t extend = INSTRUCTION(*EXTEND).flags.ALUOP;
-            bool     sign   = (extend & 0x4);
-            uint32_t count  = 1 << (extend & 0x3);
-
-            if (MEM_WE->GetValue<bool>())
-            {
-                switch(count)
-                {
-                case 1:
-                    memory[*A] = (memory[*A] & 0xffffff00) | (*WD & 0x000000ff);
-                    break;
-                case 2:
-                    memory[*A] = (memory[*A] & 0xffff0000) | (*WD & 0x0000ffff);
-                    break;
-                case 4:
-                    memory[*A] = *WD;
-                    break;
-                default:
-                    throw "DMEM bad count";
-                }
-            }
-
-
-            switch(count)
+            std::cout << "hash compare: " << first << " checkpoints match " << compare << std::endl;
+        }
+        else
+        {
+            std::cout << "hash compare: first divergence from " << compare << " at checkpoint " << first << '\n';
+            if (first > 0)
             {
-            case 1:
-                if (sign)
-                    *RD = (memory[*A] & 0x000000ff);
-                else
-                    *RD = int32_t (memory[*A] & 0x000000ff);
-                break;
-            case 2:
-                if (sign)
-                    *RD = (memory[*A] & 0x0000ffff);
-                else
-                    *RD = int32_t (memory[*A] & 0x0000ffff);
-                break;
-            case 4:
-                *RD = memory[*A];
-                break;
-            default:
-                    throw "DMEM bad count";
+                std::cout << "last match: ";
+                StateHash::PrintCheckpoint(std::cout, checkpoints[first - 1]);
             }
+            std::cout << "this run:   ";
+            if (first < checkpoints.size())
+                StateHash::PrintCheckpoint(std::cout, checkpoints[first]);
+            else
+                std::cout << "no checkpoint\n";
+            std::cout << "other run:  ";
+            if (first < expected.size())
+                StateHash::PrintCheckpoint(std::cout, expected[first]);
+            else
+                std::cout << "no checkpoint\n";
+            exit_code = 1;
         }
-        else
-            *RD = 0;
     }
-
-public:
-    DataMemory():
-        EXTEND(GetWire("Memory CONTROL_EX")),
-        MEM_WE(GetWire("DMEM WE")),
-        WD    (GetWire("DMEM WD")),
-        A     (GetWire("DMEM A")),
-        RD    (GetWire("DMEM RD"))
+    if (checker != nullptr)
     {
-        size   = 1000;
-        memory = new uint32_t[size];
+        if (checker->Finish(*engine))
+        {
+            checker->PrintReport(std::cout);
+        }
+        else
+        {
+            checker->PrintReport(std::cerr);
+            exit_code = 1;
+        }
     }
 
-public:
-    Wire* EXTEND; // byte, half, word
-    Wire* MEM_WE; // memory write enable
-    Wire* WD;     // write data
-    Wire* A;      // address
-
-public:
-    Wire* RD; // read data
-
-public:
-    uint32_t* memory;
-    size_t    size;
-};
-
-class DMEM_RD_OR_ALU : public BaseBlock
-{
-public:
-    static constexpr const char* TypeName = "DMEM_RD_OR_ALU";
-
-public:
-    const char* Type() const override
-    { return TypeName; }
-
-    void step() override
+    if (history != nullptr)
     {
-        ControlUnitFlags flags = INSTRUCTION(*flag).flags;
-
-        if (flags.MEM2REG)
-            *WB_D = *RD;
-        else
-            *WB_D = *ALU;
+        // after the checks: going back changes the final state
+        if (back_to_write >= 0)
+        {
+            if (history->RunBackToWrite(*engine, uint32_t(back_to_write)))
+                std::cout << "last write of mem[" << back_to_write << "]: pc = " << history->Resume() << ", " << engine->Memory()[back_to_write] << " before it" << '\n';
+            else
+                std::cout << "no write of mem[" << back_to_write << "] in the history" << '\n';
+        }
+        if (back != 0)
+            history->StepBack(*engine, back);
+        if (back != 0 || back_to_write >= 0)
+            std::cout << "back at pc = " << history->Resume() << ", cycle = " << engine->Cycles() << ", instret = " << engine->Instructions() << '\n';
+        history->PrintStatistics(std::cout);
     }
 
-public:
-    DMEM_RD_OR_ALU():
-        flag(GetWire("Memory CONTROL_EX")),
-        RD  (GetWire("DMEM RD")),
-        ALU (GetWire("Memory ALU")),
-        WB_D(GetWire("Memory WB_D"))
-    {}
-
-public:
-    Wire* flag;
-    Wire* RD;
-    Wire* ALU;
-
-public:
-    Wire* WB_D;
-};
-
-
-void PrintWires()
-{
-    // Prints output wires of all stages
-    std::cout << "-----------------------------------------------------" << std::endl;
-
-    std::cout << "Fetch:" << '\n';
-    std::cout << "Fetch instr = 0x" << std::hex << (Wires["IMEM D"]->OldValue()) << std::dec << (INSTRUCTION(Wires["IMEM D"]->OldValue()).opcode() == 0x63 ? " B*": " ADDI") << '\n';
-    //std::cout << "Fetch instr = 0x" << std::hex << (Wires["IMEM D"]->OldValue()) << ' ' << INSTRUCTION(Wires["IMEM D"]->OldValue()).opcode() << std::dec << '\n';
-    std::cout << "PC_R        = "   << (Wires["PC_R"]->OldValue()) << '\n';
-    std::cout << "PC          = "   << (Wires["PC"]->OldValue())   << '\n';
-    std::cout << '\n';
-
-    ControlUnitFlags flagsD = INSTRUCTION(Wires["CU FLAGS"]->OldValue()).flags;
-    std::cout << "Decode:" << '\n';
-    std::cout << "Decode instr = 0x" << std::hex << (Wires["INSTRUCTION"]->OldValue()) << std::dec << (INSTRUCTION(Wires["INSTRUCTION"]->OldValue()).opcode() == 0x63 ? " B*": " ADDI") << '\n';
-    std::cout << "PC_DE        = "   << (Wires["PC_DE"]->OldValue()) << '\n';
-    std::cout << "RF.RS1       = "   << (Wires["RS1"]->OldValue()) << '\n';
-    std::cout << "RF.RS2       = "   << (Wires["RS2"]->OldValue()) << '\n';
-    std::cout << "CU.flags     = "   << flagsD.ALUOP << ' ' << flagsD.SRC2 << ' ' << flagsD.BRN_COND << flagsD.MEM2REG << flagsD.MEM_WEN << flagsD.REG_WEN << '\n';
-    std::cout << "PC_RF        = "   << (Wires["PC_RF"]->OldValue()) << '\n';
-    std::cout << "PC_RD        = "   << (Wires["PC_RD"]->OldValue()) << '\n';
-    std::cout << "V_DE         = "   << (Wires["V_DE"]->OldValue()) << '\n';
-    std::cout << '\n';
-
-    ControlUnitFlags flagsE = INSTRUCTION(Wires["CONTROL_EX"]->OldValue()).flags;
-    std::cout << "Execute:" << '\n';
-    std::cout << "Execute instr = 0x" << std::hex << (Wires["Execute INSTRUCTION"]->OldValue()) << std::dec << (INSTRUCTION(Wires["Execute INSTRUCTION"]->OldValue()).opcode() == 0x63 ? " B*": " ADDI") << '\n';
-    std::cout << "PC_EX         = "   << (Wires["PC_EX"]->OldValue()) << '\n';
-    std::cout << "V_EX          = "   << (Wires["V_EX"]->OldValue())  << '\n';
-    std::cout << "WE_GEN WB_WE  = "   << (Wires["WE_GEN WB_WE"]->OldValue())  << '\n';
-    std::cout << "WE_GEN MEM_WE = "   << (Wires["WE_GEN MEM_WE"]->OldValue()) << '\n';
-    std::cout << "CONTROL_EX    = "   << flagsE.ALUOP << ' ' << flagsE.SRC2 << ' ' << flagsE.REG_WEN << flagsE.MEM_WEN << flagsE.MEM2REG << flagsE.BRN_COND << '\n';
-    std::cout << "RF.RS1        = "   << (Wires["Execute RS1"]->OldValue()) << '\n';
-    std::cout << "RS1V          = "   << (Wires["RS1V"]->OldValue()) << '\n';
-    std::cout << "SRC2          = "   << (Wires["SRC2"]->OldValue()) << '\n';
-    std::cout << "ALU           = "   << (Wires["ALU RESULT"]->OldValue()) << '\n';
-    std::cout << '\n';
-
-    ControlUnitFlags flagsM = INSTRUCTION(Wires["Memory CONTROL_EX"]->OldValue()).flags;
-    std::cout << "Memory:" << '\n';
-    std::cout << "Memory instr      = 0x" << std::hex << (Wires["Memory INSTRUCTION"]->OldValue()) << std::dec << (INSTRUCTION(Wires["Memory INSTRUCTION"]->OldValue()).opcode() == 0x63 ? " B*": " ADDI")  << '\n';
-    std::cout << "Memory CONTROL_EX = "   << flagsM.ALUOP << ' ' << flagsM.SRC2 << ' ' << flagsM.REG_WEN << flagsM.MEM_WEN << flagsM.MEM2REG << flagsM.BRN_COND << '\n';
-    std::cout << "WB_WE             = "   << (Wires["Memory WE_GEN WB_WE"]->OldValue()) << '\n';
-    std::cout << "WB_D              = "   << (Wires["Memory WB_D"]->OldValue())         << '\n';
-    std::cout << '\n';
-
-    ControlUnitFlags flagsWB = INSTRUCTION(Wires["WB CONTROL_EX"]->OldValue()).flags;
-    std::cout << "WB:" << '\n';
-    std::cout << "WB instr      = 0x" << std::hex << (Wires["WB_A"]->OldValue()) << std::dec << (INSTRUCTION(Wires["WB_A"]->OldValue()).opcode() == 0x63 ? " B*": " ADDI")  << '\n';
-    std::cout << "WB CONTROL_EX = "   << flagsWB.ALUOP << ' ' << flagsWB.SRC2 << ' ' << flagsWB.REG_WEN << flagsWB.MEM_WEN << flagsWB.MEM2REG << flagsWB.BRN_COND << '\n';
-    std::cout << "WB_WE         = "   << (Wires["WB_WE"]->OldValue()) << '\n';
-    std::cout << "WB_A          = "   << INSTRUCTION(Wires["WB_A"]->OldValue()).r_type.rd << '\n';
-    std::cout << "WB_D          = "   << (Wires["WB_D"]->OldValue())  << '\n';
-
-    std::cout << "-----------------------------------------------------" << std::endl;
-}
-
-int main()
-{
-    INSTRUCTION cmds[] = {
-        MakeADDI(1, 0, 20),  // r1 = rax (sum)
-        MakeADDI(2, 0, 10),  // r2 = rcx (cycle counter)
-        MakeBEQ (2, 0, +16), // for(r2 = 10; r2 != 0; --r2)
-        MakeADDI(1, 1, 15),  //   r1 += 15;
-        MakeADDI(2, 2, -1),
-        MakeBEQ (0, 0, -12), // absolute short jump
-        MakeADDI(1, 1, 1), // r1 += 1
-        MakeADDI(1, 1, 2), // r1 += 2
-        MakeADDI(0,  0,  0), // NOP
-        MakeADDI(0,  0,  0), // NOP
-        MakeADDI(0,  0,  0), // NOP
-        MakeADDI(0,  0,  0), // NOP
-    };
-
-    FillWires();
-
-    // Stage 1 - Fetch
-    InstructionMemory IMEM;
-    NextInstruction   NPC;
-
-    IMEM.SetMemory(cmds, sizeof(cmds) / sizeof(cmds[0]));
-
-    // Stage 2 - Decode
-    V_DE_Generator  V_DE_GEN;
-    ControlUnit     CU;
-    RegisterFile    RF;
-
-    // Stage 3 - Execute
-    HazardUnit           HU;
-    WriteEnableGenerator WE_GEN;
-    RS_TO_RSV            RS1V_SEL(1);
-    RS_TO_RSV            RS2V_SEL(2);
-    Immediate            IMM;
-    SRC2_SELECTOR        SRC2_SEL;
-    ArithmeticLogicUnit  ALU;
-
-    Comparator     CMP;
-    PC_R_Generator PC_R_GEN;
-
-    // Stage 4 - Memory
-    DataMemory          DMEM;
-    DMEM_RD_OR_ALU      RSEL;
-
-    std::vector<BaseBlock*> STAGE_FETCH   = {
-        dynamic_cast<FlipFlop*>(Wires["PC"]),
-        &IMEM,
-        &NPC,
-    };
-    std::vector<BaseBlock*> STAGE_DECODE  = {
-        dynamic_cast<FlipFlop*>(Wires["INSTRUCTION"]),
-        dynamic_cast<FlipFlop*>(Wires["PC_DE"]),
-        dynamic_cast<FlipFlop*>(Wires["PC_RF"]),
-        &V_DE_GEN,
-        &CU,
-        &RF,
-    };
-    std::vector<BaseBlock*> STAGE_EXECUTE = {
-        dynamic_cast<FlipFlop*>(Wires["Execute INSTRUCTION"]),
-        dynamic_cast<FlipFlop*>(Wires["CONTROL_EX"]),
-        dynamic_cast<FlipFlop*>(Wires["Execute RS1"]),
-        dynamic_cast<FlipFlop*>(Wires["Execute RS2"]),
-        dynamic_cast<FlipFlop*>(Wires["PC_EX"]),
-        &HU,
-        &WE_GEN,
-        &RS1V_SEL,
-        &RS2V_SEL,
-        &IMM,
-        &SRC2_SEL,
-        &ALU,
-        &CMP,
-        &PC_R_GEN,
-    };
-    std::vector<BaseBlock*> STAGE_MEMORY  = {
-        dynamic_cast<FlipFlop*>(Wires["WB_WE"]),
-        dynamic_cast<FlipFlop*>(Wires["WB_D"]),
-        dynamic_cast<FlipFlop*>(Wires["WB_A"]),
-
-        dynamic_cast<FlipFlop*>(Wires["Memory INSTRUCTION"]),
-        dynamic_cast<FlipFlop*>(Wires["Memory WE_GEN MEM_WE"]),
-        dynamic_cast<FlipFlop*>(Wires["Memory WE_GEN WB_WE"]),
-        dynamic_cast<FlipFlop*>(Wires["Memory CONTROL_EX"]),
-        dynamic_cast<FlipFlop*>(Wires["Memory RS1"]),
-        dynamic_cast<FlipFlop*>(Wires["Memory ALU"]),
-
-        &DMEM,
-        &RSEL,
-    };
-
-    // Running
-    for(BaseBlock* block : STAGE_FETCH)
-        block->step();
-
-    PrintWires();
-
-    ++GLOBAL_STAGE;
-
-    for(BaseBlock* block : STAGE_DECODE)
-        block->step();
-    for(BaseBlock* block : STAGE_FETCH)
-        block->step();
-
-    PrintWires();
-
-    ++GLOBAL_STAGE;
-
-    // we need to do FlipFlop (Fetch -> Decode) for PC_R before execute stage as we recalculate PC_R value
-    dynamic_cast<FlipFlop*>(Wires["PC_RF"])->step();
-
-    for(BaseBlock* block : STAGE_EXECUTE)
-        block->step();
-    for(BaseBlock* block : STAGE_DECODE)
-        block->step();
-    for(BaseBlock* block : STAGE_FETCH)
-        block->step();
-
-    PrintWires();
-
-    ++GLOBAL_STAGE;
-
-    while(true)
+    if (validate)
     {
-        try
+        // pipelines share the wires, so the one under test is gone first
+        EngineState tested(*engine);
+        delete engine;
+        engine = nullptr;
+
+        TRACE = false;
+        Pipeline     reference(cmds, count, 1);
+        SyscallProxy rerun(false);
+        reference.SetTrapHandler(SyscallProxy::Handler, &rerun);
+        reference.SetFastForward(spin);
+        SetupMmu(reference, mmu_config, satp);
+        MapFiles(reference, mappings);
+        reference.Run();
+
+        if (CompareState(tested, EngineState(reference), std::cerr))
         {
-            // we need to do FlipFlop (Fetch -> Decode) for PC_R before execute stage as we recalculate PC_R value
-            dynamic_cast<FlipFlop*>(Wires["PC_RF"])->step();
-
-            std::cout << "PC_RF = " << Wires["PC_RF"]->value << '\n';
-            std::cout << "PC_RD = " << Wires["PC_RD"]->value << '\n';
-
-            for(BaseBlock* block : STAGE_MEMORY)
-                block->step();
-            for(BaseBlock* block : STAGE_EXECUTE)
-            {
-                block->step();
-                //std::cout << "PC_RF = " << Wires["PC_RF"]->value << '\n';
-                //std::cout << "PC_RD = " << Wires["PC_RD"]->value << '\n';
-            }
-            for(BaseBlock* block : STAGE_DECODE)
-            {
-                block->step();
-                //std::cout << "PC_RF = " << Wires["PC_RF"]->value << '\n';
-                //std::cout << "PC_RD = " << Wires["PC_RD"]->value << '\n';
-            }
-            for(BaseBlock* block : STAGE_FETCH)
-                block->step();
-
-            PrintWires();
-
-            ++GLOBAL_STAGE;
-
-            std::cout << "*** r1 = " << RF.regs[1] << std::endl;
-            std::cout << "*** r2 = " << RF.regs[2] << std::endl;
+            std::cout << "validate: " << tested.name << " matches " << reference.Name() << std::endl;
         }
-        catch(const char* message)
+        else
         {
-            std::cerr << message << std::endl;
-            break;
+            std::cout << "validate: " << tested.name << " differs from " << reference.Name() << std::endl;
+            exit_code = 1;
         }
     }
 
-    return 0;
+    delete engine;
+    return exit_code;
 }
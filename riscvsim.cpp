@@ -0,0 +1,367 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <vector>
+
+#include "riscvsim.h"
+#include "ISA.h"
+#include "Pipeline.h"
+#include "OutOfOrder.h"
+#include "JIT.h"
+#include "Syscall.h"
+
+// C API over the engines (see riscvsim.h)
+
+struct rvsim
+{
+    rvsim_config config;
+    Engine*      engine;
+
+    uint32_t* attached; // host DataMemory, or nullptr
+    size_t    attached_count;
+
+    rvsim_trap_handler trap_handler;
+    void*              trap_context;
+
+    std::unique_ptr<SyscallProxy> syscalls; // nullptr = ECALLs go to the trap handler
+};
+
+// Pipeline wires are per thread: at most one pipeline engine per thread
+static thread_local size_t PIPELINES = 0;
+
+// The library never prints the per-stage trace (set at load, before any thread runs)
+static const bool NO_TRACE = (TRACE = false, true);
+
+static bool IsPipeline(uint32_t engine)
+{ return engine == RVSIM_ENGINE_INORDER || engine == RVSIM_ENGINE_INORDER2; }
+
+static bool TrapHandlerAdapter(Engine& engine, MachineState& state, void* context)
+{
+    rvsim* sim = static_cast<rvsim*>(context);
+    if (sim->syscalls != nullptr && SyscallProxy::Handler(engine, state, sim->syscalls.get()))
+        return true;
+    return sim->trap_handler != nullptr && sim->trap_handler(sim, state.cause, &state.pc, sim->trap_context) != 0;
+}
+
+static void InstallTrapHandler(rvsim* sim)
+{
+    bool handled = sim->trap_handler != nullptr || sim->syscalls != nullptr;
+    sim->engine->SetTrapHandler(handled ? TrapHandlerAdapter : nullptr, sim);
+}
+
+static void DestroyEngine(rvsim* sim)
+{
+    if (sim->engine == nullptr)
+        return;
+
+    delete sim->engine;
+    sim->engine = nullptr;
+    if (IsPipeline(sim->config.engine))
+        --PIPELINES;
+}
+
+static int CreateEngine(rvsim* sim, const std::vector<INSTRUCTION>& program)
+{
+    if (program.empty())
+        return RVSIM_EINVAL;
+
+    DestroyEngine(sim);
+    if (IsPipeline(sim->config.engine) && PIPELINES != 0)
+        return RVSIM_EBUSY;
+
+    try
+    {
+        switch (sim->config.engine)
+        {
+        case RVSIM_ENGINE_INORDER:
+        case RVSIM_ENGINE_INORDER2:
+            sim->engine = new Pipeline(program.data(), program.size(), sim->config.engine == RVSIM_ENGINE_INORDER2 ? 2 : 1);
+            ++PIPELINES;
+            break;
+        case RVSIM_ENGINE_OOO:
+        {
+            OutOfOrderConfig config;
+            config.width    = sim->config.width;
+            config.rob_size = sim->config.rob_size;
+            config.iq_size  = sim->config.iq_size;
+            config.lsq_size = sim->config.lsq_size;
+            sim->engine = new OutOfOrderCore(program.data(), program.size(), config);
+            break;
+        }
+        case RVSIM_ENGINE_JIT:
+            sim->engine = new JitEngine(program.data(), program.size());
+            break;
+        default:
+            return RVSIM_EINVAL;
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        return RVSIM_ENOMEM;
+    }
+    catch (const char*)
+    {
+        return RVSIM_EINVAL;
+    }
+
+    if (sim->attached != nullptr)
+        sim->engine->AttachMemory(sim->attached, sim->attached_count);
+    InstallTrapHandler(sim);
+    return RVSIM_OK;
+}
+
+extern "C" unsigned rvsim_version(void)
+{ return RVSIM_API_VERSION; }
+
+extern "C" void rvsim_default_config(rvsim_config* config)
+{
+    OutOfOrderConfig ooo;
+
+    config->engine   = RVSIM_ENGINE_INORDER;
+    config->width    = ooo.width;
+    config->rob_size = ooo.rob_size;
+    config->iq_size  = ooo.iq_size;
+    config->lsq_size = ooo.lsq_size;
+}
+
+extern "C" rvsim* rvsim_create(const rvsim_config* config)
+{
+    rvsim* sim = new (std::nothrow) rvsim();
+    if (sim == nullptr)
+        return nullptr;
+
+    if (config != nullptr)
+        sim->config = *config;
+    else
+        rvsim_default_config(&sim->config);
+
+    if (sim->config.engine > RVSIM_ENGINE_JIT)
+    {
+        delete sim;
+        return nullptr;
+    }
+    return sim;
+}
+
+extern "C" void rvsim_destroy(rvsim* sim)
+{
+    if (sim == nullptr)
+        return;
+
+    DestroyEngine(sim);
+    delete sim;
+}
+
+extern "C" int rvsim_load_image(rvsim* sim, const void* image, size_t size)
+{
+    if (sim == nullptr || image == nullptr || size == 0 || size % 2 != 0)
+        return RVSIM_EINVAL;
+
+    // an RVC image may end half way through a word
+    std::vector<INSTRUCTION> program(size / sizeof(INSTRUCTION) + (size % sizeof(INSTRUCTION) != 0));
+    memcpy(program.data(), image, size);
+    return CreateEngine(sim, program);
+}
+
+extern "C" int rvsim_load_file(rvsim* sim, const char* path)
+{
+    if (sim == nullptr || path == nullptr)
+        return RVSIM_EINVAL;
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return RVSIM_EIO;
+
+    std::vector<char> image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (file.bad())
+        return RVSIM_EIO;
+
+    return rvsim_load_image(sim, image.data(), image.size());
+}
+
+extern "C" int rvsim_attach_memory(rvsim* sim, uint32_t* words, size_t count)
+{
+    if (sim == nullptr || words == nullptr || count == 0)
+        return RVSIM_EINVAL;
+
+    sim->attached       = words;
+    sim->attached_count = count;
+    if (sim->engine != nullptr)
+        sim->engine->AttachMemory(words, count);
+    return RVSIM_OK;
+}
+
+extern "C" int rvsim_set_trap_handler(rvsim* sim, rvsim_trap_handler handler, void* context)
+{
+    if (sim == nullptr)
+        return RVSIM_EINVAL;
+
+    sim->trap_handler = handler;
+    sim->trap_context = context;
+    if (sim->engine != nullptr)
+        InstallTrapHandler(sim);
+    return RVSIM_OK;
+}
+
+extern "C" int rvsim_set_syscalls(rvsim* sim, int enable)
+{
+    if (sim == nullptr)
+        return RVSIM_EINVAL;
+
+    try
+    {
+        sim->syscalls.reset(enable ? new SyscallProxy() : nullptr);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return RVSIM_ENOMEM;
+    }
+    if (sim->engine != nullptr)
+        InstallTrapHandler(sim);
+    return RVSIM_OK;
+}
+
+extern "C" int rvsim_run(rvsim* sim, uint64_t cycles)
+{
+    if (sim == nullptr)
+        return RVSIM_EINVAL;
+    if (sim->engine == nullptr)
+        return RVSIM_ENOIMAGE;
+
+    try
+    {
+        int status = cycles == 0 ? sim->engine->Run().status : sim->engine->RunFor(cycles).status;
+        if (sim->syscalls != nullptr)
+            sim->syscalls->Flush();
+        return status;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return RVSIM_ENOMEM;
+    }
+}
+
+extern "C" int rvsim_get_register(const rvsim* sim, unsigned index, uint32_t* value)
+{
+    if (sim == nullptr || value == nullptr)
+        return RVSIM_EINVAL;
+    if (sim->engine == nullptr)
+        return RVSIM_ENOIMAGE;
+    if (index >= 32)
+        return RVSIM_ERANGE;
+
+    *value = sim->engine->Register(index);
+    return RVSIM_OK;
+}
+
+extern "C" int rvsim_set_register(rvsim* sim, unsigned index, uint32_t value)
+{
+    if (sim == nullptr)
+        return RVSIM_EINVAL;
+    if (sim->engine == nullptr)
+        return RVSIM_ENOIMAGE;
+    if (index >= 32)
+        return RVSIM_ERANGE;
+
+    sim->engine->SetRegister(index, value);
+    return RVSIM_OK;
+}
+
+extern "C" int rvsim_set_satp(rvsim* sim, uint32_t satp)
+{
+    if (sim == nullptr)
+        return RVSIM_EINVAL;
+    if (sim->engine == nullptr)
+        return RVSIM_ENOIMAGE;
+
+    sim->engine->MMU().SetSatp(satp);
+    return RVSIM_OK;
+}
+
+extern "C" int rvsim_read_memory(const rvsim* sim, uint32_t address, uint32_t* words, size_t count)
+{
+    if (sim == nullptr || (words == nullptr && count != 0))
+        return RVSIM_EINVAL;
+    if (sim->engine == nullptr)
+        return RVSIM_ENOIMAGE;
+    if (address > sim->engine->MemorySize() || count > sim->engine->MemorySize() - address)
+        return RVSIM_ERANGE;
+
+    memcpy(words, sim->engine->Memory() + address, count * sizeof(uint32_t));
+    return RVSIM_OK;
+}
+
+extern "C" int rvsim_write_memory(rvsim* sim, uint32_t address, const uint32_t* words, size_t count)
+{
+    if (sim == nullptr || (words == nullptr && count != 0))
+        return RVSIM_EINVAL;
+    if (sim->engine == nullptr)
+        return RVSIM_ENOIMAGE;
+    if (address > sim->engine->MemorySize() || count > sim->engine->MemorySize() - address)
+        return RVSIM_ERANGE;
+    if (!sim->engine->Guest().Writable(address, count))
+        return RVSIM_ERANGE; // a read-only mapped page
+
+    memcpy(sim->engine->Memory() + address, words, count * sizeof(uint32_t));
+    return RVSIM_OK;
+}
+
+extern "C" int rvsim_get_stats(const rvsim* sim, rvsim_stats* stats)
+{
+    if (sim == nullptr || stats == nullptr)
+        return RVSIM_EINVAL;
+    if (sim->engine == nullptr)
+        return RVSIM_ENOIMAGE;
+
+    const MachineState& state = sim->engine->Status();
+
+    stats->cycles       = sim->engine->Cycles();
+    stats->instructions = sim->engine->Instructions();
+    stats->status       = state.status;
+    stats->cause        = state.cause;
+    stats->pc           = state.pc;
+    stats->exit_code    = state.exit_code;
+    return RVSIM_OK;
+}
+
+extern "C" int rvsim_format_statistics(const rvsim* sim, char* buffer, size_t size)
+{
+    if (sim == nullptr || (buffer == nullptr && size != 0))
+        return RVSIM_EINVAL;
+    if (sim->engine == nullptr)
+        return RVSIM_ENOIMAGE;
+
+    std::ostringstream out;
+    sim->engine->PrintStatistics(out);
+    std::string text = out.str();
+
+    if (size != 0)
+    {
+        size_t length = text.size() < size - 1 ? text.size() : size - 1;
+        memcpy(buffer, text.data(), length);
+        buffer[length] = '\0';
+    }
+    return int(text.size());
+}
+
+extern "C" const char* rvsim_status_message(const rvsim* sim)
+{
+    if (sim == nullptr || sim->engine == nullptr)
+        return "";
+
+    const MachineState& state = sim->engine->Status();
+    switch (state.status)
+    {
+    case TRAP:
+        return MachineState::CauseName(state.cause);
+    case ERROR:
+        return state.message;
+    default:
+        return "";
+    }
+}
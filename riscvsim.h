@@ -0,0 +1,141 @@
+#ifndef _RISCVSIM_H_
+#define _RISCVSIM_H_ 1
+
+/**
+    C API of the simulator (libriscvsim).
+
+    An instance holds one engine. rvsim_load_image() (re)creates it with the
+    program, so configure the instance and attach host memory first, then
+    load, run and inspect it. Functions return RVSIM_OK (0) or a negative
+    RVSIM_E* code.
+
+    Only one in-order pipeline instance may exist per thread, and it has to be
+    used from the thread that loaded it. The out-of-order and jit engines have
+    no such limit.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define RVSIM_API __attribute__((visibility("default")))
+#else
+#define RVSIM_API
+#endif
+
+#define RVSIM_API_VERSION 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct rvsim rvsim;
+
+enum
+{
+    RVSIM_OK       =  0,
+    RVSIM_EINVAL   = -1, /* bad argument or configuration */
+    RVSIM_ENOIMAGE = -2, /* no program loaded yet */
+    RVSIM_EIO      = -3, /* cannot read the image file */
+    RVSIM_EBUSY    = -4, /* another in-order pipeline instance exists in this thread */
+    RVSIM_ERANGE   = -5, /* register or address out of range */
+    RVSIM_ENOMEM   = -6,
+};
+
+typedef enum rvsim_engine
+{
+    RVSIM_ENGINE_INORDER  = 0, /* 5-stage pipeline */
+    RVSIM_ENGINE_INORDER2 = 1, /* dual-issue pipeline */
+    RVSIM_ENGINE_OOO      = 2, /* out-of-order core */
+    RVSIM_ENGINE_JIT      = 3, /* x86-64 binary translator (functional) */
+} rvsim_engine;
+
+/* Same values as MachineStatus */
+typedef enum rvsim_status
+{
+    RVSIM_RUNNING = 0,
+    RVSIM_HALTED  = 1, /* EBREAK or the exit ECALL; exit_code = a0 */
+    RVSIM_TRAP    = 2, /* unhandled guest trap; cause and pc are set */
+    RVSIM_ERROR   = 3, /* simulator error */
+} rvsim_status;
+
+typedef struct rvsim_config
+{
+    uint32_t engine;   /* rvsim_engine */
+    uint32_t width;    /* out-of-order: fetch/dispatch/issue/commit width */
+    uint32_t rob_size; /* out-of-order queue sizes */
+    uint32_t iq_size;
+    uint32_t lsq_size;
+} rvsim_config;
+
+typedef struct rvsim_stats
+{
+    uint64_t cycles;
+    uint64_t instructions;
+    uint32_t status;    /* rvsim_status */
+    uint32_t cause;     /* TRAP: exception code */
+    uint32_t pc;        /* TRAP: faulting instruction */
+    uint32_t exit_code; /* HALTED: a0 */
+} rvsim_stats;
+
+/* Called for a guest trap (EBREAK and the exit ECALL halt without it). Return
+   nonzero to resume at *pc, which starts at the trapping instruction. The
+   handler may use the register and memory functions on `sim`. */
+typedef int (*rvsim_trap_handler)(rvsim* sim, uint32_t cause, uint32_t* pc, void* context);
+
+RVSIM_API unsigned rvsim_version(void);
+
+RVSIM_API void   rvsim_default_config(rvsim_config* config);
+RVSIM_API rvsim* rvsim_create(const rvsim_config* config); /* NULL config = defaults; NULL on failure */
+RVSIM_API void   rvsim_destroy(rvsim* sim);
+
+/* Program image: little-endian RV32IMAC code (16-bit parcels), loaded at address 0 */
+RVSIM_API int rvsim_load_image(rvsim* sim, const void* image, size_t size);
+RVSIM_API int rvsim_load_file (rvsim* sim, const char* path);
+
+/* Guest DataMemory becomes `count` words at `words` (one word per address), with
+   no copy. The buffer stays owned by the caller and has to outlive the instance
+   or the next rvsim_attach_memory(). Survives rvsim_load_image(). */
+RVSIM_API int rvsim_attach_memory(rvsim* sim, uint32_t* words, size_t count);
+
+RVSIM_API int rvsim_set_trap_handler(rvsim* sim, rvsim_trap_handler handler, void* context);
+
+/* Nonzero: the guest's ECALLs (write, read, openat, close, lseek, fstat, brk,
+   clock_gettime, mmap, munmap) are serviced on the host before the trap
+   handler sees them. Buffers are DataMemory words, four bytes each. mmap maps
+   host file pages without copying; pages mapped without PROT_WRITE are
+   read-only: stores to them trap and calls writing into them fail with EFAULT.
+   Console output is buffered and written out before rvsim_run() returns. Off
+   by default; re-enabling starts a new proxy (guest files opened by the old
+   one are closed). */
+RVSIM_API int rvsim_set_syscalls(rvsim* sim, int enable);
+
+/* Runs for at least `cycles` cycles (0 = until the machine stops);
+   returns the rvsim_status or a negative error */
+RVSIM_API int rvsim_run(rvsim* sim, uint64_t cycles);
+
+RVSIM_API int rvsim_get_register(const rvsim* sim, unsigned index, uint32_t* value);
+RVSIM_API int rvsim_set_register(rvsim* sim, unsigned index, uint32_t value);
+
+/* Sv32 translation of fetch and DataMemory (bit 31 = on, bits 21:0 = root page
+   table). Flushes the TLBs; a new image starts with translation off. */
+RVSIM_API int rvsim_set_satp(rvsim* sim, uint32_t satp);
+
+/* RVSIM_ERANGE outside DataMemory, and for a write into a read-only mapped page */
+RVSIM_API int rvsim_read_memory (const rvsim* sim, uint32_t address, uint32_t* words, size_t count);
+RVSIM_API int rvsim_write_memory(rvsim* sim, uint32_t address, const uint32_t* words, size_t count);
+
+RVSIM_API int rvsim_get_stats(const rvsim* sim, rvsim_stats* stats);
+
+/* Engine statistics as text; returns the full length like snprintf (or a negative error) */
+RVSIM_API int rvsim_format_statistics(const rvsim* sim, char* buffer, size_t size);
+
+/* Trap cause name or the simulator error message of the current status */
+RVSIM_API const char* rvsim_status_message(const rvsim* sim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _RISCVSIM_H_ */